@@ -0,0 +1,25 @@
+#ifndef DRIVERS_AHCI_H
+#define DRIVERS_AHCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Brings up the first SATA disk behind an AHCI HBA and registers it as a blockdev. */
+void ahci_init(void);
+bool ahci_ready(void);
+uint64_t ahci_sector_count(void);
+/* Commands the drive accepts at once: the NCQ depth, or 1 without NCQ. */
+uint32_t ahci_queue_depth(void);
+bool ahci_read(uint64_t lba, uint32_t count, void* out);
+bool ahci_write(uint64_t lba, uint32_t count, const void* in);
+bool ahci_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
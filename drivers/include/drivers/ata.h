@@ -10,8 +10,22 @@ extern "C" {
 
 void ata_init(void);
 bool ata_ready(void);
-bool ata_read_sector28(uint32_t lba, uint8_t* out512);
-bool ata_write_sector28(uint32_t lba, const uint8_t* in512);
+/* Addressable sectors reported by IDENTIFY (LBA48 count when supported). */
+uint64_t ata_sector_count(void);
+bool ata_lba48(void);
+/* Sectors per DRQ block for READ/WRITE MULTIPLE; 1 when multiple mode is off. */
+uint32_t ata_multiple_sectors(void);
+/* True while transfers go through PIIX bus-master DMA rather than PIO. */
+bool ata_dma_enabled(void);
+/*
+ * Transfer count 512-byte sectors; large requests are split across commands.
+ * DMA needs a word-aligned buffer and falls back to PIO otherwise. Writes
+ * may sit in the drive's volatile cache until the next ata_flush.
+ */
+bool ata_read(uint64_t lba, uint32_t count, void* out);
+bool ata_write(uint64_t lba, uint32_t count, const void* in);
+/* FLUSH CACHE (EXT): every write completed before it is durable on return. */
+bool ata_flush(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,67 @@
+#ifndef DRIVERS_BLOCKDEV_H
+#define DRIVERS_BLOCKDEV_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    BLOCKDEV_SECTOR_SIZE = 512,
+    BLOCKDEV_NAME_MAX = 16,
+    BLOCKDEV_NO_IRQ = 0xFF,
+};
+
+typedef void (*blockdev_done_fn)(void* token, bool ok);
+
+/*
+ * Sector-granular storage driver. Buffers must be 4-byte aligned so
+ * DMA-capable drivers can hand them to the controller directly.
+ */
+typedef struct blockdev {
+    char name[BLOCKDEV_NAME_MAX];
+    uint64_t sector_count;
+    bool (*read)(void* ctx, uint64_t lba, uint32_t count, void* out);
+    bool (*write)(void* ctx, uint64_t lba, uint32_t count, const void* in);
+    /*
+     * Write barrier. write may complete into a volatile device cache; flush
+     * makes every completed write durable. Callers issue it once per commit
+     * point, not per write. NULL when writes are already durable on return.
+     */
+    bool (*flush)(void* ctx);
+    /*
+     * Optional asynchronous path. submit starts one transfer and returns
+     * false if it cannot (busy, too large, unaligned); up to depth transfers
+     * may be outstanding at once. service reports finished transfers through
+     * done and runs from the device IRQ, or from block_queue polling when irq
+     * is BLOCKDEV_NO_IRQ. abort fails every outstanding transfer through done
+     * and leaves the device idle.
+     */
+    bool (*submit)(void* ctx, uint64_t lba, uint32_t count, void* buf, bool write,
+                   blockdev_done_fn done, void* token);
+    bool (*service)(void* ctx);
+    void (*abort)(void* ctx);
+    uint32_t depth;
+    uint8_t irq;
+    void* ctx;
+} blockdev;
+
+/* Copies dev into the registry; returns its index or -1 when full. */
+int blockdev_register(const blockdev* dev);
+size_t blockdev_count(void);
+const blockdev* blockdev_at(size_t index);
+/* First registered device; drivers are initialized fastest-first at boot. */
+const blockdev* blockdev_primary(void);
+
+bool blockdev_read(const blockdev* dev, uint64_t lba, uint32_t count, void* out);
+bool blockdev_write(const blockdev* dev, uint64_t lba, uint32_t count, const void* in);
+bool blockdev_flush(const blockdev* dev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
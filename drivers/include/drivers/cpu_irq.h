@@ -0,0 +1,37 @@
+#ifndef DRIVERS_CPU_IRQ_H
+#define DRIVERS_CPU_IRQ_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    EFLAGS_IF = 0x200,
+};
+
+/* Disables interrupts and returns the previous EFLAGS for cpu_irq_restore. */
+static inline uint32_t cpu_irq_save(void) {
+    uint32_t flags;
+    __asm__ volatile("pushfl\n"
+                     "popl %0\n"
+                     "cli"
+                     : "=r"(flags)
+                     :
+                     : "memory");
+    return flags;
+}
+
+/* Re-enables interrupts only if they were on when flags were saved. */
+static inline void cpu_irq_restore(uint32_t flags) {
+    if ((flags & (uint32_t)EFLAGS_IF) != 0) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef DRIVERS_NET_E1000_H
+#define DRIVERS_NET_E1000_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Probes an Intel 8254x-family NIC and registers it as netdev "e1000". */
+void e1000_init(void);
+bool e1000_ready(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef DRIVERS_NET_LOOPBACK_H
+#define DRIVERS_NET_LOOPBACK_H
+
+#include "drivers/netdev.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Registers netdev "lo0": every transmitted frame is queued for its own
+ * receive side. It reports a link speed of 0, so any real NIC is preferred
+ * as the stack's interface.
+ */
+void net_loopback_init(void);
+/* The registered device, or NULL before init. */
+const netdev* net_loopback_device(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
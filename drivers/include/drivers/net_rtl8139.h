@@ -9,11 +9,10 @@
 extern "C" {
 #endif
 
+/* Probes the NIC and registers it as netdev "rtl0". */
 void rtl8139_init(void);
 bool rtl8139_ready(void);
 bool rtl8139_get_mac(uint8_t out_mac[6]);
-bool rtl8139_send(const void* packet, size_t len);
-bool rtl8139_receive(void* out_packet, size_t out_cap, size_t* out_len);
 
 #ifdef __cplusplus
 }
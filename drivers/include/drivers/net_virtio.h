@@ -0,0 +1,18 @@
+#ifndef DRIVERS_NET_VIRTIO_H
+#define DRIVERS_NET_VIRTIO_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Probes a legacy virtio-net device and registers it as netdev "vnet0". */
+void virtio_net_init(void);
+bool virtio_net_ready(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
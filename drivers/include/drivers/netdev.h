@@ -0,0 +1,89 @@
+#ifndef DRIVERS_NETDEV_H
+#define DRIVERS_NETDEV_H
+
+#include "drivers/pktbuf.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    NETDEV_NAME_MAX = 16,
+    NETDEV_NO_IRQ = 0xFF,
+    /* Largest Ethernet frame without CRC that a TX buffer must hold. */
+    NETDEV_MAX_FRAME = 1514,
+};
+
+typedef struct netdev_stats {
+    uint32_t irqs;
+    uint32_t rx_frames;
+    uint32_t rx_errors;
+    /* Times a drained RX ring handed receive back to interrupts. */
+    uint32_t rx_rearms;
+    uint32_t tx_frames;
+    uint32_t tx_errors;
+    /* Frames refused because every TX buffer was still queued or in flight. */
+    uint32_t tx_drops;
+} netdev_stats;
+
+/*
+ * Ethernet driver. Receive is zero-copy: rx_peek lends a frame in place
+ * until rx_release. Transmit builds in place: tx_begin reserves a buffer of
+ * NETDEV_MAX_FRAME bytes and tx_commit queues it (len 0 gives it back).
+ *
+ * Interrupts follow the NAPI pattern: handle_irq masks RX and sets
+ * rx_pending; the stack polls until rx_peek fails, then calls rx_complete
+ * to re-arm. Without an IRQ (irq == NETDEV_NO_IRQ or enable_irq never
+ * called) rx_pending stays true and poll reaps TX completions.
+ *
+ * Drivers whose rings can point at any buffer also pass ownership:
+ * rx_take turns the lent frame into a pktbuf the caller owns (refilling the
+ * ring from the pool), and tx_pktbuf transmits straight from a pktbuf,
+ * dropping the caller's reference once the NIC is done with it. rx_take
+ * returns NULL and leaves the frame lent when it cannot swap the buffer.
+ * enable_irq, handle_irq, rx_take and tx_pktbuf are optional.
+ */
+typedef struct netdev {
+    char name[NETDEV_NAME_MAX];
+    uint8_t mac[6];
+    /* Link speed used to pick the default interface. */
+    uint32_t speed_mbps;
+    uint8_t irq;
+    bool (*rx_peek)(void* ctx, const uint8_t** out_frame, size_t* out_len);
+    void (*rx_release)(void* ctx);
+    bool (*rx_pending)(void* ctx);
+    void (*rx_complete)(void* ctx);
+    uint8_t* (*tx_begin)(void* ctx);
+    bool (*tx_commit)(void* ctx, size_t len);
+    void (*poll)(void* ctx);
+    void (*enable_irq)(void* ctx);
+    void (*handle_irq)(void* ctx);
+    void (*get_stats)(void* ctx, netdev_stats* out);
+    pktbuf* (*rx_take)(void* ctx);
+    bool (*tx_pktbuf)(void* ctx, pktbuf* pb);
+    void* ctx;
+} netdev;
+
+/* Copies dev into the registry; returns its index or -1 when full. */
+int netdev_register(const netdev* dev);
+size_t netdev_count(void);
+const netdev* netdev_at(size_t index);
+/* Registered device with the highest link speed; earlier wins on ties. */
+const netdev* netdev_fastest(void);
+
+/* Copies packet into a TX buffer; building in place via tx_begin avoids that. */
+bool netdev_send(const netdev* dev, const void* packet, size_t len);
+/* Ends the loan of the frame rx_peek returned and hands it over as a pktbuf, copying only when the driver cannot; NULL drops it. */
+pktbuf* netdev_rx_claim(const netdev* dev, const uint8_t* frame, size_t len);
+/* Transmits pb and consumes the caller's reference whether or not it was sent. */
+bool netdev_send_pktbuf(const netdev* dev, pktbuf* pb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
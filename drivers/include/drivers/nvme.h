@@ -0,0 +1,25 @@
+#ifndef DRIVERS_NVME_H
+#define DRIVERS_NVME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Brings up the first NVMe controller, namespace 1, and registers it as a blockdev. */
+void nvme_init(void);
+bool nvme_ready(void);
+uint64_t nvme_sector_count(void);
+/* Commands submitted per doorbell write on the I/O queue. */
+uint32_t nvme_queue_depth(void);
+bool nvme_read(uint64_t lba, uint32_t count, void* out);
+bool nvme_write(uint64_t lba, uint32_t count, const void* in);
+bool nvme_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
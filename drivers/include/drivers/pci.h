@@ -0,0 +1,101 @@
+#ifndef DRIVERS_PCI_H
+#define DRIVERS_PCI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    PCI_CFG_VENDOR = 0x00,
+    PCI_CFG_DEVICE = 0x02,
+    PCI_CFG_COMMAND = 0x04,
+    PCI_CFG_STATUS = 0x06,
+    PCI_CFG_REVISION = 0x08,
+    PCI_CFG_PROG_IF = 0x09,
+    PCI_CFG_SUBCLASS = 0x0A,
+    PCI_CFG_CLASS = 0x0B,
+    PCI_CFG_HEADER_TYPE = 0x0E,
+    PCI_CFG_BAR0 = 0x10,
+    PCI_CFG_SECONDARY_BUS = 0x19,
+    PCI_CFG_CAP_PTR = 0x34,
+    PCI_CFG_INTERRUPT_LINE = 0x3C,
+
+    PCI_COMMAND_IO = 0x0001,
+    PCI_COMMAND_MEMORY = 0x0002,
+    PCI_COMMAND_BUS_MASTER = 0x0004,
+    PCI_COMMAND_INTX_DISABLE = 0x0400,
+    PCI_STATUS_CAP_LIST = 0x0010,
+
+    PCI_CAP_ID_MSI = 0x05,
+
+    PCI_BAR_COUNT = 6,
+    PCI_MAX_DEVICES = 64,
+    /* Wildcard for any pci_device_id field. */
+    PCI_ANY_ID = 0xFFFF,
+};
+
+/* One function found during enumeration; BARs are sized once at boot. */
+typedef struct pci_device {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+    uint8_t header_type;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+    uint8_t revision;
+    uint8_t irq_line;
+    /* Raw BAR registers (flag bits kept) and decoded sizes; size 0 = unused. */
+    uint32_t bar[PCI_BAR_COUNT];
+    uint32_t bar_size[PCI_BAR_COUNT];
+} pci_device;
+
+/* Driver match entry; tables end with an entry whose vendor_id is 0. */
+typedef struct pci_device_id {
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint16_t class_code;
+    uint16_t subclass;
+    uint16_t prog_if;
+} pci_device_id;
+
+uint32_t pci_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+uint16_t pci_read16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+uint8_t pci_read8(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+void pci_write32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t value);
+void pci_write16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t value);
+
+/*
+ * Walks the hierarchy once from the host bridge, following PCI-to-PCI
+ * bridges to their secondary buses. Later calls are no-ops.
+ */
+void pci_init(void);
+size_t pci_device_count(void);
+const pci_device* pci_device_at(size_t index);
+/* First registered function matching any entry of ids, in enumeration order. */
+const pci_device* pci_find(const pci_device_id* ids);
+
+bool pci_bar_is_io(const pci_device* dev, uint32_t index);
+/* BAR base with the flag bits masked off; 0 when unused or above 4 GiB. */
+uint32_t pci_bar_address(const pci_device* dev, uint32_t index);
+/* Sets bits in the command register (PCI_COMMAND_*). */
+void pci_enable(const pci_device* dev, uint16_t command_bits);
+/* Config-space offset of the capability, or 0 when absent. */
+uint8_t pci_find_capability(const pci_device* dev, uint8_t cap_id);
+/*
+ * Programs a single-vector MSI with the given message and masks INTx.
+ * Returns false when the function has no MSI capability.
+ */
+bool pci_enable_msi(const pci_device* dev, uint32_t address, uint16_t data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
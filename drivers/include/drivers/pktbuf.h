@@ -0,0 +1,64 @@
+#ifndef DRIVERS_PKTBUF_H
+#define DRIVERS_PKTBUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    PKTBUF_COUNT = 512,
+    /* Room in front of a fresh buffer for headers pushed on the way out. */
+    PKTBUF_HEADROOM = 64,
+    /* Area behind the headroom; NIC receive rings post exactly this much. */
+    PKTBUF_DATA_BYTES = 2048,
+};
+
+/*
+ * Reference-counted packet buffer from a preallocated pool. Bytes
+ * [data, data + len) are the packet; headroom and tailroom around them let
+ * layers add or strip headers without copying. Whoever holds a reference
+ * may pass it on instead of copying; the last pktbuf_put frees the buffer.
+ * Only an unshared buffer (refs == 1) may be edited in place.
+ */
+typedef struct pktbuf {
+    uint8_t* data;
+    uint16_t len;
+    uint16_t refs;
+    /* Free-list link, or for the current owner's queue. */
+    struct pktbuf* next;
+} pktbuf;
+
+typedef struct pktbuf_stats {
+    uint32_t total;
+    uint32_t free;
+    uint32_t low_water;
+    uint32_t alloc_failures;
+} pktbuf_stats;
+
+/* Empty buffer with PKTBUF_HEADROOM in front and one reference; NULL when the pool is dry. Interrupt-safe. */
+pktbuf* pktbuf_alloc(void);
+void pktbuf_get(pktbuf* pb);
+void pktbuf_put(pktbuf* pb);
+
+size_t pktbuf_headroom(const pktbuf* pb);
+size_t pktbuf_tailroom(const pktbuf* pb);
+/* Grows the packet at the front; returns the new data pointer, or NULL without headroom. */
+uint8_t* pktbuf_push(pktbuf* pb, size_t n);
+/* Strips n bytes from the front; returns the new data pointer, or NULL if the packet is shorter. */
+uint8_t* pktbuf_pull(pktbuf* pb, size_t n);
+/* Grows the packet at the back; returns the first new byte, or NULL without tailroom. */
+uint8_t* pktbuf_append(pktbuf* pb, size_t n);
+/* Cuts the packet to len bytes (e.g. Ethernet padding); longer lengths are ignored. */
+void pktbuf_trim(pktbuf* pb, size_t len);
+
+void pktbuf_get_stats(pktbuf_stats* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
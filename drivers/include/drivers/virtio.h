@@ -0,0 +1,111 @@
+#ifndef DRIVERS_VIRTIO_H
+#define DRIVERS_VIRTIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Legacy (0.9.5) virtio-over-PCI: I/O BAR0 register layout without MSI-X. */
+enum {
+    VIRTIO_PCI_VENDOR = 0x1AF4,
+
+    VIRTIO_PCI_HOST_FEATURES = 0x00,
+    VIRTIO_PCI_GUEST_FEATURES = 0x04,
+    VIRTIO_PCI_QUEUE_PFN = 0x08,
+    VIRTIO_PCI_QUEUE_SIZE = 0x0C,
+    VIRTIO_PCI_QUEUE_SELECT = 0x0E,
+    VIRTIO_PCI_QUEUE_NOTIFY = 0x10,
+    VIRTIO_PCI_STATUS = 0x12,
+    VIRTIO_PCI_ISR = 0x13,
+    VIRTIO_PCI_CONFIG = 0x14,
+
+    VIRTIO_STATUS_ACKNOWLEDGE = 0x01,
+    VIRTIO_STATUS_DRIVER = 0x02,
+    VIRTIO_STATUS_DRIVER_OK = 0x04,
+    VIRTIO_STATUS_FAILED = 0x80,
+
+    VIRTQ_DESC_F_NEXT = 0x1,
+    VIRTQ_DESC_F_WRITE = 0x2,
+    VIRTQ_AVAIL_F_NO_INTERRUPT = 0x1,
+    VIRTQ_USED_F_NO_NOTIFY = 0x1,
+
+    VIRTQ_ALIGN = 4096,
+
+    /* Ring feature: used_event/avail_event replace the NO_INTERRUPT/NO_NOTIFY flags. */
+    VIRTIO_F_RING_EVENT_IDX = 1 << 29,
+    VIRTIO_ISR_QUEUE = 0x1,
+};
+
+typedef struct virtq_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} virtq_desc;
+
+typedef struct virtq_avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} virtq_avail;
+
+typedef struct virtq_used_elem {
+    uint32_t id;
+    uint32_t len;
+} virtq_used_elem;
+
+typedef struct virtq_used {
+    uint16_t flags;
+    uint16_t idx;
+    virtq_used_elem ring[];
+} virtq_used;
+
+/* Split virtqueue in caller-provided, VIRTQ_ALIGN-aligned memory. */
+typedef struct virtq {
+    uint16_t io_base;
+    uint16_t index;
+    uint16_t size;
+    volatile virtq_desc* desc;
+    volatile virtq_avail* avail;
+    volatile virtq_used* used;
+    uint16_t avail_idx;
+    uint16_t last_used;
+    /* Set by the driver after negotiating VIRTIO_F_RING_EVENT_IDX. */
+    bool event_idx;
+    /* avail_idx at the last notify, for event-index suppression. */
+    uint16_t kicked_idx;
+} virtq;
+
+/* Reset the device, acknowledge it, and accept the offered subset of `wanted`. */
+bool virtio_legacy_begin(uint16_t io_base, uint32_t wanted, uint32_t* out_features);
+void virtio_legacy_driver_ok(uint16_t io_base);
+void virtio_legacy_fail(uint16_t io_base);
+uint32_t virtio_legacy_config32(uint16_t io_base, uint32_t offset);
+uint8_t virtio_legacy_config8(uint16_t io_base, uint32_t offset);
+/* Reading ISR acknowledges the interrupt and deasserts INTx. */
+uint8_t virtio_legacy_isr(uint16_t io_base);
+
+/* Bytes a legacy queue of `size` entries occupies, including alignment padding. */
+size_t virtq_bytes(uint16_t size);
+/* Reads the device's queue size and hands it `mem`; fails if mem_size is too small. */
+bool virtq_init(virtq* q, uint16_t io_base, uint16_t index, void* mem, size_t mem_size);
+/* Exposes a descriptor chain; nothing reaches the device until virtq_kick. */
+void virtq_submit(virtq* q, uint16_t head);
+/* Publishes submitted chains and notifies the device unless it asked not to be. */
+void virtq_kick(virtq* q);
+bool virtq_pop_used(virtq* q, uint32_t* out_id, uint32_t* out_len);
+bool virtq_has_used(const virtq* q);
+/* Asks the device not to interrupt for this queue; best effort. */
+void virtq_disable_interrupts(virtq* q);
+/* Re-arms interrupts; false if used entries arrived meanwhile and the caller must keep polling. */
+bool virtq_enable_interrupts(virtq* q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef DRIVERS_VIRTIO_BLK_H
+#define DRIVERS_VIRTIO_BLK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Brings up the first legacy virtio-blk device and registers it as a blockdev. */
+void virtio_blk_init(void);
+bool virtio_blk_ready(void);
+uint64_t virtio_blk_sector_count(void);
+bool virtio_blk_read(uint64_t lba, uint32_t count, void* out);
+bool virtio_blk_write(uint64_t lba, uint32_t count, const void* in);
+bool virtio_blk_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
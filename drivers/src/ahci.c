@@ -0,0 +1,582 @@
+#include "drivers/ahci.h"
+
+#include "drivers/blockdev.h"
+#include "drivers/pci.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    kPciClassStorage = 0x01,
+    kPciSubclassSata = 0x06,
+    kPciProgIfAhci = 0x01,
+    kPciBarAbar = 5,
+
+    /* HBA generic host control registers. */
+    kHbaCap = 0x00,
+    kHbaGhc = 0x04,
+    kHbaIs = 0x08,
+    kHbaPi = 0x0C,
+    kHbaPortBase = 0x100,
+    kHbaPortStride = 0x80,
+
+    /* Per-port registers. */
+    kPortClb = 0x00,
+    kPortClbu = 0x04,
+    kPortFb = 0x08,
+    kPortFbu = 0x0C,
+    kPortIs = 0x10,
+    kPortIe = 0x14,
+    kPortCmd = 0x18,
+    kPortTfd = 0x20,
+    kPortSig = 0x24,
+    kPortSsts = 0x28,
+    kPortSerr = 0x30,
+    kPortSact = 0x34,
+    kPortCi = 0x38,
+
+    kSigSataDisk = 0x00000101,
+    kSstsDetPresent = 3,
+    kSstsIpmActive = 1,
+
+    kPortCmdSt = 1 << 0,
+    kPortCmdFre = 1 << 4,
+    kPortCmdFr = 1 << 14,
+    kPortCmdCr = 1 << 15,
+    kPortIsTfes = 1 << 30,
+    kTfdBusy = 0x80,
+    kTfdDrq = 0x08,
+
+    kFisTypeRegH2D = 0x27,
+    kFisCommandBit = 0x80,
+    kFisDeviceLba = 0x40,
+    kCmdHeaderFisDwords = 5,
+    kCmdHeaderWrite = 1 << 6,
+
+    kAtaCmdReadDmaExt = 0x25,
+    kAtaCmdWriteDmaExt = 0x35,
+    kAtaCmdReadFpdmaQueued = 0x60,
+    kAtaCmdWriteFpdmaQueued = 0x61,
+    kAtaCmdReadDma = 0xC8,
+    kAtaCmdWriteDma = 0xCA,
+    kAtaCmdFlushCache = 0xE7,
+    kAtaCmdFlushCacheExt = 0xEA,
+    kAtaCmdIdentify = 0xEC,
+
+    kIdQueueDepth = 75,
+    kIdSataCaps = 76,
+    kIdLba28Sectors = 60,
+    kIdCommandSet2 = 83,
+    kIdLba48Sectors = 100,
+
+    kAhciMaxSlots = 32,
+    /* 64 KiB per command keeps a large transfer spread across many NCQ tags. */
+    kAhciChunkSectors = 128,
+    /* One queued command per submit: the block queue never merges past 256 sectors. */
+    kAhciSubmitMaxSectors = 256,
+    kAhciPollBudget = 2000000,
+};
+
+typedef struct ahci_cmd_header {
+    uint16_t flags;
+    uint16_t prdtl;
+    volatile uint32_t prdbc;
+    uint32_t ctba;
+    uint32_t ctbau;
+    uint32_t reserved[4];
+} ahci_cmd_header;
+
+typedef struct ahci_prd {
+    uint32_t dba;
+    uint32_t dbau;
+    uint32_t reserved;
+    uint32_t dbc;
+} ahci_prd;
+
+/* The buffers handed out here are physically contiguous, so one PRD per command suffices. */
+typedef struct __attribute__((aligned(128))) ahci_cmd_table {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t reserved[48];
+    ahci_prd prdt[1];
+} ahci_cmd_table;
+
+static const pci_device_id kAhciIds[] = {
+    {PCI_ANY_ID, PCI_ANY_ID, kPciClassStorage, kPciSubclassSata, kPciProgIfAhci},
+    {0, 0, 0, 0, 0},
+};
+
+static bool s_ready = false;
+static bool s_registered = false;
+static uintptr_t s_abar = 0;
+static uintptr_t s_port = 0;
+static uint64_t s_sector_count = 0;
+static uint32_t s_depth = 1;
+static bool s_lba48 = false;
+static bool s_ncq = false;
+
+/* Slots started by ahci_submit and still owned by the HBA. */
+static uint32_t s_async_slots = 0;
+static blockdev_done_fn s_slot_done[kAhciMaxSlots];
+static void* s_slot_token[kAhciMaxSlots];
+/* Set while a synchronous caller waits the async slots out; submit refuses new work. */
+static bool s_sync_active = false;
+
+static ahci_cmd_header s_cmd_list[kAhciMaxSlots] __attribute__((aligned(1024)));
+static uint8_t s_rx_fis[256] __attribute__((aligned(256)));
+static ahci_cmd_table s_cmd_tables[kAhciMaxSlots];
+static uint16_t s_identify[256] __attribute__((aligned(4)));
+
+static inline uint32_t mmio_read32(uintptr_t addr) {
+    return *(volatile uint32_t*)addr;
+}
+
+static inline void mmio_write32(uintptr_t addr, uint32_t value) {
+    *(volatile uint32_t*)addr = value;
+}
+
+static inline void memory_barrier(void) {
+    __asm__ volatile("" : : : "memory");
+}
+
+static uint32_t port_read(uint32_t reg) {
+    return mmio_read32(s_port + reg);
+}
+
+static void port_write(uint32_t reg, uint32_t value) {
+    mmio_write32(s_port + reg, value);
+}
+
+static bool port_stop(void) {
+    port_write(kPortCmd, port_read(kPortCmd) & ~(uint32_t)(kPortCmdSt | kPortCmdFre));
+    for (uint32_t i = 0; i < kAhciPollBudget; ++i) {
+        if ((port_read(kPortCmd) & (kPortCmdCr | kPortCmdFr)) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void port_start(void) {
+    for (uint32_t i = 0; i < kAhciPollBudget; ++i) {
+        if ((port_read(kPortCmd) & kPortCmdCr) == 0) {
+            break;
+        }
+    }
+    port_write(kPortCmd, port_read(kPortCmd) | kPortCmdFre);
+    port_write(kPortCmd, port_read(kPortCmd) | kPortCmdSt);
+}
+
+static bool port_wait_idle(void) {
+    for (uint32_t i = 0; i < kAhciPollBudget; ++i) {
+        if ((port_read(kPortTfd) & (kTfdBusy | kTfdDrq)) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Restarting the command engine clears PxCI/PxSACT and discards the failed batch. */
+static void port_recover(void) {
+    (void)port_stop();
+    port_write(kPortSerr, 0xFFFFFFFFU);
+    port_write(kPortIs, 0xFFFFFFFFU);
+    port_start();
+}
+
+static void build_command(uint32_t slot, uint8_t command, uint64_t lba, uint32_t count,
+                          void* buf, uint32_t bytes, bool write) {
+    ahci_cmd_header* hdr = &s_cmd_list[slot];
+    hdr->flags = (uint16_t)(kCmdHeaderFisDwords | (write ? kCmdHeaderWrite : 0));
+    hdr->prdtl = (uint16_t)((bytes > 0) ? 1U : 0U);
+    hdr->prdbc = 0;
+
+    ahci_cmd_table* tbl = &s_cmd_tables[slot];
+    uint8_t* fis = tbl->cfis;
+    for (size_t i = 0; i < 20; ++i) {
+        fis[i] = 0;
+    }
+
+    const bool queued = command == kAtaCmdReadFpdmaQueued || command == kAtaCmdWriteFpdmaQueued;
+    const bool lba28 = command == kAtaCmdReadDma || command == kAtaCmdWriteDma;
+    const uint32_t lo = (uint32_t)lba;
+    const uint32_t hi = (uint32_t)(lba >> 32U);
+    fis[0] = kFisTypeRegH2D;
+    fis[1] = kFisCommandBit;
+    fis[2] = command;
+    fis[4] = (uint8_t)(lo & 0xFFU);
+    fis[5] = (uint8_t)((lo >> 8U) & 0xFFU);
+    fis[6] = (uint8_t)((lo >> 16U) & 0xFFU);
+    fis[7] = (command == kAtaCmdIdentify || command == kAtaCmdFlushCache) ? 0U : (uint8_t)kFisDeviceLba;
+    if (lba28) {
+        /* 28-bit commands carry LBA bits 24-27 in the DEVICE register. */
+        fis[7] = (uint8_t)(fis[7] | ((lo >> 24U) & 0x0FU));
+    } else {
+        fis[8] = (uint8_t)((lo >> 24U) & 0xFFU);
+        fis[9] = (uint8_t)(hi & 0xFFU);
+        fis[10] = (uint8_t)((hi >> 8U) & 0xFFU);
+    }
+    if (queued) {
+        /* FPDMA commands carry the sector count in FEATURES and the tag in COUNT. */
+        fis[3] = (uint8_t)(count & 0xFFU);
+        fis[11] = (uint8_t)((count >> 8U) & 0xFFU);
+        fis[12] = (uint8_t)(slot << 3U);
+    } else {
+        fis[12] = (uint8_t)(count & 0xFFU);
+        fis[13] = (uint8_t)((count >> 8U) & 0xFFU);
+    }
+
+    if (bytes > 0) {
+        tbl->prdt[0].dba = (uint32_t)(uintptr_t)buf;
+        tbl->prdt[0].dbau = 0;
+        tbl->prdt[0].reserved = 0;
+        tbl->prdt[0].dbc = bytes - 1U;
+    }
+}
+
+static bool issue_and_wait(uint32_t mask, bool queued) {
+    memory_barrier();
+    port_write(kPortIs, 0xFFFFFFFFU);
+    if (queued) {
+        port_write(kPortSact, mask);
+    }
+    port_write(kPortCi, mask);
+
+    for (uint32_t i = 0; i < kAhciPollBudget; ++i) {
+        if ((port_read(kPortIs) & kPortIsTfes) != 0) {
+            break;
+        }
+        uint32_t busy = port_read(kPortCi);
+        if (queued) {
+            busy |= port_read(kPortSact);
+        }
+        if ((busy & mask) == 0) {
+            memory_barrier();
+            return true;
+        }
+    }
+
+    port_recover();
+    return false;
+}
+
+static void parse_identify(bool hba_ncq) {
+    s_lba48 = (s_identify[kIdCommandSet2] & (1U << 10U)) != 0;
+    if (s_lba48) {
+        s_sector_count = (uint64_t)s_identify[kIdLba48Sectors] |
+                         ((uint64_t)s_identify[kIdLba48Sectors + 1] << 16U) |
+                         ((uint64_t)s_identify[kIdLba48Sectors + 2] << 32U) |
+                         ((uint64_t)s_identify[kIdLba48Sectors + 3] << 48U);
+    }
+    if (!s_lba48 || s_sector_count == 0) {
+        /* Without the 48-bit feature set only READ/WRITE DMA and FLUSH CACHE exist. */
+        s_lba48 = false;
+        s_sector_count = (uint64_t)s_identify[kIdLba28Sectors] |
+                         ((uint64_t)s_identify[kIdLba28Sectors + 1] << 16U);
+    }
+
+    /* FPDMA QUEUED commands are 48-bit only. */
+    s_ncq = hba_ncq && s_lba48 && (s_identify[kIdSataCaps] & (1U << 8U)) != 0;
+    s_depth = 1;
+    if (s_ncq) {
+        const uint32_t slots = ((mmio_read32(s_abar + kHbaCap) >> 8U) & 0x1FU) + 1U;
+        s_depth = (uint32_t)(s_identify[kIdQueueDepth] & 0x1FU) + 1U;
+        if (s_depth > slots) {
+            s_depth = slots;
+        }
+    }
+}
+
+static bool find_port(void) {
+    const uint32_t implemented = mmio_read32(s_abar + kHbaPi);
+    for (uint32_t port = 0; port < 32U; ++port) {
+        if ((implemented & (1U << port)) == 0) {
+            continue;
+        }
+        const uintptr_t base = s_abar + kHbaPortBase + port * kHbaPortStride;
+        const uint32_t ssts = mmio_read32(base + kPortSsts);
+        if ((ssts & 0x0FU) != kSstsDetPresent || ((ssts >> 8U) & 0x0FU) != kSstsIpmActive) {
+            continue;
+        }
+        if (mmio_read32(base + kPortSig) != kSigSataDisk) {
+            continue;
+        }
+        s_port = base;
+        return true;
+    }
+    return false;
+}
+
+static uint8_t transfer_command(bool write) {
+    if (s_ncq) {
+        return write ? kAtaCmdWriteFpdmaQueued : kAtaCmdReadFpdmaQueued;
+    }
+    if (s_lba48) {
+        return write ? kAtaCmdWriteDmaExt : kAtaCmdReadDmaExt;
+    }
+    return write ? kAtaCmdWriteDma : kAtaCmdReadDma;
+}
+
+/*
+ * Starts one command in a free slot and returns at once. Without NCQ the
+ * port runs one command at a time; with it up to s_depth tags are queued.
+ * Port interrupts stay masked, so ahci_service is polled by the block queue.
+ */
+static bool ahci_submit(void* ctx, uint64_t lba, uint32_t count, void* buf, bool write,
+                        blockdev_done_fn done, void* token) {
+    (void)ctx;
+    if (!s_ready || s_sync_active || done == NULL || buf == NULL || ((uintptr_t)buf & 1U) != 0U ||
+        count == 0 || count > kAhciSubmitMaxSectors) {
+        return false;
+    }
+    if (lba > s_sector_count || count > s_sector_count - lba) {
+        return false;
+    }
+    if (!s_ncq && s_async_slots != 0) {
+        return false;
+    }
+
+    uint32_t slot = 0;
+    while (slot < s_depth && (s_async_slots & (1U << slot)) != 0) {
+        ++slot;
+    }
+    if (slot == s_depth) {
+        return false;
+    }
+
+    build_command(slot, transfer_command(write), lba, count, buf, count * 512U, write);
+    s_slot_done[slot] = done;
+    s_slot_token[slot] = token;
+    s_async_slots |= 1U << slot;
+    memory_barrier();
+    if (s_ncq) {
+        port_write(kPortSact, 1U << slot);
+    }
+    port_write(kPortCi, 1U << slot);
+    return true;
+}
+
+/* A task-file error stops the whole port, so every outstanding slot fails with it. */
+static void ahci_abort(void* ctx) {
+    (void)ctx;
+    const uint32_t failed = s_async_slots;
+    if (failed == 0) {
+        return;
+    }
+    s_async_slots = 0;
+    port_recover();
+    for (uint32_t slot = 0; slot < kAhciMaxSlots; ++slot) {
+        if ((failed & (1U << slot)) != 0) {
+            s_slot_done[slot](s_slot_token[slot], false);
+        }
+    }
+}
+
+static bool ahci_service(void* ctx) {
+    (void)ctx;
+    if (s_async_slots == 0) {
+        return false;
+    }
+    if ((port_read(kPortIs) & kPortIsTfes) != 0) {
+        ahci_abort(NULL);
+        return true;
+    }
+
+    uint32_t busy = port_read(kPortCi);
+    if (s_ncq) {
+        busy |= port_read(kPortSact);
+    }
+    const uint32_t finished = s_async_slots & ~busy;
+    if (finished == 0) {
+        return false;
+    }
+    memory_barrier();
+    s_async_slots &= ~finished;
+    for (uint32_t slot = 0; slot < kAhciMaxSlots; ++slot) {
+        if ((finished & (1U << slot)) != 0) {
+            s_slot_done[slot](s_slot_token[slot], true);
+        }
+    }
+    return true;
+}
+
+/* Synchronous callers reuse the slots, so queued commands must retire first. */
+static void sync_begin(void) {
+    s_sync_active = true;
+    for (uint32_t i = 0; s_async_slots != 0 && i < kAhciPollBudget; ++i) {
+        (void)ahci_service(NULL);
+    }
+    ahci_abort(NULL);
+}
+
+static void sync_end(void) {
+    s_sync_active = false;
+}
+
+static bool ahci_blk_read(void* ctx, uint64_t lba, uint32_t count, void* out) {
+    (void)ctx;
+    return ahci_read(lba, count, out);
+}
+
+static bool ahci_blk_write(void* ctx, uint64_t lba, uint32_t count, const void* in) {
+    (void)ctx;
+    return ahci_write(lba, count, in);
+}
+
+static bool ahci_blk_flush(void* ctx) {
+    (void)ctx;
+    return ahci_flush();
+}
+
+static void ahci_register_blockdev(void) {
+    if (s_registered) {
+        return;
+    }
+
+    blockdev dev;
+    const char name[] = "ahci0";
+    for (size_t i = 0; i < sizeof(name); ++i) {
+        dev.name[i] = name[i];
+    }
+    dev.sector_count = s_sector_count;
+    dev.read = ahci_blk_read;
+    dev.write = ahci_blk_write;
+    dev.flush = ahci_blk_flush;
+    dev.submit = ahci_submit;
+    dev.service = ahci_service;
+    dev.abort = ahci_abort;
+    dev.depth = s_depth;
+    dev.irq = BLOCKDEV_NO_IRQ;
+    dev.ctx = NULL;
+    s_registered = blockdev_register(&dev) >= 0;
+}
+
+void ahci_init(void) {
+    s_ready = false;
+    s_abar = 0;
+    s_port = 0;
+    s_sector_count = 0;
+    s_depth = 1;
+    s_lba48 = false;
+    s_ncq = false;
+    s_async_slots = 0;
+    s_sync_active = false;
+
+    const pci_device* pci = pci_find(kAhciIds);
+    if (pci == NULL || pci_bar_is_io(pci, kPciBarAbar)) {
+        return;
+    }
+    const uint32_t bar5 = pci_bar_address(pci, kPciBarAbar);
+    if (bar5 == 0U) {
+        return;
+    }
+    pci_enable(pci, PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER);
+
+    s_abar = (uintptr_t)bar5;
+    mmio_write32(s_abar + kHbaGhc, mmio_read32(s_abar + kHbaGhc) | 0x80000000U);
+    if (!find_port() || !port_stop()) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < kAhciMaxSlots; ++i) {
+        ahci_cmd_header* hdr = &s_cmd_list[i];
+        hdr->flags = 0;
+        hdr->prdtl = 0;
+        hdr->prdbc = 0;
+        hdr->ctba = (uint32_t)(uintptr_t)&s_cmd_tables[i];
+        hdr->ctbau = 0;
+        for (int r = 0; r < 4; ++r) {
+            hdr->reserved[r] = 0;
+        }
+    }
+    for (size_t i = 0; i < sizeof(s_rx_fis); ++i) {
+        s_rx_fis[i] = 0;
+    }
+
+    port_write(kPortClb, (uint32_t)(uintptr_t)s_cmd_list);
+    port_write(kPortClbu, 0);
+    port_write(kPortFb, (uint32_t)(uintptr_t)s_rx_fis);
+    port_write(kPortFbu, 0);
+    port_write(kPortSerr, 0xFFFFFFFFU);
+    port_write(kPortIs, 0xFFFFFFFFU);
+    /* Port interrupts stay masked: completions are read from PxCI/PxSACT. */
+    port_write(kPortIe, 0);
+    mmio_write32(s_abar + kHbaIs, 0xFFFFFFFFU);
+    port_start();
+
+    if (!port_wait_idle()) {
+        return;
+    }
+    build_command(0, kAtaCmdIdentify, 0, 0, s_identify, sizeof(s_identify), false);
+    if (!issue_and_wait(1U, false)) {
+        return;
+    }
+    parse_identify((mmio_read32(s_abar + kHbaCap) & (1U << 30U)) != 0);
+
+    s_ready = true;
+    ahci_register_blockdev();
+}
+
+bool ahci_ready(void) {
+    return s_ready;
+}
+
+uint64_t ahci_sector_count(void) {
+    return s_sector_count;
+}
+
+uint32_t ahci_queue_depth(void) {
+    return s_depth;
+}
+
+/*
+ * Splits the request into 64 KiB commands and issues up to s_depth of them
+ * together; with NCQ the drive may complete them in any order. The caller
+ * busy-waits until the whole group is done, so this is a synchronous call.
+ */
+static bool ahci_transfer(uint64_t lba, uint32_t count, uint8_t* buf, bool write) {
+    if (!s_ready || buf == NULL || ((uintptr_t)buf & 1U) != 0U) {
+        return false;
+    }
+    if (lba > s_sector_count || count > s_sector_count - lba) {
+        return false;
+    }
+
+    const uint8_t command = transfer_command(write);
+    sync_begin();
+    bool ok = true;
+    while (ok && count > 0) {
+        uint32_t mask = 0;
+        for (uint32_t slot = 0; slot < s_depth && count > 0; ++slot) {
+            const uint32_t chunk = (count < kAhciChunkSectors) ? count : kAhciChunkSectors;
+            build_command(slot, command, lba, chunk, buf, chunk * 512U, write);
+            mask |= 1U << slot;
+            buf += (size_t)chunk * 512U;
+            lba += chunk;
+            count -= chunk;
+        }
+        ok = issue_and_wait(mask, s_ncq);
+    }
+    sync_end();
+    return ok;
+}
+
+bool ahci_read(uint64_t lba, uint32_t count, void* out) {
+    return ahci_transfer(lba, count, (uint8_t*)out, false);
+}
+
+bool ahci_write(uint64_t lba, uint32_t count, const void* in) {
+    return ahci_transfer(lba, count, (uint8_t*)(uintptr_t)in, true);
+}
+
+bool ahci_flush(void) {
+    if (!s_ready) {
+        return false;
+    }
+    sync_begin();
+    build_command(0, s_lba48 ? kAtaCmdFlushCacheExt : kAtaCmdFlushCache, 0, 0, NULL, 0, false);
+    const bool ok = issue_and_wait(1U, false);
+    sync_end();
+    return ok;
+}
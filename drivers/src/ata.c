@@ -1,5 +1,9 @@
 #include "drivers/ata.h"
 
+#include "drivers/blockdev.h"
+#include "drivers/cpu_irq.h"
+#include "drivers/pci.h"
+
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -14,6 +18,8 @@ enum {
     kAtaDrive = 0x1F6,
     kAtaStatus = 0x1F7,
     kAtaCommand = 0x1F7,
+    kAtaControl = 0x3F6,
+    kAtaControlSrst = 0x04,
 
     kAtaStatusErr = 0x01,
     kAtaStatusDrq = 0x08,
@@ -22,13 +28,87 @@ enum {
     kAtaStatusBusy = 0x80,
 
     kAtaCmdReadSectors = 0x20,
+    kAtaCmdReadSectorsExt = 0x24,
+    kAtaCmdReadMultipleExt = 0x29,
     kAtaCmdWriteSectors = 0x30,
+    kAtaCmdWriteSectorsExt = 0x34,
+    kAtaCmdWriteMultipleExt = 0x39,
+    kAtaCmdReadDmaExt = 0x25,
+    kAtaCmdWriteDmaExt = 0x35,
+    kAtaCmdReadMultiple = 0xC4,
+    kAtaCmdWriteMultiple = 0xC5,
+    kAtaCmdSetMultiple = 0xC6,
+    kAtaCmdReadDma = 0xC8,
+    kAtaCmdWriteDma = 0xCA,
+    kAtaCmdFlushCache = 0xE7,
+    kAtaCmdFlushCacheExt = 0xEA,
     kAtaCmdIdentify = 0xEC,
 
+    /* IDENTIFY DEVICE word offsets. */
+    kIdMultipleMax = 47,
+    kIdCapabilities = 49,
+    kIdMultipleCurrent = 59,
+    kIdLba28Sectors = 60,
+    kIdCommandSet2 = 83,
+    kIdLba48Sectors = 100,
+
+    kAtaSectorWords = 256,
+    /* One command moves at most 256 sectors (count 0) in both LBA28 and our LBA48 use. */
+    kAtaMaxCommandSectors = 256,
     kAtaPollBudget = 100000,
+    kAtaIrq = 14,
+
+    /* PIIX bus-master IDE registers for the primary channel, relative to BAR4. */
+    kBmCommand = 0x00,
+    kBmStatus = 0x02,
+    kBmPrdt = 0x04,
+    kBmCmdStart = 0x01,
+    kBmCmdToMemory = 0x08,
+    kBmStatusActive = 0x01,
+    kBmStatusError = 0x02,
+    kBmStatusIrq = 0x04,
+
+    kPciClassStorage = 0x01,
+    kPciSubclassIde = 0x01,
+    kPciProgIfBusMaster = 0x80,
+    kPciBarBusMaster = 4,
+
+    /* 256 sectors = 128 KiB, split at 64 KiB boundaries: three entries at most. */
+    kAtaPrdMax = 4,
+    kAtaPrdEnd = 0x8000,
+    kAtaDmaPollBudget = 2000000,
+};
+
+typedef struct ata_prd {
+    uint32_t addr;
+    uint16_t bytes;
+    uint16_t flags;
+} ata_prd;
+
+static const uint64_t kAtaLba28Limit = 0x10000000ULL;
+
+static const pci_device_id kIdeIds[] = {
+    {PCI_ANY_ID, PCI_ANY_ID, kPciClassStorage, kPciSubclassIde, PCI_ANY_ID},
+    {0, 0, 0, 0, 0},
 };
 
 static bool s_ready = false;
+static bool s_lba48 = false;
+static uint64_t s_sector_count = 0;
+static uint32_t s_multiple = 1;
+static uint16_t s_identify[kAtaSectorWords];
+static uint16_t s_bm_base = 0;
+static bool s_dma = false;
+static bool s_registered = false;
+/* One interrupt-driven DMA command may be in flight; see ata_submit. */
+static volatile bool s_async_busy = false;
+/* Set while a synchronous caller waits the async command out; submit refuses new work. */
+static bool s_sync_active = false;
+static bool s_async_write = false;
+static blockdev_done_fn s_async_done = NULL;
+static void* s_async_token = NULL;
+/* 32-byte aligned, so the table never straddles a 64 KiB boundary. */
+static ata_prd s_prdt[kAtaPrdMax] __attribute__((aligned(32)));
 
 static inline void io_wait(void) {
     __asm__ volatile("outb %%al, $0x80" : : "a"(0));
@@ -40,18 +120,20 @@ static inline uint8_t inb(uint16_t port) {
     return value;
 }
 
-static inline uint16_t inw(uint16_t port) {
-    uint16_t value;
-    __asm__ volatile("inw %1, %0" : "=a"(value) : "Nd"(port));
-    return value;
-}
-
 static inline void outb(uint16_t port, uint8_t value) {
     __asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
 }
 
-static inline void outw(uint16_t port, uint16_t value) {
-    __asm__ volatile("outw %0, %1" : : "a"(value), "Nd"(port));
+static inline void outl(uint16_t port, uint32_t value) {
+    __asm__ volatile("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline void insw(uint16_t port, void* dst, uint32_t words) {
+    __asm__ volatile("cld; rep insw" : "+D"(dst), "+c"(words) : "d"(port) : "memory");
+}
+
+static inline void outsw(uint16_t port, const void* src, uint32_t words) {
+    __asm__ volatile("cld; rep outsw" : "+S"(src), "+c"(words) : "d"(port) : "memory");
 }
 
 static bool ata_poll(bool require_drq) {
@@ -74,13 +156,140 @@ static bool ata_poll(bool require_drq) {
     return false;
 }
 
-static void ata_select_drive(uint32_t lba) {
-    outb(kAtaDrive, (uint8_t)(0xE0U | ((lba >> 24U) & 0x0FU)));
+static void ata_select_drive(uint32_t lba_top) {
+    outb(kAtaDrive, (uint8_t)(0xE0U | (lba_top & 0x0FU)));
     io_wait();
 }
 
+static void ata_issue(uint64_t lba, uint32_t count, bool ext, uint8_t command) {
+    const uint32_t lo = (uint32_t)lba;
+    if (ext) {
+        const uint32_t hi = (uint32_t)(lba >> 32U);
+        outb(kAtaDrive, 0x40U);
+        io_wait();
+        /* LBA48 registers are two-deep FIFOs: high-order bytes go first. */
+        outb(kAtaSectorCount, (uint8_t)((count >> 8U) & 0xFFU));
+        outb(kAtaLbaLow, (uint8_t)((lo >> 24U) & 0xFFU));
+        outb(kAtaLbaMid, (uint8_t)(hi & 0xFFU));
+        outb(kAtaLbaHigh, (uint8_t)((hi >> 8U) & 0xFFU));
+    } else {
+        ata_select_drive(lo >> 24U);
+    }
+    outb(kAtaSectorCount, (uint8_t)(count & 0xFFU));
+    outb(kAtaLbaLow, (uint8_t)(lo & 0xFFU));
+    outb(kAtaLbaMid, (uint8_t)((lo >> 8U) & 0xFFU));
+    outb(kAtaLbaHigh, (uint8_t)((lo >> 16U) & 0xFFU));
+    outb(kAtaCommand, command);
+}
+
+static void ata_parse_identify(void) {
+    s_lba48 = (s_identify[kIdCommandSet2] & (1U << 10U)) != 0;
+    if (s_lba48) {
+        s_sector_count = (uint64_t)s_identify[kIdLba48Sectors] |
+                         ((uint64_t)s_identify[kIdLba48Sectors + 1] << 16U) |
+                         ((uint64_t)s_identify[kIdLba48Sectors + 2] << 32U) |
+                         ((uint64_t)s_identify[kIdLba48Sectors + 3] << 48U);
+    }
+    if (!s_lba48 || s_sector_count == 0) {
+        s_lba48 = false;
+        s_sector_count = (uint64_t)s_identify[kIdLba28Sectors] |
+                         ((uint64_t)s_identify[kIdLba28Sectors + 1] << 16U);
+    }
+}
+
+static void ata_enable_multiple(void) {
+    s_multiple = 1;
+
+    const uint32_t max = s_identify[kIdMultipleMax] & 0xFFU;
+    if (max < 2) {
+        return;
+    }
+
+    ata_select_drive(0);
+    outb(kAtaSectorCount, (uint8_t)max);
+    outb(kAtaCommand, kAtaCmdSetMultiple);
+    if (ata_poll(false)) {
+        s_multiple = max;
+    }
+}
+
+static void ata_enable_dma(void) {
+    s_dma = false;
+    s_bm_base = 0;
+
+    if ((s_identify[kIdCapabilities] & (1U << 8U)) == 0) {
+        return;
+    }
+
+    const pci_device* pci = pci_find(kIdeIds);
+    if (pci == NULL || (pci->prog_if & kPciProgIfBusMaster) == 0) {
+        return;
+    }
+
+    const uint32_t bm_base = pci_bar_address(pci, kPciBarBusMaster);
+    if (!pci_bar_is_io(pci, kPciBarBusMaster) || bm_base == 0U) {
+        return;
+    }
+    pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+    s_bm_base = (uint16_t)bm_base;
+    outb((uint16_t)(s_bm_base + kBmCommand), 0);
+    outb((uint16_t)(s_bm_base + kBmStatus), kBmStatusError | kBmStatusIrq);
+    /* Clear nIEN so the drive raises INTRQ for interrupt-driven DMA. */
+    outb(kAtaControl, 0);
+    s_dma = true;
+}
+
+static bool ata_submit(void* ctx, uint64_t lba, uint32_t count, void* buf, bool write,
+                       blockdev_done_fn done, void* token);
+static bool ata_service(void* ctx);
+static void ata_abort(void* ctx);
+
+static bool ata_blk_read(void* ctx, uint64_t lba, uint32_t count, void* out) {
+    (void)ctx;
+    return ata_read(lba, count, out);
+}
+
+static bool ata_blk_write(void* ctx, uint64_t lba, uint32_t count, const void* in) {
+    (void)ctx;
+    return ata_write(lba, count, in);
+}
+
+static bool ata_blk_flush(void* ctx) {
+    (void)ctx;
+    return ata_flush();
+}
+
+static void ata_register_blockdev(void) {
+    if (s_registered) {
+        return;
+    }
+
+    blockdev dev;
+    const char name[] = "ata0";
+    for (size_t i = 0; i < sizeof(name); ++i) {
+        dev.name[i] = name[i];
+    }
+    dev.sector_count = s_sector_count;
+    dev.read = ata_blk_read;
+    dev.write = ata_blk_write;
+    dev.flush = ata_blk_flush;
+    /* Only bus-master DMA can complete without the CPU, so PIO stays polled. */
+    dev.submit = s_dma ? ata_submit : NULL;
+    dev.service = s_dma ? ata_service : NULL;
+    dev.abort = s_dma ? ata_abort : NULL;
+    dev.depth = 1;
+    dev.irq = s_dma ? (uint8_t)kAtaIrq : (uint8_t)BLOCKDEV_NO_IRQ;
+    dev.ctx = NULL;
+    s_registered = blockdev_register(&dev) >= 0;
+}
+
 void ata_init(void) {
     s_ready = false;
+    s_lba48 = false;
+    s_sector_count = 0;
+    s_multiple = 1;
+    s_dma = false;
 
     ata_select_drive(0);
     outb(kAtaSectorCount, 0);
@@ -97,63 +306,284 @@ void ata_init(void) {
         return;
     }
 
-    for (int i = 0; i < 256; ++i) {
-        (void)inw(kAtaData);
-    }
+    insw(kAtaData, s_identify, kAtaSectorWords);
+    ata_parse_identify();
+    ata_enable_multiple();
+    ata_enable_dma();
 
     s_ready = true;
+    ata_register_blockdev();
 }
 
 bool ata_ready(void) {
     return s_ready;
 }
 
-bool ata_read_sector28(uint32_t lba, uint8_t* out512) {
-    if (!s_ready || out512 == NULL) {
+uint64_t ata_sector_count(void) {
+    return s_sector_count;
+}
+
+bool ata_lba48(void) {
+    return s_lba48;
+}
+
+uint32_t ata_multiple_sectors(void) {
+    return s_multiple;
+}
+
+bool ata_dma_enabled(void) {
+    return s_dma;
+}
+
+static bool ata_range_ok(uint64_t lba, uint32_t count, bool* out_ext) {
+    const uint64_t end = lba + count;
+    if (s_sector_count != 0 && end > s_sector_count) {
         return false;
     }
+    *out_ext = end > kAtaLba28Limit;
+    return !*out_ext || s_lba48;
+}
 
-    ata_select_drive(lba);
-    outb(kAtaSectorCount, 1);
-    outb(kAtaLbaLow, (uint8_t)(lba & 0xFFU));
-    outb(kAtaLbaMid, (uint8_t)((lba >> 8U) & 0xFFU));
-    outb(kAtaLbaHigh, (uint8_t)((lba >> 16U) & 0xFFU));
-    outb(kAtaCommand, kAtaCmdReadSectors);
+static uint8_t ata_pio_command(bool ext, bool write) {
+    if (s_multiple > 1) {
+        if (write) {
+            return ext ? kAtaCmdWriteMultipleExt : kAtaCmdWriteMultiple;
+        }
+        return ext ? kAtaCmdReadMultipleExt : kAtaCmdReadMultiple;
+    }
+    if (write) {
+        return ext ? kAtaCmdWriteSectorsExt : kAtaCmdWriteSectors;
+    }
+    return ext ? kAtaCmdReadSectorsExt : kAtaCmdReadSectors;
+}
 
-    if (!ata_poll(true)) {
+static bool ata_pio_transfer(uint64_t lba, uint32_t count, bool ext, uint8_t* buf, bool write) {
+    ata_issue(lba, count, ext, ata_pio_command(ext, write));
+
+    /* One DRQ block per s_multiple sectors; the last block may be short. */
+    while (count > 0) {
+        const uint32_t block = (count < s_multiple) ? count : s_multiple;
+        if (!ata_poll(true)) {
+            return false;
+        }
+        if (write) {
+            outsw(kAtaData, buf, block * kAtaSectorWords);
+        } else {
+            insw(kAtaData, buf, block * kAtaSectorWords);
+        }
+        buf += (size_t)block * 512U;
+        count -= block;
+    }
+    return !write || ata_poll(false);
+}
+
+static bool ata_build_prdt(const uint8_t* buf, uint32_t bytes) {
+    uint32_t addr = (uint32_t)(uintptr_t)buf;
+    uint32_t n = 0;
+    while (bytes > 0) {
+        if (n == kAtaPrdMax) {
+            return false;
+        }
+        /* An entry may not cross a 64 KiB boundary; a byte count of 0 means 64 KiB. */
+        uint32_t chunk = 0x10000U - (addr & 0xFFFFU);
+        if (chunk > bytes) {
+            chunk = bytes;
+        }
+        s_prdt[n].addr = addr;
+        s_prdt[n].bytes = (uint16_t)(chunk & 0xFFFFU);
+        s_prdt[n].flags = 0;
+        addr += chunk;
+        bytes -= chunk;
+        ++n;
+    }
+    s_prdt[n - 1].flags = kAtaPrdEnd;
+    return true;
+}
+
+static bool ata_dma_start(uint64_t lba, uint32_t count, bool ext, uint8_t* buf, bool write) {
+    if (((uintptr_t)buf & 1U) != 0U || !ata_build_prdt(buf, count * 512U)) {
         return false;
     }
 
-    for (int i = 0; i < 256; ++i) {
-        const uint16_t word = inw(kAtaData);
-        out512[i * 2] = (uint8_t)(word & 0xFFU);
-        out512[i * 2 + 1] = (uint8_t)((word >> 8U) & 0xFFU);
+    const uint16_t bm_cmd = (uint16_t)(s_bm_base + kBmCommand);
+    const uint8_t direction = write ? 0U : (uint8_t)kBmCmdToMemory;
+
+    __asm__ volatile("" : : : "memory");
+    outb(bm_cmd, 0);
+    outl((uint16_t)(s_bm_base + kBmPrdt), (uint32_t)(uintptr_t)s_prdt);
+    outb((uint16_t)(s_bm_base + kBmStatus), kBmStatusError | kBmStatusIrq);
+    outb(bm_cmd, direction);
+
+    uint8_t command = 0;
+    if (write) {
+        command = ext ? kAtaCmdWriteDmaExt : kAtaCmdWriteDma;
+    } else {
+        command = ext ? kAtaCmdReadDmaExt : kAtaCmdReadDma;
     }
+    ata_issue(lba, count, ext, command);
+    outb(bm_cmd, (uint8_t)(direction | kBmCmdStart));
     return true;
 }
 
-bool ata_write_sector28(uint32_t lba, const uint8_t* in512) {
-    if (!s_ready || in512 == NULL) {
+/* The bus-master IRQ bit latches the drive's INTRQ, or the engine stopped on its own. */
+static bool ata_dma_done(uint8_t status) {
+    return (status & (kBmStatusIrq | kBmStatusError)) != 0 || (status & kBmStatusActive) == 0;
+}
+
+static bool ata_dma_finish(uint8_t status, bool write) {
+    outb((uint16_t)(s_bm_base + kBmCommand), write ? 0U : (uint8_t)kBmCmdToMemory);
+    outb((uint16_t)(s_bm_base + kBmStatus), kBmStatusError | kBmStatusIrq);
+    __asm__ volatile("" : : : "memory");
+
+    /* Reading the drive status also deasserts INTRQ. */
+    const bool drive_ok = ata_poll(false);
+    return drive_ok && (status & kBmStatusError) == 0;
+}
+
+static bool ata_dma_transfer(uint64_t lba, uint32_t count, bool ext, uint8_t* buf, bool write) {
+    if (!ata_dma_start(lba, count, ext, buf, write)) {
         return false;
     }
 
-    ata_select_drive(lba);
-    outb(kAtaSectorCount, 1);
-    outb(kAtaLbaLow, (uint8_t)(lba & 0xFFU));
-    outb(kAtaLbaMid, (uint8_t)((lba >> 8U) & 0xFFU));
-    outb(kAtaLbaHigh, (uint8_t)((lba >> 16U) & 0xFFU));
-    outb(kAtaCommand, kAtaCmdWriteSectors);
+    const uint16_t bm_status = (uint16_t)(s_bm_base + kBmStatus);
+    bool done = false;
+    uint8_t status = 0;
+    for (uint32_t i = 0; i < kAtaDmaPollBudget; ++i) {
+        status = inb(bm_status);
+        if (ata_dma_done(status)) {
+            done = true;
+            break;
+        }
+    }
+    return ata_dma_finish(status, write) && done;
+}
 
-    if (!ata_poll(true)) {
+static bool ata_service(void* ctx) {
+    (void)ctx;
+    if (!s_async_busy) {
+        /* Acknowledge a stray INTRQ (e.g. from a polled command). */
+        (void)inb(kAtaStatus);
         return false;
     }
 
-    for (int i = 0; i < 256; ++i) {
-        const uint16_t word = (uint16_t)in512[i * 2] | ((uint16_t)in512[i * 2 + 1] << 8U);
-        outw(kAtaData, word);
+    const uint8_t status = inb((uint16_t)(s_bm_base + kBmStatus));
+    if (!ata_dma_done(status)) {
+        return false;
     }
 
-    io_wait();
-    outb(kAtaCommand, 0xE7);
-    return ata_poll(false);
+    const bool ok = ata_dma_finish(status, s_async_write);
+    const blockdev_done_fn done = s_async_done;
+    void* token = s_async_token;
+    s_async_busy = false;
+    done(token, ok);
+    return true;
+}
+
+/*
+ * Starts a DMA command and returns at once; ata_service completes it from
+ * IRQ14. Returns false (nothing started) when the caller should use the
+ * synchronous path instead.
+ */
+static bool ata_submit(void* ctx, uint64_t lba, uint32_t count, void* buf, bool write,
+                       blockdev_done_fn done, void* token) {
+    (void)ctx;
+    bool ext = false;
+    if (!s_ready || !s_dma || s_async_busy || s_sync_active || done == NULL || buf == NULL || count == 0 ||
+        count > kAtaMaxCommandSectors || !ata_range_ok(lba, count, &ext)) {
+        return false;
+    }
+
+    const uint32_t flags = cpu_irq_save();
+    s_async_write = write;
+    s_async_done = done;
+    s_async_token = token;
+    s_async_busy = ata_dma_start(lba, count, ext, (uint8_t*)buf, write);
+    cpu_irq_restore(flags);
+    return s_async_busy;
+}
+
+/* Stops the bus master and resets the drive, failing the interrupt-driven command. */
+static void ata_abort(void* ctx) {
+    (void)ctx;
+    if (!s_async_busy) {
+        return;
+    }
+
+    outb((uint16_t)(s_bm_base + kBmCommand), 0);
+    outb((uint16_t)(s_bm_base + kBmStatus), kBmStatusError | kBmStatusIrq);
+    /* SRST must stay asserted for at least 5 us. */
+    outb(kAtaControl, kAtaControlSrst);
+    for (int i = 0; i < 8; ++i) {
+        io_wait();
+    }
+    outb(kAtaControl, 0);
+    (void)ata_poll(false);
+
+    const blockdev_done_fn done = s_async_done;
+    void* token = s_async_token;
+    s_async_busy = false;
+    done(token, false);
+}
+
+/*
+ * Synchronous callers first retire any interrupt-driven command, then keep
+ * IRQs off. A command that never completes is aborted rather than waited on.
+ */
+static uint32_t ata_sync_begin(void) {
+    uint32_t flags = cpu_irq_save();
+    s_sync_active = true;
+    for (uint32_t i = 0; s_async_busy && i < kAtaDmaPollBudget; ++i) {
+        (void)ata_service(NULL);
+    }
+    ata_abort(NULL);
+    s_sync_active = false;
+    return flags;
+}
+
+static bool ata_transfer(uint64_t lba, uint32_t count, uint8_t* buf, bool write) {
+    bool ext = false;
+    if (!s_ready || buf == NULL || !ata_range_ok(lba, count, &ext)) {
+        return false;
+    }
+
+    const uint32_t flags = ata_sync_begin();
+    bool ok = true;
+    while (ok && count > 0) {
+        const uint32_t batch = (count < kAtaMaxCommandSectors) ? count : kAtaMaxCommandSectors;
+        ok = s_dma && ata_dma_transfer(lba, batch, ext, buf, write);
+        if (!ok) {
+            /* A DMA failure drops the channel back to PIO for good. */
+            if (s_dma && ((uintptr_t)buf & 1U) == 0U) {
+                s_dma = false;
+            }
+            ok = ata_pio_transfer(lba, batch, ext, buf, write);
+        }
+
+        buf += (size_t)batch * 512U;
+        lba += batch;
+        count -= batch;
+    }
+    cpu_irq_restore(flags);
+    return ok;
+}
+
+bool ata_read(uint64_t lba, uint32_t count, void* out) {
+    return ata_transfer(lba, count, (uint8_t*)out, false);
+}
+
+bool ata_write(uint64_t lba, uint32_t count, const void* in) {
+    return ata_transfer(lba, count, (uint8_t*)(uintptr_t)in, true);
+}
+
+bool ata_flush(void) {
+    if (!s_ready) {
+        return false;
+    }
+
+    const uint32_t flags = ata_sync_begin();
+    ata_select_drive(0);
+    outb(kAtaCommand, s_lba48 ? kAtaCmdFlushCacheExt : kAtaCmdFlushCache);
+    const bool ok = ata_poll(false);
+    cpu_irq_restore(flags);
+    return ok;
 }
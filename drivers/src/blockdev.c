@@ -0,0 +1,59 @@
+#include "drivers/blockdev.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    kBlockDevMax = 8,
+};
+
+static blockdev s_devices[kBlockDevMax];
+static size_t s_device_count = 0;
+
+static bool range_ok(const blockdev* dev, uint64_t lba, uint32_t count) {
+    return lba <= dev->sector_count && count <= dev->sector_count - lba;
+}
+
+int blockdev_register(const blockdev* dev) {
+    if (dev == NULL || dev->read == NULL || dev->write == NULL || s_device_count >= kBlockDevMax) {
+        return -1;
+    }
+
+    s_devices[s_device_count] = *dev;
+    s_devices[s_device_count].name[BLOCKDEV_NAME_MAX - 1] = '\0';
+    return (int)s_device_count++;
+}
+
+size_t blockdev_count(void) {
+    return s_device_count;
+}
+
+const blockdev* blockdev_at(size_t index) {
+    return (index < s_device_count) ? &s_devices[index] : NULL;
+}
+
+const blockdev* blockdev_primary(void) {
+    return blockdev_at(0);
+}
+
+bool blockdev_read(const blockdev* dev, uint64_t lba, uint32_t count, void* out) {
+    if (dev == NULL || out == NULL || !range_ok(dev, lba, count)) {
+        return false;
+    }
+    return count == 0 || dev->read(dev->ctx, lba, count, out);
+}
+
+bool blockdev_write(const blockdev* dev, uint64_t lba, uint32_t count, const void* in) {
+    if (dev == NULL || in == NULL || !range_ok(dev, lba, count)) {
+        return false;
+    }
+    return count == 0 || dev->write(dev->ctx, lba, count, in);
+}
+
+bool blockdev_flush(const blockdev* dev) {
+    if (dev == NULL) {
+        return false;
+    }
+    return dev->flush == NULL || dev->flush(dev->ctx);
+}
@@ -0,0 +1,575 @@
+#include "drivers/net_e1000.h"
+
+#include "drivers/cpu_irq.h"
+#include "drivers/netdev.h"
+#include "drivers/pci.h"
+#include "drivers/pktbuf.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Ring sizes and interrupt throttling can be overridden from EXTRA_CFLAGS. */
+#ifndef E1000_RX_DESCRIPTORS
+#define E1000_RX_DESCRIPTORS 128
+#endif
+#ifndef E1000_TX_DESCRIPTORS
+#define E1000_TX_DESCRIPTORS 64
+#endif
+/* Minimum gap between interrupts in 256 ns units: 488 is about 8000 IRQ/s. */
+#ifndef E1000_ITR_INTERVAL
+#define E1000_ITR_INTERVAL 488
+#endif
+
+/* RDLEN/TDLEN must be multiples of 128 bytes, i.e. of 8 descriptors. */
+#if (E1000_RX_DESCRIPTORS % 8) != 0 || (E1000_TX_DESCRIPTORS % 8) != 0
+#error "e1000 ring sizes must be multiples of 8 descriptors"
+#endif
+
+enum {
+    kIntelVendor = 0x8086,
+
+    kRegCtrl = 0x0000,
+    kRegStatus = 0x0008,
+    kRegEerd = 0x0014,
+    kRegIcr = 0x00C0,
+    kRegItr = 0x00C4,
+    kRegIms = 0x00D0,
+    kRegImc = 0x00D8,
+    kRegRctl = 0x0100,
+    kRegTctl = 0x0400,
+    kRegTipg = 0x0410,
+    kRegRdbal = 0x2800,
+    kRegRdbah = 0x2804,
+    kRegRdlen = 0x2808,
+    kRegRdh = 0x2810,
+    kRegRdt = 0x2818,
+    kRegTdbal = 0x3800,
+    kRegTdbah = 0x3804,
+    kRegTdlen = 0x3808,
+    kRegTdh = 0x3810,
+    kRegTdt = 0x3818,
+    kRegMta = 0x5200,
+    kRegRal0 = 0x5400,
+    kRegRah0 = 0x5404,
+
+    kCtrlAsde = 1 << 5,
+    kCtrlSlu = 1 << 6,
+    kCtrlReset = 1 << 26,
+    kStatusSpeedShift = 6,
+    kRahValid = (int)(1U << 31),
+    kEerdStart = 1 << 0,
+    kEerdDone = 1 << 4,
+
+    kIntTxDone = 1 << 0,
+    kIntLinkChange = 1 << 2,
+    kIntRxMinThreshold = 1 << 4,
+    kIntRxOverrun = 1 << 6,
+    kIntRxTimer = 1 << 7,
+    kIntRxMask = kIntRxMinThreshold | kIntRxOverrun | kIntRxTimer,
+
+    kRctlEnable = 1 << 1,
+    kRctlBroadcast = 1 << 15,
+    /* BSIZE 00 = 2048-byte buffers, i.e. PKTBUF_DATA_BYTES. */
+    kRctlStripCrc = 1 << 26,
+    kTctlEnable = 1 << 1,
+    kTctlPadShort = 1 << 3,
+    kTctlCollisionThreshold = 0x10 << 4,
+    kTctlCollisionDistance = 0x40 << 12,
+    kTipgDefault = 0x0060200A,
+
+    kRxDescDone = 0x01,
+    kRxDescEop = 0x02,
+    kTxCmdEop = 0x01,
+    kTxCmdFcs = 0x02,
+    kTxCmdReportStatus = 0x08,
+    kTxDescDone = 0x01,
+
+    kTxBufBytes = 1536,
+    /* Receive tail writes are batched: each one is an MMIO exit under emulation. */
+    kRxRefillBatch = 8,
+    kResetPollBudget = 1000000,
+};
+
+typedef struct e1000_rx_desc {
+    uint64_t addr;
+    uint16_t length;
+    uint16_t checksum;
+    uint8_t status;
+    uint8_t errors;
+    uint16_t special;
+} e1000_rx_desc;
+
+typedef struct e1000_tx_desc {
+    uint64_t addr;
+    uint16_t length;
+    uint8_t cso;
+    uint8_t cmd;
+    uint8_t status;
+    uint8_t css;
+    uint16_t special;
+} e1000_tx_desc;
+
+/* 82540EM (QEMU's default), 82545EM, 82574L. */
+static const pci_device_id kE1000Ids[] = {
+    {kIntelVendor, 0x100E, PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID},
+    {kIntelVendor, 0x100F, PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID},
+    {kIntelVendor, 0x10D3, PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID},
+    {0, 0, 0, 0, 0},
+};
+
+static bool s_ready = false;
+static bool s_registered = false;
+static uintptr_t s_mmio = 0;
+static uint8_t s_mac[6];
+static uint32_t s_speed_mbps = 0;
+static uint8_t s_irq_line = NETDEV_NO_IRQ;
+static bool s_irq_mode = false;
+static volatile bool s_rx_pending = true;
+static netdev_stats s_stats;
+
+static e1000_rx_desc s_rx_ring[E1000_RX_DESCRIPTORS] __attribute__((aligned(128)));
+static e1000_tx_desc s_tx_ring[E1000_TX_DESCRIPTORS] __attribute__((aligned(128)));
+/* Receive buffers come from the pktbuf pool so rx_take can hand them up the stack. */
+static pktbuf* s_rx_pb[E1000_RX_DESCRIPTORS];
+static uint8_t s_tx_buf[E1000_TX_DESCRIPTORS][kTxBufBytes] __attribute__((aligned(16)));
+/* Set while a descriptor transmits from a pktbuf rather than its own s_tx_buf. */
+static pktbuf* s_tx_pb[E1000_TX_DESCRIPTORS];
+/* Next descriptor to inspect; descriptors released but not yet given back via RDT. */
+static uint32_t s_rx_next = 0;
+static uint32_t s_rx_unposted = 0;
+static bool s_rx_borrowed = false;
+/* TX: tail is the next free descriptor, clean the oldest one not yet reaped. */
+static uint32_t s_tx_tail = 0;
+static uint32_t s_tx_clean = 0;
+static bool s_tx_building = false;
+
+static inline uint32_t mmio_read32(uint32_t reg) {
+    return *(volatile uint32_t*)(s_mmio + reg);
+}
+
+static inline void mmio_write32(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(s_mmio + reg) = value;
+}
+
+static inline void memory_barrier(void) {
+    __asm__ volatile("" : : : "memory");
+}
+
+static bool eeprom_read(uint8_t word, uint16_t* out) {
+    mmio_write32(kRegEerd, ((uint32_t)word << 8U) | kEerdStart);
+    for (uint32_t i = 0; i < kResetPollBudget; ++i) {
+        const uint32_t value = mmio_read32(kRegEerd);
+        if ((value & kEerdDone) != 0U) {
+            *out = (uint16_t)(value >> 16U);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool read_mac(void) {
+    const uint32_t ral = mmio_read32(kRegRal0);
+    const uint32_t rah = mmio_read32(kRegRah0);
+    if ((rah & (uint32_t)kRahValid) != 0U) {
+        for (int i = 0; i < 4; ++i) {
+            s_mac[i] = (uint8_t)(ral >> (i * 8));
+        }
+        s_mac[4] = (uint8_t)rah;
+        s_mac[5] = (uint8_t)(rah >> 8U);
+        return true;
+    }
+
+    for (uint8_t word = 0; word < 3U; ++word) {
+        uint16_t value = 0;
+        if (!eeprom_read(word, &value)) {
+            return false;
+        }
+        s_mac[word * 2U] = (uint8_t)value;
+        s_mac[word * 2U + 1U] = (uint8_t)(value >> 8U);
+    }
+    mmio_write32(kRegRal0, (uint32_t)s_mac[0] | ((uint32_t)s_mac[1] << 8U) | ((uint32_t)s_mac[2] << 16U) |
+                               ((uint32_t)s_mac[3] << 24U));
+    mmio_write32(kRegRah0, (uint32_t)s_mac[4] | ((uint32_t)s_mac[5] << 8U) | (uint32_t)kRahValid);
+    return true;
+}
+
+static bool rx_setup(void) {
+    for (uint32_t i = 0; i < E1000_RX_DESCRIPTORS; ++i) {
+        if (s_rx_pb[i] == NULL) {
+            s_rx_pb[i] = pktbuf_alloc();
+            if (s_rx_pb[i] == NULL) {
+                return false;
+            }
+        }
+        s_rx_ring[i].addr = (uint64_t)(uintptr_t)s_rx_pb[i]->data;
+        s_rx_ring[i].status = 0;
+    }
+    s_rx_next = 0;
+    s_rx_unposted = 0;
+    s_rx_borrowed = false;
+
+    mmio_write32(kRegRdbal, (uint32_t)(uintptr_t)s_rx_ring);
+    mmio_write32(kRegRdbah, 0);
+    mmio_write32(kRegRdlen, (uint32_t)sizeof(s_rx_ring));
+    mmio_write32(kRegRdh, 0);
+    /* One descriptor stays with software so a full ring is distinguishable from an empty one. */
+    mmio_write32(kRegRdt, E1000_RX_DESCRIPTORS - 1U);
+    mmio_write32(kRegRctl, kRctlEnable | kRctlBroadcast | kRctlStripCrc);
+    return true;
+}
+
+static void tx_setup(void) {
+    for (uint32_t i = 0; i < E1000_TX_DESCRIPTORS; ++i) {
+        s_tx_ring[i].addr = (uint64_t)(uintptr_t)s_tx_buf[i];
+        s_tx_ring[i].cmd = 0;
+        s_tx_ring[i].status = kTxDescDone;
+        if (s_tx_pb[i] != NULL) {
+            pktbuf_put(s_tx_pb[i]);
+            s_tx_pb[i] = NULL;
+        }
+    }
+    s_tx_tail = 0;
+    s_tx_clean = 0;
+    s_tx_building = false;
+
+    mmio_write32(kRegTdbal, (uint32_t)(uintptr_t)s_tx_ring);
+    mmio_write32(kRegTdbah, 0);
+    mmio_write32(kRegTdlen, (uint32_t)sizeof(s_tx_ring));
+    mmio_write32(kRegTdh, 0);
+    mmio_write32(kRegTdt, 0);
+    mmio_write32(kRegTipg, kTipgDefault);
+    mmio_write32(kRegTctl, kTctlEnable | kTctlPadShort | kTctlCollisionThreshold | kTctlCollisionDistance);
+}
+
+static void e1000_register_netdev(void);
+
+void e1000_init(void) {
+    s_ready = false;
+    s_mmio = 0;
+    s_irq_line = NETDEV_NO_IRQ;
+    s_irq_mode = false;
+    s_rx_pending = true;
+
+    const pci_device* pci = pci_find(kE1000Ids);
+    if (pci == NULL || pci_bar_is_io(pci, 0)) {
+        return;
+    }
+    s_mmio = (uintptr_t)pci_bar_address(pci, 0);
+    if (s_mmio == 0U) {
+        return;
+    }
+    pci_enable(pci, PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER);
+    if (pci->irq_line < 16U) {
+        s_irq_line = pci->irq_line;
+    }
+
+    mmio_write32(kRegImc, 0xFFFFFFFFU);
+    mmio_write32(kRegCtrl, mmio_read32(kRegCtrl) | kCtrlReset);
+    for (uint32_t i = 0; i < kResetPollBudget; ++i) {
+        if ((mmio_read32(kRegCtrl) & kCtrlReset) == 0U) {
+            break;
+        }
+    }
+    mmio_write32(kRegImc, 0xFFFFFFFFU);
+    (void)mmio_read32(kRegIcr);
+    mmio_write32(kRegCtrl, mmio_read32(kRegCtrl) | kCtrlSlu | kCtrlAsde);
+
+    if (!read_mac()) {
+        return;
+    }
+    for (uint32_t i = 0; i < 128U; ++i) {
+        mmio_write32(kRegMta + i * 4U, 0);
+    }
+
+    static const uint32_t kSpeeds[4] = {10U, 100U, 1000U, 1000U};
+    s_speed_mbps = kSpeeds[(mmio_read32(kRegStatus) >> kStatusSpeedShift) & 0x3U];
+    mmio_write32(kRegItr, E1000_ITR_INTERVAL);
+
+    if (!rx_setup()) {
+        return;
+    }
+    tx_setup();
+    s_ready = true;
+    e1000_register_netdev();
+}
+
+bool e1000_ready(void) {
+    return s_ready;
+}
+
+/* Reaps finished transmits in ring order. Interrupts off. */
+static void tx_reap(void) {
+    while (s_tx_clean != s_tx_tail && (s_tx_ring[s_tx_clean].status & kTxDescDone) != 0U) {
+        if (s_tx_pb[s_tx_clean] != NULL) {
+            pktbuf_put(s_tx_pb[s_tx_clean]);
+            s_tx_pb[s_tx_clean] = NULL;
+        }
+        ++s_stats.tx_frames;
+        s_tx_clean = (s_tx_clean + 1U) % E1000_TX_DESCRIPTORS;
+    }
+}
+
+static void e1000_flush_rx_tail(void) {
+    if (s_rx_unposted == 0U) {
+        return;
+    }
+    memory_barrier();
+    mmio_write32(kRegRdt, (s_rx_next + E1000_RX_DESCRIPTORS - 1U) % E1000_RX_DESCRIPTORS);
+    s_rx_unposted = 0;
+}
+
+static bool e1000_rx_peek(void* ctx, const uint8_t** out_frame, size_t* out_len) {
+    (void)ctx;
+    if (!s_ready || s_rx_borrowed || out_frame == NULL || out_len == NULL) {
+        return false;
+    }
+
+    for (;;) {
+        e1000_rx_desc* desc = &s_rx_ring[s_rx_next];
+        if ((desc->status & kRxDescDone) == 0U) {
+            e1000_flush_rx_tail();
+            return false;
+        }
+        memory_barrier();
+        /* 2 KiB buffers without long-packet mode: every good frame fits in one descriptor. */
+        if ((desc->status & kRxDescEop) != 0U && desc->errors == 0U && desc->length >= 14U) {
+            *out_frame = s_rx_pb[s_rx_next]->data;
+            *out_len = desc->length;
+            s_rx_borrowed = true;
+            return true;
+        }
+
+        ++s_stats.rx_errors;
+        desc->status = 0;
+        s_rx_next = (s_rx_next + 1U) % E1000_RX_DESCRIPTORS;
+        ++s_rx_unposted;
+    }
+}
+
+/* Ends the loan of the current descriptor and gives it back to the NIC. */
+static void rx_advance(void) {
+    s_rx_borrowed = false;
+    s_rx_ring[s_rx_next].status = 0;
+    s_rx_next = (s_rx_next + 1U) % E1000_RX_DESCRIPTORS;
+    ++s_stats.rx_frames;
+    if (++s_rx_unposted >= kRxRefillBatch) {
+        e1000_flush_rx_tail();
+    }
+}
+
+static void e1000_rx_release(void* ctx) {
+    (void)ctx;
+    if (s_rx_borrowed) {
+        rx_advance();
+    }
+}
+
+/* Swaps a fresh pool buffer into the descriptor and hands the filled one up. */
+static pktbuf* e1000_rx_take(void* ctx) {
+    (void)ctx;
+    if (!s_rx_borrowed) {
+        return NULL;
+    }
+    pktbuf* fresh = pktbuf_alloc();
+    if (fresh == NULL) {
+        return NULL;
+    }
+
+    pktbuf* pb = s_rx_pb[s_rx_next];
+    pb->len = s_rx_ring[s_rx_next].length;
+    s_rx_pb[s_rx_next] = fresh;
+    s_rx_ring[s_rx_next].addr = (uint64_t)(uintptr_t)fresh->data;
+    rx_advance();
+    return pb;
+}
+
+static bool e1000_rx_pending(void* ctx) {
+    (void)ctx;
+    return s_ready && s_rx_pending;
+}
+
+static void e1000_rx_complete(void* ctx) {
+    (void)ctx;
+    if (!s_ready || !s_irq_mode) {
+        return;
+    }
+    const uint32_t flags = cpu_irq_save();
+    s_rx_pending = false;
+    mmio_write32(kRegIms, kIntRxMask);
+    /* Same race as any NAPI re-arm: recheck the ring after unmasking. */
+    if ((s_rx_ring[s_rx_next].status & kRxDescDone) != 0U) {
+        mmio_write32(kRegImc, kIntRxMask);
+        s_rx_pending = true;
+    } else {
+        ++s_stats.rx_rearms;
+    }
+    cpu_irq_restore(flags);
+}
+
+static uint8_t* e1000_tx_begin(void* ctx) {
+    (void)ctx;
+    if (!s_ready || s_tx_building) {
+        return NULL;
+    }
+
+    const uint32_t flags = cpu_irq_save();
+    const uint32_t next = (s_tx_tail + 1U) % E1000_TX_DESCRIPTORS;
+    if (next == s_tx_clean) {
+        tx_reap();
+    }
+    uint8_t* buf = NULL;
+    if (next != s_tx_clean) {
+        buf = s_tx_buf[s_tx_tail];
+        s_tx_building = true;
+    } else {
+        ++s_stats.tx_drops;
+    }
+    cpu_irq_restore(flags);
+    return buf;
+}
+
+/* Queues one frame at the tail descriptor; the caller has checked there is room. Interrupts off. */
+static void tx_post(const uint8_t* frame, size_t len) {
+    e1000_tx_desc* desc = &s_tx_ring[s_tx_tail];
+    desc->addr = (uint64_t)(uintptr_t)frame;
+    desc->length = (uint16_t)len;
+    desc->cso = 0;
+    desc->css = 0;
+    desc->special = 0;
+    desc->status = 0;
+    desc->cmd = kTxCmdEop | kTxCmdFcs | kTxCmdReportStatus;
+    s_tx_tail = (s_tx_tail + 1U) % E1000_TX_DESCRIPTORS;
+    memory_barrier();
+    mmio_write32(kRegTdt, s_tx_tail);
+}
+
+static bool e1000_tx_commit(void* ctx, size_t len) {
+    (void)ctx;
+    if (!s_tx_building) {
+        return false;
+    }
+    s_tx_building = false;
+    if (len == 0U || len > NETDEV_MAX_FRAME) {
+        return false;
+    }
+
+    const uint32_t flags = cpu_irq_save();
+    tx_post(s_tx_buf[s_tx_tail], len);
+    cpu_irq_restore(flags);
+    return true;
+}
+
+/* Transmits straight from pb; the reference is dropped when the descriptor is reaped. */
+static bool e1000_tx_pktbuf(void* ctx, pktbuf* pb) {
+    (void)ctx;
+    if (!s_ready || s_tx_building || pb->len == 0U || pb->len > NETDEV_MAX_FRAME) {
+        pktbuf_put(pb);
+        return false;
+    }
+
+    const uint32_t flags = cpu_irq_save();
+    const uint32_t next = (s_tx_tail + 1U) % E1000_TX_DESCRIPTORS;
+    if (next == s_tx_clean) {
+        tx_reap();
+    }
+    const bool room = next != s_tx_clean;
+    if (room) {
+        s_tx_pb[s_tx_tail] = pb;
+        tx_post(pb->data, pb->len);
+    } else {
+        ++s_stats.tx_drops;
+    }
+    cpu_irq_restore(flags);
+
+    if (!room) {
+        pktbuf_put(pb);
+    }
+    return room;
+}
+
+static void e1000_poll(void* ctx) {
+    (void)ctx;
+    if (!s_ready || s_irq_mode || s_tx_clean == s_tx_tail) {
+        return;
+    }
+    const uint32_t flags = cpu_irq_save();
+    tx_reap();
+    cpu_irq_restore(flags);
+}
+
+static void e1000_enable_irq(void* ctx) {
+    (void)ctx;
+    if (!s_ready || s_irq_line == NETDEV_NO_IRQ) {
+        return;
+    }
+    const uint32_t flags = cpu_irq_save();
+    s_irq_mode = true;
+    s_rx_pending = true;
+    (void)mmio_read32(kRegIcr);
+    /* RX stays masked: the first poll drains the ring and re-arms it. */
+    mmio_write32(kRegIms, kIntTxDone | kIntLinkChange);
+    cpu_irq_restore(flags);
+}
+
+static void e1000_handle_irq(void* ctx) {
+    (void)ctx;
+    if (!s_ready) {
+        return;
+    }
+    /* Reading ICR acknowledges every cause it returns. */
+    const uint32_t icr = mmio_read32(kRegIcr);
+    if (icr == 0U) {
+        return;
+    }
+    ++s_stats.irqs;
+
+    if ((icr & kIntRxMask) != 0U) {
+        mmio_write32(kRegImc, kIntRxMask);
+        s_rx_pending = true;
+    }
+    if ((icr & kIntTxDone) != 0U) {
+        tx_reap();
+    }
+}
+
+static void e1000_get_stats(void* ctx, netdev_stats* out) {
+    (void)ctx;
+    if (out == NULL) {
+        return;
+    }
+    const uint32_t flags = cpu_irq_save();
+    *out = s_stats;
+    cpu_irq_restore(flags);
+}
+
+static void e1000_register_netdev(void) {
+    if (s_registered) {
+        return;
+    }
+
+    netdev dev;
+    const char name[] = "e1000";
+    for (size_t i = 0; i < sizeof(name); ++i) {
+        dev.name[i] = name[i];
+    }
+    for (int i = 0; i < 6; ++i) {
+        dev.mac[i] = s_mac[i];
+    }
+    dev.speed_mbps = s_speed_mbps;
+    dev.irq = s_irq_line;
+    dev.rx_peek = e1000_rx_peek;
+    dev.rx_release = e1000_rx_release;
+    dev.rx_pending = e1000_rx_pending;
+    dev.rx_complete = e1000_rx_complete;
+    dev.tx_begin = e1000_tx_begin;
+    dev.tx_commit = e1000_tx_commit;
+    dev.poll = e1000_poll;
+    dev.enable_irq = e1000_enable_irq;
+    dev.handle_irq = e1000_handle_irq;
+    dev.get_stats = e1000_get_stats;
+    dev.rx_take = e1000_rx_take;
+    dev.tx_pktbuf = e1000_tx_pktbuf;
+    dev.ctx = NULL;
+    s_registered = netdev_register(&dev) >= 0;
+}
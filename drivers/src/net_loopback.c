@@ -0,0 +1,164 @@
+#include "drivers/net_loopback.h"
+
+#include "drivers/netdev.h"
+#include "drivers/pktbuf.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    /* Frames in flight between transmit and the next poll; a power of two. */
+    kQueueSlots = 128,
+};
+
+static pktbuf* s_queue[kQueueSlots];
+static uint32_t s_head = 0;
+static uint32_t s_tail = 0;
+/* Buffer handed out by tx_begin until tx_commit. */
+static pktbuf* s_building = NULL;
+static netdev_stats s_stats;
+static int s_index = -1;
+
+static bool enqueue(pktbuf* pb) {
+    if (s_tail - s_head == kQueueSlots) {
+        ++s_stats.tx_drops;
+        pktbuf_put(pb);
+        return false;
+    }
+    s_queue[s_tail % kQueueSlots] = pb;
+    ++s_tail;
+    ++s_stats.tx_frames;
+    return true;
+}
+
+static bool lo_rx_peek(void* ctx, const uint8_t** out_frame, size_t* out_len) {
+    (void)ctx;
+    if (s_head == s_tail || out_frame == NULL || out_len == NULL) {
+        return false;
+    }
+    const pktbuf* pb = s_queue[s_head % kQueueSlots];
+    *out_frame = pb->data;
+    *out_len = pb->len;
+    return true;
+}
+
+static pktbuf* lo_rx_take(void* ctx) {
+    (void)ctx;
+    if (s_head == s_tail) {
+        return NULL;
+    }
+    pktbuf* pb = s_queue[s_head % kQueueSlots];
+    ++s_head;
+    ++s_stats.rx_frames;
+    return pb;
+}
+
+static void lo_rx_release(void* ctx) {
+    pktbuf_put(lo_rx_take(ctx));
+}
+
+static bool lo_rx_pending(void* ctx) {
+    (void)ctx;
+    return s_head != s_tail;
+}
+
+static void lo_rx_complete(void* ctx) {
+    (void)ctx;
+}
+
+static uint8_t* lo_tx_begin(void* ctx) {
+    (void)ctx;
+    if (s_building != NULL) {
+        return NULL;
+    }
+    s_building = pktbuf_alloc();
+    if (s_building == NULL) {
+        ++s_stats.tx_drops;
+        return NULL;
+    }
+    return s_building->data;
+}
+
+static bool lo_tx_commit(void* ctx, size_t len) {
+    (void)ctx;
+    pktbuf* pb = s_building;
+    s_building = NULL;
+    if (pb == NULL || len == 0U || len > NETDEV_MAX_FRAME) {
+        pktbuf_put(pb);
+        return false;
+    }
+    (void)pktbuf_append(pb, len);
+    return enqueue(pb);
+}
+
+/*
+ * Queues pb itself when the caller holds the only reference. A shared
+ * buffer (a TCP segment kept for retransmission) has its headers stripped
+ * again once this returns, so the frame is copied instead.
+ */
+static bool lo_tx_pktbuf(void* ctx, pktbuf* pb) {
+    (void)ctx;
+    if (pb->refs == 1U) {
+        return enqueue(pb);
+    }
+    pktbuf* copy = pktbuf_alloc();
+    uint8_t* dst = (copy != NULL) ? pktbuf_append(copy, pb->len) : NULL;
+    if (dst == NULL) {
+        ++s_stats.tx_drops;
+        pktbuf_put(copy);
+        pktbuf_put(pb);
+        return false;
+    }
+    for (size_t i = 0; i < pb->len; ++i) {
+        dst[i] = pb->data[i];
+    }
+    pktbuf_put(pb);
+    return enqueue(copy);
+}
+
+static void lo_poll(void* ctx) {
+    (void)ctx;
+}
+
+static void lo_get_stats(void* ctx, netdev_stats* out) {
+    (void)ctx;
+    if (out != NULL) {
+        *out = s_stats;
+    }
+}
+
+void net_loopback_init(void) {
+    if (s_index >= 0) {
+        return;
+    }
+
+    netdev dev;
+    const char name[] = "lo0";
+    for (size_t i = 0; i < sizeof(name); ++i) {
+        dev.name[i] = name[i];
+    }
+    for (int i = 0; i < 6; ++i) {
+        dev.mac[i] = 0U;
+    }
+    dev.speed_mbps = 0;
+    dev.irq = NETDEV_NO_IRQ;
+    dev.rx_peek = lo_rx_peek;
+    dev.rx_release = lo_rx_release;
+    dev.rx_pending = lo_rx_pending;
+    dev.rx_complete = lo_rx_complete;
+    dev.tx_begin = lo_tx_begin;
+    dev.tx_commit = lo_tx_commit;
+    dev.poll = lo_poll;
+    dev.enable_irq = NULL;
+    dev.handle_irq = NULL;
+    dev.get_stats = lo_get_stats;
+    dev.rx_take = lo_rx_take;
+    dev.tx_pktbuf = lo_tx_pktbuf;
+    dev.ctx = NULL;
+    s_index = netdev_register(&dev);
+}
+
+const netdev* net_loopback_device(void) {
+    return (s_index >= 0) ? netdev_at((size_t)s_index) : NULL;
+}
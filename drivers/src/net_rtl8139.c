@@ -1,12 +1,13 @@
 #include "drivers/net_rtl8139.h"
 
+#include "drivers/cpu_irq.h"
+#include "drivers/netdev.h"
+#include "drivers/pci.h"
+
 #include <stddef.h>
 #include <stdint.h>
 
 enum {
-    kPciCfgAddr = 0xCF8,
-    kPciCfgData = 0xCFC,
-
     kRtlVendor = 0x10EC,
     kRtlDevice = 0x8139,
 
@@ -28,19 +29,71 @@ enum {
     kCrReset = 0x10,
     kCrBufEmpty = 0x01,
 
+    kIsrRxOk = 0x0001,
+    kIsrRxErr = 0x0002,
+    kIsrTxOk = 0x0004,
+    kIsrTxErr = 0x0008,
+    kIsrRxOverflow = 0x0010,
+    kIsrRxFifoOverflow = 0x0040,
+    kIsrRxMask = kIsrRxOk | kIsrRxErr | kIsrRxOverflow | kIsrRxFifoOverflow,
+
+    /* Accept broadcast/multicast/physical-match/all, WRAP: frames never split at the ring end. */
+    kRcrConfig = 0x0000000F | (1 << 7),
+    kRxStatusOk = 0x0001,
+    /* Header length field: frame plus 4-byte CRC. */
+    kRxFrameMin = 14 + 4,
+    kRxFrameMax = 1514 + 4,
+
     kRxRingBytes = 8192,
-    kRxRingAlloc = kRxRingBytes + 16 + 1500,
+    /* With WRAP set the NIC writes past the ring end instead of wrapping mid-frame. */
+    kRxRingAlloc = kRxRingBytes + 16 + 2048,
+    /* The NIC has four TX descriptors; frames beyond that wait in software. */
     kTxSlots = 4,
-    kTxBufBytes = 2048,
+    kTxQueueFrames = 16,
+    kTxBufBytes = 1536,
+    kTxMinFrame = 60,
+    kTsdOwn = 1 << 13,
+    kTsdUnderrun = 1 << 14,
+    kTsdTxOk = 1 << 15,
+    kTsdAbort = 1 << 30,
+};
+
+static const pci_device_id kRtlIds[] = {
+    {kRtlVendor, kRtlDevice, PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID},
+    {0, 0, 0, 0, 0},
 };
 
 static bool s_ready = false;
+static bool s_registered = false;
 static uint16_t s_io_base = 0;
 static uint8_t s_rx_ring[kRxRingAlloc] __attribute__((aligned(16)));
-static uint8_t s_tx_buf[kTxSlots][kTxBufBytes] __attribute__((aligned(4)));
-static uint8_t s_tx_next = 0;
+/*
+ * TX buffers form a FIFO of kTxQueueFrames; TSAD points straight at them,
+ * so a frame is never copied after it is built. Free-running counters:
+ * done <= posted <= queued <= done + kTxQueueFrames, and posted - done is
+ * at most kTxSlots. Descriptor n uses slot n % kTxSlots, matching the
+ * NIC's round-robin order.
+ */
+static uint8_t s_tx_buf[kTxQueueFrames][kTxBufBytes] __attribute__((aligned(4)));
+static uint16_t s_tx_len[kTxQueueFrames];
+static uint32_t s_tx_queued = 0;
+static uint32_t s_tx_posted = 0;
+static uint32_t s_tx_done = 0;
+static bool s_tx_building = false;
 static uint16_t s_rx_read = 0;
+static uint16_t s_rx_next = 0;
+static bool s_rx_borrowed = false;
 static uint8_t s_mac[6] = {0, 0, 0, 0, 0, 0};
+static uint8_t s_irq_line = NETDEV_NO_IRQ;
+/*
+ * NAPI-style receive: the IRQ masks RX interrupts and flags the ring for
+ * polling; rtl8139_rx_complete re-arms them once a poll drains it. Without
+ * an IRQ the ring is always treated as pending.
+ */
+static bool s_irq_mode = false;
+static volatile bool s_rx_pending = true;
+static volatile uint16_t s_imr = 0;
+static netdev_stats s_stats;
 
 static inline void outb(uint16_t port, uint8_t value) {
     __asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
@@ -54,6 +107,12 @@ static inline void outl(uint16_t port, uint32_t value) {
     __asm__ volatile("outl %0, %1" : : "a"(value), "Nd"(port));
 }
 
+static inline uint32_t inl(uint16_t port) {
+    uint32_t value;
+    __asm__ volatile("inl %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
 static inline uint8_t inb(uint16_t port) {
     uint8_t value;
     __asm__ volatile("inb %1, %0" : "=a"(value) : "Nd"(port));
@@ -66,68 +125,9 @@ static inline uint16_t inw(uint16_t port) {
     return value;
 }
 
-static inline uint32_t inl(uint16_t port) {
-    uint32_t value;
-    __asm__ volatile("inl %1, %0" : "=a"(value) : "Nd"(port));
-    return value;
-}
-
-static uint32_t pci_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
-    const uint32_t addr = 0x80000000U |
-                          ((uint32_t)bus << 16U) |
-                          ((uint32_t)slot << 11U) |
-                          ((uint32_t)func << 8U) |
-                          (uint32_t)(offset & 0xFCU);
-    outl(kPciCfgAddr, addr);
-    return inl(kPciCfgData);
-}
-
-static void pci_write32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t value) {
-    const uint32_t addr = 0x80000000U |
-                          ((uint32_t)bus << 16U) |
-                          ((uint32_t)slot << 11U) |
-                          ((uint32_t)func << 8U) |
-                          (uint32_t)(offset & 0xFCU);
-    outl(kPciCfgAddr, addr);
-    outl(kPciCfgData, value);
-}
-
-static uint16_t pci_read16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
-    const uint32_t value = pci_read32(bus, slot, func, offset);
-    return (uint16_t)((value >> ((offset & 2U) * 8U)) & 0xFFFFU);
-}
-
-static void pci_write16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t value) {
-    const uint8_t aligned = (uint8_t)(offset & 0xFCU);
-    uint32_t reg = pci_read32(bus, slot, func, aligned);
-    const uint32_t shift = (uint32_t)(offset & 2U) * 8U;
-    reg &= ~(0xFFFFU << shift);
-    reg |= (uint32_t)value << shift;
-    pci_write32(bus, slot, func, aligned, reg);
-}
-
-static bool rtl_find_pci(uint8_t* out_bus, uint8_t* out_slot, uint8_t* out_func) {
-    for (uint16_t bus = 0; bus < 256U; ++bus) {
-        for (uint8_t slot = 0; slot < 32U; ++slot) {
-            for (uint8_t func = 0; func < 8U; ++func) {
-                const uint16_t vendor = pci_read16((uint8_t)bus, slot, func, 0x00);
-                if (vendor == 0xFFFFU) {
-                    if (func == 0U) {
-                        break;
-                    }
-                    continue;
-                }
-                const uint16_t device = pci_read16((uint8_t)bus, slot, func, 0x02);
-                if (vendor == kRtlVendor && device == kRtlDevice) {
-                    *out_bus = (uint8_t)bus;
-                    *out_slot = slot;
-                    *out_func = func;
-                    return true;
-                }
-            }
-        }
-    }
-    return false;
+static void set_imr(uint16_t imr) {
+    s_imr = imr;
+    outw((uint16_t)(s_io_base + kRegImr), imr);
 }
 
 static void rtl_reset(void) {
@@ -139,50 +139,61 @@ static void rtl_reset(void) {
     }
 }
 
-static uint16_t read_ring16(uint16_t offset) {
-    const uint16_t a = (uint16_t)(offset % kRxRingBytes);
-    const uint16_t b = (uint16_t)((offset + 1U) % kRxRingBytes);
-    return (uint16_t)s_rx_ring[a] | ((uint16_t)s_rx_ring[b] << 8U);
+static uint16_t ring_le16(uint16_t offset) {
+    return (uint16_t)s_rx_ring[offset] | ((uint16_t)s_rx_ring[offset + 1U] << 8U);
 }
 
-static uint8_t read_ring8(uint16_t offset) {
-    return s_rx_ring[offset % kRxRingBytes];
+/* Bad header or status: stop RX, rewind the ring to 0 and start again. */
+static void rx_restart(void) {
+    outb((uint16_t)(s_io_base + kRegCr), kCrTe);
+    s_rx_read = 0;
+    outl((uint16_t)(s_io_base + kRegRbstart), (uint32_t)(uintptr_t)s_rx_ring);
+    outb((uint16_t)(s_io_base + kRegCr), (uint8_t)(kCrRe | kCrTe));
+    outl((uint16_t)(s_io_base + kRegRcr), kRcrConfig);
+    outw((uint16_t)(s_io_base + kRegCapr), (uint16_t)(s_rx_read - 16U));
+    ++s_stats.rx_errors;
 }
 
+static void rtl_register_netdev(void);
+
 void rtl8139_init(void) {
     s_ready = false;
     s_io_base = 0;
-    s_tx_next = 0;
+    s_tx_queued = 0;
+    s_tx_posted = 0;
+    s_tx_done = 0;
+    s_tx_building = false;
     s_rx_read = 0;
+    s_rx_borrowed = false;
+    s_irq_line = NETDEV_NO_IRQ;
+    s_irq_mode = false;
+    s_rx_pending = true;
 
-    uint8_t bus = 0;
-    uint8_t slot = 0;
-    uint8_t func = 0;
-    if (!rtl_find_pci(&bus, &slot, &func)) {
+    const pci_device* pci = pci_find(kRtlIds);
+    if (pci == NULL) {
         return;
     }
+    pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
 
-    uint16_t cmd = pci_read16(bus, slot, func, 0x04);
-    cmd |= 0x0005U;
-    pci_write16(bus, slot, func, 0x04, cmd);
-
-    const uint32_t bar0 = pci_read32(bus, slot, func, 0x10);
-    if ((bar0 & 0x1U) == 0U) {
+    if (!pci_bar_is_io(pci, 0)) {
         return;
     }
-    s_io_base = (uint16_t)(bar0 & 0xFFFCU);
+    s_io_base = (uint16_t)pci_bar_address(pci, 0);
     if (s_io_base == 0U) {
         return;
     }
+    if (pci->irq_line < 16U) {
+        s_irq_line = pci->irq_line;
+    }
 
     outb((uint16_t)(s_io_base + kRegConfig1), 0x00);
     rtl_reset();
 
     outl((uint16_t)(s_io_base + kRegRbstart), (uint32_t)(uintptr_t)s_rx_ring);
-    outw((uint16_t)(s_io_base + kRegImr), 0x0005U);
+    set_imr(0);
     outw((uint16_t)(s_io_base + kRegIsr), 0xFFFFU);
 
-    outl((uint16_t)(s_io_base + kRegRcr), 0x0000000FU | (1U << 7));
+    outl((uint16_t)(s_io_base + kRegRcr), kRcrConfig);
     outl((uint16_t)(s_io_base + kRegTcr), 0x03000600U);
     outb((uint16_t)(s_io_base + kRegCr), (uint8_t)(kCrRe | kCrTe));
 
@@ -191,6 +202,7 @@ void rtl8139_init(void) {
     }
 
     s_ready = true;
+    rtl_register_netdev();
 }
 
 bool rtl8139_ready(void) {
@@ -207,65 +219,219 @@ bool rtl8139_get_mac(uint8_t out_mac[6]) {
     return true;
 }
 
-bool rtl8139_send(const void* packet, size_t len) {
-    if (!s_ready || packet == NULL || len == 0 || len > 1514U) {
-        return false;
+/* Retires finished descriptors in order, then posts queued frames to free slots. Interrupts off. */
+static void tx_service(void) {
+    while (s_tx_done != s_tx_posted) {
+        const uint16_t slot = (uint16_t)(s_tx_done % kTxSlots);
+        const uint32_t tsd = inl((uint16_t)(s_io_base + kRegTsd0 + slot * 4U));
+        if ((tsd & (kTsdTxOk | kTsdAbort | kTsdUnderrun)) == 0U) {
+            break;
+        }
+        if ((tsd & kTsdTxOk) != 0U) {
+            ++s_stats.tx_frames;
+        } else {
+            ++s_stats.tx_errors;
+        }
+        ++s_tx_done;
     }
 
-    const uint8_t slot = s_tx_next;
-    s_tx_next = (uint8_t)((s_tx_next + 1U) % kTxSlots);
+    while (s_tx_posted != s_tx_queued && s_tx_posted - s_tx_done < kTxSlots) {
+        const uint32_t index = s_tx_posted % kTxQueueFrames;
+        const uint16_t slot = (uint16_t)(s_tx_posted % kTxSlots);
+        outl((uint16_t)(s_io_base + kRegTsad0 + slot * 4U), (uint32_t)(uintptr_t)s_tx_buf[index]);
+        /* Writing the size clears OWN and starts the DMA. */
+        outl((uint16_t)(s_io_base + kRegTsd0 + slot * 4U), (uint32_t)s_tx_len[index]);
+        ++s_tx_posted;
+    }
+}
 
-    const uint8_t* src = (const uint8_t*)packet;
-    for (size_t i = 0; i < len; ++i) {
-        s_tx_buf[slot][i] = src[i];
+static void rtl_enable_irq(void* ctx) {
+    (void)ctx;
+    if (!s_ready || s_irq_line == NETDEV_NO_IRQ) {
+        return;
     }
+    const uint32_t flags = cpu_irq_save();
+    s_irq_mode = true;
+    s_rx_pending = true;
+    outw((uint16_t)(s_io_base + kRegIsr), 0xFFFFU);
+    /* RX stays masked: the first poll drains the ring and re-arms it. */
+    set_imr(kIsrTxOk | kIsrTxErr);
+    cpu_irq_restore(flags);
+}
 
-    outl((uint16_t)(s_io_base + kRegTsad0 + slot * 4U), (uint32_t)(uintptr_t)s_tx_buf[slot]);
-    outl((uint16_t)(s_io_base + kRegTsd0 + slot * 4U), (uint32_t)len);
-    return true;
+static void rtl_handle_irq(void* ctx) {
+    (void)ctx;
+    if (!s_ready) {
+        return;
+    }
+    const uint16_t isr = inw((uint16_t)(s_io_base + kRegIsr));
+    if (isr == 0U) {
+        return;
+    }
+    outw((uint16_t)(s_io_base + kRegIsr), isr);
+    ++s_stats.irqs;
+
+    if ((isr & kIsrRxMask) != 0U) {
+        set_imr((uint16_t)(s_imr & ~kIsrRxMask));
+        s_rx_pending = true;
+    }
+    if ((isr & (kIsrTxOk | kIsrTxErr)) != 0U) {
+        tx_service();
+    }
+}
+
+static bool rtl_rx_pending(void* ctx) {
+    (void)ctx;
+    return s_ready && s_rx_pending;
 }
 
-bool rtl8139_receive(void* out_packet, size_t out_cap, size_t* out_len) {
-    if (out_len != NULL) {
-        *out_len = 0;
+static void rtl_rx_complete(void* ctx) {
+    (void)ctx;
+    if (!s_ready || !s_irq_mode) {
+        return;
     }
-    if (!s_ready || out_packet == NULL || out_cap == 0U) {
-        return false;
+    const uint32_t flags = cpu_irq_save();
+    s_rx_pending = false;
+    set_imr((uint16_t)(s_imr | kIsrRxMask));
+    /* A frame that landed after the last poll but before the unmask may not raise an IRQ. */
+    if ((inb((uint16_t)(s_io_base + kRegCr)) & kCrBufEmpty) == 0U) {
+        set_imr((uint16_t)(s_imr & ~kIsrRxMask));
+        s_rx_pending = true;
+    } else {
+        ++s_stats.rx_rearms;
     }
+    cpu_irq_restore(flags);
+}
 
-    const uint8_t cr = inb((uint16_t)(s_io_base + kRegCr));
-    if ((cr & kCrBufEmpty) != 0U) {
-        return false;
+static void rtl_get_stats(void* ctx, netdev_stats* out) {
+    (void)ctx;
+    if (out == NULL) {
+        return;
+    }
+    const uint32_t flags = cpu_irq_save();
+    *out = s_stats;
+    cpu_irq_restore(flags);
+}
+
+static uint8_t* rtl_tx_begin(void* ctx) {
+    (void)ctx;
+    if (!s_ready || s_tx_building) {
+        return NULL;
     }
 
-    const uint16_t status = read_ring16(s_rx_read);
-    const uint16_t frame_len_raw = read_ring16((uint16_t)(s_rx_read + 2U));
-    if ((status & 0x1U) == 0U || frame_len_raw < 4U || frame_len_raw > 1792U) {
-        rtl_reset();
+    const uint32_t flags = cpu_irq_save();
+    if (s_tx_queued - s_tx_done == kTxQueueFrames) {
+        tx_service();
+    }
+    uint8_t* buf = NULL;
+    if (s_tx_queued - s_tx_done < kTxQueueFrames) {
+        buf = s_tx_buf[s_tx_queued % kTxQueueFrames];
+        s_tx_building = true;
+    } else {
+        ++s_stats.tx_drops;
+    }
+    cpu_irq_restore(flags);
+    return buf;
+}
+
+static bool rtl_tx_commit(void* ctx, size_t len) {
+    (void)ctx;
+    if (!s_tx_building) {
+        return false;
+    }
+    s_tx_building = false;
+    if (len == 0U || len > NETDEV_MAX_FRAME) {
         return false;
     }
 
-    size_t frame_len = (size_t)frame_len_raw - 4U;
-    if (frame_len > out_cap) {
-        frame_len = out_cap;
+    uint8_t* buf = s_tx_buf[s_tx_queued % kTxQueueFrames];
+    for (size_t i = len; i < kTxMinFrame; ++i) {
+        buf[i] = 0;
+    }
+    const uint32_t flags = cpu_irq_save();
+    s_tx_len[s_tx_queued % kTxQueueFrames] = (uint16_t)((len < kTxMinFrame) ? kTxMinFrame : len);
+    ++s_tx_queued;
+    tx_service();
+    cpu_irq_restore(flags);
+    return true;
+}
+
+static void rtl_poll(void* ctx) {
+    (void)ctx;
+    if (!s_ready || s_irq_mode || s_tx_done == s_tx_queued) {
+        return;
+    }
+    const uint32_t flags = cpu_irq_save();
+    tx_service();
+    cpu_irq_restore(flags);
+}
+
+static bool rtl_rx_peek(void* ctx, const uint8_t** out_frame, size_t* out_len) {
+    (void)ctx;
+    if (!s_ready || s_rx_borrowed || out_frame == NULL || out_len == NULL) {
+        return false;
+    }
+    if ((inb((uint16_t)(s_io_base + kRegCr)) & kCrBufEmpty) != 0U) {
+        return false;
     }
 
-    uint8_t* dst = (uint8_t*)out_packet;
-    const uint16_t payload = (uint16_t)(s_rx_read + 4U);
-    for (size_t i = 0; i < frame_len; ++i) {
-        dst[i] = read_ring8((uint16_t)(payload + (uint16_t)i));
+    const uint16_t status = ring_le16(s_rx_read);
+    const uint16_t frame_len_raw = ring_le16((uint16_t)(s_rx_read + 2U));
+    if ((status & kRxStatusOk) == 0U || frame_len_raw < kRxFrameMin || frame_len_raw > kRxFrameMax) {
+        rx_restart();
+        return false;
     }
 
-    uint16_t next = (uint16_t)(s_rx_read + frame_len_raw + 4U);
-    next = (uint16_t)((next + 3U) & ~3U);
-    next %= kRxRingBytes;
-    s_rx_read = next;
+    *out_frame = &s_rx_ring[s_rx_read + 4U];
+    *out_len = (size_t)frame_len_raw - 4U;
+    s_rx_next = (uint16_t)(((uint32_t)s_rx_read + frame_len_raw + 4U + 3U) & ~3U);
+    s_rx_next = (uint16_t)(s_rx_next % kRxRingBytes);
+    s_rx_borrowed = true;
+    return true;
+}
 
+static void rtl_rx_release(void* ctx) {
+    (void)ctx;
+    if (!s_rx_borrowed) {
+        return;
+    }
+    s_rx_borrowed = false;
+    s_rx_read = s_rx_next;
     outw((uint16_t)(s_io_base + kRegCapr), (uint16_t)(s_rx_read - 16U));
-    outw((uint16_t)(s_io_base + kRegIsr), 0xFFFFU);
+    if (!s_irq_mode) {
+        outw((uint16_t)(s_io_base + kRegIsr), 0xFFFFU);
+    }
+    ++s_stats.rx_frames;
+}
 
-    if (out_len != NULL) {
-        *out_len = frame_len;
+static void rtl_register_netdev(void) {
+    if (s_registered) {
+        return;
     }
-    return true;
+
+    netdev dev;
+    const char name[] = "rtl0";
+    for (size_t i = 0; i < sizeof(name); ++i) {
+        dev.name[i] = name[i];
+    }
+    for (int i = 0; i < 6; ++i) {
+        dev.mac[i] = s_mac[i];
+    }
+    dev.speed_mbps = 100;
+    dev.irq = s_irq_line;
+    dev.rx_peek = rtl_rx_peek;
+    dev.rx_release = rtl_rx_release;
+    dev.rx_pending = rtl_rx_pending;
+    dev.rx_complete = rtl_rx_complete;
+    dev.tx_begin = rtl_tx_begin;
+    dev.tx_commit = rtl_tx_commit;
+    dev.poll = rtl_poll;
+    dev.enable_irq = rtl_enable_irq;
+    dev.handle_irq = rtl_handle_irq;
+    dev.get_stats = rtl_get_stats;
+    /* The receive ring and TX FIFO are fixed buffers; netdev falls back to copying. */
+    dev.rx_take = NULL;
+    dev.tx_pktbuf = NULL;
+    dev.ctx = NULL;
+    s_registered = netdev_register(&dev) >= 0;
 }
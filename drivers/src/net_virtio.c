@@ -0,0 +1,579 @@
+#include "drivers/net_virtio.h"
+
+#include "drivers/cpu_irq.h"
+#include "drivers/netdev.h"
+#include "drivers/pci.h"
+#include "drivers/pktbuf.h"
+#include "drivers/virtio.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    kVirtioNetDevice = 0x1000,
+
+    kFeatureCsum = 1 << 0,
+    kFeatureGuestCsum = 1 << 1,
+    kFeatureMac = 1 << 5,
+    kFeatureMergeRxBuf = 1 << 15,
+
+    kHdrNeedsCsum = 0x1,
+
+    kQueueRx = 0,
+    kQueueTx = 1,
+    /* Room for a 1024-entry legacy ring, the largest QEMU offers. */
+    kQueueMemBytes = 32768,
+
+    kRxBuffers = 128,
+    kRxBufBytes = PKTBUF_DATA_BYTES,
+    kTxSlots = 64,
+    kTxBufBytes = 1536,
+    /* Refilled buffers are published to the device this many at a time. */
+    kRxRefillBatch = 8,
+    kNoSlot = 0xFFFF,
+
+    /* No link speed is reported; a paravirtual NIC should win over emulated ones. */
+    kParavirtSpeedMbps = 10000,
+};
+
+/* Legacy header; num_buffers is only present when mergeable RX buffers are negotiated. */
+typedef struct virtio_net_hdr {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+    uint16_t num_buffers;
+} virtio_net_hdr;
+
+static const pci_device_id kVirtioNetIds[] = {
+    {VIRTIO_PCI_VENDOR, kVirtioNetDevice, PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID},
+    {0, 0, 0, 0, 0},
+};
+
+static bool s_ready = false;
+static bool s_registered = false;
+static uint16_t s_io_base = 0;
+static uint8_t s_mac[6];
+static uint8_t s_irq_line = NETDEV_NO_IRQ;
+static bool s_irq_mode = false;
+static volatile bool s_rx_pending = true;
+static bool s_mergeable = false;
+static uint32_t s_hdr_bytes = 10;
+static netdev_stats s_stats;
+
+static virtq s_rx_queue;
+static virtq s_tx_queue;
+static uint8_t s_rx_queue_mem[kQueueMemBytes] __attribute__((aligned(VIRTQ_ALIGN)));
+static uint8_t s_tx_queue_mem[kQueueMemBytes] __attribute__((aligned(VIRTQ_ALIGN)));
+
+/*
+ * With mergeable buffers each RX slot is one descriptor holding header and
+ * frame; otherwise slot i is the chain 2i (header) -> 2i+1 (frame). Frames
+ * land in pool buffers so rx_take can hand them up the stack.
+ */
+static pktbuf* s_rx_pb[kRxBuffers];
+static virtio_net_hdr s_rx_hdr[kRxBuffers];
+static uint32_t s_rx_slots = 0;
+static uint32_t s_rx_unposted = 0;
+static uint32_t s_rx_current = kNoSlot;
+static size_t s_rx_current_len = 0;
+static bool s_rx_borrowed = false;
+/* Frames the device spread over several buffers are gathered here. */
+static uint8_t s_rx_merge[NETDEV_MAX_FRAME] __attribute__((aligned(16)));
+
+/* TX slot i is the chain 2i (header) -> 2i+1 (frame). */
+static virtio_net_hdr s_tx_hdr[kTxSlots];
+static uint8_t s_tx_buf[kTxSlots][kTxBufBytes] __attribute__((aligned(16)));
+static bool s_tx_busy[kTxSlots];
+/* Set while a slot transmits from a pktbuf rather than its own s_tx_buf. */
+static pktbuf* s_tx_pb[kTxSlots];
+static uint32_t s_tx_slots = 0;
+static uint32_t s_tx_next = 0;
+static bool s_tx_building = false;
+
+static void set_desc(virtq* q, uint16_t index, const void* addr, uint32_t len, uint16_t flags) {
+    volatile virtq_desc* d = &q->desc[index];
+    d->addr = (uint32_t)(uintptr_t)addr;
+    d->len = len;
+    d->flags = flags;
+    d->next = (uint16_t)(index + 1U);
+}
+
+static void rx_post(uint32_t slot) {
+    if (s_mergeable) {
+        set_desc(&s_rx_queue, (uint16_t)slot, s_rx_pb[slot]->data, kRxBufBytes, VIRTQ_DESC_F_WRITE);
+        virtq_submit(&s_rx_queue, (uint16_t)slot);
+    } else {
+        const uint16_t head = (uint16_t)(slot * 2U);
+        set_desc(&s_rx_queue, head, &s_rx_hdr[slot], s_hdr_bytes, VIRTQ_DESC_F_WRITE | VIRTQ_DESC_F_NEXT);
+        set_desc(&s_rx_queue, (uint16_t)(head + 1U), s_rx_pb[slot]->data, kRxBufBytes, VIRTQ_DESC_F_WRITE);
+        virtq_submit(&s_rx_queue, head);
+    }
+    ++s_rx_unposted;
+}
+
+static void rx_flush(void) {
+    if (s_rx_unposted == 0U) {
+        return;
+    }
+    virtq_kick(&s_rx_queue);
+    s_rx_unposted = 0;
+}
+
+static uint32_t rx_slot(uint32_t id) {
+    const uint32_t slot = s_mergeable ? id : id / 2U;
+    return (slot < s_rx_slots) ? slot : kNoSlot;
+}
+
+/* Copies the rest of a multi-buffer frame after `len` bytes already in s_rx_merge. */
+static bool rx_gather(uint32_t len, uint32_t buffers, size_t* out_len) {
+    bool fits = true;
+    for (uint32_t i = 1; i < buffers; ++i) {
+        uint32_t id = 0;
+        uint32_t part = 0;
+        if (!virtq_pop_used(&s_rx_queue, &id, &part)) {
+            return false;
+        }
+        const uint32_t slot = rx_slot(id);
+        if (slot == kNoSlot) {
+            return false;
+        }
+        if (part > kRxBufBytes || len + part > NETDEV_MAX_FRAME) {
+            fits = false;
+        } else {
+            for (uint32_t j = 0; j < part; ++j) {
+                s_rx_merge[len + j] = s_rx_pb[slot]->data[j];
+            }
+            len += part;
+        }
+        rx_post(slot);
+    }
+    *out_len = len;
+    return fits;
+}
+
+/* Finishes a checksum the host left partial (VIRTIO_NET_F_GUEST_CSUM), so the stack can verify it. */
+static bool rx_complete_csum(uint8_t* frame, size_t len, uint32_t start, uint32_t offset) {
+    if (start >= len || offset + 2U > len - start) {
+        return false;
+    }
+    uint32_t sum = 0;
+    size_t i = start;
+    for (; i + 1U < len; i += 2U) {
+        sum += ((uint32_t)frame[i] << 8U) | frame[i + 1U];
+    }
+    if (i < len) {
+        sum += (uint32_t)frame[i] << 8U;
+    }
+    while ((sum >> 16U) != 0U) {
+        sum = (sum & 0xFFFFU) + (sum >> 16U);
+    }
+    uint16_t csum = (uint16_t)~sum;
+    if (csum == 0U) {
+        csum = 0xFFFFU;
+    }
+    frame[start + offset] = (uint8_t)(csum >> 8U);
+    frame[start + offset + 1U] = (uint8_t)csum;
+    return true;
+}
+
+static bool virtio_net_rx_peek(void* ctx, const uint8_t** out_frame, size_t* out_len) {
+    (void)ctx;
+    if (!s_ready || s_rx_borrowed || out_frame == NULL || out_len == NULL) {
+        return false;
+    }
+
+    for (;;) {
+        uint32_t id = 0;
+        uint32_t used = 0;
+        if (!virtq_pop_used(&s_rx_queue, &id, &used)) {
+            rx_flush();
+            return false;
+        }
+        uint32_t slot = rx_slot(id);
+        if (slot == kNoSlot) {
+            ++s_stats.rx_errors;
+            continue;
+        }
+
+        /* Copy the header out: a merged frame hands its buffers back before it is lent. */
+        const virtio_net_hdr hdr = s_mergeable ? *(const virtio_net_hdr*)(void*)s_rx_pb[slot]->data : s_rx_hdr[slot];
+        uint8_t* frame = s_rx_pb[slot]->data + (s_mergeable ? s_hdr_bytes : 0U);
+        size_t len = (used > s_hdr_bytes) ? used - s_hdr_bytes : 0U;
+        const uint32_t buffers = s_mergeable ? hdr.num_buffers : 1U;
+
+        if (buffers > 1U) {
+            const bool fits = len <= NETDEV_MAX_FRAME;
+            for (size_t i = 0; fits && i < len; ++i) {
+                s_rx_merge[i] = frame[i];
+            }
+            rx_post(slot);
+            if (!rx_gather(fits ? (uint32_t)len : NETDEV_MAX_FRAME + 1U, buffers, &len)) {
+                ++s_stats.rx_errors;
+                continue;
+            }
+            frame = s_rx_merge;
+            slot = kNoSlot;
+        }
+
+        if (len < 14U || used > kRxBufBytes + (s_mergeable ? 0U : s_hdr_bytes) ||
+            ((hdr.flags & kHdrNeedsCsum) != 0U && !rx_complete_csum(frame, len, hdr.csum_start, hdr.csum_offset))) {
+            ++s_stats.rx_errors;
+            if (slot != kNoSlot) {
+                rx_post(slot);
+            }
+            continue;
+        }
+
+        *out_frame = frame;
+        *out_len = len;
+        s_rx_current = slot;
+        s_rx_current_len = len;
+        s_rx_borrowed = true;
+        return true;
+    }
+}
+
+static void virtio_net_rx_release(void* ctx) {
+    (void)ctx;
+    if (!s_rx_borrowed) {
+        return;
+    }
+    s_rx_borrowed = false;
+    if (s_rx_current != kNoSlot) {
+        rx_post(s_rx_current);
+    }
+    ++s_stats.rx_frames;
+    if (s_rx_unposted >= kRxRefillBatch) {
+        rx_flush();
+    }
+}
+
+/* Swaps a fresh pool buffer into the slot and hands the filled one up; merged frames stay lent. */
+static pktbuf* virtio_net_rx_take(void* ctx) {
+    (void)ctx;
+    if (!s_rx_borrowed || s_rx_current == kNoSlot) {
+        return NULL;
+    }
+    pktbuf* fresh = pktbuf_alloc();
+    if (fresh == NULL) {
+        return NULL;
+    }
+
+    pktbuf* pb = s_rx_pb[s_rx_current];
+    if (s_mergeable) {
+        pb->len = (uint16_t)(s_hdr_bytes + s_rx_current_len);
+        (void)pktbuf_pull(pb, s_hdr_bytes);
+    } else {
+        pb->len = (uint16_t)s_rx_current_len;
+    }
+    s_rx_pb[s_rx_current] = fresh;
+    s_rx_borrowed = false;
+    rx_post(s_rx_current);
+    ++s_stats.rx_frames;
+    if (s_rx_unposted >= kRxRefillBatch) {
+        rx_flush();
+    }
+    return pb;
+}
+
+static bool virtio_net_rx_pending(void* ctx) {
+    (void)ctx;
+    return s_ready && s_rx_pending;
+}
+
+static void virtio_net_rx_complete(void* ctx) {
+    (void)ctx;
+    if (!s_ready || !s_irq_mode) {
+        return;
+    }
+    const uint32_t flags = cpu_irq_save();
+    s_rx_pending = false;
+    rx_flush();
+    if (virtq_enable_interrupts(&s_rx_queue)) {
+        ++s_stats.rx_rearms;
+    } else {
+        virtq_disable_interrupts(&s_rx_queue);
+        s_rx_pending = true;
+    }
+    cpu_irq_restore(flags);
+}
+
+/* TX completions never interrupt; they are reaped when a slot is needed and on poll. Interrupts off. */
+static void tx_reap(void) {
+    uint32_t id = 0;
+    while (virtq_pop_used(&s_tx_queue, &id, NULL)) {
+        const uint32_t slot = id / 2U;
+        if (slot < s_tx_slots && s_tx_busy[slot]) {
+            s_tx_busy[slot] = false;
+            if (s_tx_pb[slot] != NULL) {
+                pktbuf_put(s_tx_pb[slot]);
+                s_tx_pb[slot] = NULL;
+            }
+            ++s_stats.tx_frames;
+        }
+    }
+}
+
+static uint8_t* virtio_net_tx_begin(void* ctx) {
+    (void)ctx;
+    if (!s_ready || s_tx_building) {
+        return NULL;
+    }
+
+    const uint32_t flags = cpu_irq_save();
+    if (s_tx_busy[s_tx_next]) {
+        tx_reap();
+    }
+    uint8_t* buf = NULL;
+    if (!s_tx_busy[s_tx_next]) {
+        buf = s_tx_buf[s_tx_next];
+        s_tx_building = true;
+    } else {
+        ++s_stats.tx_drops;
+    }
+    cpu_irq_restore(flags);
+    return buf;
+}
+
+/* Queues the header/frame chain of the next slot; the caller has checked it is free. Interrupts off. */
+static void tx_post(const uint8_t* frame, size_t len) {
+    const uint32_t slot = s_tx_next;
+    const uint16_t head = (uint16_t)(slot * 2U);
+    virtio_net_hdr* hdr = &s_tx_hdr[slot];
+    hdr->flags = 0;
+    hdr->gso_type = 0;
+    hdr->hdr_len = 0;
+    hdr->gso_size = 0;
+    hdr->csum_start = 0;
+    hdr->csum_offset = 0;
+    hdr->num_buffers = 0;
+    set_desc(&s_tx_queue, head, hdr, s_hdr_bytes, VIRTQ_DESC_F_NEXT);
+    set_desc(&s_tx_queue, (uint16_t)(head + 1U), frame, (uint32_t)len, 0);
+    s_tx_busy[slot] = true;
+    s_tx_next = (slot + 1U) % s_tx_slots;
+    virtq_submit(&s_tx_queue, head);
+    /* With event indices this only exits to the host when the device has gone idle. */
+    virtq_kick(&s_tx_queue);
+}
+
+static bool virtio_net_tx_commit(void* ctx, size_t len) {
+    (void)ctx;
+    if (!s_tx_building) {
+        return false;
+    }
+    s_tx_building = false;
+    if (len == 0U || len > NETDEV_MAX_FRAME) {
+        return false;
+    }
+
+    const uint32_t flags = cpu_irq_save();
+    tx_post(s_tx_buf[s_tx_next], len);
+    cpu_irq_restore(flags);
+    return true;
+}
+
+/* Transmits straight from pb; the reference is dropped when the slot is reaped. */
+static bool virtio_net_tx_pktbuf(void* ctx, pktbuf* pb) {
+    (void)ctx;
+    if (!s_ready || s_tx_building || pb->len == 0U || pb->len > NETDEV_MAX_FRAME) {
+        pktbuf_put(pb);
+        return false;
+    }
+
+    const uint32_t flags = cpu_irq_save();
+    if (s_tx_busy[s_tx_next]) {
+        tx_reap();
+    }
+    const bool room = !s_tx_busy[s_tx_next];
+    if (room) {
+        s_tx_pb[s_tx_next] = pb;
+        tx_post(pb->data, pb->len);
+    } else {
+        ++s_stats.tx_drops;
+    }
+    cpu_irq_restore(flags);
+
+    if (!room) {
+        pktbuf_put(pb);
+    }
+    return room;
+}
+
+static void virtio_net_poll(void* ctx) {
+    (void)ctx;
+    if (!s_ready || !virtq_has_used(&s_tx_queue)) {
+        return;
+    }
+    const uint32_t flags = cpu_irq_save();
+    tx_reap();
+    cpu_irq_restore(flags);
+}
+
+static void virtio_net_enable_irq(void* ctx) {
+    (void)ctx;
+    if (!s_ready || s_irq_line == NETDEV_NO_IRQ) {
+        return;
+    }
+    const uint32_t flags = cpu_irq_save();
+    s_irq_mode = true;
+    s_rx_pending = true;
+    (void)virtio_legacy_isr(s_io_base);
+    /* RX stays suppressed: the first poll drains the ring and re-arms it. */
+    cpu_irq_restore(flags);
+}
+
+static void virtio_net_handle_irq(void* ctx) {
+    (void)ctx;
+    if (!s_ready) {
+        return;
+    }
+    const uint8_t isr = virtio_legacy_isr(s_io_base);
+    if (isr == 0U) {
+        return;
+    }
+    ++s_stats.irqs;
+    if ((isr & VIRTIO_ISR_QUEUE) != 0U) {
+        virtq_disable_interrupts(&s_rx_queue);
+        s_rx_pending = true;
+    }
+}
+
+static void virtio_net_get_stats(void* ctx, netdev_stats* out) {
+    (void)ctx;
+    if (out == NULL) {
+        return;
+    }
+    const uint32_t flags = cpu_irq_save();
+    *out = s_stats;
+    cpu_irq_restore(flags);
+}
+
+static void virtio_net_register_netdev(void);
+
+void virtio_net_init(void) {
+    s_ready = false;
+    s_io_base = 0;
+    s_irq_line = NETDEV_NO_IRQ;
+    s_irq_mode = false;
+    s_rx_pending = true;
+
+    const pci_device* pci = pci_find(kVirtioNetIds);
+    if (pci == NULL || !pci_bar_is_io(pci, 0) || pci_bar_address(pci, 0) == 0U) {
+        return;
+    }
+    pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+    s_io_base = (uint16_t)pci_bar_address(pci, 0);
+    if (pci->irq_line < 16U) {
+        s_irq_line = pci->irq_line;
+    }
+
+    /*
+     * Checksum offload is negotiated both ways: the host may hand over frames
+     * with a partial checksum, which rx_complete_csum finishes. Transmit
+     * headers still ask for nothing because the stack fills its checksums.
+     */
+    const uint32_t wanted = kFeatureCsum | kFeatureGuestCsum | kFeatureMac | kFeatureMergeRxBuf | VIRTIO_F_RING_EVENT_IDX;
+    uint32_t features = 0;
+    if (!virtio_legacy_begin(s_io_base, wanted, &features)) {
+        return;
+    }
+    /* No MAC means no stable address to answer ARP with. */
+    if ((features & kFeatureMac) == 0U) {
+        virtio_legacy_fail(s_io_base);
+        return;
+    }
+    s_mergeable = (features & kFeatureMergeRxBuf) != 0U;
+    s_hdr_bytes = s_mergeable ? 12U : 10U;
+
+    if (!virtq_init(&s_rx_queue, s_io_base, kQueueRx, s_rx_queue_mem, sizeof(s_rx_queue_mem)) ||
+        !virtq_init(&s_tx_queue, s_io_base, kQueueTx, s_tx_queue_mem, sizeof(s_tx_queue_mem))) {
+        virtio_legacy_fail(s_io_base);
+        return;
+    }
+    s_rx_queue.event_idx = (features & VIRTIO_F_RING_EVENT_IDX) != 0U;
+    s_tx_queue.event_idx = s_rx_queue.event_idx;
+    virtq_disable_interrupts(&s_rx_queue);
+    virtq_disable_interrupts(&s_tx_queue);
+
+    s_rx_slots = s_mergeable ? s_rx_queue.size : s_rx_queue.size / 2U;
+    if (s_rx_slots > kRxBuffers) {
+        s_rx_slots = kRxBuffers;
+    }
+    s_tx_slots = s_tx_queue.size / 2U;
+    if (s_tx_slots > kTxSlots) {
+        s_tx_slots = kTxSlots;
+    }
+    if (s_rx_slots == 0U || s_tx_slots == 0U) {
+        virtio_legacy_fail(s_io_base);
+        return;
+    }
+
+    for (uint32_t i = 0; i < 6U; ++i) {
+        s_mac[i] = virtio_legacy_config8(s_io_base, i);
+    }
+    virtio_legacy_driver_ok(s_io_base);
+
+    s_rx_unposted = 0;
+    s_rx_borrowed = false;
+    for (uint32_t slot = 0; slot < s_rx_slots; ++slot) {
+        if (s_rx_pb[slot] == NULL) {
+            s_rx_pb[slot] = pktbuf_alloc();
+        }
+        if (s_rx_pb[slot] == NULL) {
+            s_rx_slots = slot;
+            break;
+        }
+        rx_post(slot);
+    }
+    rx_flush();
+    for (uint32_t slot = 0; slot < kTxSlots; ++slot) {
+        s_tx_busy[slot] = false;
+        s_tx_pb[slot] = NULL;
+    }
+    s_tx_next = 0;
+    s_tx_building = false;
+
+    s_ready = s_rx_slots > 0U;
+    if (s_ready) {
+        virtio_net_register_netdev();
+    }
+}
+
+bool virtio_net_ready(void) {
+    return s_ready;
+}
+
+static void virtio_net_register_netdev(void) {
+    if (s_registered) {
+        return;
+    }
+
+    netdev dev;
+    const char name[] = "vnet0";
+    for (size_t i = 0; i < sizeof(name); ++i) {
+        dev.name[i] = name[i];
+    }
+    for (int i = 0; i < 6; ++i) {
+        dev.mac[i] = s_mac[i];
+    }
+    dev.speed_mbps = kParavirtSpeedMbps;
+    dev.irq = s_irq_line;
+    dev.rx_peek = virtio_net_rx_peek;
+    dev.rx_release = virtio_net_rx_release;
+    dev.rx_pending = virtio_net_rx_pending;
+    dev.rx_complete = virtio_net_rx_complete;
+    dev.tx_begin = virtio_net_tx_begin;
+    dev.tx_commit = virtio_net_tx_commit;
+    dev.poll = virtio_net_poll;
+    dev.enable_irq = virtio_net_enable_irq;
+    dev.handle_irq = virtio_net_handle_irq;
+    dev.get_stats = virtio_net_get_stats;
+    dev.rx_take = virtio_net_rx_take;
+    dev.tx_pktbuf = virtio_net_tx_pktbuf;
+    dev.ctx = NULL;
+    s_registered = netdev_register(&dev) >= 0;
+}
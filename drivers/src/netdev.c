@@ -0,0 +1,105 @@
+#include "drivers/netdev.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    kNetDevMax = 4,
+};
+
+static netdev s_devices[kNetDevMax];
+static size_t s_device_count = 0;
+
+int netdev_register(const netdev* dev) {
+    if (dev == NULL || dev->rx_peek == NULL || dev->rx_release == NULL || dev->rx_pending == NULL ||
+        dev->rx_complete == NULL || dev->tx_begin == NULL || dev->tx_commit == NULL || dev->poll == NULL ||
+        dev->get_stats == NULL || s_device_count >= kNetDevMax) {
+        return -1;
+    }
+
+    s_devices[s_device_count] = *dev;
+    s_devices[s_device_count].name[NETDEV_NAME_MAX - 1] = '\0';
+    return (int)s_device_count++;
+}
+
+size_t netdev_count(void) {
+    return s_device_count;
+}
+
+const netdev* netdev_at(size_t index) {
+    return (index < s_device_count) ? &s_devices[index] : NULL;
+}
+
+const netdev* netdev_fastest(void) {
+    const netdev* best = NULL;
+    for (size_t i = 0; i < s_device_count; ++i) {
+        if (best == NULL || s_devices[i].speed_mbps > best->speed_mbps) {
+            best = &s_devices[i];
+        }
+    }
+    return best;
+}
+
+bool netdev_send(const netdev* dev, const void* packet, size_t len) {
+    if (dev == NULL || packet == NULL || len == 0U || len > NETDEV_MAX_FRAME) {
+        return false;
+    }
+    uint8_t* buf = dev->tx_begin(dev->ctx);
+    if (buf == NULL) {
+        return false;
+    }
+
+    const uint8_t* src = (const uint8_t*)packet;
+    size_t i = 0;
+    if ((((uintptr_t)src | (uintptr_t)buf) & 3U) == 0U) {
+        for (; i + 4U <= len; i += 4U) {
+            *(uint32_t*)(void*)(buf + i) = *(const uint32_t*)(const void*)(src + i);
+        }
+    }
+    for (; i < len; ++i) {
+        buf[i] = src[i];
+    }
+    return dev->tx_commit(dev->ctx, len);
+}
+
+pktbuf* netdev_rx_claim(const netdev* dev, const uint8_t* frame, size_t len) {
+    if (dev == NULL) {
+        return NULL;
+    }
+    if (dev->rx_take != NULL) {
+        pktbuf* pb = dev->rx_take(dev->ctx);
+        if (pb != NULL) {
+            return pb;
+        }
+    }
+
+    pktbuf* pb = pktbuf_alloc();
+    uint8_t* dst = (pb != NULL && frame != NULL) ? pktbuf_append(pb, len) : NULL;
+    if (dst != NULL) {
+        for (size_t i = 0; i < len; ++i) {
+            dst[i] = frame[i];
+        }
+    } else {
+        pktbuf_put(pb);
+        pb = NULL;
+    }
+    dev->rx_release(dev->ctx);
+    return pb;
+}
+
+bool netdev_send_pktbuf(const netdev* dev, pktbuf* pb) {
+    if (pb == NULL) {
+        return false;
+    }
+    if (dev == NULL) {
+        pktbuf_put(pb);
+        return false;
+    }
+    if (dev->tx_pktbuf != NULL) {
+        return dev->tx_pktbuf(dev->ctx, pb);
+    }
+    const bool sent = netdev_send(dev, pb->data, pb->len);
+    pktbuf_put(pb);
+    return sent;
+}
@@ -0,0 +1,630 @@
+#include "drivers/nvme.h"
+
+#include "drivers/blockdev.h"
+#include "drivers/pci.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    kPciClassStorage = 0x01,
+    kPciSubclassNvm = 0x08,
+    kPciProgIfNvme = 0x02,
+
+    /* Controller registers. */
+    kRegCap = 0x00,
+    kRegCc = 0x14,
+    kRegCsts = 0x1C,
+    kRegAqa = 0x24,
+    kRegAsq = 0x28,
+    kRegAcq = 0x30,
+    kRegDoorbells = 0x1000,
+
+    kCcEnable = 1 << 0,
+    kCcIosqes = 6 << 16,
+    kCcIocqes = 4 << 20,
+    kCstsReady = 1 << 0,
+    kCstsFatal = 1 << 1,
+
+    kAdminCreateIoSq = 0x01,
+    kAdminCreateIoCq = 0x05,
+    kAdminIdentify = 0x06,
+    kIoFlush = 0x00,
+    kIoWrite = 0x01,
+    kIoRead = 0x02,
+
+    kIdentifyNamespace = 0,
+    kIdentifyController = 1,
+    kIdCtrlMdts = 77,
+    kIdNsFlbas = 26,
+    kIdNsLbaFormats = 128,
+
+    kNvmePage = 4096,
+    kNvmeNamespace = 1,
+    kNvmeAdminEntries = 8,
+    kNvmeIoEntries = 32,
+    /* One I/O queue pair per CPU; this kernel only ever runs on the boot CPU. */
+    kNvmeIoQueues = 1,
+    /* 128 KiB per command: at most 33 pages, so one PRP list page always suffices. */
+    kNvmeChunkSectors = 256,
+    kNvmePollBudget = 5000000,
+};
+
+typedef struct nvme_sqe {
+    uint32_t cdw0;
+    uint32_t nsid;
+    uint32_t cdw2;
+    uint32_t cdw3;
+    uint64_t mptr;
+    uint64_t prp1;
+    uint64_t prp2;
+    uint32_t cdw10;
+    uint32_t cdw11;
+    uint32_t cdw12;
+    uint32_t cdw13;
+    uint32_t cdw14;
+    uint32_t cdw15;
+} nvme_sqe;
+
+typedef struct nvme_cqe {
+    uint32_t dw0;
+    uint32_t dw1;
+    uint16_t sq_head;
+    uint16_t sq_id;
+    uint16_t cid;
+    uint16_t status;
+} nvme_cqe;
+
+typedef struct nvme_queue {
+    nvme_sqe* sq;
+    volatile nvme_cqe* cq;
+    uint16_t entries;
+    uint16_t sq_tail;
+    uint16_t cq_head;
+    uint16_t phase;
+    uintptr_t sq_doorbell;
+    uintptr_t cq_doorbell;
+    /* Set when a reap ran out of budget; head/tail/phase no longer match the controller. */
+    bool stalled;
+} nvme_queue;
+
+static const pci_device_id kNvmeIds[] = {
+    {PCI_ANY_ID, PCI_ANY_ID, kPciClassStorage, kPciSubclassNvm, kPciProgIfNvme},
+    {0, 0, 0, 0, 0},
+};
+
+static bool s_ready = false;
+static bool s_registered = false;
+static uintptr_t s_bar = 0;
+static uint32_t s_doorbell_stride = 4;
+static uint64_t s_sector_count = 0;
+static uint32_t s_chunk_sectors = kNvmeChunkSectors;
+
+static nvme_queue s_admin;
+static nvme_queue s_io[kNvmeIoQueues];
+
+/* Commands started by nvme_submit, indexed by command identifier. */
+static blockdev_done_fn s_cmd_done[kNvmeIoEntries];
+static void* s_cmd_token[kNvmeIoEntries];
+static uint32_t s_async_count = 0;
+/* Set while a synchronous caller waits the async commands out; submit refuses new work. */
+static bool s_sync_active = false;
+
+static nvme_sqe s_admin_sq[kNvmeAdminEntries] __attribute__((aligned(4096)));
+static nvme_cqe s_admin_cq[kNvmeAdminEntries] __attribute__((aligned(4096)));
+static nvme_sqe s_io_sq[kNvmeIoQueues][kNvmeIoEntries] __attribute__((aligned(4096)));
+static nvme_cqe s_io_cq[kNvmeIoQueues][kNvmeIoEntries] __attribute__((aligned(4096)));
+static uint64_t s_prp_lists[kNvmeIoEntries][kNvmePage / 8] __attribute__((aligned(4096)));
+static uint8_t s_identify[kNvmePage] __attribute__((aligned(4096)));
+
+static inline uint32_t mmio_read32(uintptr_t addr) {
+    return *(volatile uint32_t*)addr;
+}
+
+static inline void mmio_write32(uintptr_t addr, uint32_t value) {
+    *(volatile uint32_t*)addr = value;
+}
+
+static inline void memory_barrier(void) {
+    __asm__ volatile("" : : : "memory");
+}
+
+static void mmio_write64(uintptr_t addr, uint64_t value) {
+    mmio_write32(addr, (uint32_t)value);
+    mmio_write32(addr + 4U, (uint32_t)(value >> 32U));
+}
+
+static bool wait_ready(bool ready) {
+    for (uint32_t i = 0; i < kNvmePollBudget; ++i) {
+        const uint32_t csts = mmio_read32(s_bar + kRegCsts);
+        if ((csts & kCstsFatal) != 0) {
+            return false;
+        }
+        if (((csts & kCstsReady) != 0) == ready) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void queue_setup(nvme_queue* q, uint16_t qid, nvme_sqe* sq, nvme_cqe* cq, uint16_t entries) {
+    q->sq = sq;
+    q->cq = cq;
+    q->entries = entries;
+    q->sq_tail = 0;
+    q->cq_head = 0;
+    q->phase = 1;
+    q->stalled = false;
+    q->sq_doorbell = s_bar + kRegDoorbells + (uintptr_t)(2U * qid) * s_doorbell_stride;
+    q->cq_doorbell = q->sq_doorbell + s_doorbell_stride;
+
+    uint8_t* raw_sq = (uint8_t*)sq;
+    for (size_t i = 0; i < (size_t)entries * sizeof(nvme_sqe); ++i) {
+        raw_sq[i] = 0;
+    }
+    uint8_t* raw_cq = (uint8_t*)cq;
+    for (size_t i = 0; i < (size_t)entries * sizeof(nvme_cqe); ++i) {
+        raw_cq[i] = 0;
+    }
+}
+
+static void clear_command(nvme_sqe* cmd) {
+    uint8_t* raw = (uint8_t*)cmd;
+    for (size_t i = 0; i < sizeof(*cmd); ++i) {
+        raw[i] = 0;
+    }
+}
+
+/* Queue a command without touching the doorbell; the caller rings once per batch. */
+static void queue_push(nvme_queue* q, const nvme_sqe* cmd) {
+    q->sq[q->sq_tail] = *cmd;
+    q->sq_tail = (uint16_t)((q->sq_tail + 1U) % q->entries);
+}
+
+static void queue_ring(nvme_queue* q) {
+    memory_barrier();
+    mmio_write32(q->sq_doorbell, q->sq_tail);
+}
+
+/* Consume `expected` completions, then release them with a single CQ doorbell write. */
+static bool queue_reap(nvme_queue* q, uint32_t expected) {
+    bool ok = true;
+    uint32_t seen = 0;
+    uint32_t budget = kNvmePollBudget;
+    while (seen < expected && budget > 0) {
+        const uint16_t status = q->cq[q->cq_head].status;
+        if ((status & 1U) != q->phase) {
+            --budget;
+            continue;
+        }
+        if ((status >> 1U) != 0) {
+            ok = false;
+        }
+        ++seen;
+        if (++q->cq_head == q->entries) {
+            q->cq_head = 0;
+            q->phase ^= 1U;
+        }
+    }
+    memory_barrier();
+    if (seen > 0) {
+        mmio_write32(q->cq_doorbell, q->cq_head);
+    }
+    if (seen < expected) {
+        q->stalled = true;
+        return false;
+    }
+    return ok;
+}
+
+static bool admin_command(nvme_sqe* cmd) {
+    cmd->cdw0 |= (uint32_t)s_admin.sq_tail << 16U;
+    queue_push(&s_admin, cmd);
+    queue_ring(&s_admin);
+    return queue_reap(&s_admin, 1);
+}
+
+static bool identify(uint32_t cns, uint32_t nsid) {
+    nvme_sqe cmd;
+    clear_command(&cmd);
+    cmd.cdw0 = kAdminIdentify;
+    cmd.nsid = nsid;
+    cmd.prp1 = (uint32_t)(uintptr_t)s_identify;
+    cmd.cdw10 = cns;
+    return admin_command(&cmd);
+}
+
+static bool create_io_queue(uint16_t qid) {
+    nvme_queue* q = &s_io[qid - 1U];
+    queue_setup(q, qid, s_io_sq[qid - 1U], s_io_cq[qid - 1U], kNvmeIoEntries);
+
+    /* Physically contiguous, interrupts disabled: completions are polled. */
+    nvme_sqe cmd;
+    clear_command(&cmd);
+    cmd.cdw0 = kAdminCreateIoCq;
+    cmd.prp1 = (uint32_t)(uintptr_t)q->cq;
+    cmd.cdw10 = ((uint32_t)(q->entries - 1U) << 16U) | qid;
+    cmd.cdw11 = 1U;
+    if (!admin_command(&cmd)) {
+        return false;
+    }
+
+    clear_command(&cmd);
+    cmd.cdw0 = kAdminCreateIoSq;
+    cmd.prp1 = (uint32_t)(uintptr_t)q->sq;
+    cmd.cdw10 = ((uint32_t)(q->entries - 1U) << 16U) | qid;
+    cmd.cdw11 = ((uint32_t)qid << 16U) | 1U;
+    return admin_command(&cmd);
+}
+
+static bool read_namespace(void) {
+    if (!identify(kIdentifyController, 0)) {
+        return false;
+    }
+    const uint32_t mdts = s_identify[kIdCtrlMdts];
+    const uint32_t cap_hi = mmio_read32(s_bar + kRegCap + 4U);
+    const uint32_t mps_min = (cap_hi >> 16U) & 0x0FU;
+    /* MDTS is a power of two in CAP.MPSMIN pages; 0 means unlimited. */
+    if (mdts != 0) {
+        const uint32_t shift = mdts + mps_min + 3U;
+        if (shift < 8U) {
+            s_chunk_sectors = 1U << shift;
+        }
+    }
+
+    if (!identify(kIdentifyNamespace, kNvmeNamespace)) {
+        return false;
+    }
+    uint64_t nsze = 0;
+    for (int i = 7; i >= 0; --i) {
+        nsze = (nsze << 8U) | s_identify[i];
+    }
+    const uint32_t format = s_identify[kIdNsFlbas] & 0x0FU;
+    const uint32_t lbads = s_identify[kIdNsLbaFormats + format * 4U + 2U];
+    /* The block layer is 512-byte granular; other LBA formats are left alone. */
+    if (lbads != 9U || nsze == 0) {
+        return false;
+    }
+    s_sector_count = nsze;
+    return true;
+}
+
+/* Disabling the controller aborts every outstanding command and clears its queues. */
+static bool controller_enable(void) {
+    mmio_write32(s_bar + kRegCc, mmio_read32(s_bar + kRegCc) & ~(uint32_t)kCcEnable);
+    if (!wait_ready(false)) {
+        return false;
+    }
+
+    queue_setup(&s_admin, 0, s_admin_sq, s_admin_cq, kNvmeAdminEntries);
+    mmio_write32(s_bar + kRegAqa, ((uint32_t)(kNvmeAdminEntries - 1) << 16U) | (kNvmeAdminEntries - 1U));
+    mmio_write64(s_bar + kRegAsq, (uint32_t)(uintptr_t)s_admin_sq);
+    mmio_write64(s_bar + kRegAcq, (uint32_t)(uintptr_t)s_admin_cq);
+    mmio_write32(s_bar + kRegCc, (uint32_t)(kCcIosqes | kCcIocqes | kCcEnable));
+    return wait_ready(true);
+}
+
+static bool create_io_queues(void) {
+    for (uint16_t qid = 1; qid <= kNvmeIoQueues; ++qid) {
+        if (!create_io_queue(qid)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * A command that never completed may still be owned by the controller, so
+ * the queue cannot be reused as is. Reset the controller and rebuild the
+ * queues; if that fails the device stays marked not ready.
+ */
+static void recover_io_queue(nvme_queue* q) {
+    if (!q->stalled) {
+        return;
+    }
+    s_ready = controller_enable() && create_io_queues();
+}
+
+static void build_prps(nvme_sqe* cmd, const uint8_t* buf, uint32_t bytes, uint64_t* list);
+
+/*
+ * Starts one command and returns at once; up to entries-1 may be queued.
+ * Completion interrupts are off, so nvme_service is polled by the block queue.
+ */
+static bool nvme_submit(void* ctx, uint64_t lba, uint32_t count, void* buf, bool write,
+                        blockdev_done_fn done, void* token) {
+    (void)ctx;
+    nvme_queue* q = &s_io[0];
+    if (!s_ready || s_sync_active || done == NULL || buf == NULL || ((uintptr_t)buf & 3U) != 0U ||
+        count == 0 || count > s_chunk_sectors || s_async_count >= (uint32_t)(q->entries - 1U)) {
+        return false;
+    }
+    if (lba > s_sector_count || count > s_sector_count - lba) {
+        return false;
+    }
+
+    /* Completions arrive out of order, so identifiers are allocated, not taken from the tail. */
+    uint32_t cid = 0;
+    while (s_cmd_done[cid] != NULL) {
+        ++cid;
+    }
+
+    nvme_sqe cmd;
+    clear_command(&cmd);
+    cmd.cdw0 = (uint32_t)(write ? kIoWrite : kIoRead) | (cid << 16U);
+    cmd.nsid = kNvmeNamespace;
+    build_prps(&cmd, (const uint8_t*)buf, count * 512U, s_prp_lists[cid]);
+    cmd.cdw10 = (uint32_t)lba;
+    cmd.cdw11 = (uint32_t)(lba >> 32U);
+    cmd.cdw12 = count - 1U;
+    s_cmd_done[cid] = done;
+    s_cmd_token[cid] = token;
+    ++s_async_count;
+    queue_push(q, &cmd);
+    queue_ring(q);
+    return true;
+}
+
+/* Resetting the controller aborts every queued command; each one fails. */
+static void nvme_abort(void* ctx) {
+    (void)ctx;
+    if (s_async_count == 0) {
+        return;
+    }
+    s_io[0].stalled = true;
+    recover_io_queue(&s_io[0]);
+    s_async_count = 0;
+    for (uint32_t cid = 0; cid < kNvmeIoEntries; ++cid) {
+        const blockdev_done_fn done = s_cmd_done[cid];
+        if (done != NULL) {
+            s_cmd_done[cid] = NULL;
+            done(s_cmd_token[cid], false);
+        }
+    }
+}
+
+static bool nvme_service(void* ctx) {
+    (void)ctx;
+    nvme_queue* q = &s_io[0];
+    if (s_async_count == 0) {
+        return false;
+    }
+
+    uint16_t cids[kNvmeIoEntries];
+    bool oks[kNvmeIoEntries];
+    uint32_t n = 0;
+    while (n < kNvmeIoEntries) {
+        const volatile nvme_cqe* cqe = &q->cq[q->cq_head];
+        const uint16_t status = cqe->status;
+        if ((status & 1U) != q->phase) {
+            break;
+        }
+        cids[n] = cqe->cid;
+        oks[n] = (status >> 1U) == 0;
+        ++n;
+        if (++q->cq_head == q->entries) {
+            q->cq_head = 0;
+            q->phase ^= 1U;
+        }
+    }
+    if (n == 0) {
+        return false;
+    }
+    memory_barrier();
+    mmio_write32(q->cq_doorbell, q->cq_head);
+
+    /* Release every entry before running callbacks: they may submit again. */
+    for (uint32_t i = 0; i < n; ++i) {
+        const uint16_t cid = cids[i];
+        if (cid >= kNvmeIoEntries || s_cmd_done[cid] == NULL) {
+            continue;
+        }
+        const blockdev_done_fn done = s_cmd_done[cid];
+        s_cmd_done[cid] = NULL;
+        --s_async_count;
+        done(s_cmd_token[cid], oks[i]);
+    }
+    return true;
+}
+
+/* The synchronous path reaps completions in order, so queued commands must retire first. */
+static void sync_begin(void) {
+    s_sync_active = true;
+    for (uint32_t i = 0; s_async_count != 0 && i < kNvmePollBudget; ++i) {
+        (void)nvme_service(NULL);
+    }
+    nvme_abort(NULL);
+}
+
+static void sync_end(void) {
+    s_sync_active = false;
+}
+
+static bool nvme_blk_read(void* ctx, uint64_t lba, uint32_t count, void* out) {
+    (void)ctx;
+    return nvme_read(lba, count, out);
+}
+
+static bool nvme_blk_write(void* ctx, uint64_t lba, uint32_t count, const void* in) {
+    (void)ctx;
+    return nvme_write(lba, count, in);
+}
+
+static bool nvme_blk_flush(void* ctx) {
+    (void)ctx;
+    return nvme_flush();
+}
+
+static void nvme_register_blockdev(void) {
+    if (s_registered) {
+        return;
+    }
+
+    blockdev dev;
+    const char name[] = "nvme0n1";
+    for (size_t i = 0; i < sizeof(name); ++i) {
+        dev.name[i] = name[i];
+    }
+    dev.sector_count = s_sector_count;
+    dev.read = nvme_blk_read;
+    dev.write = nvme_blk_write;
+    dev.flush = nvme_blk_flush;
+    dev.submit = nvme_submit;
+    dev.service = nvme_service;
+    dev.abort = nvme_abort;
+    dev.depth = kNvmeIoEntries - 1U;
+    dev.irq = BLOCKDEV_NO_IRQ;
+    dev.ctx = NULL;
+    s_registered = blockdev_register(&dev) >= 0;
+}
+
+void nvme_init(void) {
+    s_ready = false;
+    s_bar = 0;
+    s_sector_count = 0;
+    s_chunk_sectors = kNvmeChunkSectors;
+    s_async_count = 0;
+    s_sync_active = false;
+    for (uint32_t cid = 0; cid < kNvmeIoEntries; ++cid) {
+        s_cmd_done[cid] = NULL;
+    }
+
+    const pci_device* pci = pci_find(kNvmeIds);
+    if (pci == NULL || pci_bar_is_io(pci, 0)) {
+        return;
+    }
+    /* BAR0/BAR1 form a 64-bit BAR; without paging it has to sit below 4 GiB. */
+    s_bar = (uintptr_t)pci_bar_address(pci, 0);
+    if (s_bar == 0U) {
+        return;
+    }
+    pci_enable(pci, PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER);
+
+    const uint32_t cap_lo = mmio_read32(s_bar + kRegCap);
+    const uint32_t cap_hi = mmio_read32(s_bar + kRegCap + 4U);
+    const uint32_t max_entries = (cap_lo & 0xFFFFU) + 1U;
+    s_doorbell_stride = 4U << (cap_hi & 0x0FU);
+    if (max_entries < kNvmeIoEntries) {
+        return;
+    }
+
+    if (!controller_enable() || !read_namespace() || !create_io_queues()) {
+        return;
+    }
+
+    s_ready = true;
+    nvme_register_blockdev();
+}
+
+bool nvme_ready(void) {
+    return s_ready;
+}
+
+uint64_t nvme_sector_count(void) {
+    return s_sector_count;
+}
+
+uint32_t nvme_queue_depth(void) {
+    return kNvmeIoEntries - 1U;
+}
+
+static void build_prps(nvme_sqe* cmd, const uint8_t* buf, uint32_t bytes, uint64_t* list) {
+    const uint32_t addr = (uint32_t)(uintptr_t)buf;
+    cmd->prp1 = addr;
+    cmd->prp2 = 0;
+
+    const uint32_t first = kNvmePage - (addr & (kNvmePage - 1U));
+    if (bytes <= first) {
+        return;
+    }
+
+    uint32_t next = addr + first;
+    uint32_t rest = bytes - first;
+    if (rest <= kNvmePage) {
+        cmd->prp2 = next;
+        return;
+    }
+
+    uint32_t n = 0;
+    while (rest > 0) {
+        list[n++] = next;
+        next += kNvmePage;
+        rest = (rest > kNvmePage) ? rest - kNvmePage : 0;
+    }
+    cmd->prp2 = (uint32_t)(uintptr_t)list;
+}
+
+/*
+ * Fills the I/O submission queue with up to entries-1 commands, rings the
+ * doorbell once for the batch, and reaps the whole batch before refilling.
+ * Busy-waits until every command completes, so this is a synchronous call.
+ */
+static bool nvme_transfer(uint64_t lba, uint32_t count, uint8_t* buf, bool write) {
+    if (!s_ready || buf == NULL || ((uintptr_t)buf & 3U) != 0U) {
+        return false;
+    }
+    if (lba > s_sector_count || count > s_sector_count - lba) {
+        return false;
+    }
+
+    nvme_queue* q = &s_io[0];
+    sync_begin();
+    while (count > 0) {
+        uint32_t batch = 0;
+        while (batch < (uint32_t)(q->entries - 1U) && count > 0) {
+            const uint32_t chunk = (count < s_chunk_sectors) ? count : s_chunk_sectors;
+            nvme_sqe cmd;
+            clear_command(&cmd);
+            cmd.cdw0 = (uint32_t)(write ? kIoWrite : kIoRead) | ((uint32_t)q->sq_tail << 16U);
+            cmd.nsid = kNvmeNamespace;
+            build_prps(&cmd, buf, chunk * 512U, s_prp_lists[batch]);
+            cmd.cdw10 = (uint32_t)lba;
+            cmd.cdw11 = (uint32_t)(lba >> 32U);
+            cmd.cdw12 = chunk - 1U;
+            queue_push(q, &cmd);
+
+            buf += (size_t)chunk * 512U;
+            lba += chunk;
+            count -= chunk;
+            ++batch;
+        }
+        queue_ring(q);
+        if (!queue_reap(q, batch)) {
+            recover_io_queue(q);
+            sync_end();
+            return false;
+        }
+    }
+    sync_end();
+    return true;
+}
+
+bool nvme_read(uint64_t lba, uint32_t count, void* out) {
+    return nvme_transfer(lba, count, (uint8_t*)out, false);
+}
+
+bool nvme_write(uint64_t lba, uint32_t count, const void* in) {
+    return nvme_transfer(lba, count, (uint8_t*)(uintptr_t)in, true);
+}
+
+bool nvme_flush(void) {
+    if (!s_ready) {
+        return false;
+    }
+
+    nvme_queue* q = &s_io[0];
+    sync_begin();
+    nvme_sqe cmd;
+    clear_command(&cmd);
+    cmd.cdw0 = (uint32_t)kIoFlush | ((uint32_t)q->sq_tail << 16U);
+    cmd.nsid = kNvmeNamespace;
+    queue_push(q, &cmd);
+    queue_ring(q);
+    const bool ok = queue_reap(q, 1);
+    if (!ok) {
+        recover_io_queue(q);
+    }
+    sync_end();
+    return ok;
+}
@@ -0,0 +1,288 @@
+#include "drivers/pci.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    kPciCfgAddr = 0xCF8,
+    kPciCfgData = 0xCFC,
+
+    kPciClassBridge = 0x06,
+    kPciSubclassPciBridge = 0x04,
+    kPciHeaderTypeMask = 0x7F,
+    kPciHeaderMultiFunction = 0x80,
+    kPciHeaderBridge = 0x01,
+    kPciBridgeBars = 2,
+    /* Bridges nested deeper than this are not followed. */
+    kPciMaxBridgeDepth = 8,
+
+    kMsiControlEnable = 0x0001,
+    kMsiControlMultiEnableMask = 0x0070,
+    kMsiControl64Bit = 0x0080,
+};
+
+static pci_device s_devices[PCI_MAX_DEVICES];
+static size_t s_device_count = 0;
+static bool s_enumerated = false;
+static uint32_t s_bus_seen[256 / 32];
+
+static inline void outl(uint16_t port, uint32_t value) {
+    __asm__ volatile("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint32_t inl(uint16_t port) {
+    uint32_t value;
+    __asm__ volatile("inl %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static uint32_t pci_cfg_address(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    return 0x80000000U |
+           ((uint32_t)bus << 16U) |
+           ((uint32_t)slot << 11U) |
+           ((uint32_t)func << 8U) |
+           (uint32_t)(offset & 0xFCU);
+}
+
+uint32_t pci_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    outl(kPciCfgAddr, pci_cfg_address(bus, slot, func, offset));
+    return inl(kPciCfgData);
+}
+
+uint16_t pci_read16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    const uint32_t value = pci_read32(bus, slot, func, offset);
+    return (uint16_t)((value >> ((offset & 2U) * 8U)) & 0xFFFFU);
+}
+
+uint8_t pci_read8(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    const uint32_t value = pci_read32(bus, slot, func, offset);
+    return (uint8_t)((value >> ((offset & 3U) * 8U)) & 0xFFU);
+}
+
+void pci_write32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t value) {
+    outl(kPciCfgAddr, pci_cfg_address(bus, slot, func, offset));
+    outl(kPciCfgData, value);
+}
+
+void pci_write16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t value) {
+    const uint8_t aligned = (uint8_t)(offset & 0xFCU);
+    uint32_t reg = pci_read32(bus, slot, func, aligned);
+    const uint32_t shift = (uint32_t)(offset & 2U) * 8U;
+    reg &= ~(0xFFFFU << shift);
+    if (aligned == PCI_CFG_COMMAND && shift == 0U) {
+        /* STATUS error bits are write-1-to-clear; writing back what was read would ack them. */
+        reg &= 0x0000FFFFU;
+    }
+    reg |= (uint32_t)value << shift;
+    pci_write32(bus, slot, func, aligned, reg);
+}
+
+/* Sizes each BAR with decode disabled so the probe pattern never claims address space. */
+static void size_bars(pci_device* dev, uint32_t bar_count) {
+    const uint16_t command = pci_read16(dev->bus, dev->slot, dev->func, PCI_CFG_COMMAND);
+    pci_write16(dev->bus, dev->slot, dev->func, PCI_CFG_COMMAND,
+                (uint16_t)(command & ~(PCI_COMMAND_IO | PCI_COMMAND_MEMORY)));
+
+    for (uint32_t i = 0; i < bar_count; ++i) {
+        const uint8_t offset = (uint8_t)(PCI_CFG_BAR0 + i * 4U);
+        const uint32_t raw = pci_read32(dev->bus, dev->slot, dev->func, offset);
+        pci_write32(dev->bus, dev->slot, dev->func, offset, 0xFFFFFFFFU);
+        const uint32_t probe = pci_read32(dev->bus, dev->slot, dev->func, offset);
+        pci_write32(dev->bus, dev->slot, dev->func, offset, raw);
+
+        dev->bar[i] = raw;
+        const bool io = (raw & 0x1U) != 0U;
+        uint32_t mask = probe & (io ? 0xFFFFFFFCU : 0xFFFFFFF0U);
+        if (io) {
+            /* I/O BARs may only implement the low 16 bits. */
+            mask |= 0xFFFF0000U;
+        }
+        dev->bar_size[i] = (mask != 0U) ? (~mask + 1U) : 0U;
+
+        if (!io && ((raw >> 1U) & 0x3U) == 0x2U && i + 1U < bar_count) {
+            /* 64-bit memory BAR: the upper half lives in the next slot. */
+            ++i;
+            dev->bar[i] = pci_read32(dev->bus, dev->slot, dev->func, (uint8_t)(PCI_CFG_BAR0 + i * 4U));
+            dev->bar_size[i] = 0;
+        }
+    }
+
+    pci_write16(dev->bus, dev->slot, dev->func, PCI_CFG_COMMAND, command);
+}
+
+static void scan_bus(uint8_t bus, uint32_t depth);
+
+static void scan_function(uint8_t bus, uint8_t slot, uint8_t func, uint32_t depth) {
+    if (s_device_count >= PCI_MAX_DEVICES) {
+        return;
+    }
+
+    pci_device* dev = &s_devices[s_device_count++];
+    dev->bus = bus;
+    dev->slot = slot;
+    dev->func = func;
+    dev->vendor_id = pci_read16(bus, slot, func, PCI_CFG_VENDOR);
+    dev->device_id = pci_read16(bus, slot, func, PCI_CFG_DEVICE);
+    dev->revision = pci_read8(bus, slot, func, PCI_CFG_REVISION);
+    dev->prog_if = pci_read8(bus, slot, func, PCI_CFG_PROG_IF);
+    dev->subclass = pci_read8(bus, slot, func, PCI_CFG_SUBCLASS);
+    dev->class_code = pci_read8(bus, slot, func, PCI_CFG_CLASS);
+    dev->header_type = pci_read8(bus, slot, func, PCI_CFG_HEADER_TYPE);
+    dev->irq_line = pci_read8(bus, slot, func, PCI_CFG_INTERRUPT_LINE);
+    for (uint32_t i = 0; i < PCI_BAR_COUNT; ++i) {
+        dev->bar[i] = 0;
+        dev->bar_size[i] = 0;
+    }
+
+    const uint8_t layout = (uint8_t)(dev->header_type & kPciHeaderTypeMask);
+    if (layout == 0U) {
+        size_bars(dev, PCI_BAR_COUNT);
+    } else if (layout == kPciHeaderBridge) {
+        size_bars(dev, kPciBridgeBars);
+        if (dev->class_code == kPciClassBridge && dev->subclass == kPciSubclassPciBridge &&
+            depth < kPciMaxBridgeDepth) {
+            scan_bus(pci_read8(bus, slot, func, PCI_CFG_SECONDARY_BUS), depth + 1U);
+        }
+    }
+}
+
+static void scan_bus(uint8_t bus, uint32_t depth) {
+    /* Guards against misconfigured bridges that point back at a scanned bus. */
+    if ((s_bus_seen[bus >> 5U] & (1U << (bus & 31U))) != 0U) {
+        return;
+    }
+    s_bus_seen[bus >> 5U] |= 1U << (bus & 31U);
+
+    for (uint8_t slot = 0; slot < 32U; ++slot) {
+        if (pci_read16(bus, slot, 0, PCI_CFG_VENDOR) == 0xFFFFU) {
+            continue;
+        }
+        scan_function(bus, slot, 0, depth);
+        if ((pci_read8(bus, slot, 0, PCI_CFG_HEADER_TYPE) & kPciHeaderMultiFunction) == 0U) {
+            continue;
+        }
+        for (uint8_t func = 1; func < 8U; ++func) {
+            if (pci_read16(bus, slot, func, PCI_CFG_VENDOR) != 0xFFFFU) {
+                scan_function(bus, slot, func, depth);
+            }
+        }
+    }
+}
+
+void pci_init(void) {
+    if (s_enumerated) {
+        return;
+    }
+    s_enumerated = true;
+    s_device_count = 0;
+    for (size_t i = 0; i < sizeof(s_bus_seen) / sizeof(s_bus_seen[0]); ++i) {
+        s_bus_seen[i] = 0;
+    }
+
+    /* A multi-function host bridge exposes one root bus per function. */
+    if ((pci_read8(0, 0, 0, PCI_CFG_HEADER_TYPE) & kPciHeaderMultiFunction) == 0U) {
+        scan_bus(0, 0);
+        return;
+    }
+    for (uint8_t func = 0; func < 8U; ++func) {
+        if (pci_read16(0, 0, func, PCI_CFG_VENDOR) != 0xFFFFU) {
+            scan_bus(func, 0);
+        }
+    }
+}
+
+size_t pci_device_count(void) {
+    pci_init();
+    return s_device_count;
+}
+
+const pci_device* pci_device_at(size_t index) {
+    pci_init();
+    return (index < s_device_count) ? &s_devices[index] : NULL;
+}
+
+static bool id_field_matches(uint16_t want, uint16_t have) {
+    return want == PCI_ANY_ID || want == have;
+}
+
+const pci_device* pci_find(const pci_device_id* ids) {
+    pci_init();
+    if (ids == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < s_device_count; ++i) {
+        const pci_device* dev = &s_devices[i];
+        for (const pci_device_id* id = ids; id->vendor_id != 0U; ++id) {
+            if (id_field_matches(id->vendor_id, dev->vendor_id) && id_field_matches(id->device_id, dev->device_id) &&
+                id_field_matches(id->class_code, dev->class_code) && id_field_matches(id->subclass, dev->subclass) &&
+                id_field_matches(id->prog_if, dev->prog_if)) {
+                return dev;
+            }
+        }
+    }
+    return NULL;
+}
+
+bool pci_bar_is_io(const pci_device* dev, uint32_t index) {
+    return dev != NULL && index < PCI_BAR_COUNT && (dev->bar[index] & 0x1U) != 0U;
+}
+
+uint32_t pci_bar_address(const pci_device* dev, uint32_t index) {
+    if (dev == NULL || index >= PCI_BAR_COUNT || dev->bar_size[index] == 0U) {
+        return 0;
+    }
+    const uint32_t raw = dev->bar[index];
+    if ((raw & 0x1U) != 0U) {
+        return raw & 0xFFFCU;
+    }
+    if (((raw >> 1U) & 0x3U) == 0x2U && (index + 1U >= PCI_BAR_COUNT || dev->bar[index + 1U] != 0U)) {
+        return 0;
+    }
+    return raw & 0xFFFFFFF0U;
+}
+
+void pci_enable(const pci_device* dev, uint16_t command_bits) {
+    if (dev == NULL) {
+        return;
+    }
+    const uint16_t command = pci_read16(dev->bus, dev->slot, dev->func, PCI_CFG_COMMAND);
+    pci_write16(dev->bus, dev->slot, dev->func, PCI_CFG_COMMAND, (uint16_t)(command | command_bits));
+}
+
+uint8_t pci_find_capability(const pci_device* dev, uint8_t cap_id) {
+    if (dev == NULL || (pci_read16(dev->bus, dev->slot, dev->func, PCI_CFG_STATUS) & PCI_STATUS_CAP_LIST) == 0U) {
+        return 0;
+    }
+
+    uint8_t offset = (uint8_t)(pci_read8(dev->bus, dev->slot, dev->func, PCI_CFG_CAP_PTR) & 0xFCU);
+    /* 48 entries fit in the 192 bytes past the header; stop there on a looped list. */
+    for (uint32_t guard = 0; offset >= 0x40U && guard < 48U; ++guard) {
+        if (pci_read8(dev->bus, dev->slot, dev->func, offset) == cap_id) {
+            return offset;
+        }
+        offset = (uint8_t)(pci_read8(dev->bus, dev->slot, dev->func, (uint8_t)(offset + 1U)) & 0xFCU);
+    }
+    return 0;
+}
+
+bool pci_enable_msi(const pci_device* dev, uint32_t address, uint16_t data) {
+    const uint8_t cap = pci_find_capability(dev, PCI_CAP_ID_MSI);
+    if (cap == 0U) {
+        return false;
+    }
+
+    uint16_t control = pci_read16(dev->bus, dev->slot, dev->func, (uint8_t)(cap + 2U));
+    pci_write32(dev->bus, dev->slot, dev->func, (uint8_t)(cap + 4U), address);
+    if ((control & kMsiControl64Bit) != 0U) {
+        pci_write32(dev->bus, dev->slot, dev->func, (uint8_t)(cap + 8U), 0);
+        pci_write16(dev->bus, dev->slot, dev->func, (uint8_t)(cap + 12U), data);
+    } else {
+        pci_write16(dev->bus, dev->slot, dev->func, (uint8_t)(cap + 8U), data);
+    }
+
+    control = (uint16_t)((control & ~kMsiControlMultiEnableMask) | kMsiControlEnable);
+    pci_write16(dev->bus, dev->slot, dev->func, (uint8_t)(cap + 2U), control);
+    pci_enable(dev, PCI_COMMAND_INTX_DISABLE);
+    return true;
+}
@@ -0,0 +1,141 @@
+#include "drivers/pktbuf.h"
+
+#include "drivers/cpu_irq.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    kBufferBytes = PKTBUF_HEADROOM + PKTBUF_DATA_BYTES,
+};
+
+static pktbuf s_pool[PKTBUF_COUNT];
+static uint8_t s_storage[PKTBUF_COUNT][kBufferBytes] __attribute__((aligned(64)));
+static pktbuf* s_free = NULL;
+static bool s_ready = false;
+static uint32_t s_free_count = 0;
+static uint32_t s_low_water = 0;
+static uint32_t s_alloc_failures = 0;
+
+static uint8_t* buffer_start(const pktbuf* pb) {
+    return s_storage[pb - s_pool];
+}
+
+/* Built on first use so drivers can fill their rings before anything else runs. Interrupts off. */
+static void pool_setup(void) {
+    for (uint32_t i = 0; i < PKTBUF_COUNT; ++i) {
+        s_pool[i].data = s_storage[i] + PKTBUF_HEADROOM;
+        s_pool[i].len = 0;
+        s_pool[i].refs = 0;
+        s_pool[i].next = (i + 1U < PKTBUF_COUNT) ? &s_pool[i + 1U] : NULL;
+    }
+    s_free = &s_pool[0];
+    s_free_count = PKTBUF_COUNT;
+    s_low_water = PKTBUF_COUNT;
+    s_ready = true;
+}
+
+pktbuf* pktbuf_alloc(void) {
+    const uint32_t flags = cpu_irq_save();
+    if (!s_ready) {
+        pool_setup();
+    }
+    pktbuf* pb = s_free;
+    if (pb != NULL) {
+        s_free = pb->next;
+        --s_free_count;
+        if (s_free_count < s_low_water) {
+            s_low_water = s_free_count;
+        }
+    } else {
+        ++s_alloc_failures;
+    }
+    cpu_irq_restore(flags);
+
+    if (pb != NULL) {
+        pb->data = buffer_start(pb) + PKTBUF_HEADROOM;
+        pb->len = 0;
+        pb->refs = 1;
+        pb->next = NULL;
+    }
+    return pb;
+}
+
+void pktbuf_get(pktbuf* pb) {
+    if (pb == NULL) {
+        return;
+    }
+    const uint32_t flags = cpu_irq_save();
+    ++pb->refs;
+    cpu_irq_restore(flags);
+}
+
+void pktbuf_put(pktbuf* pb) {
+    if (pb == NULL) {
+        return;
+    }
+    const uint32_t flags = cpu_irq_save();
+    if (pb->refs > 0U && --pb->refs == 0U) {
+        pb->next = s_free;
+        s_free = pb;
+        ++s_free_count;
+    }
+    cpu_irq_restore(flags);
+}
+
+size_t pktbuf_headroom(const pktbuf* pb) {
+    return (size_t)(pb->data - buffer_start(pb));
+}
+
+size_t pktbuf_tailroom(const pktbuf* pb) {
+    return (size_t)kBufferBytes - pktbuf_headroom(pb) - pb->len;
+}
+
+uint8_t* pktbuf_push(pktbuf* pb, size_t n) {
+    if (n > pktbuf_headroom(pb)) {
+        return NULL;
+    }
+    pb->data -= n;
+    pb->len = (uint16_t)(pb->len + n);
+    return pb->data;
+}
+
+uint8_t* pktbuf_pull(pktbuf* pb, size_t n) {
+    if (n > pb->len) {
+        return NULL;
+    }
+    pb->data += n;
+    pb->len = (uint16_t)(pb->len - n);
+    return pb->data;
+}
+
+uint8_t* pktbuf_append(pktbuf* pb, size_t n) {
+    if (n > pktbuf_tailroom(pb)) {
+        return NULL;
+    }
+    uint8_t* tail = pb->data + pb->len;
+    pb->len = (uint16_t)(pb->len + n);
+    return tail;
+}
+
+void pktbuf_trim(pktbuf* pb, size_t len) {
+    if (len < pb->len) {
+        pb->len = (uint16_t)len;
+    }
+}
+
+void pktbuf_get_stats(pktbuf_stats* out) {
+    if (out == NULL) {
+        return;
+    }
+    const uint32_t flags = cpu_irq_save();
+    if (!s_ready) {
+        pool_setup();
+    }
+    out->total = PKTBUF_COUNT;
+    out->free = s_free_count;
+    out->low_water = s_low_water;
+    out->alloc_failures = s_alloc_failures;
+    cpu_irq_restore(flags);
+}
@@ -0,0 +1,197 @@
+#include "drivers/virtio.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+static inline void outb(uint16_t port, uint8_t value) {
+    __asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline void outw(uint16_t port, uint16_t value) {
+    __asm__ volatile("outw %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline void outl(uint16_t port, uint32_t value) {
+    __asm__ volatile("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t value;
+    __asm__ volatile("inb %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline uint16_t inw(uint16_t port) {
+    uint16_t value;
+    __asm__ volatile("inw %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline uint32_t inl(uint16_t port) {
+    uint32_t value;
+    __asm__ volatile("inl %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline void memory_barrier(void) {
+    __asm__ volatile("" : : : "memory");
+}
+
+/* Store-load ordering needs a locked op on x86; a compiler barrier is not enough. */
+static inline void full_barrier(void) {
+    __asm__ volatile("lock; addl $0, (%%esp)" : : : "memory");
+}
+
+static size_t align_up(size_t value, size_t align) {
+    return (value + align - 1U) & ~(align - 1U);
+}
+
+bool virtio_legacy_begin(uint16_t io_base, uint32_t wanted, uint32_t* out_features) {
+    outb((uint16_t)(io_base + VIRTIO_PCI_STATUS), 0);
+    outb((uint16_t)(io_base + VIRTIO_PCI_STATUS), VIRTIO_STATUS_ACKNOWLEDGE);
+    outb((uint16_t)(io_base + VIRTIO_PCI_STATUS), VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    if ((inb((uint16_t)(io_base + VIRTIO_PCI_STATUS)) & VIRTIO_STATUS_DRIVER) == 0) {
+        return false;
+    }
+
+    const uint32_t features = inl((uint16_t)(io_base + VIRTIO_PCI_HOST_FEATURES)) & wanted;
+    outl((uint16_t)(io_base + VIRTIO_PCI_GUEST_FEATURES), features);
+    if (out_features != NULL) {
+        *out_features = features;
+    }
+    return true;
+}
+
+void virtio_legacy_driver_ok(uint16_t io_base) {
+    const uint8_t status = inb((uint16_t)(io_base + VIRTIO_PCI_STATUS));
+    outb((uint16_t)(io_base + VIRTIO_PCI_STATUS), (uint8_t)(status | VIRTIO_STATUS_DRIVER_OK));
+}
+
+void virtio_legacy_fail(uint16_t io_base) {
+    const uint8_t status = inb((uint16_t)(io_base + VIRTIO_PCI_STATUS));
+    outb((uint16_t)(io_base + VIRTIO_PCI_STATUS), (uint8_t)(status | VIRTIO_STATUS_FAILED));
+}
+
+uint32_t virtio_legacy_config32(uint16_t io_base, uint32_t offset) {
+    return inl((uint16_t)(io_base + VIRTIO_PCI_CONFIG + offset));
+}
+
+uint8_t virtio_legacy_config8(uint16_t io_base, uint32_t offset) {
+    return inb((uint16_t)(io_base + VIRTIO_PCI_CONFIG + offset));
+}
+
+uint8_t virtio_legacy_isr(uint16_t io_base) {
+    return inb((uint16_t)(io_base + VIRTIO_PCI_ISR));
+}
+
+size_t virtq_bytes(uint16_t size) {
+    const size_t ring = sizeof(virtq_desc) * size + sizeof(uint16_t) * (3U + size);
+    return align_up(ring, VIRTQ_ALIGN) + align_up(sizeof(uint16_t) * 3U + sizeof(virtq_used_elem) * size, VIRTQ_ALIGN);
+}
+
+bool virtq_init(virtq* q, uint16_t io_base, uint16_t index, void* mem, size_t mem_size) {
+    if (q == NULL || mem == NULL || ((uintptr_t)mem & (VIRTQ_ALIGN - 1U)) != 0U) {
+        return false;
+    }
+
+    outw((uint16_t)(io_base + VIRTIO_PCI_QUEUE_SELECT), index);
+    const uint16_t size = inw((uint16_t)(io_base + VIRTIO_PCI_QUEUE_SIZE));
+    /* Legacy devices fix the ring size; the driver cannot shrink it. */
+    if (size == 0 || virtq_bytes(size) > mem_size) {
+        return false;
+    }
+
+    uint8_t* raw = (uint8_t*)mem;
+    for (size_t i = 0; i < virtq_bytes(size); ++i) {
+        raw[i] = 0;
+    }
+
+    q->io_base = io_base;
+    q->index = index;
+    q->size = size;
+    q->desc = (volatile virtq_desc*)raw;
+    q->avail = (volatile virtq_avail*)(raw + sizeof(virtq_desc) * size);
+    q->used = (volatile virtq_used*)(raw + align_up(sizeof(virtq_desc) * size + sizeof(uint16_t) * (3U + size), VIRTQ_ALIGN));
+    q->avail_idx = 0;
+    q->last_used = 0;
+    q->event_idx = false;
+    q->kicked_idx = 0;
+
+    outl((uint16_t)(io_base + VIRTIO_PCI_QUEUE_PFN), (uint32_t)((uintptr_t)mem / VIRTQ_ALIGN));
+    return true;
+}
+
+void virtq_submit(virtq* q, uint16_t head) {
+    q->avail->ring[q->avail_idx % q->size] = head;
+    ++q->avail_idx;
+}
+
+/* used_event trails the avail ring and avail_event the used ring (legacy layout). */
+static volatile uint16_t* used_event(virtq* q) {
+    return &q->avail->ring[q->size];
+}
+
+static volatile uint16_t* avail_event(virtq* q) {
+    return (volatile uint16_t*)&q->used->ring[q->size];
+}
+
+void virtq_kick(virtq* q) {
+    memory_barrier();
+    q->avail->idx = q->avail_idx;
+    /* Order the idx store before the used->flags/avail_event load. */
+    full_barrier();
+
+    bool notify;
+    if (q->event_idx) {
+        /* Notify only if avail_event lies in (kicked_idx, avail_idx]; the device is otherwise still consuming. */
+        const uint16_t event = *avail_event(q);
+        notify = (uint16_t)(q->avail_idx - event - 1U) < (uint16_t)(q->avail_idx - q->kicked_idx);
+    } else {
+        notify = (q->used->flags & VIRTQ_USED_F_NO_NOTIFY) == 0;
+    }
+    q->kicked_idx = q->avail_idx;
+    if (notify) {
+        outw((uint16_t)(q->io_base + VIRTIO_PCI_QUEUE_NOTIFY), q->index);
+    }
+}
+
+bool virtq_pop_used(virtq* q, uint32_t* out_id, uint32_t* out_len) {
+    if (q->last_used == q->used->idx) {
+        return false;
+    }
+    memory_barrier();
+
+    const volatile virtq_used_elem* elem = &q->used->ring[q->last_used % q->size];
+    if (out_id != NULL) {
+        *out_id = elem->id;
+    }
+    if (out_len != NULL) {
+        *out_len = elem->len;
+    }
+    ++q->last_used;
+    return true;
+}
+
+bool virtq_has_used(const virtq* q) {
+    return q->last_used != q->used->idx;
+}
+
+void virtq_disable_interrupts(virtq* q) {
+    if (q->event_idx) {
+        /* An event one behind the consumer is only crossed again after the index wraps. */
+        *used_event(q) = (uint16_t)(q->last_used - 1U);
+    } else {
+        q->avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+    }
+}
+
+bool virtq_enable_interrupts(virtq* q) {
+    if (q->event_idx) {
+        *used_event(q) = q->last_used;
+    } else {
+        q->avail->flags = 0;
+    }
+    full_barrier();
+    return !virtq_has_used(q);
+}
@@ -0,0 +1,234 @@
+#include "drivers/virtio_blk.h"
+
+#include "drivers/blockdev.h"
+#include "drivers/pci.h"
+#include "drivers/virtio.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    kVirtioBlkDevice = 0x1001,
+
+    kFeatureReadOnly = 1 << 5,
+    kFeatureFlush = 1 << 9,
+
+    kReqIn = 0,
+    kReqOut = 1,
+    kReqFlush = 4,
+    kReqStatusOk = 0,
+
+    /* Each request is a header/data/status chain of three descriptors. */
+    kChainLength = 3,
+    kBatchMax = 32,
+    kChunkSectors = 256,
+    /* Room for a 1024-entry legacy ring, the largest QEMU offers. */
+    kQueueMemBytes = 32768,
+    kPollBudget = 5000000,
+};
+
+typedef struct virtio_blk_req {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} virtio_blk_req;
+
+static const pci_device_id kVirtioBlkIds[] = {
+    {VIRTIO_PCI_VENDOR, kVirtioBlkDevice, PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID},
+    {0, 0, 0, 0, 0},
+};
+
+static bool s_ready = false;
+static bool s_registered = false;
+static bool s_read_only = false;
+static bool s_has_flush = false;
+static uint16_t s_io_base = 0;
+static uint64_t s_sector_count = 0;
+static uint32_t s_batch = 1;
+static virtq s_queue;
+
+static uint8_t s_queue_mem[kQueueMemBytes] __attribute__((aligned(VIRTQ_ALIGN)));
+static virtio_blk_req s_headers[kBatchMax];
+static volatile uint8_t s_status[kBatchMax];
+
+static void set_desc(uint16_t index, const void* addr, uint32_t len, uint16_t flags) {
+    volatile virtq_desc* d = &s_queue.desc[index];
+    d->addr = (uint32_t)(uintptr_t)addr;
+    d->len = len;
+    d->flags = flags;
+    d->next = (uint16_t)(index + 1U);
+}
+
+/* Request `slot` owns descriptors [slot * 3, slot * 3 + 2]; no free list is needed. */
+static void queue_request(uint32_t slot, uint32_t type, uint64_t sector, void* buf, uint32_t bytes) {
+    const uint16_t head = (uint16_t)(slot * kChainLength);
+    s_headers[slot].type = type;
+    s_headers[slot].reserved = 0;
+    s_headers[slot].sector = sector;
+    s_status[slot] = 0xFF;
+
+    set_desc(head, &s_headers[slot], sizeof(s_headers[slot]), VIRTQ_DESC_F_NEXT);
+    uint16_t next = (uint16_t)(head + 1U);
+    if (bytes > 0) {
+        const uint16_t dir = (type == kReqIn) ? VIRTQ_DESC_F_WRITE : 0U;
+        set_desc(next, buf, bytes, (uint16_t)(dir | VIRTQ_DESC_F_NEXT));
+        ++next;
+    }
+    set_desc(next, (const void*)&s_status[slot], 1U, VIRTQ_DESC_F_WRITE);
+    virtq_submit(&s_queue, head);
+}
+
+static bool wait_batch(uint32_t batch) {
+    uint32_t done = 0;
+    for (uint32_t i = 0; i < kPollBudget && done < batch; ++i) {
+        while (virtq_pop_used(&s_queue, NULL, NULL)) {
+            ++done;
+        }
+    }
+    if (done < batch) {
+        /* Requests are still owned by the device; stop using the ring. */
+        s_ready = false;
+        return false;
+    }
+    for (uint32_t slot = 0; slot < batch; ++slot) {
+        if (s_status[slot] != kReqStatusOk) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool virtio_blk_blk_read(void* ctx, uint64_t lba, uint32_t count, void* out) {
+    (void)ctx;
+    return virtio_blk_read(lba, count, out);
+}
+
+static bool virtio_blk_blk_write(void* ctx, uint64_t lba, uint32_t count, const void* in) {
+    (void)ctx;
+    return virtio_blk_write(lba, count, in);
+}
+
+static bool virtio_blk_blk_flush(void* ctx) {
+    (void)ctx;
+    return virtio_blk_flush();
+}
+
+static void virtio_blk_register_blockdev(void) {
+    if (s_registered) {
+        return;
+    }
+
+    blockdev dev;
+    const char name[] = "vda";
+    for (size_t i = 0; i < sizeof(name); ++i) {
+        dev.name[i] = name[i];
+    }
+    dev.sector_count = s_sector_count;
+    dev.read = virtio_blk_blk_read;
+    dev.write = virtio_blk_blk_write;
+    /* Without VIRTIO_BLK_F_FLUSH the device is write-through. */
+    dev.flush = s_has_flush ? virtio_blk_blk_flush : NULL;
+    dev.submit = NULL;
+    dev.service = NULL;
+    dev.abort = NULL;
+    dev.depth = 1;
+    dev.irq = BLOCKDEV_NO_IRQ;
+    dev.ctx = NULL;
+    s_registered = blockdev_register(&dev) >= 0;
+}
+
+void virtio_blk_init(void) {
+    s_ready = false;
+    s_io_base = 0;
+    s_sector_count = 0;
+
+    const pci_device* pci = pci_find(kVirtioBlkIds);
+    if (pci == NULL || !pci_bar_is_io(pci, 0) || pci_bar_address(pci, 0) == 0U) {
+        return;
+    }
+    pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+    s_io_base = (uint16_t)pci_bar_address(pci, 0);
+
+    uint32_t features = 0;
+    if (!virtio_legacy_begin(s_io_base, kFeatureReadOnly | kFeatureFlush, &features)) {
+        return;
+    }
+    s_read_only = (features & kFeatureReadOnly) != 0;
+    s_has_flush = (features & kFeatureFlush) != 0;
+
+    if (!virtq_init(&s_queue, s_io_base, 0, s_queue_mem, sizeof(s_queue_mem))) {
+        virtio_legacy_fail(s_io_base);
+        return;
+    }
+    /* Completions are polled, so ask the device not to raise interrupts. */
+    s_queue.avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+    s_batch = s_queue.size / kChainLength;
+    if (s_batch > kBatchMax) {
+        s_batch = kBatchMax;
+    }
+
+    s_sector_count = (uint64_t)virtio_legacy_config32(s_io_base, 0) |
+                     ((uint64_t)virtio_legacy_config32(s_io_base, 4) << 32U);
+    virtio_legacy_driver_ok(s_io_base);
+
+    s_ready = s_batch > 0;
+    if (s_ready) {
+        virtio_blk_register_blockdev();
+    }
+}
+
+bool virtio_blk_ready(void) {
+    return s_ready;
+}
+
+uint64_t virtio_blk_sector_count(void) {
+    return s_sector_count;
+}
+
+/* Queues up to s_batch chained requests, then notifies the device once for all of them. */
+static bool virtio_blk_transfer(uint64_t lba, uint32_t count, uint8_t* buf, bool write) {
+    if (!s_ready || buf == NULL || (write && s_read_only)) {
+        return false;
+    }
+    if (lba > s_sector_count || count > s_sector_count - lba) {
+        return false;
+    }
+
+    while (count > 0) {
+        uint32_t batch = 0;
+        while (batch < s_batch && count > 0) {
+            const uint32_t chunk = (count < kChunkSectors) ? count : kChunkSectors;
+            queue_request(batch, write ? kReqOut : kReqIn, lba, buf, chunk * 512U);
+            buf += (size_t)chunk * 512U;
+            lba += chunk;
+            count -= chunk;
+            ++batch;
+        }
+        virtq_kick(&s_queue);
+        if (!wait_batch(batch)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool virtio_blk_read(uint64_t lba, uint32_t count, void* out) {
+    return virtio_blk_transfer(lba, count, (uint8_t*)out, false);
+}
+
+bool virtio_blk_write(uint64_t lba, uint32_t count, const void* in) {
+    return virtio_blk_transfer(lba, count, (uint8_t*)(uintptr_t)in, true);
+}
+
+bool virtio_blk_flush(void) {
+    if (!s_ready) {
+        return false;
+    }
+    if (!s_has_flush) {
+        return true;
+    }
+    queue_request(0, kReqFlush, 0, NULL, 0);
+    virtq_kick(&s_queue);
+    return wait_batch(1);
+}
@@ -7,6 +7,7 @@
 #include "gui/image_loader.h"
 #include "kernel/console.h"
 #include "kernel/filesystem.h"
+#include "kernel/interrupts.h"
 #include "kernel/net_stack.h"
 #include "kernel/release.h"
 
@@ -455,6 +456,7 @@ static bool s_clip_enabled = false;
 static rect_i s_dirty_rect = {0, 0, kScreenWidth, kScreenHeight};
 static bool s_dirty_valid = true;
 static uint32_t s_autosave_ticks = 0;
+static bool s_autosave_failed = false;
 
 static wm_window s_terminal_window;
 static bool s_start_menu_open = false;
@@ -536,6 +538,19 @@ static int s_settings_resolution_mode = 0;
 
 static int s_files_selected = -1;
 
+/* Rows of the Files app, rebuilt only when fs_generation() moves; the watch redraws. */
+typedef struct files_row_cache {
+    char name[56];
+    size_t size;
+    fs_backend backend;
+} files_row_cache;
+
+static files_row_cache s_files_rows[kFileRowsVisible];
+static int s_files_row_count = 0;
+static int s_files_total = 0;
+static uint32_t s_files_cache_gen = 0; /* fs_generation() starts at 1 */
+static int s_files_watch = -1;
+
 static uint32_t s_last_idle_spins = 0;
 static uint32_t s_max_idle_spins = 1;
 static uint8_t s_cpu_history[kPerfHistory];
@@ -565,6 +580,7 @@ static void compute_layout(ui_layout* out);
 static void start_menu_reset_search(void);
 static void process_queued_keys(void);
 static void process_pending_shell_command(void);
+static void run_shell_command(void* ctx);
 
 static void copy_str(char* dst, size_t cap, const char* src) {
     if (cap == 0) {
@@ -880,9 +896,12 @@ static void notes_load(void) {
     s_notes_dirty = false;
 }
 
-static void notes_save(void) {
-    (void)fs_write_bytes("notes.txt", s_notes_text, s_notes_len);
+static bool notes_save(void) {
+    if (!fs_write_bytes("notes.txt", s_notes_text, s_notes_len)) {
+        return false;
+    }
     s_notes_dirty = false;
+    return true;
 }
 
 static void perf_push_sample(uint8_t cpu_pct, uint8_t mem_pct) {
@@ -2064,12 +2083,15 @@ static void editor_open_file(const char* filename) {
     s_editor_focused = true;
 }
 
-static void editor_save(void) {
+static bool editor_save(void) {
     if (s_editor_filename[0] == '\0') {
-        return;
+        return false;
+    }
+    if (!fs_write_bytes(s_editor_filename, s_editor_text, s_editor_len)) {
+        return false;
     }
-    (void)fs_write_bytes(s_editor_filename, s_editor_text, s_editor_len);
     s_editor_dirty = false;
+    return true;
 }
 
 static bool app_id_from_name(const char* name, app_id* out_app) {
@@ -2613,18 +2635,54 @@ static void draw_file_preview(const rect_i* content,
     }
 }
 
+static void files_cache_refresh(void) {
+    const uint32_t gen = fs_generation();
+    if (gen == s_files_cache_gen) {
+        return;
+    }
+
+    s_files_total = (int)fs_count();
+    s_files_row_count = 0;
+    for (int i = 0; i < s_files_total && s_files_row_count < kFileRowsVisible; ++i) {
+        files_row_cache* row = &s_files_rows[s_files_row_count];
+        if (!fs_name_at((size_t)i, row->name, sizeof(row->name))) {
+            continue;
+        }
+        row->size = 0;
+        row->backend = FS_BACKEND_RAM;
+        (void)fs_size_at((size_t)i, &row->size);
+        (void)fs_backend_at((size_t)i, &row->backend);
+        ++s_files_row_count;
+    }
+    s_files_cache_gen = gen;
+}
+
+static void files_cache_on_change(const char* name, uint32_t events, void* ctx) {
+    (void)name;
+    (void)events;
+    (void)ctx;
+    if (s_app_windows[APP_FILES].open && !s_app_windows[APP_FILES].minimized) {
+        const rect_i r = app_window_rect(APP_FILES);
+        request_redraw_rect(r.x, r.y, r.w, r.h);
+    }
+}
+
 static bool file_entry_at(int index, char* name_out, size_t name_cap, size_t* out_size, fs_backend* out_backend) {
     if (index < 0 || name_out == NULL || name_cap == 0) {
         return false;
     }
-    if (!fs_name_at((size_t)index, name_out, name_cap)) {
+    files_cache_refresh();
+    if (index >= s_files_row_count) {
         return false;
     }
+
+    const files_row_cache* row = &s_files_rows[index];
+    copy_str(name_out, name_cap, row->name);
     if (out_size != NULL) {
-        (void)fs_size_at((size_t)index, out_size);
+        *out_size = row->size;
     }
     if (out_backend != NULL) {
-        (void)fs_backend_at((size_t)index, out_backend);
+        *out_backend = row->backend;
     }
     return true;
 }
@@ -2735,12 +2793,13 @@ static void draw_files_content(const rect_i* content) {
     char msg[80];
     size_t idx = 0;
     msg[0] = '\0';
+    files_cache_refresh();
     buf_append_str(msg, sizeof(msg), &idx, "FILES ");
-    buf_append_u32(msg, sizeof(msg), &idx, (uint32_t)fs_count());
+    buf_append_u32(msg, sizeof(msg), &idx, (uint32_t)s_files_total);
     buf_append_str(msg, sizeof(msg), &idx, " (click to open)");
     draw_app_content_line(content, 0, msg, kPalette.text_primary);
 
-    const int total = (int)fs_count();
+    const int total = s_files_row_count;
     for (int row = 0; row < kFileRowsVisible; ++row) {
         const int file_idx = row;
         if (file_idx >= total) {
@@ -3283,7 +3342,7 @@ static void draw_app_window_content(int app_idx, const rect_i* content) {
 
     if (app_idx == APP_NETWORK) {
         draw_app_content_line(content, 0, "Network panel", kPalette.text_primary);
-        draw_app_content_line(content, 1, net_stack_ready() ? "RTL8139 stack: ready" : "RTL8139 stack: unavailable",
+        draw_app_content_line(content, 1, net_stack_ready() ? "Network stack: ready" : "Network stack: unavailable",
                               kPalette.text_muted);
         draw_app_content_line(content, 2, "Send test packet with: ping 1.1.1.1", kPalette.text_muted);
         draw_app_content_line(content, 3, "More details: netinfo", kPalette.text_muted);
@@ -3429,10 +3488,32 @@ static void draw_app_window_content(int app_idx, const rect_i* content) {
     }
 
     if (app_idx == APP_SNAPSHOTS) {
-        draw_app_content_line(content, 0, "Snapshot workflow", kPalette.text_primary);
-        draw_app_content_line(content, 1, "savefs: write RAM filesystem image", kPalette.text_muted);
-        draw_app_content_line(content, 2, "loadfs: restore saved image", kPalette.text_muted);
-        draw_app_content_line(content, 3, "betareport: capture diagnostics snapshot", kPalette.text_muted);
+        draw_app_content_line(content, 0, "Filesystem snapshots (copy-on-write)", kPalette.text_primary);
+        int line = 1;
+        const size_t count = fs_snapshot_count();
+        for (size_t i = 0; i < count && line < 5; ++i) {
+            fs_snapshot_info info;
+            if (!fs_snapshot_info_at(i, &info)) {
+                continue;
+            }
+            char msg[80];
+            size_t idx = 0;
+            msg[0] = '\0';
+            buf_append_char(msg, sizeof(msg), &idx, '#');
+            buf_append_u32(msg, sizeof(msg), &idx, info.id);
+            buf_append_char(msg, sizeof(msg), &idx, ' ');
+            buf_append_str(msg, sizeof(msg), &idx, info.label);
+            buf_append_str(msg, sizeof(msg), &idx, "  ");
+            buf_append_u32(msg, sizeof(msg), &idx, info.files);
+            buf_append_str(msg, sizeof(msg), &idx, " files, ");
+            buf_append_u32(msg, sizeof(msg), &idx, info.private_bytes);
+            buf_append_str(msg, sizeof(msg), &idx, "b private");
+            draw_app_content_line(content, line++, msg, kPalette.text_muted);
+        }
+        if (line == 1) {
+            draw_app_content_line(content, line++, "No snapshots yet.", kPalette.text_muted);
+        }
+        draw_app_content_line(content, line, "snap take [label] / diff <id> / restore <id>; savefs persists", kPalette.text_muted);
         return;
     }
 
@@ -4775,8 +4856,11 @@ static bool handle_settings_click(const rect_i* content) {
 
 static bool handle_notes_click(const rect_i* content) {
     if (rect_contains(notes_save_rect(content), s_mouse_x, s_mouse_y)) {
-        notes_save();
-        desktop_append_log("notes saved");
+        if (notes_save()) {
+            desktop_append_log("notes saved");
+        } else {
+            desktop_append_log(fs_ramdisk_full() ? "notes: save failed (ramdisk full)" : "notes: save failed");
+        }
         request_redraw();
         return true;
     }
@@ -4792,8 +4876,11 @@ static bool handle_notes_click(const rect_i* content) {
 
 static bool handle_editor_click(const rect_i* content) {
     if (rect_contains(editor_save_rect(content), s_mouse_x, s_mouse_y)) {
-        editor_save();
-        desktop_append_log("editor saved");
+        if (editor_save()) {
+            desktop_append_log("editor saved");
+        } else {
+            desktop_append_log(fs_ramdisk_full() ? "editor: save failed (ramdisk full)" : "editor: save failed");
+        }
         request_redraw();
         return true;
     }
@@ -5380,6 +5467,7 @@ void desktop_queue_key(char c) {
 }
 
 void desktop_init(void) {
+    (void)kernel_call_register(KERNEL_CALL_SHELL, run_shell_command);
     s_ticks = 0;
     s_last_frame_tick = 0;
     s_needs_redraw = true;
@@ -5410,6 +5498,10 @@ void desktop_init(void) {
     s_notes_dirty = false;
     s_editor_dirty = false;
     s_files_selected = -1;
+    s_files_cache_gen = 0;
+    if (s_files_watch < 0) {
+        s_files_watch = fs_watch(NULL, FS_EVENT_ALL, files_cache_on_change, NULL);
+    }
     s_last_idle_spins = 0;
     s_max_idle_spins = 1;
     s_perf_hist_len = 0;
@@ -5506,18 +5598,30 @@ void desktop_tick(void) {
     if (s_autosave_ticks >= kTicksPerSecondEstimate * 5U) {
         s_autosave_ticks = 0;
         bool saved = false;
+        bool failed = false;
         if (s_notes_dirty) {
-            notes_save();
-            saved = true;
+            if (notes_save()) {
+                saved = true;
+            } else {
+                failed = true;
+            }
         }
         if (s_editor_dirty) {
-            editor_save();
-            saved = true;
+            if (editor_save()) {
+                saved = true;
+            } else {
+                failed = true;
+            }
         }
-        if (saved) {
+        /* Report a failing autosave once, not every interval. */
+        if (failed && !s_autosave_failed) {
+            log_push_line(fs_ramdisk_full() ? "Autosave failed: ramdisk full." : "Autosave failed.");
+            request_redraw_log_and_status();
+        } else if (saved) {
             log_push_line("Autosaved notes/editor.");
             request_redraw_log_and_status();
         }
+        s_autosave_failed = failed;
     }
 
     apply_mouse_frame_state();
@@ -5741,6 +5845,16 @@ static void process_queued_keys(void) {
     }
 }
 
+typedef struct shell_call {
+    const char* cmd;
+    cli_action action;
+} shell_call;
+
+static void run_shell_command(void* ctx) {
+    shell_call* call = (shell_call*)ctx;
+    call->action = cli_execute(call->cmd);
+}
+
 static void process_pending_shell_command(void) {
     if (!session_logged_in() || !s_has_pending_command) {
         return;
@@ -5751,7 +5865,9 @@ static void process_pending_shell_command(void) {
     s_has_pending_command = false;
     s_pending_command[0] = '\0';
 
-    cli_action action = cli_execute(cmd);
+    shell_call call = {cmd, CLI_ACTION_NONE};
+    kernel_call(KERNEL_CALL_SHELL, &call);
+    const cli_action action = call.action;
     if (action != CLI_ACTION_NONE) {
         if (s_pending_kernel_action == CLI_ACTION_NONE) {
             s_pending_kernel_action = action;
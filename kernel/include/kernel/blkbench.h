@@ -0,0 +1,63 @@
+#ifndef KERNEL_BLKBENCH_H
+#define KERNEL_BLKBENCH_H
+
+#include "drivers/blockdev.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum blkbench_test {
+    BLKBENCH_SEQ_READ = 0,
+    BLKBENCH_SEQ_WRITE,
+    BLKBENCH_RAND_READ,
+    BLKBENCH_RAND_WRITE,
+    BLKBENCH_TEST_COUNT,
+} blkbench_test;
+
+enum {
+    BLKBENCH_MAX_TRANSFER_SECTORS = 256,
+    BLKBENCH_MAX_QUEUE_DEPTH = 32,
+    BLKBENCH_MAX_OPS = 4096,
+};
+
+typedef struct blkbench_config {
+    const blockdev* dev;
+    blkbench_test test;
+    uint32_t transfer_sectors;
+    /*
+     * Requests kept outstanding on the block queue. The device itself sees at
+     * most its driver depth of them at once; a synchronous driver sees one.
+     */
+    uint32_t queue_depth;
+    uint32_t ops;
+} blkbench_config;
+
+typedef struct blkbench_result {
+    uint32_t ops;
+    uint32_t failed;
+    uint32_t elapsed_us;
+    /* Throughput in tenths of MB/s (10^6 bytes). */
+    uint32_t mbps_x10;
+    uint32_t iops;
+    uint32_t lat_p50_us;
+    uint32_t lat_p90_us;
+    uint32_t lat_p99_us;
+    uint32_t lat_max_us;
+} blkbench_result;
+
+/*
+ * Runs one test against a scratch range at the end of dev, clear of the
+ * persist region. Write tests destroy whatever was stored there.
+ */
+bool blkbench_run(const blkbench_config* config, blkbench_result* out);
+const char* blkbench_test_name(blkbench_test test);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
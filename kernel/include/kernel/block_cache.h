@@ -0,0 +1,41 @@
+#ifndef KERNEL_BLOCK_CACHE_H
+#define KERNEL_BLOCK_CACHE_H
+
+#include "drivers/blockdev.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct block_cache_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t readahead;
+    uint32_t writebacks;
+    /* Evictions whose write-back failed; the block stays dirty for the next sync. */
+    uint32_t writeback_errors;
+    uint32_t dirty;
+    uint32_t cached;
+    uint32_t capacity;
+    uint32_t block_bytes;
+} block_cache_stats;
+
+void block_cache_init(void);
+/* Sector-granular access through the shared write-back cache. */
+bool block_cache_read(const blockdev* dev, uint64_t lba, uint32_t count, void* out);
+bool block_cache_write(const blockdev* dev, uint64_t lba, uint32_t count, const void* in);
+/*
+ * Commit point: writes back dirty blocks (dev NULL = every device) through
+ * the request queue, then issues one flush per device as the barrier.
+ */
+bool block_cache_sync(const blockdev* dev);
+void block_cache_get_stats(block_cache_stats* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
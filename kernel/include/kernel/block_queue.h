@@ -0,0 +1,75 @@
+#ifndef KERNEL_BLOCK_QUEUE_H
+#define KERNEL_BLOCK_QUEUE_H
+
+#include "drivers/blockdev.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct block_request block_request;
+/*
+ * Runs with interrupts disabled from the disk IRQ for interrupt-driven
+ * devices, from block_queue_poll/drain for polled asynchronous ones, or
+ * before dispatch returns for synchronous ones; must not block.
+ */
+typedef void (*block_request_done_fn)(block_request* req, bool ok);
+
+struct block_request {
+    const blockdev* dev;
+    uint64_t lba;
+    uint32_t count;
+    void* buf;
+    bool write;
+    block_request_done_fn done;
+    void* ctx;
+
+    /* Owned by the queue from submit until done runs. */
+    uint32_t progress;
+    uint32_t seq;
+    block_request* next;
+};
+
+typedef struct block_queue_stats {
+    uint32_t submitted;
+    uint32_t merged;
+    uint32_t dispatched;
+    uint32_t irq_completions;
+    uint32_t polled_completions;
+    /* Batches put back because the driver was busy in completion context. */
+    uint32_t deferred;
+    uint32_t timeouts;
+} block_queue_stats;
+
+/*
+ * Hooks the IRQ line of every interrupt-capable device registered so far;
+ * asynchronous devices without one are serviced by polling.
+ */
+void block_queue_init(void);
+/*
+ * Requests are served in elevator order, except that overlapping requests
+ * involving a write always reach the device in submission order.
+ */
+bool block_queue_submit(block_request* req);
+/* While plugged (dev NULL = all devices), submissions only queue so they can merge. */
+void block_queue_plug(const blockdev* dev);
+void block_queue_unplug(const blockdev* dev);
+/* Reaps polled completions and retries deferred dispatches; call from the main loop. */
+void block_queue_poll(void);
+/*
+ * Waits until at most max_outstanding requests on dev (NULL = all devices)
+ * are left. Returns false after a timeout that failed the remaining requests.
+ */
+bool block_queue_wait(const blockdev* dev, uint32_t max_outstanding);
+/* Waits until every request on dev has completed, as block_queue_wait(dev, 0). */
+bool block_queue_drain(const blockdev* dev);
+void block_queue_get_stats(block_queue_stats* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -14,8 +14,36 @@ typedef enum fs_backend {
     FS_BACKEND_BOOT_MODULE = 1,
 } fs_backend;
 
+typedef enum fs_snapshot_change {
+    FS_SNAPSHOT_ADDED = 0,
+    FS_SNAPSHOT_REMOVED = 1,
+    FS_SNAPSHOT_MODIFIED = 2,
+} fs_snapshot_change;
+
+typedef struct fs_snapshot_info {
+    uint32_t id;
+    char label[24];
+    uint32_t files;
+    uint32_t bytes;
+    uint32_t private_bytes;
+} fs_snapshot_info;
+
+typedef void (*fs_snapshot_diff_fn)(const char* name, fs_snapshot_change change, void* ctx);
+
+typedef enum fs_event {
+    FS_EVENT_CREATE = 1U << 0,
+    FS_EVENT_WRITE = 1U << 1,
+    FS_EVENT_REMOVE = 1U << 2,
+    FS_EVENT_RESET = 1U << 3,
+    FS_EVENT_ALL = 0x0FU,
+} fs_event;
+
+/* name is NULL for FS_EVENT_RESET. Callbacks must not mutate the filesystem. */
+typedef void (*fs_watch_fn)(const char* name, uint32_t events, void* ctx);
+
 void fs_init(void);
 void fs_reset_ramdisk(void);
+/* Re-importing an existing module fails once fs_map_readonly has mapped it. */
 bool fs_import_module(const char* name, const void* data, size_t size);
 size_t fs_count(void);
 bool fs_name_at(size_t index, char* out, size_t out_cap);
@@ -32,8 +60,28 @@ bool fs_exists(const char* name);
 bool fs_size(const char* name, size_t* out_size);
 size_t fs_ramdisk_used(void);
 size_t fs_ramdisk_capacity(void);
+/* True when every pool block is in use: writes that need a block fail. */
+bool fs_ramdisk_full(void);
 size_t fs_serialize_ramdisk(uint8_t* out, size_t out_cap);
 bool fs_deserialize_ramdisk(const uint8_t* data, size_t size);
+/*
+ * Replaces the ramdisk with a streamed image. The live state is set aside
+ * first (false when there is no memory for it); abort, or an end on an
+ * incomplete image, puts it back unchanged.
+ */
+bool fs_load_stream_begin(void);
+bool fs_load_stream_feed(const uint8_t* data, size_t size);
+bool fs_load_stream_end(void);
+void fs_load_stream_abort(void);
+bool fs_snapshot_create(const char* label, uint32_t* out_id);
+size_t fs_snapshot_count(void);
+bool fs_snapshot_info_at(size_t index, fs_snapshot_info* out_info);
+bool fs_snapshot_restore(uint32_t id);
+bool fs_snapshot_delete(uint32_t id);
+size_t fs_snapshot_diff(uint32_t id, fs_snapshot_diff_fn callback, void* ctx);
+uint32_t fs_generation(void);
+int fs_watch(const char* name, uint32_t event_mask, fs_watch_fn callback, void* ctx);
+void fs_unwatch(int handle);
 
 #ifdef __cplusplus
 }
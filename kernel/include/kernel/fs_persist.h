@@ -2,6 +2,7 @@
 #define KERNEL_FS_PERSIST_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -11,6 +12,8 @@ void fs_persist_init(void);
 bool fs_persist_available(void);
 bool fs_persist_save_now(void);
 bool fs_persist_load_now(void);
+/* First LBA past the largest image the persist region can hold. */
+uint64_t fs_persist_reserved_end(void);
 bool fs_save_to_disk(void);
 bool fs_load_from_disk(void);
 
@@ -1,12 +1,42 @@
 #ifndef KERNEL_INTERRUPTS_H
 #define KERNEL_INTERRUPTS_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef void (*irq_handler_fn)(void* ctx);
+typedef void (*kernel_call_fn)(void* ctx);
+
+/* Kernel entry points the ring-3 desktop tick may request through kernel_call. */
+typedef enum kernel_call_id {
+    KERNEL_CALL_SHELL = 0,
+    KERNEL_CALL_COUNT,
+} kernel_call_id;
+
 void idt_init(void);
 void desktop_tick_user(void);
+/* Fills one kernel_call slot; only accepted at CPL0 and once per slot. */
+bool kernel_call_register(kernel_call_id id, kernel_call_fn fn);
+/*
+ * Runs the registered entry point for id with ctx at CPL0. The desktop tick
+ * has no I/O privilege, so anything it starts that touches ports or the
+ * interrupt flag must go through here. Unknown or empty slots do nothing.
+ */
+void kernel_call(kernel_call_id id, void* ctx);
+
+/*
+ * Legacy PIC lines are remapped to vectors 0x20-0x2F and start masked.
+ * Registering a handler unmasks its line; EOI is sent by the dispatcher.
+ */
+bool irq_register(uint8_t irq, irq_handler_fn handler, void* ctx);
+void irq_enable(void);
+/* Disable interrupts and return the previous EFLAGS for irq_restore. */
+uint32_t irq_save(void);
+void irq_restore(uint32_t flags);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,19 @@
+#ifndef KERNEL_KMEM_H
+#define KERNEL_KMEM_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void* kmem_alloc(size_t size);
+void kmem_free(void* ptr);
+size_t kmem_used(void);
+size_t kmem_capacity(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
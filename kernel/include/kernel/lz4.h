@@ -0,0 +1,20 @@
+#ifndef KERNEL_LZ4_H
+#define KERNEL_LZ4_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool lz4_frame_detect(const uint8_t* data, size_t size);
+bool lz4_frame_content_size(const uint8_t* data, size_t size, size_t* out_size);
+bool lz4_frame_decode(const uint8_t* data, size_t size, uint8_t* out, size_t out_cap, size_t* out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef KERNEL_NET_ARP_H
+#define KERNEL_NET_ARP_H
+
+#include "drivers/pktbuf.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    NET_ARP_MAX_ENTRIES = 32,
+    /* Packets held per unresolved neighbour; the oldest is dropped beyond this. */
+    NET_ARP_MAX_PENDING = 4,
+};
+
+typedef enum net_arp_state {
+    NET_ARP_FREE = 0,
+    /* Request sent, packets queued until the reply. */
+    NET_ARP_INCOMPLETE,
+    NET_ARP_REACHABLE,
+    /* Still used, but old enough that the next send asks again. */
+    NET_ARP_STALE,
+} net_arp_state;
+
+typedef struct net_arp_entry {
+    net_arp_state state;
+    uint32_t ipv4_be;
+    uint8_t mac[6];
+    /* Milliseconds since the mapping was last confirmed. */
+    uint32_t age_ms;
+    uint32_t pending;
+} net_arp_entry;
+
+typedef struct net_arp_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t requests_sent;
+    uint32_t replies_sent;
+    uint32_t updates;
+    /* Queued packets dropped because the neighbour never answered or the queue overflowed. */
+    uint32_t pending_drops;
+    uint32_t evictions;
+} net_arp_stats;
+
+/*
+ * Neighbour cache for the interface net_stack runs on, hashed by address.
+ * Entries are refreshed in the background: a stale mapping keeps being used
+ * while a new request goes out, so only the first packet to a neighbour
+ * waits for resolution.
+ */
+/* Sends a frame whose Ethernet header has been pushed; fills in the destination MAC. Consumes pb. */
+bool net_arp_output(pktbuf* pb, uint32_t next_hop_be);
+void net_arp_input(const uint8_t* frame, size_t len);
+/* Ages entries and retries requests; called from net_stack_poll. */
+void net_arp_timer(void);
+/* Drops every entry and its queued packets (e.g. after an address change). */
+void net_arp_flush(void);
+bool net_arp_entry_at(size_t index, net_arp_entry* out);
+void net_arp_get_stats(net_arp_stats* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef KERNEL_NET_CSUM_H
+#define KERNEL_NET_CSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Internet checksum (RFC 1071). Partial sums are 32-bit values that only
+ * matter modulo 0xFFFF, so they can be chained across buffers and headers
+ * before a final fold; every buffer but the last must have even length.
+ */
+/* Adds data as big-endian 16-bit words (an odd last byte is padded with zero). */
+uint32_t net_csum_add(uint32_t sum, const uint8_t* data, size_t len);
+/* Folds a partial sum to 16 bits and complements it: the value stored in a header. */
+uint16_t net_csum_fold(uint32_t sum);
+/* Sum of the IPv4 pseudo-header that TCP and UDP checksums cover. */
+uint32_t net_csum_pseudo(uint32_t src_ipv4_be, uint32_t dst_ipv4_be, uint8_t protocol, uint16_t length);
+
+/* RFC 1624 incremental update of a stored checksum after one field changes, in O(1). */
+uint16_t net_csum_update16(uint16_t csum, uint16_t old_word, uint16_t new_word);
+uint16_t net_csum_update32(uint16_t csum, uint32_t old_value, uint32_t new_value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
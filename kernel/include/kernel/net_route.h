@@ -0,0 +1,40 @@
+#ifndef KERNEL_NET_ROUTE_H
+#define KERNEL_NET_ROUTE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    NET_ROUTE_MAX = 8,
+};
+
+typedef struct net_route {
+    uint32_t dest_be;
+    uint32_t netmask_be;
+    /* 0 for a directly connected network. */
+    uint32_t gateway_be;
+} net_route;
+
+/*
+ * IPv4 routing table, longest prefix first. net_stack installs the
+ * connected subnet and the default route whenever the interface address
+ * changes; further routes are added from the CLI.
+ */
+bool net_route_add(uint32_t dest_be, uint32_t netmask_be, uint32_t gateway_be);
+bool net_route_remove(uint32_t dest_be, uint32_t netmask_be);
+void net_route_clear(void);
+size_t net_route_count(void);
+bool net_route_at(size_t index, net_route* out);
+/* Picks the most specific route to dst; next_hop is dst itself for on-link routes. */
+bool net_route_lookup(uint32_t dst_be, uint32_t* next_hop_be);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
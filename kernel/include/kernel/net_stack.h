@@ -1,17 +1,37 @@
 #ifndef KERNEL_NET_STACK_H
 #define KERNEL_NET_STACK_H
 
+#include "drivers/netdev.h"
+#include "drivers/pktbuf.h"
+
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Also brings up the loopback device, which carries traffic for 127.0.0.0/8 and the local address. */
 void net_stack_init(void);
 bool net_stack_ready(void);
+/* Interface the stack runs on: the fastest registered NIC (loopback when there is none). */
+const netdev* net_stack_device(void);
 void net_stack_poll(void);
 bool net_stack_send_ping(uint32_t ipv4_be);
+/* Echo replies addressed to us so far. */
+uint32_t net_stack_echo_replies(void);
+uint32_t net_stack_local_ipv4(void);
+/* Source address for a datagram to dst: 127.0.0.1 towards the loopback network, else the interface address. */
+uint32_t net_stack_source_ipv4(uint32_t dst_ipv4_be);
+/* Rejects non-contiguous masks, network/broadcast addresses and off-subnet gateways (0 means none). */
+bool net_stack_set_ipv4(uint32_t ipv4_be, uint32_t netmask_be, uint32_t gateway_be);
+void net_stack_get_ipv4(uint32_t* ipv4_be, uint32_t* netmask_be, uint32_t* gateway_be);
+
+/* For protocol modules: take ownership of the frame being handled (NULL drops it). */
+pktbuf* net_stack_claim(const uint8_t* frame, size_t len);
+/* Prepends IPv4 and Ethernet headers in pb's headroom and routes it out; consumes pb. */
+bool net_stack_send_ipv4(pktbuf* pb, uint32_t dst_ipv4_be, uint8_t protocol);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,107 @@
+#ifndef KERNEL_NET_TCP_H
+#define KERNEL_NET_TCP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    NET_TCP_MAX_SOCKETS = 8,
+    /* Largest segment payload we send or accept over Ethernet. */
+    NET_TCP_MSS = 1460,
+    /* Connections a listener holds before accept; further SYNs are ignored. */
+    NET_TCP_BACKLOG = 4,
+
+    NET_TCP_POLL_IN = 1 << 0,
+    NET_TCP_POLL_OUT = 1 << 1,
+    NET_TCP_POLL_HUP = 1 << 2,
+};
+
+typedef enum net_tcp_state {
+    NET_TCP_CLOSED = 0,
+    NET_TCP_LISTEN,
+    NET_TCP_SYN_SENT,
+    NET_TCP_SYN_RECEIVED,
+    NET_TCP_ESTABLISHED,
+    NET_TCP_FIN_WAIT_1,
+    NET_TCP_FIN_WAIT_2,
+    NET_TCP_CLOSE_WAIT,
+    NET_TCP_CLOSING,
+    NET_TCP_LAST_ACK,
+    NET_TCP_TIME_WAIT,
+} net_tcp_state;
+
+typedef struct net_tcp_info {
+    net_tcp_state state;
+    bool reset;
+    uint32_t srtt_ms;
+    uint32_t rto_ms;
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t snd_wnd;
+    uint32_t rcv_wnd;
+    uint8_t snd_wscale;
+    uint8_t rcv_wscale;
+    uint64_t bytes_acked;
+    uint64_t bytes_received;
+    uint32_t retransmits;
+    uint32_t fast_retransmits;
+    uint32_t ooo_segments;
+} net_tcp_info;
+
+typedef struct net_tcp_stats {
+    uint32_t active_opens;
+    uint32_t passive_opens;
+    uint32_t rx_segments;
+    uint32_t tx_segments;
+    uint32_t rx_errors;
+    uint32_t retransmits;
+    uint32_t fast_retransmits;
+    uint32_t resets_sent;
+    uint32_t resets_received;
+    /* SYNs ignored because the backlog or the socket table was full. */
+    uint32_t listen_drops;
+} net_tcp_stats;
+
+/*
+ * Nonblocking stream sockets. Send copies each byte once, from the caller's
+ * buffer (e.g. a file mapped with fs_map_readonly) into the frame the NIC
+ * transmits from; retransmissions reuse that frame by reference. Received
+ * segments stay in the pktbufs they arrived in until recv copies them out.
+ * Addresses use the numeric a.b.c.d form of net_stack_send_ping.
+ */
+int net_tcp_socket(void);
+/* Port 0 picks a free ephemeral port. */
+bool net_tcp_bind(int sock, uint16_t port);
+bool net_tcp_listen(int sock);
+/* Returns a connected socket, or -1 when none is waiting. */
+int net_tcp_accept(int sock, uint32_t* out_ipv4_be, uint16_t* out_port);
+/* Starts the handshake; poll reports NET_TCP_POLL_OUT once established. */
+bool net_tcp_connect(int sock, uint32_t dst_ipv4_be, uint16_t dst_port);
+/* Queues up to len bytes and returns how many were taken (0 when the send queue is full), -1 on error. */
+int net_tcp_send(int sock, const void* buf, size_t len);
+/* Returns bytes copied, 0 at end of stream, -1 when nothing is available yet. */
+int net_tcp_recv(int sock, void* buf, size_t cap);
+/* Sends FIN after queued data; the stack finishes the close in the background. */
+void net_tcp_close(int sock);
+/* Disables Nagle's algorithm so small writes go out immediately. */
+void net_tcp_set_nodelay(int sock, bool nodelay);
+uint32_t net_tcp_poll(int sock);
+bool net_tcp_get_info(int sock, net_tcp_info* out);
+void net_tcp_get_stats(net_tcp_stats* out);
+const char* net_tcp_state_name(net_tcp_state state);
+
+/* Called by net_stack: retransmit, delayed-ACK and TIME_WAIT timers. */
+void net_tcp_timer(void);
+/* Called by net_stack for an IPv4/TCP frame addressed to us; returns true once the frame is claimed. */
+bool net_tcp_input(const uint8_t* frame, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
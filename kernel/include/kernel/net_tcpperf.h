@@ -0,0 +1,46 @@
+#ifndef KERNEL_NET_TCPPERF_H
+#define KERNEL_NET_TCPPERF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    /* Discard sink that `make nettest` streams into through QEMU port forwarding. */
+    NET_TCPPERF_PORT = 5001,
+};
+
+typedef struct net_tcpperf_result {
+    /* Direction: true when we were the sender. */
+    bool sent;
+    /* False when the connection was reset before the transfer finished. */
+    bool ok;
+    uint64_t bytes;
+    uint32_t ms;
+    uint32_t kib_per_s;
+    uint32_t retransmits;
+} net_tcpperf_result;
+
+/*
+ * TCP throughput test. Received transfers are timed from accept to the
+ * peer's FIN; sent ones from the handshake to the last byte acknowledged.
+ * Each finished transfer is also reported on serial as a
+ * PYCOREOS_TCPPERF line.
+ */
+void net_tcpperf_init(void);
+/* Drives both directions; call from the main loop after net_stack_poll. */
+void net_tcpperf_poll(void);
+/* Streams total bytes to the peer, repeating a private copy of data (zeros when NULL). */
+bool net_tcpperf_start_send(uint32_t ipv4_be, uint16_t port, const uint8_t* data, size_t len, uint32_t total);
+bool net_tcpperf_busy(void);
+bool net_tcpperf_last_result(net_tcpperf_result* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef KERNEL_NET_UDP_H
+#define KERNEL_NET_UDP_H
+
+#include "drivers/pktbuf.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    NET_UDP_MAX_SOCKETS = 16,
+    /* Datagrams a socket holds before new arrivals are dropped. */
+    NET_UDP_RX_QUEUE_MAX = 32,
+    /* Largest payload that fits one Ethernet frame without fragmentation. */
+    NET_UDP_MAX_PAYLOAD = 1472,
+    /* Ports handed out by bind(0). */
+    NET_UDP_EPHEMERAL_FIRST = 49152,
+
+    NET_UDP_POLL_IN = 1 << 0,
+    NET_UDP_POLL_OUT = 1 << 1,
+};
+
+typedef struct net_udp_socket_stats {
+    uint32_t rx_datagrams;
+    /* Arrivals dropped because the receive queue was full. */
+    uint32_t rx_drops;
+    uint32_t tx_datagrams;
+    uint32_t tx_errors;
+    uint32_t queued;
+} net_udp_socket_stats;
+
+typedef struct net_udp_stats {
+    uint32_t rx_datagrams;
+    /* Datagrams for a port nobody has bound. */
+    uint32_t rx_no_port;
+    /* Bad length or checksum. */
+    uint32_t rx_errors;
+    uint32_t rx_queue_drops;
+    uint32_t tx_datagrams;
+    uint32_t tx_errors;
+} net_udp_stats;
+
+/*
+ * Nonblocking datagram sockets identified by small integer handles. Bound
+ * ports are found through a hash table; each socket keeps its own bounded
+ * queue of received pktbufs. Addresses use the same numeric a.b.c.d form
+ * as net_stack_send_ping.
+ */
+int net_udp_socket(void);
+/* Port 0 picks a free ephemeral port. */
+bool net_udp_bind(int sock, uint16_t port);
+void net_udp_close(int sock);
+uint16_t net_udp_local_port(int sock);
+/* Returns len on success, -1 on failure. An unbound socket is bound to an ephemeral port first. */
+int net_udp_sendto(int sock, const void* buf, size_t len, uint32_t dst_ipv4_be, uint16_t dst_port);
+/* Copies the oldest datagram into buf (the excess is discarded); -1 when none is queued. */
+int net_udp_recvfrom(int sock, void* buf, size_t cap, uint32_t* out_ipv4_be, uint16_t* out_port);
+/* Readiness mask of NET_UDP_POLL_* bits. */
+uint32_t net_udp_poll(int sock);
+bool net_udp_get_socket_stats(int sock, net_udp_socket_stats* out);
+void net_udp_get_stats(net_udp_stats* out);
+
+/* Zero-copy variants: send consumes pb (payload at pb->data, 42 bytes of headroom needed). */
+bool net_udp_send_pktbuf(int sock, pktbuf* pb, uint32_t dst_ipv4_be, uint16_t dst_port);
+/* The returned pktbuf holds just the payload and belongs to the caller. */
+pktbuf* net_udp_recv_pktbuf(int sock, uint32_t* out_ipv4_be, uint16_t* out_port);
+
+/* Called by net_stack for an IPv4/UDP frame addressed to us or broadcast; returns true once the frame is claimed. */
+bool net_udp_input(const uint8_t* frame, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
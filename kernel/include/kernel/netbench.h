@@ -0,0 +1,58 @@
+#ifndef KERNEL_NETBENCH_H
+#define KERNEL_NETBENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum netbench_test {
+    NETBENCH_UDP = 0,
+    NETBENCH_ICMP,
+    NETBENCH_TCP,
+    NETBENCH_TEST_COUNT,
+} netbench_test;
+
+enum {
+    /* UDP and TCP port the benchmark receives on. */
+    NETBENCH_PORT = 5002,
+    /* One UDP datagram per frame. */
+    NETBENCH_MAX_SIZE = 1472,
+    NETBENCH_MAX_COUNT = 1000000,
+};
+
+typedef struct netbench_config {
+    netbench_test test;
+    /* Datagrams, echo requests or TCP writes. */
+    uint32_t count;
+    /* Bytes per datagram or write; echo requests carry no payload. */
+    uint32_t size;
+} netbench_config;
+
+typedef struct netbench_result {
+    /* Frames the stack received over loopback, both directions. */
+    uint32_t packets;
+    /* Payload delivered to the receiving socket (8-byte echo messages for ICMP). */
+    uint32_t bytes;
+    /* Datagrams or echoes that never came back. */
+    uint32_t lost;
+    uint32_t elapsed_us;
+    uint32_t packets_per_s;
+    uint32_t bytes_per_s;
+    uint32_t cycles_per_packet;
+} netbench_result;
+
+/*
+ * Drives the stack over the loopback device: both ends of every exchange
+ * run in this call, so the figures measure protocol processing alone.
+ */
+bool netbench_run(const netbench_config* config, netbench_result* out);
+const char* netbench_test_name(netbench_test test);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -9,6 +9,12 @@ extern "C" {
 
 void timing_init_from_frame_cycles(uint32_t frame_cycles_60hz);
 void timing_sleep_ms(uint32_t ms);
+void timing_calibrate_tsc(void);
+uint64_t timing_tsc_now(void);
+uint32_t timing_tsc_khz(void);
+uint32_t timing_tsc_to_us(uint64_t cycles);
+/* Milliseconds since boot from the TSC; wraps after about 49 days. */
+uint32_t timing_ms_now(void);
 
 #ifdef __cplusplus
 }
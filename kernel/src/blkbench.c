@@ -0,0 +1,206 @@
+#include "kernel/blkbench.h"
+
+#include "kernel/block_queue.h"
+#include "kernel/fs_persist.h"
+#include "kernel/interrupts.h"
+#include "kernel/kmem.h"
+#include "kernel/timing.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    /* Upper bound on the scratch range: the last 64 MiB of the device. */
+    kBenchScratchSectors = 131072,
+};
+
+static const char* const kTestNames[BLKBENCH_TEST_COUNT] = {
+    "seqread",
+    "seqwrite",
+    "randread",
+    "randwrite",
+};
+
+typedef struct bench_slot {
+    block_request req;
+    uint64_t start_tsc;
+} bench_slot;
+
+static bench_slot s_slots[BLKBENCH_MAX_QUEUE_DEPTH];
+/* Slots whose request has completed; pushed by bench_done, popped by the submit loop. */
+static uint32_t s_free_slots[BLKBENCH_MAX_QUEUE_DEPTH];
+static volatile uint32_t s_free_count = 0;
+static uint32_t s_latency_us[BLKBENCH_MAX_OPS];
+static uint32_t s_latency_count = 0;
+static uint32_t s_failed = 0;
+
+static void bench_done(block_request* req, bool ok) {
+    const bench_slot* slot = (const bench_slot*)req->ctx;
+    if (!ok) {
+        ++s_failed;
+    }
+    if (s_latency_count < BLKBENCH_MAX_OPS) {
+        s_latency_us[s_latency_count++] = timing_tsc_to_us(timing_tsc_now() - slot->start_tsc);
+    }
+    s_free_slots[s_free_count++] = (uint32_t)(slot - s_slots);
+}
+
+static uint32_t take_free_slot(void) {
+    const uint32_t flags = irq_save();
+    const uint32_t index = s_free_slots[--s_free_count];
+    irq_restore(flags);
+    return index;
+}
+
+static uint32_t xorshift32(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13U;
+    x ^= x >> 17U;
+    x ^= x << 5U;
+    *state = x;
+    return x;
+}
+
+/* num * mul / den in 32 bits, trading low bits of num and den for range. */
+static uint32_t scaled_ratio(uint32_t num, uint32_t mul, uint32_t den) {
+    while (num > 0xFFFFFFFFU / mul) {
+        num >>= 1U;
+        den >>= 1U;
+    }
+    return (den > 0U) ? (num * mul) / den : 0U;
+}
+
+static void sort_latencies(uint32_t* v, uint32_t n) {
+    /* Shell sort with Ciura's gaps: n is at most BLKBENCH_MAX_OPS. */
+    static const uint32_t kGaps[] = {701U, 301U, 132U, 57U, 23U, 10U, 4U, 1U};
+    for (size_t g = 0; g < sizeof(kGaps) / sizeof(kGaps[0]); ++g) {
+        const uint32_t gap = kGaps[g];
+        for (uint32_t i = gap; i < n; ++i) {
+            const uint32_t key = v[i];
+            uint32_t j = i;
+            while (j >= gap && v[j - gap] > key) {
+                v[j] = v[j - gap];
+                j -= gap;
+            }
+            v[j] = key;
+        }
+    }
+}
+
+static uint32_t percentile(const uint32_t* sorted, uint32_t n, uint32_t pct) {
+    if (n == 0U) {
+        return 0U;
+    }
+    const uint32_t idx = (n * pct + 99U) / 100U;
+    return sorted[(idx > 0U) ? idx - 1U : 0U];
+}
+
+const char* blkbench_test_name(blkbench_test test) {
+    return ((uint32_t)test < BLKBENCH_TEST_COUNT) ? kTestNames[test] : "?";
+}
+
+bool blkbench_run(const blkbench_config* config, blkbench_result* out) {
+    if (config == NULL || out == NULL || config->dev == NULL || (uint32_t)config->test >= BLKBENCH_TEST_COUNT) {
+        return false;
+    }
+    const uint32_t xfer = config->transfer_sectors;
+    const uint32_t depth = config->queue_depth;
+    const uint32_t ops = config->ops;
+    if (xfer == 0U || xfer > BLKBENCH_MAX_TRANSFER_SECTORS || depth == 0U || depth > BLKBENCH_MAX_QUEUE_DEPTH ||
+        ops == 0U || ops > BLKBENCH_MAX_OPS || timing_tsc_khz() == 0U) {
+        return false;
+    }
+
+    const blockdev* dev = config->dev;
+    const uint64_t floor = fs_persist_reserved_end();
+    if (dev->sector_count <= floor) {
+        return false;
+    }
+    uint64_t span = dev->sector_count - floor;
+    if (span > kBenchScratchSectors) {
+        span = kBenchScratchSectors;
+    }
+    const uint32_t slots_in_span = (uint32_t)span / xfer;
+    if (slots_in_span < depth) {
+        return false;
+    }
+    const uint64_t base = dev->sector_count - (uint64_t)slots_in_span * xfer;
+
+    const size_t slot_bytes = (size_t)xfer * BLOCKDEV_SECTOR_SIZE;
+    uint8_t* buffers = (uint8_t*)kmem_alloc(slot_bytes * depth);
+    if (buffers == NULL) {
+        return false;
+    }
+    const bool write = config->test == BLKBENCH_SEQ_WRITE || config->test == BLKBENCH_RAND_WRITE;
+    const bool random = config->test == BLKBENCH_RAND_READ || config->test == BLKBENCH_RAND_WRITE;
+    for (size_t i = 0; i < slot_bytes * depth; ++i) {
+        buffers[i] = (uint8_t)(i * 31U + 7U);
+    }
+
+    s_latency_count = 0;
+    s_failed = 0;
+    s_free_count = depth;
+    for (uint32_t i = 0; i < depth; ++i) {
+        s_free_slots[i] = depth - 1U - i;
+    }
+    uint32_t rng = 0x2545F491U;
+    uint32_t next_slot = 0;
+    uint32_t issued = 0;
+    bool drained = true;
+
+    /*
+     * Keeps depth requests outstanding: each completion frees a slot that is
+     * refilled at once, so the device sees up to min(depth, driver depth)
+     * commands in flight rather than rounds that drain to empty.
+     */
+    const uint64_t start = timing_tsc_now();
+    while (issued < ops) {
+        while (drained && s_free_count == 0U) {
+            drained = block_queue_wait(dev, depth - 1U);
+        }
+        if (!drained) {
+            break;
+        }
+        const uint32_t slot_index = random ? xorshift32(&rng) % slots_in_span : next_slot;
+        next_slot = (next_slot + 1U == slots_in_span) ? 0U : next_slot + 1U;
+
+        const uint32_t i = take_free_slot();
+        bench_slot* slot = &s_slots[i];
+        slot->req.dev = dev;
+        slot->req.lba = base + (uint64_t)slot_index * xfer;
+        slot->req.count = xfer;
+        slot->req.buf = buffers + (size_t)i * slot_bytes;
+        slot->req.write = write;
+        slot->req.done = bench_done;
+        slot->req.ctx = slot;
+        slot->start_tsc = timing_tsc_now();
+        ++issued;
+        if (!block_queue_submit(&slot->req)) {
+            const uint32_t flags = irq_save();
+            ++s_failed;
+            s_free_slots[s_free_count++] = i;
+            irq_restore(flags);
+        }
+    }
+    if (drained) {
+        drained = block_queue_drain(dev);
+    }
+    const uint32_t elapsed_us = timing_tsc_to_us(timing_tsc_now() - start);
+    kmem_free(buffers);
+
+    sort_latencies(s_latency_us, s_latency_count);
+    const uint32_t us = (elapsed_us > 0U) ? elapsed_us : 1U;
+    const uint32_t done = issued - s_failed;
+    out->ops = issued;
+    out->failed = s_failed;
+    out->elapsed_us = elapsed_us;
+    /* At most 4096 x 128 KiB, so the byte count fits in 32 bits. */
+    out->mbps_x10 = scaled_ratio(done * (uint32_t)slot_bytes, 10U, us);
+    out->iops = scaled_ratio(done, 1000000U, us);
+    out->lat_p50_us = percentile(s_latency_us, s_latency_count, 50U);
+    out->lat_p90_us = percentile(s_latency_us, s_latency_count, 90U);
+    out->lat_p99_us = percentile(s_latency_us, s_latency_count, 99U);
+    out->lat_max_us = (s_latency_count > 0U) ? s_latency_us[s_latency_count - 1U] : 0U;
+    return drained && s_failed == 0U;
+}
@@ -0,0 +1,380 @@
+#include "kernel/block_cache.h"
+
+#include "kernel/block_queue.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    kCacheBlockShift = 3,
+    kCacheBlockSectors = 1 << kCacheBlockShift,
+    kCacheBlockBytes = kCacheBlockSectors * BLOCKDEV_SECTOR_SIZE,
+    kCacheBlocks = 256,
+    kCacheBuckets = 128,
+    kCacheNone = -1,
+    /* Blocks fetched on a miss that continues a sequential scan. */
+    kReadAheadBlocks = 8,
+};
+
+/*
+ * 4 KiB blocks keyed by (device, LBA / 8), chained in a hash table and kept
+ * on an LRU list. Dirty blocks stay in memory until sync or eviction.
+ */
+typedef struct cache_entry {
+    const blockdev* dev;
+    uint64_t block;
+    uint16_t sectors;
+    bool valid;
+    bool dirty;
+    int16_t hash_next;
+    int16_t lru_prev;
+    int16_t lru_next;
+} cache_entry;
+
+static cache_entry s_entries[kCacheBlocks];
+static uint8_t s_data[kCacheBlocks][kCacheBlockBytes] __attribute__((aligned(4096)));
+static uint8_t s_staging[kReadAheadBlocks * kCacheBlockBytes] __attribute__((aligned(4096)));
+static int16_t s_buckets[kCacheBuckets];
+static int16_t s_lru_head = kCacheNone;
+static int16_t s_lru_tail = kCacheNone;
+static const blockdev* s_seq_dev = NULL;
+static uint64_t s_seq_next = 0;
+static block_cache_stats s_stats;
+static block_request s_sync_reqs[kCacheBlocks];
+static uint32_t s_sync_failed = 0;
+
+static void copy_bytes(uint8_t* dst, const uint8_t* src, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        dst[i] = src[i];
+    }
+}
+
+static uint32_t bucket_of(const blockdev* dev, uint64_t block) {
+    uint32_t h = (uint32_t)block ^ (uint32_t)(block >> 32U);
+    h ^= (uint32_t)(uintptr_t)dev * 0x9E3779B1U;
+    h *= 0x85EBCA6BU;
+    return (h >> 16U) & (kCacheBuckets - 1U);
+}
+
+static uint16_t block_sectors(const blockdev* dev, uint64_t block) {
+    const uint64_t first = block << kCacheBlockShift;
+    const uint64_t left = dev->sector_count - first;
+    return (uint16_t)((left < kCacheBlockSectors) ? left : kCacheBlockSectors);
+}
+
+static int lookup(const blockdev* dev, uint64_t block) {
+    for (int i = s_buckets[bucket_of(dev, block)]; i != kCacheNone; i = s_entries[i].hash_next) {
+        if (s_entries[i].dev == dev && s_entries[i].block == block) {
+            return i;
+        }
+    }
+    return kCacheNone;
+}
+
+static void hash_remove(int idx) {
+    int16_t* link = &s_buckets[bucket_of(s_entries[idx].dev, s_entries[idx].block)];
+    while (*link != kCacheNone) {
+        if (*link == idx) {
+            *link = s_entries[idx].hash_next;
+            return;
+        }
+        link = &s_entries[*link].hash_next;
+    }
+}
+
+static void lru_unlink(int idx) {
+    cache_entry* e = &s_entries[idx];
+    if (e->lru_prev != kCacheNone) {
+        s_entries[e->lru_prev].lru_next = e->lru_next;
+    } else {
+        s_lru_head = e->lru_next;
+    }
+    if (e->lru_next != kCacheNone) {
+        s_entries[e->lru_next].lru_prev = e->lru_prev;
+    } else {
+        s_lru_tail = e->lru_prev;
+    }
+}
+
+static void lru_push_front(int idx) {
+    cache_entry* e = &s_entries[idx];
+    e->lru_prev = kCacheNone;
+    e->lru_next = s_lru_head;
+    if (s_lru_head != kCacheNone) {
+        s_entries[s_lru_head].lru_prev = (int16_t)idx;
+    }
+    s_lru_head = (int16_t)idx;
+    if (s_lru_tail == kCacheNone) {
+        s_lru_tail = (int16_t)idx;
+    }
+}
+
+static void touch(int idx) {
+    if (s_lru_head != idx) {
+        lru_unlink(idx);
+        lru_push_front(idx);
+    }
+}
+
+static bool write_back(int idx) {
+    cache_entry* e = &s_entries[idx];
+    if (!blockdev_write(e->dev, e->block << kCacheBlockShift, e->sectors, s_data[idx])) {
+        return false;
+    }
+    e->dirty = false;
+    ++s_stats.writebacks;
+    return true;
+}
+
+/*
+ * Recycles the least recently used block for (dev, block); data is left to
+ * the caller. One dirty victim per call gets a write-back; if that fails the
+ * block keeps its data, moves to the front and only clean blocks are taken
+ * past it, so one bad sector cannot wedge every later miss.
+ */
+static int claim(const blockdev* dev, uint64_t block) {
+    bool tried_writeback = false;
+    int idx = s_lru_tail;
+    while (idx != kCacheNone && s_entries[idx].valid && s_entries[idx].dirty) {
+        const int prev = s_entries[idx].lru_prev;
+        if (!tried_writeback) {
+            tried_writeback = true;
+            if (write_back(idx)) {
+                break;
+            }
+            ++s_stats.writeback_errors;
+            touch(idx);
+        }
+        idx = prev;
+    }
+    if (idx == kCacheNone) {
+        return kCacheNone;
+    }
+
+    cache_entry* e = &s_entries[idx];
+    if (e->valid) {
+        hash_remove(idx);
+    }
+
+    e->dev = dev;
+    e->block = block;
+    e->sectors = block_sectors(dev, block);
+    e->valid = true;
+    e->dirty = false;
+    const uint32_t bucket = bucket_of(dev, block);
+    e->hash_next = s_buckets[bucket];
+    s_buckets[bucket] = (int16_t)idx;
+    touch(idx);
+    return idx;
+}
+
+/*
+ * Returns the cached block, reading it on a miss. A miss on the block right
+ * after the previous access reads ahead, stopping early at cached blocks.
+ */
+static int fetch(const blockdev* dev, uint64_t block) {
+    const bool sequential = dev == s_seq_dev && block == s_seq_next;
+    s_seq_dev = dev;
+    s_seq_next = block + 1U;
+
+    int idx = lookup(dev, block);
+    if (idx != kCacheNone) {
+        ++s_stats.hits;
+        touch(idx);
+        return idx;
+    }
+    ++s_stats.misses;
+
+    const uint64_t last_block = (dev->sector_count - 1U) >> kCacheBlockShift;
+    uint32_t run = 1;
+    uint32_t sectors = block_sectors(dev, block);
+    while (sequential && run < kReadAheadBlocks && block + run <= last_block &&
+           lookup(dev, block + run) == kCacheNone) {
+        sectors += block_sectors(dev, block + run);
+        ++run;
+    }
+    if (!blockdev_read(dev, block << kCacheBlockShift, sectors, s_staging)) {
+        return kCacheNone;
+    }
+
+    int first = kCacheNone;
+    for (uint32_t i = 0; i < run; ++i) {
+        idx = claim(dev, block + i);
+        if (idx == kCacheNone) {
+            break;
+        }
+        copy_bytes(s_data[idx], s_staging + (size_t)i * kCacheBlockBytes,
+                   (size_t)s_entries[idx].sectors * BLOCKDEV_SECTOR_SIZE);
+        if (i == 0) {
+            first = idx;
+        } else {
+            ++s_stats.readahead;
+        }
+    }
+    if (first != kCacheNone) {
+        touch(first);
+    }
+    return first;
+}
+
+void block_cache_init(void) {
+    for (int i = 0; i < kCacheBuckets; ++i) {
+        s_buckets[i] = kCacheNone;
+    }
+    s_lru_head = kCacheNone;
+    s_lru_tail = kCacheNone;
+    for (int i = 0; i < kCacheBlocks; ++i) {
+        s_entries[i].dev = NULL;
+        s_entries[i].valid = false;
+        s_entries[i].dirty = false;
+        s_entries[i].hash_next = kCacheNone;
+        lru_push_front(i);
+    }
+    s_seq_dev = NULL;
+    s_seq_next = 0;
+
+    s_stats.hits = 0;
+    s_stats.misses = 0;
+    s_stats.readahead = 0;
+    s_stats.writebacks = 0;
+    s_stats.writeback_errors = 0;
+    s_stats.capacity = kCacheBlocks;
+    s_stats.block_bytes = kCacheBlockBytes;
+}
+
+static bool range_ok(const blockdev* dev, uint64_t lba, uint32_t count) {
+    return dev != NULL && lba <= dev->sector_count && count <= dev->sector_count - lba;
+}
+
+bool block_cache_read(const blockdev* dev, uint64_t lba, uint32_t count, void* out) {
+    if (out == NULL || !range_ok(dev, lba, count)) {
+        return false;
+    }
+
+    uint8_t* dst = (uint8_t*)out;
+    while (count > 0) {
+        const uint64_t block = lba >> kCacheBlockShift;
+        const uint32_t offset = (uint32_t)(lba & (kCacheBlockSectors - 1U));
+        const int idx = fetch(dev, block);
+        if (idx == kCacheNone) {
+            return false;
+        }
+
+        uint32_t n = s_entries[idx].sectors - offset;
+        if (n > count) {
+            n = count;
+        }
+        copy_bytes(dst, s_data[idx] + (size_t)offset * BLOCKDEV_SECTOR_SIZE, (size_t)n * BLOCKDEV_SECTOR_SIZE);
+        dst += (size_t)n * BLOCKDEV_SECTOR_SIZE;
+        lba += n;
+        count -= n;
+    }
+    return true;
+}
+
+bool block_cache_write(const blockdev* dev, uint64_t lba, uint32_t count, const void* in) {
+    if (in == NULL || !range_ok(dev, lba, count)) {
+        return false;
+    }
+
+    const uint8_t* src = (const uint8_t*)in;
+    while (count > 0) {
+        const uint64_t block = lba >> kCacheBlockShift;
+        const uint32_t offset = (uint32_t)(lba & (kCacheBlockSectors - 1U));
+        uint32_t n = block_sectors(dev, block) - offset;
+        if (n > count) {
+            n = count;
+        }
+
+        /* Whole-block overwrites skip the read half of read-modify-write. */
+        int idx = lookup(dev, block);
+        if (idx != kCacheNone) {
+            ++s_stats.hits;
+            touch(idx);
+        } else if (offset == 0 && n == block_sectors(dev, block)) {
+            ++s_stats.misses;
+            idx = claim(dev, block);
+        } else {
+            idx = fetch(dev, block);
+        }
+        if (idx == kCacheNone) {
+            return false;
+        }
+
+        copy_bytes(s_data[idx] + (size_t)offset * BLOCKDEV_SECTOR_SIZE, src, (size_t)n * BLOCKDEV_SECTOR_SIZE);
+        s_entries[idx].dirty = true;
+        src += (size_t)n * BLOCKDEV_SECTOR_SIZE;
+        lba += n;
+        count -= n;
+    }
+    return true;
+}
+
+static bool flush_devices(const blockdev* dev) {
+    if (dev != NULL) {
+        return blockdev_flush(dev);
+    }
+    bool ok = true;
+    for (size_t i = 0; i < blockdev_count(); ++i) {
+        ok = blockdev_flush(blockdev_at(i)) && ok;
+    }
+    return ok;
+}
+
+static void sync_done(block_request* req, bool ok) {
+    if (ok) {
+        ((cache_entry*)req->ctx)->dirty = false;
+        ++s_stats.writebacks;
+    } else {
+        ++s_sync_failed;
+    }
+}
+
+/*
+ * Every dirty block becomes one request on a plugged queue; the elevator
+ * sorts them and merges adjacent blocks into large writes on unplug.
+ */
+bool block_cache_sync(const blockdev* dev) {
+    s_sync_failed = 0;
+    block_queue_plug(dev);
+    for (int i = 0; i < kCacheBlocks; ++i) {
+        cache_entry* entry = &s_entries[i];
+        if (!entry->valid || !entry->dirty || (dev != NULL && entry->dev != dev)) {
+            continue;
+        }
+        block_request* req = &s_sync_reqs[i];
+        req->dev = entry->dev;
+        req->lba = entry->block << kCacheBlockShift;
+        req->count = entry->sectors;
+        req->buf = s_data[i];
+        req->write = true;
+        req->done = sync_done;
+        req->ctx = entry;
+        if (!block_queue_submit(req)) {
+            ++s_sync_failed;
+        }
+    }
+    block_queue_unplug(dev);
+    const bool drained = block_queue_drain(dev);
+
+    return flush_devices(dev) && drained && s_sync_failed == 0;
+}
+
+void block_cache_get_stats(block_cache_stats* out) {
+    if (out == NULL) {
+        return;
+    }
+
+    s_stats.dirty = 0;
+    s_stats.cached = 0;
+    for (int i = 0; i < kCacheBlocks; ++i) {
+        if (s_entries[i].valid) {
+            ++s_stats.cached;
+            if (s_entries[i].dirty) {
+                ++s_stats.dirty;
+            }
+        }
+    }
+    *out = s_stats;
+}
@@ -0,0 +1,510 @@
+#include "kernel/block_queue.h"
+
+#include "kernel/interrupts.h"
+#include "kernel/kmem.h"
+#include "kernel/timing.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    kQueueDevMax = 8,
+    /* Largest merged dispatch; matches the per-command limit of the disk drivers. */
+    kDispatchMaxSectors = 256,
+    kBatchMax = 64,
+    /* Dispatches in flight per device; the deepest driver queue (AHCI NCQ) has 32 tags. */
+    kInflightMax = 32,
+    kDrainTimeoutMs = 5000,
+    /* Before the TSC is calibrated, drain counts pause iterations instead. */
+    kDrainSpinBudget = 100000000,
+    kEflagsIf = 0x200,
+};
+
+typedef struct device_queue device_queue;
+
+/* One driver command: the head chunk of reqs[0] plus whole merged successors. */
+typedef struct queue_batch {
+    device_queue* dq;
+    bool active;
+    block_request* reqs[kBatchMax];
+    uint32_t count;
+    uint32_t sectors;
+    uint32_t head_chunk;
+    bool write;
+    bool bounced;
+    uint8_t* bounce;
+} queue_batch;
+
+/*
+ * Per-device elevator: pending requests are kept sorted by the next LBA to
+ * transfer and served in one direction (C-LOOK). Adjacent requests with the
+ * same direction are merged into one driver command, through a bounce buffer
+ * when their memory is not contiguous. Up to depth commands are in flight.
+ */
+struct device_queue {
+    const blockdev* dev;
+    bool async;
+    bool polled;
+    bool failing;
+    /* A synchronous transfer is running with interrupts enabled. */
+    bool sync_busy;
+    uint32_t depth;
+    uint32_t plugged;
+    block_request* pending;
+    uint32_t outstanding;
+    uint32_t inflight;
+    uint64_t head;
+    queue_batch batches[kInflightMax];
+};
+
+static device_queue s_queues[kQueueDevMax];
+static size_t s_queue_count = 0;
+static block_queue_stats s_stats;
+static uint32_t s_next_seq = 0;
+/* Nonzero while completions run; dispatch then never falls back to synchronous I/O. */
+static uint32_t s_completing = 0;
+
+static void copy_bytes(uint8_t* dst, const uint8_t* src, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        dst[i] = src[i];
+    }
+}
+
+static uint64_t next_lba(const block_request* req) {
+    return req->lba + req->progress;
+}
+
+static device_queue* queue_for(const blockdev* dev) {
+    for (size_t i = 0; i < s_queue_count; ++i) {
+        if (s_queues[i].dev == dev) {
+            return &s_queues[i];
+        }
+    }
+    if (dev == NULL || s_queue_count >= kQueueDevMax) {
+        return NULL;
+    }
+
+    device_queue* dq = &s_queues[s_queue_count++];
+    dq->dev = dev;
+    dq->async = false;
+    dq->polled = false;
+    dq->failing = false;
+    dq->sync_busy = false;
+    dq->depth = 1;
+    dq->plugged = 0;
+    dq->pending = NULL;
+    dq->outstanding = 0;
+    dq->inflight = 0;
+    dq->head = 0;
+    for (size_t i = 0; i < kInflightMax; ++i) {
+        dq->batches[i].dq = dq;
+        dq->batches[i].active = false;
+        dq->batches[i].count = 0;
+        dq->batches[i].bounce = NULL;
+    }
+    return dq;
+}
+
+static void insert_sorted(device_queue* dq, block_request* req) {
+    block_request** link = &dq->pending;
+    while (*link != NULL && next_lba(*link) <= next_lba(req)) {
+        link = &(*link)->next;
+    }
+    req->next = *link;
+    *link = req;
+}
+
+static bool conflicts(const block_request* a, const block_request* b) {
+    if (!a->write && !b->write) {
+        return false;
+    }
+    return a->lba < b->lba + b->count && b->lba < a->lba + a->count;
+}
+
+/* Overlapping requests that involve a write reach the device in submission order. */
+static bool must_wait(const device_queue* dq, const block_request* req) {
+    for (const block_request* p = dq->pending; p != NULL; p = p->next) {
+        if (p != req && (int32_t)(p->seq - req->seq) < 0 && conflicts(p, req)) {
+            return true;
+        }
+    }
+    for (size_t i = 0; i < kInflightMax; ++i) {
+        const queue_batch* qb = &dq->batches[i];
+        for (uint32_t j = 0; qb->active && j < qb->count; ++j) {
+            if (conflicts(qb->reqs[j], req)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void complete(device_queue* dq, block_request* req, bool ok) {
+    req->next = NULL;
+    --dq->outstanding;
+    if (req->done != NULL) {
+        ++s_completing;
+        req->done(req, ok);
+        --s_completing;
+    }
+}
+
+static void finish_batch(queue_batch* qb, bool ok) {
+    device_queue* dq = qb->dq;
+    block_request* head = qb->reqs[0];
+    if (ok && qb->bounced && !qb->write) {
+        size_t offset = 0;
+        for (uint32_t i = 0; i < qb->count; ++i) {
+            block_request* req = qb->reqs[i];
+            const uint32_t sectors = (i == 0) ? qb->head_chunk : req->count;
+            const size_t skip = (i == 0) ? (size_t)req->progress * BLOCKDEV_SECTOR_SIZE : 0U;
+            copy_bytes((uint8_t*)req->buf + skip, qb->bounce + offset, (size_t)sectors * BLOCKDEV_SECTOR_SIZE);
+            offset += (size_t)sectors * BLOCKDEV_SECTOR_SIZE;
+        }
+    }
+
+    qb->active = false;
+    --dq->inflight;
+    head->progress += qb->head_chunk;
+    for (uint32_t i = 0; i < qb->count; ++i) {
+        block_request* req = qb->reqs[i];
+        if (i == 0 && ok && head->progress < head->count) {
+            insert_sorted(dq, head);
+            continue;
+        }
+        complete(dq, req, ok);
+    }
+    qb->count = 0;
+}
+
+/* Hands a batch the driver refused back to the elevator untouched. */
+static void unbuild_batch(queue_batch* qb) {
+    device_queue* dq = qb->dq;
+    qb->active = false;
+    --dq->inflight;
+    for (uint32_t i = 0; i < qb->count; ++i) {
+        insert_sorted(dq, qb->reqs[i]);
+    }
+    qb->count = 0;
+}
+
+static void dispatch(device_queue* dq, uint32_t flags);
+
+static void driver_done(void* token, bool ok) {
+    queue_batch* qb = (queue_batch*)token;
+    ++s_completing;
+    finish_batch(qb, ok);
+    dispatch(qb->dq, 0);
+    --s_completing;
+}
+
+static bool ensure_bounce(queue_batch* qb) {
+    if (qb->bounce == NULL) {
+        qb->bounce = (uint8_t*)kmem_alloc((size_t)kDispatchMaxSectors * BLOCKDEV_SECTOR_SIZE);
+    }
+    return qb->bounce != NULL;
+}
+
+/*
+ * Pops the next request in elevator order that no earlier overlapping
+ * request holds back, and merges its contiguous successors. Returns false
+ * when every pending request has to wait for one in flight.
+ */
+static bool build_batch(device_queue* dq, queue_batch* qb) {
+    block_request** start = &dq->pending;
+    while (*start != NULL && next_lba(*start) < dq->head) {
+        start = &(*start)->next;
+    }
+
+    block_request** link = NULL;
+    for (block_request** l = start; *l != NULL && link == NULL; l = &(*l)->next) {
+        if (!must_wait(dq, *l)) {
+            link = l;
+        }
+    }
+    for (block_request** l = &dq->pending; l != start && link == NULL; l = &(*l)->next) {
+        if (!must_wait(dq, *l)) {
+            link = l;
+        }
+    }
+    if (link == NULL) {
+        return false;
+    }
+
+    block_request* first = *link;
+    *link = first->next;
+
+    const uint32_t remaining = first->count - first->progress;
+    const uint32_t chunk = (remaining < kDispatchMaxSectors) ? remaining : kDispatchMaxSectors;
+    qb->reqs[0] = first;
+    qb->count = 1;
+    qb->head_chunk = chunk;
+    qb->sectors = chunk;
+    qb->write = first->write;
+    qb->bounced = false;
+
+    const uint64_t lba = next_lba(first);
+    uint8_t* mem_end = (uint8_t*)first->buf + (size_t)(first->progress + chunk) * BLOCKDEV_SECTOR_SIZE;
+    while (chunk == remaining && *link != NULL && qb->count < kBatchMax) {
+        block_request* next = *link;
+        if (next->write != qb->write || next->progress != 0 || next->lba != lba + qb->sectors ||
+            qb->sectors + next->count > kDispatchMaxSectors || must_wait(dq, next)) {
+            break;
+        }
+        if ((uint8_t*)next->buf != mem_end) {
+            if (!ensure_bounce(qb)) {
+                break;
+            }
+            qb->bounced = true;
+        }
+
+        *link = next->next;
+        qb->reqs[qb->count++] = next;
+        qb->sectors += next->count;
+        mem_end = (uint8_t*)next->buf + (size_t)next->count * BLOCKDEV_SECTOR_SIZE;
+        ++s_stats.merged;
+    }
+    return true;
+}
+
+static uint8_t* batch_buffer(queue_batch* qb) {
+    block_request* first = qb->reqs[0];
+    uint8_t* direct = (uint8_t*)first->buf + (size_t)first->progress * BLOCKDEV_SECTOR_SIZE;
+    if (!qb->bounced) {
+        return direct;
+    }
+
+    if (qb->write) {
+        size_t offset = 0;
+        for (uint32_t i = 0; i < qb->count; ++i) {
+            const block_request* req = qb->reqs[i];
+            const uint8_t* src = (i == 0) ? direct : (const uint8_t*)req->buf;
+            const uint32_t sectors = (i == 0) ? qb->head_chunk : req->count;
+            copy_bytes(qb->bounce + offset, src, (size_t)sectors * BLOCKDEV_SECTOR_SIZE);
+            offset += (size_t)sectors * BLOCKDEV_SECTOR_SIZE;
+        }
+    }
+    return qb->bounce;
+}
+
+static queue_batch* free_batch(device_queue* dq) {
+    for (size_t i = 0; i < kInflightMax; ++i) {
+        if (!dq->batches[i].active) {
+            return &dq->batches[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Called with interrupts disabled; flags are the caller's irq_save value.
+ * Asynchronous devices get up to depth commands in flight. The synchronous
+ * read/write fallback only runs from task context with nothing else in
+ * flight; otherwise the batch waits for the next completion,
+ * block_queue_poll or block_queue_drain.
+ */
+static void dispatch(device_queue* dq, uint32_t flags) {
+    while (dq->plugged == 0 && !dq->failing && !dq->sync_busy && dq->pending != NULL && dq->inflight < dq->depth) {
+        queue_batch* qb = free_batch(dq);
+        if (qb == NULL || !build_batch(dq, qb)) {
+            return;
+        }
+        const blockdev* dev = dq->dev;
+        const uint64_t lba = next_lba(qb->reqs[0]);
+        uint8_t* buf = batch_buffer(qb);
+        qb->active = true;
+        ++dq->inflight;
+
+        if (dq->async && dev->submit(dev->ctx, lba, qb->sectors, buf, qb->write, driver_done, qb)) {
+            dq->head = lba + qb->sectors;
+            ++s_stats.dispatched;
+            continue;
+        }
+        if (s_completing > 0 || dq->inflight > 1) {
+            unbuild_batch(qb);
+            ++s_stats.deferred;
+            return;
+        }
+
+        /*
+         * The transfer runs with the caller's interrupt state so NIC and
+         * timer interrupts keep being served; sync_busy keeps other
+         * dispatches off the device meanwhile.
+         */
+        dq->head = lba + qb->sectors;
+        ++s_stats.dispatched;
+        dq->sync_busy = true;
+        irq_restore(flags);
+        const bool ok = qb->write ? dev->write(dev->ctx, lba, qb->sectors, buf)
+                                  : dev->read(dev->ctx, lba, qb->sectors, buf);
+        (void)irq_save();
+        dq->sync_busy = false;
+        finish_batch(qb, ok);
+    }
+}
+
+static void queue_irq(void* ctx) {
+    device_queue* dq = (device_queue*)ctx;
+    if (dq->dev->service(dq->dev->ctx)) {
+        ++s_stats.irq_completions;
+    }
+}
+
+/* Called with interrupts disabled; flags say whether the caller had them off too. */
+static void poll_queue(device_queue* dq, uint32_t flags) {
+    if (dq->async && dq->inflight > 0 && (dq->polled || (flags & kEflagsIf) == 0)) {
+        if (dq->dev->service(dq->dev->ctx)) {
+            ++s_stats.polled_completions;
+        }
+    }
+    dispatch(dq, flags);
+}
+
+/* Fails everything queued or in flight on dq; the driver aborts what it owns. */
+static void fail_queue(device_queue* dq) {
+    dq->failing = true;
+    if (dq->inflight > 0 && dq->dev->abort != NULL) {
+        dq->dev->abort(dq->dev->ctx);
+    }
+    for (size_t i = 0; i < kInflightMax; ++i) {
+        if (dq->batches[i].active) {
+            finish_batch(&dq->batches[i], false);
+        }
+    }
+    while (dq->pending != NULL) {
+        block_request* req = dq->pending;
+        dq->pending = req->next;
+        complete(dq, req, false);
+    }
+    dq->failing = false;
+}
+
+void block_queue_init(void) {
+    for (size_t i = 0; i < blockdev_count(); ++i) {
+        const blockdev* dev = blockdev_at(i);
+        device_queue* dq = queue_for(dev);
+        if (dq == NULL || dev->submit == NULL || dev->service == NULL) {
+            continue;
+        }
+        /* Drivers without an IRQ line are serviced by block_queue_poll and drain. */
+        dq->polled = dev->irq == BLOCKDEV_NO_IRQ;
+        dq->async = dq->polled || irq_register(dev->irq, queue_irq, dq);
+        if (dq->async) {
+            dq->depth = dev->depth == 0U ? 1U : (dev->depth > kInflightMax ? kInflightMax : dev->depth);
+        }
+    }
+}
+
+bool block_queue_submit(block_request* req) {
+    if (req == NULL || req->dev == NULL || req->buf == NULL || req->count == 0) {
+        return false;
+    }
+    if (req->lba > req->dev->sector_count || req->count > req->dev->sector_count - req->lba) {
+        return false;
+    }
+
+    const uint32_t flags = irq_save();
+    device_queue* dq = queue_for(req->dev);
+    if (dq == NULL) {
+        irq_restore(flags);
+        return false;
+    }
+
+    req->progress = 0;
+    req->seq = s_next_seq++;
+    insert_sorted(dq, req);
+    ++dq->outstanding;
+    ++s_stats.submitted;
+    dispatch(dq, flags);
+    irq_restore(flags);
+    return true;
+}
+
+void block_queue_plug(const blockdev* dev) {
+    const uint32_t flags = irq_save();
+    for (size_t i = 0; i < blockdev_count(); ++i) {
+        if (dev == NULL || blockdev_at(i) == dev) {
+            device_queue* dq = queue_for(blockdev_at(i));
+            if (dq != NULL) {
+                ++dq->plugged;
+            }
+        }
+    }
+    irq_restore(flags);
+}
+
+void block_queue_unplug(const blockdev* dev) {
+    const uint32_t flags = irq_save();
+    for (size_t i = 0; i < s_queue_count; ++i) {
+        device_queue* dq = &s_queues[i];
+        if ((dev == NULL || dq->dev == dev) && dq->plugged > 0) {
+            --dq->plugged;
+            dispatch(dq, flags);
+        }
+    }
+    irq_restore(flags);
+}
+
+void block_queue_poll(void) {
+    const uint32_t flags = irq_save();
+    for (size_t i = 0; i < s_queue_count; ++i) {
+        poll_queue(&s_queues[i], flags);
+    }
+    irq_restore(flags);
+}
+
+/*
+ * With interrupts enabled this only waits for the IRQ to deliver completions;
+ * with them disabled (early boot) it services the devices itself. Polled
+ * asynchronous devices are serviced either way. Gives up after
+ * kDrainTimeoutMs and fails whatever is still outstanding.
+ */
+bool block_queue_wait(const blockdev* dev, uint32_t max_outstanding) {
+    const bool timed = timing_tsc_khz() != 0U;
+    const uint32_t start_ms = timing_ms_now();
+    uint32_t spins = 0;
+    for (;;) {
+        uint32_t flags = irq_save();
+        uint32_t left = 0;
+        for (size_t i = 0; i < s_queue_count; ++i) {
+            device_queue* dq = &s_queues[i];
+            if (dev == NULL || dq->dev == dev) {
+                poll_queue(dq, flags);
+                left += dq->outstanding;
+            }
+        }
+        irq_restore(flags);
+
+        if (left <= max_outstanding) {
+            return true;
+        }
+        const bool expired = timed ? timing_ms_now() - start_ms >= kDrainTimeoutMs : ++spins >= kDrainSpinBudget;
+        if (expired) {
+            flags = irq_save();
+            for (size_t i = 0; i < s_queue_count; ++i) {
+                device_queue* dq = &s_queues[i];
+                if ((dev == NULL || dq->dev == dev) && dq->outstanding > 0) {
+                    fail_queue(dq);
+                    ++s_stats.timeouts;
+                }
+            }
+            irq_restore(flags);
+            return false;
+        }
+        __asm__ volatile("pause");
+    }
+}
+
+bool block_queue_drain(const blockdev* dev) {
+    return block_queue_wait(dev, 0);
+}
+
+void block_queue_get_stats(block_queue_stats* out) {
+    if (out == NULL) {
+        return;
+    }
+    const uint32_t flags = irq_save();
+    *out = s_stats;
+    irq_restore(flags);
+}
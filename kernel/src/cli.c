@@ -1,12 +1,23 @@
 #include "kernel/cli.h"
 
 #include "drivers/ata.h"
+#include "drivers/blockdev.h"
 #include "drivers/mouse.h"
+#include "drivers/pktbuf.h"
 #include "gui/desktop.h"
+#include "kernel/blkbench.h"
+#include "kernel/block_cache.h"
+#include "kernel/block_queue.h"
 #include "kernel/display.h"
 #include "kernel/filesystem.h"
 #include "kernel/fs_persist.h"
+#include "kernel/net_arp.h"
+#include "kernel/net_route.h"
 #include "kernel/net_stack.h"
+#include "kernel/net_tcp.h"
+#include "kernel/net_tcpperf.h"
+#include "kernel/net_udp.h"
+#include "kernel/netbench.h"
 #include "kernel/release.h"
 
 #include <stdbool.h>
@@ -248,6 +259,26 @@ static void buf_append_i32(char* out, size_t cap, size_t* idx, int32_t value) {
     buf_append_u32(out, cap, idx, (uint32_t)value);
 }
 
+static void buf_append_ipv4(char* out, size_t cap, size_t* idx, uint32_t ipv4_be) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        buf_append_u32(out, cap, idx, (ipv4_be >> (uint32_t)shift) & 0xFFU);
+        if (shift > 0) {
+            buf_append_char(out, cap, idx, '.');
+        }
+    }
+}
+
+static void buf_append_mac(char* out, size_t cap, size_t* idx, const uint8_t* mac) {
+    static const char kDigits[] = "0123456789abcdef";
+    for (int i = 0; i < 6; ++i) {
+        if (i > 0) {
+            buf_append_char(out, cap, idx, ':');
+        }
+        buf_append_char(out, cap, idx, kDigits[mac[i] >> 4U]);
+        buf_append_char(out, cap, idx, kDigits[mac[i] & 0x0FU]);
+    }
+}
+
 enum {
     kHistoryMax = 40,
     kHistoryLineMax = 80,
@@ -400,6 +431,22 @@ static bool append_line_to_file(const char* filename, const char* line) {
     return fs_write(filename, data);
 }
 
+static void log_snapshot_change(const char* name, fs_snapshot_change change, void* ctx) {
+    (void)ctx;
+    char msg[72];
+    size_t idx = 0;
+    msg[0] = '\0';
+    if (change == FS_SNAPSHOT_ADDED) {
+        buf_append_str(msg, sizeof(msg), &idx, "+ ");
+    } else if (change == FS_SNAPSHOT_REMOVED) {
+        buf_append_str(msg, sizeof(msg), &idx, "- ");
+    } else {
+        buf_append_str(msg, sizeof(msg), &idx, "~ ");
+    }
+    buf_append_str(msg, sizeof(msg), &idx, name);
+    desktop_append_log(msg);
+}
+
 static uint32_t clamp_u32(uint32_t v, uint32_t lo, uint32_t hi) {
     if (v < lo) {
         return lo;
@@ -410,12 +457,78 @@ static uint32_t clamp_u32(uint32_t v, uint32_t lo, uint32_t hi) {
     return v;
 }
 
+static void log_blkbench_result(const blkbench_config* config, const blkbench_result* r) {
+    char msg[96];
+    size_t idx = 0;
+    msg[0] = '\0';
+    buf_append_str(msg, sizeof(msg), &idx, blkbench_test_name(config->test));
+    buf_append_str(msg, sizeof(msg), &idx, " bs=");
+    buf_append_u32(msg, sizeof(msg), &idx, config->transfer_sectors / 2U);
+    buf_append_str(msg, sizeof(msg), &idx, "K qd=");
+    buf_append_u32(msg, sizeof(msg), &idx, config->queue_depth);
+    buf_append_str(msg, sizeof(msg), &idx, ": ");
+    buf_append_u32(msg, sizeof(msg), &idx, r->mbps_x10 / 10U);
+    buf_append_char(msg, sizeof(msg), &idx, '.');
+    buf_append_u32(msg, sizeof(msg), &idx, r->mbps_x10 % 10U);
+    buf_append_str(msg, sizeof(msg), &idx, " MB/s ");
+    buf_append_u32(msg, sizeof(msg), &idx, r->iops);
+    buf_append_str(msg, sizeof(msg), &idx, " IOPS");
+    if (r->failed > 0U) {
+        buf_append_str(msg, sizeof(msg), &idx, " failed=");
+        buf_append_u32(msg, sizeof(msg), &idx, r->failed);
+    }
+    desktop_append_log(msg);
+
+    idx = 0;
+    msg[0] = '\0';
+    buf_append_str(msg, sizeof(msg), &idx, "  lat us p50=");
+    buf_append_u32(msg, sizeof(msg), &idx, r->lat_p50_us);
+    buf_append_str(msg, sizeof(msg), &idx, " p90=");
+    buf_append_u32(msg, sizeof(msg), &idx, r->lat_p90_us);
+    buf_append_str(msg, sizeof(msg), &idx, " p99=");
+    buf_append_u32(msg, sizeof(msg), &idx, r->lat_p99_us);
+    buf_append_str(msg, sizeof(msg), &idx, " max=");
+    buf_append_u32(msg, sizeof(msg), &idx, r->lat_max_us);
+    desktop_append_log(msg);
+}
+
+static void log_netbench_result(const netbench_config* config, const netbench_result* r) {
+    char msg[96];
+    size_t idx = 0;
+    msg[0] = '\0';
+    buf_append_str(msg, sizeof(msg), &idx, netbench_test_name(config->test));
+    if (config->test != NETBENCH_ICMP) {
+        buf_append_str(msg, sizeof(msg), &idx, " size=");
+        buf_append_u32(msg, sizeof(msg), &idx, config->size);
+    }
+    buf_append_str(msg, sizeof(msg), &idx, ": ");
+    buf_append_u32(msg, sizeof(msg), &idx, r->packets_per_s);
+    buf_append_str(msg, sizeof(msg), &idx, " pkts/s ");
+    buf_append_u32(msg, sizeof(msg), &idx, r->bytes_per_s);
+    buf_append_str(msg, sizeof(msg), &idx, " B/s ");
+    buf_append_u32(msg, sizeof(msg), &idx, r->cycles_per_packet);
+    buf_append_str(msg, sizeof(msg), &idx, " cycles/pkt");
+    desktop_append_log(msg);
+
+    idx = 0;
+    msg[0] = '\0';
+    buf_append_str(msg, sizeof(msg), &idx, "  pkts=");
+    buf_append_u32(msg, sizeof(msg), &idx, r->packets);
+    buf_append_str(msg, sizeof(msg), &idx, " bytes=");
+    buf_append_u32(msg, sizeof(msg), &idx, r->bytes);
+    buf_append_str(msg, sizeof(msg), &idx, " lost=");
+    buf_append_u32(msg, sizeof(msg), &idx, r->lost);
+    buf_append_str(msg, sizeof(msg), &idx, " us=");
+    buf_append_u32(msg, sizeof(msg), &idx, r->elapsed_us);
+    desktop_append_log(msg);
+}
+
 void cli_init(void) {
     desktop_append_log("Commands: help about version beta uname whoami hostname date time");
     desktop_append_log("ls cat touch write append rm cp mv stat find head tail grep wc");
     desktop_append_log("clip todo journal apps open resmode calc history");
-    desktop_append_log("display mouse fsinfo meminfo netinfo sysinfo savefs loadfs ping");
-    desktop_append_log("betareport clear doom");
+    desktop_append_log("display mouse fsinfo meminfo netinfo sysinfo savefs loadfs blkstat blkbench netbench snap ping udpsend tcpsend");
+    desktop_append_log("ifconfig route arp betareport clear doom");
     desktop_append_log("power: sleep logout restart shutdown");
 }
 
@@ -434,7 +547,11 @@ cli_action cli_execute(const char* line) {
         desktop_append_log("files: ls/cat/touch/write/append/rm/cp/mv/stat/find/head/tail/grep/wc");
         desktop_append_log("workspace: clip/todo/journal/apps/open/resmode/calc");
         desktop_append_log("system: display/mouse/fsinfo/meminfo/netinfo/sysinfo");
-        desktop_append_log("persist: savefs/loadfs/sync/save betareport ping clear doom");
+        desktop_append_log("persist: savefs/loadfs/sync/save blkstat betareport ping udpsend tcpsend clear doom");
+        desktop_append_log("net: ifconfig [<ip> <netmask> [gateway]]/route [add <dest> <mask> <gw>|del <dest> <mask>]/arp [flush]");
+        desktop_append_log("bench: blkbench [dev] [seqread|randread|write|seqwrite|randwrite|all] [bs=KiB] [qd=N] [n=N] [confirm]");
+        desktop_append_log("bench: netbench [udp|icmp|tcp|all] [n=N] [size=bytes] (over loopback)");
+        desktop_append_log("snapshots: snap take [label]/snap list/snap diff <id>/snap restore <id>/snap rm <id>");
         desktop_append_log("power: sleep/logout/restart/shutdown");
         return CLI_ACTION_NONE;
     }
@@ -765,7 +882,7 @@ cli_action cli_execute(const char* line) {
         if (fs_write(name, p)) {
             desktop_append_log("write: saved");
         } else {
-            desktop_append_log("write: failed");
+            desktop_append_log(fs_ramdisk_full() ? "write: failed (ramdisk full)" : "write: failed");
         }
         return CLI_ACTION_NONE;
     }
@@ -806,7 +923,7 @@ cli_action cli_execute(const char* line) {
         if (fs_write(name, data)) {
             desktop_append_log("append: done");
         } else {
-            desktop_append_log("append: failed");
+            desktop_append_log(fs_ramdisk_full() ? "append: failed (ramdisk full)" : "append: failed");
         }
         return CLI_ACTION_NONE;
     }
@@ -829,7 +946,7 @@ cli_action cli_execute(const char* line) {
         if (fs_write(dst, data)) {
             desktop_append_log("cp: copied");
         } else {
-            desktop_append_log("cp: failed");
+            desktop_append_log(fs_ramdisk_full() ? "cp: failed (ramdisk full)" : "cp: failed");
         }
         return CLI_ACTION_NONE;
     }
@@ -855,7 +972,7 @@ cli_action cli_execute(const char* line) {
         }
 
         if (!fs_write(dst, data)) {
-            desktop_append_log("mv: write failed");
+            desktop_append_log(fs_ramdisk_full() ? "mv: write failed (ramdisk full)" : "mv: write failed");
             return CLI_ACTION_NONE;
         }
         if (!fs_remove(src)) {
@@ -1135,7 +1252,155 @@ cli_action cli_execute(const char* line) {
 
     if (str_eq(p, "netinfo")) {
         desktop_append_log(net_stack_ready() ? "network: ready" : "network: unavailable");
-        desktop_append_log("use: ping <a.b.c.d>");
+        if (net_stack_ready()) {
+            const netdev* dev = net_stack_device();
+            netdev_stats st;
+            dev->get_stats(dev->ctx, &st);
+            char msg[96];
+            size_t idx = 0;
+            msg[0] = '\0';
+            buf_append_str(msg, sizeof(msg), &idx, "nic: ");
+            buf_append_str(msg, sizeof(msg), &idx, dev->name);
+            buf_append_char(msg, sizeof(msg), &idx, ' ');
+            buf_append_u32(msg, sizeof(msg), &idx, dev->speed_mbps);
+            buf_append_str(msg, sizeof(msg), &idx, " Mbit irq=");
+            if (dev->irq == NETDEV_NO_IRQ) {
+                buf_append_str(msg, sizeof(msg), &idx, "none (polled)");
+            } else {
+                buf_append_u32(msg, sizeof(msg), &idx, dev->irq);
+            }
+            buf_append_str(msg, sizeof(msg), &idx, " irqs=");
+            buf_append_u32(msg, sizeof(msg), &idx, st.irqs);
+            desktop_append_log(msg);
+
+            idx = 0;
+            msg[0] = '\0';
+            buf_append_str(msg, sizeof(msg), &idx, "nic: rx=");
+            buf_append_u32(msg, sizeof(msg), &idx, st.rx_frames);
+            buf_append_str(msg, sizeof(msg), &idx, " err=");
+            buf_append_u32(msg, sizeof(msg), &idx, st.rx_errors);
+            buf_append_str(msg, sizeof(msg), &idx, " rearms=");
+            buf_append_u32(msg, sizeof(msg), &idx, st.rx_rearms);
+            desktop_append_log(msg);
+
+            idx = 0;
+            msg[0] = '\0';
+            buf_append_str(msg, sizeof(msg), &idx, "nic: tx=");
+            buf_append_u32(msg, sizeof(msg), &idx, st.tx_frames);
+            buf_append_str(msg, sizeof(msg), &idx, " err=");
+            buf_append_u32(msg, sizeof(msg), &idx, st.tx_errors);
+            buf_append_str(msg, sizeof(msg), &idx, " drops=");
+            buf_append_u32(msg, sizeof(msg), &idx, st.tx_drops);
+            desktop_append_log(msg);
+
+            pktbuf_stats pool;
+            pktbuf_get_stats(&pool);
+            idx = 0;
+            msg[0] = '\0';
+            buf_append_str(msg, sizeof(msg), &idx, "pktbuf: free=");
+            buf_append_u32(msg, sizeof(msg), &idx, pool.free);
+            buf_append_char(msg, sizeof(msg), &idx, '/');
+            buf_append_u32(msg, sizeof(msg), &idx, pool.total);
+            buf_append_str(msg, sizeof(msg), &idx, " low=");
+            buf_append_u32(msg, sizeof(msg), &idx, pool.low_water);
+            buf_append_str(msg, sizeof(msg), &idx, " fail=");
+            buf_append_u32(msg, sizeof(msg), &idx, pool.alloc_failures);
+            desktop_append_log(msg);
+
+            uint32_t ip = 0;
+            uint32_t mask = 0;
+            uint32_t gw = 0;
+            net_stack_get_ipv4(&ip, &mask, &gw);
+            idx = 0;
+            msg[0] = '\0';
+            buf_append_str(msg, sizeof(msg), &idx, "ip: ");
+            buf_append_ipv4(msg, sizeof(msg), &idx, ip);
+            buf_append_str(msg, sizeof(msg), &idx, " mask ");
+            buf_append_ipv4(msg, sizeof(msg), &idx, mask);
+            buf_append_str(msg, sizeof(msg), &idx, " gw ");
+            if (gw != 0U) {
+                buf_append_ipv4(msg, sizeof(msg), &idx, gw);
+            } else {
+                buf_append_str(msg, sizeof(msg), &idx, "none");
+            }
+            desktop_append_log(msg);
+
+            net_arp_stats arp;
+            net_arp_get_stats(&arp);
+            idx = 0;
+            msg[0] = '\0';
+            buf_append_str(msg, sizeof(msg), &idx, "arp: hits=");
+            buf_append_u32(msg, sizeof(msg), &idx, arp.hits);
+            buf_append_str(msg, sizeof(msg), &idx, " miss=");
+            buf_append_u32(msg, sizeof(msg), &idx, arp.misses);
+            buf_append_str(msg, sizeof(msg), &idx, " req=");
+            buf_append_u32(msg, sizeof(msg), &idx, arp.requests_sent);
+            buf_append_str(msg, sizeof(msg), &idx, " rep=");
+            buf_append_u32(msg, sizeof(msg), &idx, arp.replies_sent);
+            buf_append_str(msg, sizeof(msg), &idx, " upd=");
+            buf_append_u32(msg, sizeof(msg), &idx, arp.updates);
+            buf_append_str(msg, sizeof(msg), &idx, " qdrops=");
+            buf_append_u32(msg, sizeof(msg), &idx, arp.pending_drops);
+            buf_append_str(msg, sizeof(msg), &idx, " evict=");
+            buf_append_u32(msg, sizeof(msg), &idx, arp.evictions);
+            desktop_append_log(msg);
+
+            net_udp_stats udp;
+            net_udp_get_stats(&udp);
+            idx = 0;
+            msg[0] = '\0';
+            buf_append_str(msg, sizeof(msg), &idx, "udp: rx=");
+            buf_append_u32(msg, sizeof(msg), &idx, udp.rx_datagrams);
+            buf_append_str(msg, sizeof(msg), &idx, " noport=");
+            buf_append_u32(msg, sizeof(msg), &idx, udp.rx_no_port);
+            buf_append_str(msg, sizeof(msg), &idx, " err=");
+            buf_append_u32(msg, sizeof(msg), &idx, udp.rx_errors);
+            buf_append_str(msg, sizeof(msg), &idx, " qdrops=");
+            buf_append_u32(msg, sizeof(msg), &idx, udp.rx_queue_drops);
+            buf_append_str(msg, sizeof(msg), &idx, " tx=");
+            buf_append_u32(msg, sizeof(msg), &idx, udp.tx_datagrams);
+            buf_append_str(msg, sizeof(msg), &idx, " txerr=");
+            buf_append_u32(msg, sizeof(msg), &idx, udp.tx_errors);
+            desktop_append_log(msg);
+
+            net_tcp_stats tcp;
+            net_tcp_get_stats(&tcp);
+            idx = 0;
+            msg[0] = '\0';
+            buf_append_str(msg, sizeof(msg), &idx, "tcp: rx=");
+            buf_append_u32(msg, sizeof(msg), &idx, tcp.rx_segments);
+            buf_append_str(msg, sizeof(msg), &idx, " tx=");
+            buf_append_u32(msg, sizeof(msg), &idx, tcp.tx_segments);
+            buf_append_str(msg, sizeof(msg), &idx, " retx=");
+            buf_append_u32(msg, sizeof(msg), &idx, tcp.retransmits);
+            buf_append_str(msg, sizeof(msg), &idx, " fastretx=");
+            buf_append_u32(msg, sizeof(msg), &idx, tcp.fast_retransmits);
+            buf_append_str(msg, sizeof(msg), &idx, " rst=");
+            buf_append_u32(msg, sizeof(msg), &idx, tcp.resets_received);
+            buf_append_char(msg, sizeof(msg), &idx, '/');
+            buf_append_u32(msg, sizeof(msg), &idx, tcp.resets_sent);
+            buf_append_str(msg, sizeof(msg), &idx, " err=");
+            buf_append_u32(msg, sizeof(msg), &idx, tcp.rx_errors);
+            desktop_append_log(msg);
+
+            net_tcpperf_result perf;
+            if (net_tcpperf_last_result(&perf)) {
+                idx = 0;
+                msg[0] = '\0';
+                buf_append_str(msg, sizeof(msg), &idx, perf.sent ? "tcpperf: sent " : "tcpperf: received ");
+                buf_append_u32(msg, sizeof(msg), &idx, (uint32_t)(perf.bytes >> 10U));
+                buf_append_str(msg, sizeof(msg), &idx, " KiB in ");
+                buf_append_u32(msg, sizeof(msg), &idx, perf.ms);
+                buf_append_str(msg, sizeof(msg), &idx, " ms = ");
+                buf_append_u32(msg, sizeof(msg), &idx, perf.kib_per_s);
+                buf_append_str(msg, sizeof(msg), &idx, " KiB/s");
+                if (!perf.ok) {
+                    buf_append_str(msg, sizeof(msg), &idx, " (reset)");
+                }
+                desktop_append_log(msg);
+            }
+        }
+        desktop_append_log("use: ping <a.b.c.d> | udpsend <a.b.c.d> <port> <text> | tcpsend <a.b.c.d> <port> [MiB|file]");
         return CLI_ACTION_NONE;
     }
 
@@ -1331,7 +1596,7 @@ cli_action cli_execute(const char* line) {
         if (fs_persist_save_now()) {
             desktop_append_log("savefs: ramdisk image written");
         } else {
-            desktop_append_log("savefs: failed (ata unavailable or write error)");
+            desktop_append_log("savefs: failed (no disk or write error)");
         }
         return CLI_ACTION_NONE;
     }
@@ -1354,6 +1619,455 @@ cli_action cli_execute(const char* line) {
         return CLI_ACTION_NONE;
     }
 
+    if (str_eq(p, "blkstat")) {
+        if (blockdev_count() == 0) {
+            desktop_append_log("blk: no block devices");
+        }
+        for (size_t i = 0; i < blockdev_count(); ++i) {
+            const blockdev* dev = blockdev_at(i);
+            char msg[64];
+            size_t idx = 0;
+            msg[0] = '\0';
+            buf_append_str(msg, sizeof(msg), &idx, "blk: ");
+            buf_append_str(msg, sizeof(msg), &idx, dev->name);
+            buf_append_char(msg, sizeof(msg), &idx, ' ');
+            buf_append_u32(msg, sizeof(msg), &idx, (uint32_t)(dev->sector_count >> 11U));
+            buf_append_str(msg, sizeof(msg), &idx, " MiB");
+            if (i == 0) {
+                buf_append_str(msg, sizeof(msg), &idx, " (persist)");
+            }
+            desktop_append_log(msg);
+        }
+
+        block_cache_stats st;
+        block_cache_get_stats(&st);
+        uint32_t hits = st.hits;
+        uint32_t total = st.hits + st.misses;
+        while (total > 0x00FFFFFFU) {
+            hits >>= 1U;
+            total >>= 1U;
+        }
+        const uint32_t pct = (total > 0U) ? (hits * 100U) / total : 0U;
+
+        char msg[128];
+        size_t idx = 0;
+        msg[0] = '\0';
+        buf_append_str(msg, sizeof(msg), &idx, "cache: hits=");
+        buf_append_u32(msg, sizeof(msg), &idx, st.hits);
+        buf_append_str(msg, sizeof(msg), &idx, " misses=");
+        buf_append_u32(msg, sizeof(msg), &idx, st.misses);
+        buf_append_str(msg, sizeof(msg), &idx, " hit=");
+        buf_append_u32(msg, sizeof(msg), &idx, pct);
+        buf_append_str(msg, sizeof(msg), &idx, "% readahead=");
+        buf_append_u32(msg, sizeof(msg), &idx, st.readahead);
+        desktop_append_log(msg);
+
+        idx = 0;
+        msg[0] = '\0';
+        buf_append_str(msg, sizeof(msg), &idx, "cache: dirty=");
+        buf_append_u32(msg, sizeof(msg), &idx, st.dirty);
+        buf_append_char(msg, sizeof(msg), &idx, '/');
+        buf_append_u32(msg, sizeof(msg), &idx, st.cached);
+        buf_append_str(msg, sizeof(msg), &idx, " of ");
+        buf_append_u32(msg, sizeof(msg), &idx, st.capacity);
+        buf_append_str(msg, sizeof(msg), &idx, " x ");
+        buf_append_u32(msg, sizeof(msg), &idx, st.block_bytes);
+        buf_append_str(msg, sizeof(msg), &idx, " B writebacks=");
+        buf_append_u32(msg, sizeof(msg), &idx, st.writebacks);
+        if (st.writeback_errors > 0U) {
+            buf_append_str(msg, sizeof(msg), &idx, " errors=");
+            buf_append_u32(msg, sizeof(msg), &idx, st.writeback_errors);
+        }
+        desktop_append_log(msg);
+
+        block_queue_stats qs;
+        block_queue_get_stats(&qs);
+        idx = 0;
+        msg[0] = '\0';
+        buf_append_str(msg, sizeof(msg), &idx, "queue: submitted=");
+        buf_append_u32(msg, sizeof(msg), &idx, qs.submitted);
+        buf_append_str(msg, sizeof(msg), &idx, " merged=");
+        buf_append_u32(msg, sizeof(msg), &idx, qs.merged);
+        buf_append_str(msg, sizeof(msg), &idx, " dispatched=");
+        buf_append_u32(msg, sizeof(msg), &idx, qs.dispatched);
+        buf_append_str(msg, sizeof(msg), &idx, " irq=");
+        buf_append_u32(msg, sizeof(msg), &idx, qs.irq_completions);
+        buf_append_str(msg, sizeof(msg), &idx, " polled=");
+        buf_append_u32(msg, sizeof(msg), &idx, qs.polled_completions);
+        buf_append_str(msg, sizeof(msg), &idx, " timeouts=");
+        buf_append_u32(msg, sizeof(msg), &idx, qs.timeouts);
+        desktop_append_log(msg);
+        return CLI_ACTION_NONE;
+    }
+
+    if (str_eq(p, "blkbench") || starts_with(p, "blkbench ")) {
+        p += 8;
+        blkbench_config config;
+        config.dev = blockdev_primary();
+        config.test = BLKBENCH_SEQ_READ;
+        config.transfer_sectors = 8U;
+        config.queue_depth = 1U;
+        config.ops = 256U;
+        const uint32_t read_tests = (1U << BLKBENCH_SEQ_READ) | (1U << BLKBENCH_RAND_READ);
+        const uint32_t write_tests = (1U << BLKBENCH_SEQ_WRITE) | (1U << BLKBENCH_RAND_WRITE);
+        uint32_t tests = read_tests;
+        bool confirm = false;
+
+        char arg[32];
+        while (parse_arg(&p, arg, sizeof(arg))) {
+            uint32_t value = 0;
+            bool matched = false;
+            if (starts_with(arg, "bs=") && parse_u32(arg + 3, &value) && value > 0U &&
+                value <= BLKBENCH_MAX_TRANSFER_SECTORS / 2U) {
+                config.transfer_sectors = value * 2U;
+                matched = true;
+            } else if (starts_with(arg, "qd=") && parse_u32(arg + 3, &value) && value > 0U &&
+                       value <= BLKBENCH_MAX_QUEUE_DEPTH) {
+                config.queue_depth = value;
+                matched = true;
+            } else if (starts_with(arg, "n=") && parse_u32(arg + 2, &value) && value > 0U &&
+                       value <= BLKBENCH_MAX_OPS) {
+                config.ops = value;
+                matched = true;
+            } else if (str_eq(arg, "all")) {
+                tests = read_tests | write_tests;
+                matched = true;
+            } else if (str_eq(arg, "write")) {
+                tests = write_tests;
+                matched = true;
+            } else if (str_eq(arg, "confirm")) {
+                confirm = true;
+                matched = true;
+            }
+            for (uint32_t t = 0; !matched && t < BLKBENCH_TEST_COUNT; ++t) {
+                if (str_eq(arg, blkbench_test_name((blkbench_test)t))) {
+                    tests = 1U << t;
+                    matched = true;
+                }
+            }
+            for (size_t i = 0; !matched && i < blockdev_count(); ++i) {
+                if (str_eq(arg, blockdev_at(i)->name)) {
+                    config.dev = blockdev_at(i);
+                    matched = true;
+                }
+            }
+            if (!matched) {
+                desktop_append_log("usage: blkbench [dev] [seqread|randread|write|seqwrite|randwrite|all] [bs=KiB] [qd=N] [n=N] [confirm]");
+                return CLI_ACTION_NONE;
+            }
+        }
+        if (config.dev == NULL) {
+            desktop_append_log("blkbench: no block device");
+            return CLI_ACTION_NONE;
+        }
+        if ((tests & write_tests) != 0U && !confirm) {
+            desktop_append_log("blkbench: write tests overwrite the last 64 MiB of the disk; add 'confirm' to run them");
+            return CLI_ACTION_NONE;
+        }
+
+        char msg[96];
+        size_t idx = 0;
+        msg[0] = '\0';
+        buf_append_str(msg, sizeof(msg), &idx, "blkbench: ");
+        buf_append_str(msg, sizeof(msg), &idx, config.dev->name);
+        buf_append_str(msg, sizeof(msg), &idx, " ops=");
+        buf_append_u32(msg, sizeof(msg), &idx, config.ops);
+        buf_append_str(msg, sizeof(msg), &idx, " device depth=");
+        buf_append_u32(msg, sizeof(msg), &idx, (config.dev->depth > 0U) ? config.dev->depth : 1U);
+        buf_append_str(msg, sizeof(msg), &idx, " (scratch at end of disk)");
+        desktop_append_log(msg);
+
+        for (uint32_t t = 0; t < BLKBENCH_TEST_COUNT; ++t) {
+            if ((tests & (1U << t)) == 0U) {
+                continue;
+            }
+            config.test = (blkbench_test)t;
+            blkbench_result r;
+            r.ops = 0U;
+            if (!blkbench_run(&config, &r) && r.ops == 0U) {
+                desktop_append_log("blkbench: disk too small or out of memory");
+                return CLI_ACTION_NONE;
+            }
+            log_blkbench_result(&config, &r);
+        }
+        return CLI_ACTION_NONE;
+    }
+
+    if (str_eq(p, "netbench") || starts_with(p, "netbench ")) {
+        p += 8;
+        netbench_config config;
+        config.test = NETBENCH_TEST_COUNT;
+        config.count = 10000U;
+        config.size = 1024U;
+
+        char arg[32];
+        while (parse_arg(&p, arg, sizeof(arg))) {
+            uint32_t value = 0;
+            bool matched = false;
+            if (starts_with(arg, "n=") && parse_u32(arg + 2, &value) && value > 0U && value <= NETBENCH_MAX_COUNT) {
+                config.count = value;
+                matched = true;
+            } else if (starts_with(arg, "size=") && parse_u32(arg + 5, &value) && value > 0U &&
+                       value <= NETBENCH_MAX_SIZE) {
+                config.size = value;
+                matched = true;
+            } else if (str_eq(arg, "all")) {
+                config.test = NETBENCH_TEST_COUNT;
+                matched = true;
+            }
+            for (uint32_t t = 0; !matched && t < NETBENCH_TEST_COUNT; ++t) {
+                if (str_eq(arg, netbench_test_name((netbench_test)t))) {
+                    config.test = (netbench_test)t;
+                    matched = true;
+                }
+            }
+            if (!matched) {
+                desktop_append_log("usage: netbench [udp|icmp|tcp|all] [n=N] [size=bytes]");
+                return CLI_ACTION_NONE;
+            }
+        }
+        if (!net_stack_ready()) {
+            desktop_append_log("netbench: network stack unavailable");
+            return CLI_ACTION_NONE;
+        }
+
+        const netbench_test only = config.test;
+        for (uint32_t t = 0; t < NETBENCH_TEST_COUNT; ++t) {
+            if (only != NETBENCH_TEST_COUNT && (netbench_test)t != only) {
+                continue;
+            }
+            config.test = (netbench_test)t;
+            netbench_result r;
+            r.packets = 0U;
+            if (!netbench_run(&config, &r) && r.packets == 0U) {
+                desktop_append_log("netbench: run failed (sockets busy or no timer)");
+                continue;
+            }
+            log_netbench_result(&config, &r);
+        }
+        return CLI_ACTION_NONE;
+    }
+
+    if (str_eq(p, "snap") || str_eq(p, "snap list")) {
+        const size_t count = fs_snapshot_count();
+        if (count == 0) {
+            desktop_append_log("snap: no snapshots (use: snap take [label])");
+            return CLI_ACTION_NONE;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            fs_snapshot_info info;
+            if (!fs_snapshot_info_at(i, &info)) {
+                continue;
+            }
+            char msg[96];
+            size_t idx = 0;
+            msg[0] = '\0';
+            buf_append_char(msg, sizeof(msg), &idx, '#');
+            buf_append_u32(msg, sizeof(msg), &idx, info.id);
+            buf_append_char(msg, sizeof(msg), &idx, ' ');
+            buf_append_str(msg, sizeof(msg), &idx, info.label);
+            buf_append_str(msg, sizeof(msg), &idx, " files=");
+            buf_append_u32(msg, sizeof(msg), &idx, info.files);
+            buf_append_str(msg, sizeof(msg), &idx, " bytes=");
+            buf_append_u32(msg, sizeof(msg), &idx, info.bytes);
+            buf_append_str(msg, sizeof(msg), &idx, " private=");
+            buf_append_u32(msg, sizeof(msg), &idx, info.private_bytes);
+            desktop_append_log(msg);
+        }
+        return CLI_ACTION_NONE;
+    }
+
+    if (str_eq(p, "snap take") || starts_with(p, "snap take ")) {
+        p = skip_ws(p + 9);
+        char label[24];
+        label[0] = '\0';
+        (void)parse_arg(&p, label, sizeof(label));
+
+        uint32_t id = 0;
+        if (!fs_snapshot_create(label, &id)) {
+            desktop_append_log("snap: snapshot table full (use: snap rm <id>)");
+            return CLI_ACTION_NONE;
+        }
+        char msg[48];
+        size_t idx = 0;
+        msg[0] = '\0';
+        buf_append_str(msg, sizeof(msg), &idx, "snap: created #");
+        buf_append_u32(msg, sizeof(msg), &idx, id);
+        desktop_append_log(msg);
+        return CLI_ACTION_NONE;
+    }
+
+    if (starts_with(p, "snap restore ") || starts_with(p, "snap rm ") || starts_with(p, "snap diff ")) {
+        p += 5;
+        char verb[12];
+        char id_arg[12];
+        uint32_t id = 0;
+        if (!parse_arg(&p, verb, sizeof(verb)) || !parse_arg(&p, id_arg, sizeof(id_arg)) ||
+            !parse_u32(id_arg[0] == '#' ? id_arg + 1 : id_arg, &id)) {
+            desktop_append_log("usage: snap restore|rm|diff <id>");
+            return CLI_ACTION_NONE;
+        }
+
+        if (str_eq(verb, "restore")) {
+            desktop_append_log(fs_snapshot_restore(id) ? "snap: restored" : "snap: unknown snapshot");
+        } else if (str_eq(verb, "rm")) {
+            desktop_append_log(fs_snapshot_delete(id) ? "snap: removed" : "snap: unknown snapshot");
+        } else if (fs_snapshot_diff(id, log_snapshot_change, NULL) == 0) {
+            desktop_append_log("snap: no changes (or unknown snapshot)");
+        }
+        return CLI_ACTION_NONE;
+    }
+
+    if (str_eq(p, "ifconfig") || starts_with(p, "ifconfig ")) {
+        p += 8;
+        char ip_arg[32];
+        char mask_arg[32];
+        char gw_arg[32];
+        if (parse_arg(&p, ip_arg, sizeof(ip_arg))) {
+            uint32_t ip = 0;
+            uint32_t mask = 0;
+            uint32_t gw = 0;
+            if (!parse_arg(&p, mask_arg, sizeof(mask_arg))) {
+                desktop_append_log("usage: ifconfig [<ip> <netmask> [gateway]]");
+                return CLI_ACTION_NONE;
+            }
+            const bool have_gw = parse_arg(&p, gw_arg, sizeof(gw_arg));
+            if (!parse_ipv4(ip_arg, &ip) || !parse_ipv4(mask_arg, &mask) || (have_gw && !parse_ipv4(gw_arg, &gw))) {
+                desktop_append_log("ifconfig: invalid ipv4 address");
+                return CLI_ACTION_NONE;
+            }
+            if (!net_stack_set_ipv4(ip, mask, gw)) {
+                desktop_append_log("ifconfig: rejected (bad netmask, or gateway outside the subnet)");
+                return CLI_ACTION_NONE;
+            }
+        }
+
+        uint32_t ip = 0;
+        uint32_t mask = 0;
+        uint32_t gw = 0;
+        net_stack_get_ipv4(&ip, &mask, &gw);
+        char msg[96];
+        size_t idx = 0;
+        msg[0] = '\0';
+        buf_append_str(msg, sizeof(msg), &idx, "ifconfig: ");
+        buf_append_ipv4(msg, sizeof(msg), &idx, ip);
+        buf_append_str(msg, sizeof(msg), &idx, " netmask ");
+        buf_append_ipv4(msg, sizeof(msg), &idx, mask);
+        buf_append_str(msg, sizeof(msg), &idx, " gateway ");
+        if (gw != 0U) {
+            buf_append_ipv4(msg, sizeof(msg), &idx, gw);
+        } else {
+            buf_append_str(msg, sizeof(msg), &idx, "none");
+        }
+        desktop_append_log(msg);
+        if (net_stack_ready()) {
+            idx = 0;
+            msg[0] = '\0';
+            buf_append_str(msg, sizeof(msg), &idx, "ifconfig: ");
+            buf_append_str(msg, sizeof(msg), &idx, net_stack_device()->name);
+            buf_append_str(msg, sizeof(msg), &idx, " ether ");
+            buf_append_mac(msg, sizeof(msg), &idx, net_stack_device()->mac);
+            desktop_append_log(msg);
+        }
+        return CLI_ACTION_NONE;
+    }
+
+    if (str_eq(p, "route") || starts_with(p, "route ")) {
+        p += 5;
+        char verb[8];
+        char dest_arg[32];
+        char mask_arg[32];
+        char gw_arg[32];
+        if (parse_arg(&p, verb, sizeof(verb))) {
+            uint32_t dest = 0;
+            uint32_t mask = 0;
+            uint32_t gw = 0;
+            const bool is_add = str_eq(verb, "add");
+            if ((!is_add && !str_eq(verb, "del")) || !parse_arg(&p, dest_arg, sizeof(dest_arg)) ||
+                !parse_arg(&p, mask_arg, sizeof(mask_arg)) || (is_add && !parse_arg(&p, gw_arg, sizeof(gw_arg)))) {
+                desktop_append_log("usage: route [add <dest> <mask> <gw>|del <dest> <mask>]");
+                return CLI_ACTION_NONE;
+            }
+            if (!parse_ipv4(dest_arg, &dest) || !parse_ipv4(mask_arg, &mask) || (is_add && !parse_ipv4(gw_arg, &gw))) {
+                desktop_append_log("route: invalid ipv4 address");
+                return CLI_ACTION_NONE;
+            }
+            if (is_add) {
+                desktop_append_log(net_route_add(dest, mask, gw) ? "route: added"
+                                                                 : "route: rejected (bad netmask or table full)");
+            } else {
+                desktop_append_log(net_route_remove(dest, mask) ? "route: removed" : "route: no such route");
+            }
+            return CLI_ACTION_NONE;
+        }
+
+        const size_t count = net_route_count();
+        if (count == 0U) {
+            desktop_append_log("route: table empty");
+        }
+        for (size_t i = 0; i < count; ++i) {
+            net_route r;
+            if (!net_route_at(i, &r)) {
+                break;
+            }
+            char msg[80];
+            size_t idx = 0;
+            msg[0] = '\0';
+            buf_append_str(msg, sizeof(msg), &idx, "route: ");
+            buf_append_ipv4(msg, sizeof(msg), &idx, r.dest_be);
+            buf_append_char(msg, sizeof(msg), &idx, '/');
+            buf_append_ipv4(msg, sizeof(msg), &idx, r.netmask_be);
+            if (r.gateway_be != 0U) {
+                buf_append_str(msg, sizeof(msg), &idx, " via ");
+                buf_append_ipv4(msg, sizeof(msg), &idx, r.gateway_be);
+            } else {
+                buf_append_str(msg, sizeof(msg), &idx, " on-link");
+            }
+            desktop_append_log(msg);
+        }
+        return CLI_ACTION_NONE;
+    }
+
+    if (str_eq(p, "arp") || starts_with(p, "arp ")) {
+        p += 3;
+        char verb[8];
+        if (parse_arg(&p, verb, sizeof(verb))) {
+            if (!str_eq(verb, "flush")) {
+                desktop_append_log("usage: arp [flush]");
+                return CLI_ACTION_NONE;
+            }
+            net_arp_flush();
+            desktop_append_log("arp: cache flushed");
+            return CLI_ACTION_NONE;
+        }
+
+        net_arp_entry e;
+        size_t shown = 0;
+        while (net_arp_entry_at(shown, &e)) {
+            char msg[96];
+            size_t idx = 0;
+            msg[0] = '\0';
+            buf_append_str(msg, sizeof(msg), &idx, "arp: ");
+            buf_append_ipv4(msg, sizeof(msg), &idx, e.ipv4_be);
+            if (e.state == NET_ARP_INCOMPLETE) {
+                buf_append_str(msg, sizeof(msg), &idx, " (incomplete) queued=");
+                buf_append_u32(msg, sizeof(msg), &idx, e.pending);
+            } else {
+                buf_append_char(msg, sizeof(msg), &idx, ' ');
+                buf_append_mac(msg, sizeof(msg), &idx, e.mac);
+                buf_append_str(msg, sizeof(msg), &idx, e.state == NET_ARP_STALE ? " stale " : " reachable ");
+                buf_append_u32(msg, sizeof(msg), &idx, e.age_ms / 1000U);
+                buf_append_char(msg, sizeof(msg), &idx, 's');
+            }
+            desktop_append_log(msg);
+            ++shown;
+        }
+        if (shown == 0U) {
+            desktop_append_log("arp: cache empty");
+        }
+        return CLI_ACTION_NONE;
+    }
+
     if (starts_with(p, "ping ")) {
         p += 5;
         char ip_arg[32];
@@ -1379,6 +2093,82 @@ cli_action cli_execute(const char* line) {
         return CLI_ACTION_NONE;
     }
 
+    if (starts_with(p, "udpsend ")) {
+        p += 8;
+        char ip_arg[32];
+        char port_arg[16];
+        uint32_t ip_be = 0;
+        uint32_t port = 0;
+        if (!parse_arg(&p, ip_arg, sizeof(ip_arg)) || !parse_arg(&p, port_arg, sizeof(port_arg))) {
+            desktop_append_log("usage: udpsend <a.b.c.d> <port> <text>");
+            return CLI_ACTION_NONE;
+        }
+        if (!parse_ipv4(ip_arg, &ip_be) || !parse_u32(port_arg, &port) || port == 0U || port > 0xFFFFU) {
+            desktop_append_log("udpsend: invalid address or port");
+            return CLI_ACTION_NONE;
+        }
+        if (!net_stack_ready()) {
+            desktop_append_log("udpsend: network stack unavailable");
+            return CLI_ACTION_NONE;
+        }
+
+        const char* text = skip_ws(p);
+        size_t len = 0;
+        while (text[len] != '\0') {
+            ++len;
+        }
+        const int sock = net_udp_socket();
+        const int sent = (sock >= 0) ? net_udp_sendto(sock, text, len, ip_be, (uint16_t)port) : -1;
+        net_udp_close(sock);
+        desktop_append_log(sent >= 0 ? "udpsend: datagram sent" : "udpsend: send failed");
+        return CLI_ACTION_NONE;
+    }
+
+    if (starts_with(p, "tcpsend ")) {
+        p += 8;
+        char ip_arg[32];
+        char port_arg[16];
+        char what_arg[64];
+        uint32_t ip_be = 0;
+        uint32_t port = 0;
+        if (!parse_arg(&p, ip_arg, sizeof(ip_arg)) || !parse_arg(&p, port_arg, sizeof(port_arg))) {
+            desktop_append_log("usage: tcpsend <a.b.c.d> <port> [MiB|file]");
+            return CLI_ACTION_NONE;
+        }
+        if (!parse_ipv4(ip_arg, &ip_be) || !parse_u32(port_arg, &port) || port == 0U || port > 0xFFFFU) {
+            desktop_append_log("tcpsend: invalid address or port");
+            return CLI_ACTION_NONE;
+        }
+        if (!net_stack_ready()) {
+            desktop_append_log("tcpsend: network stack unavailable");
+            return CLI_ACTION_NONE;
+        }
+        if (net_tcpperf_busy()) {
+            desktop_append_log("tcpsend: a transfer is already running");
+            return CLI_ACTION_NONE;
+        }
+
+        /* A number streams that many MiB of zeros; a file name sends a snapshot of the file taken now. */
+        const uint8_t* data = NULL;
+        size_t size = 0;
+        uint32_t total = 16U * 1024U * 1024U;
+        if (parse_arg(&p, what_arg, sizeof(what_arg))) {
+            uint32_t mib = 0;
+            if (parse_u32(what_arg, &mib) && mib > 0U && mib <= 4095U) {
+                total = mib * 1024U * 1024U;
+            } else if (fs_map_readonly(what_arg, &data, &size) && size > 0U) {
+                total = (uint32_t)size;
+            } else {
+                desktop_append_log("tcpsend: expected MiB (1-4095) or a file name");
+                return CLI_ACTION_NONE;
+            }
+        }
+        const bool started = net_tcpperf_start_send(ip_be, (uint16_t)port, data, size, total);
+        desktop_append_log(started ? "tcpsend: started; see netinfo or serial for the result"
+                                   : "tcpsend: connect failed or out of memory");
+        return CLI_ACTION_NONE;
+    }
+
     if (str_eq(p, "clear")) {
         desktop_clear_log();
         return CLI_ACTION_NONE;
@@ -1,5 +1,8 @@
 #include "kernel/filesystem.h"
 
+#include "kernel/kmem.h"
+#include "kernel/lz4.h"
+
 #include <stddef.h>
 #include <stdint.h>
 
@@ -7,26 +10,69 @@ enum {
     kRamMaxFiles = 64,
     kRamNameMax = 48,
     kRamDataMax = 4096,
-    kModuleMaxFiles = 8,
+    kRamBlockCount = 192,
+    kRamNoBlock = -1,
+    kSnapshotMax = 8,
+    kSnapshotLabelMax = 24,
+    kModuleTableInitial = 16,
     kModuleNameMax = 64,
+    kWatchMax = 16,
 };
 
+/*
+ * File payloads live in a shared pool of refcounted blocks. A snapshot is a
+ * copy of the file table that takes a reference on each block; the first
+ * write to a shared block moves the writer onto a fresh one.
+ */
 typedef struct ram_file {
     bool used;
     char name[kRamNameMax];
     size_t size;
-    uint8_t data[kRamDataMax];
+    int16_t block;
 } ram_file;
 
-typedef struct module_file {
+typedef struct ram_snapshot {
     bool used;
+    uint32_t id;
+    char label[kSnapshotLabelMax];
+    ram_file files[kRamMaxFiles];
+} ram_snapshot;
+
+/*
+ * Boot modules stay where the bootloader put them. LZ4-framed modules keep
+ * data == NULL until the first read or map inflates them into kmem.
+ */
+typedef struct module_file {
     char name[kModuleNameMax];
+    const uint8_t* raw;
+    size_t raw_size;
     const uint8_t* data;
     size_t size;
+    uint8_t* inflated;
+    bool compressed;
+    bool mapped; /* fs_map_readonly handed out data; the image is now pinned */
 } module_file;
 
 static ram_file s_ram_files[kRamMaxFiles];
-static module_file s_module_files[kModuleMaxFiles];
+static uint8_t s_block_data[kRamBlockCount][kRamDataMax];
+static uint16_t s_block_refs[kRamBlockCount];
+static ram_snapshot s_snapshots[kSnapshotMax];
+static uint32_t s_next_snapshot_id = 1;
+static module_file* s_module_files = NULL;
+static size_t s_module_count = 0;
+static size_t s_module_cap = 0;
+static const uint8_t kEmptyData[1] = {0};
+
+typedef struct fs_watcher {
+    bool used;
+    char name[kModuleNameMax];
+    uint32_t mask;
+    fs_watch_fn callback;
+    void* ctx;
+} fs_watcher;
+
+static fs_watcher s_watchers[kWatchMax];
+static uint32_t s_generation = 1;
 
 static size_t cstr_len(const char* s) {
     size_t n = 0;
@@ -64,86 +110,261 @@ static size_t min_size(size_t a, size_t b) {
     return (a < b) ? a : b;
 }
 
-static int find_ram_file(const char* name) {
+static void notify(const char* name, uint32_t event) {
+    ++s_generation;
+    for (size_t i = 0; i < kWatchMax; ++i) {
+        const fs_watcher* w = &s_watchers[i];
+        if (!w->used || (w->mask & event) == 0) {
+            continue;
+        }
+        if (name != NULL && w->name[0] != '\0' && !str_eq(w->name, name)) {
+            continue;
+        }
+        w->callback(name, event, w->ctx);
+    }
+}
+
+static int find_table_file(const ram_file* table, const char* name) {
     if (name == NULL || name[0] == '\0') {
         return -1;
     }
     for (size_t i = 0; i < kRamMaxFiles; ++i) {
-        if (s_ram_files[i].used && str_eq(s_ram_files[i].name, name)) {
+        if (table[i].used && str_eq(table[i].name, name)) {
             return (int)i;
         }
     }
     return -1;
 }
 
+static int find_ram_file(const char* name) {
+    return find_table_file(s_ram_files, name);
+}
+
 static int find_module_file(const char* name) {
     if (name == NULL || name[0] == '\0') {
         return -1;
     }
-    for (size_t i = 0; i < kModuleMaxFiles; ++i) {
-        if (s_module_files[i].used && str_eq(s_module_files[i].name, name)) {
+    for (size_t i = 0; i < s_module_count; ++i) {
+        if (str_eq(s_module_files[i].name, name)) {
             return (int)i;
         }
     }
     return -1;
 }
 
-static int alloc_ram_slot(void) {
+static int alloc_table_slot(const ram_file* table) {
     for (size_t i = 0; i < kRamMaxFiles; ++i) {
-        if (!s_ram_files[i].used) {
+        if (!table[i].used) {
             return (int)i;
         }
     }
     return -1;
 }
 
-static int alloc_module_slot(void) {
-    for (size_t i = 0; i < kModuleMaxFiles; ++i) {
-        if (!s_module_files[i].used) {
+static int alloc_ram_slot(void) {
+    return alloc_table_slot(s_ram_files);
+}
+
+static int alloc_block(void) {
+    for (size_t i = 0; i < kRamBlockCount; ++i) {
+        if (s_block_refs[i] == 0) {
+            s_block_refs[i] = 1;
             return (int)i;
         }
     }
-    return -1;
+    return kRamNoBlock;
+}
+
+static void block_ref(int16_t block) {
+    if (block != kRamNoBlock) {
+        ++s_block_refs[block];
+    }
+}
+
+static void block_unref(int16_t block) {
+    if (block != kRamNoBlock && s_block_refs[block] > 0) {
+        --s_block_refs[block];
+    }
+}
+
+static const uint8_t* file_data(const ram_file* f) {
+    return (f->block == kRamNoBlock) ? kEmptyData : s_block_data[f->block];
+}
+
+static void clear_file(ram_file* f) {
+    block_unref(f->block);
+    f->used = false;
+    f->name[0] = '\0';
+    f->size = 0;
+    f->block = kRamNoBlock;
+}
+
+/* Returns a block the file owns exclusively, breaking any sharing first. */
+static uint8_t* file_data_for_write(ram_file* f, size_t size) {
+    if (size == 0) {
+        block_unref(f->block);
+        f->block = kRamNoBlock;
+        return NULL;
+    }
+    if (f->block != kRamNoBlock && s_block_refs[f->block] == 1) {
+        return s_block_data[f->block];
+    }
+
+    const int block = alloc_block();
+    if (block == kRamNoBlock) {
+        return NULL;
+    }
+    block_unref(f->block);
+    f->block = (int16_t)block;
+    return s_block_data[block];
+}
+
+static int alloc_module_slot(void) {
+    if (s_module_count == s_module_cap) {
+        const size_t new_cap = (s_module_cap == 0) ? (size_t)kModuleTableInitial : s_module_cap * 2U;
+        module_file* grown = (module_file*)kmem_alloc(new_cap * sizeof(module_file));
+        if (grown == NULL) {
+            return -1;
+        }
+        for (size_t i = 0; i < s_module_count; ++i) {
+            grown[i] = s_module_files[i];
+        }
+        kmem_free(s_module_files);
+        s_module_files = grown;
+        s_module_cap = new_cap;
+    }
+    return (int)s_module_count++;
+}
+
+static bool set_module_image(module_file* f, const uint8_t* data, size_t size) {
+    /* Mappings have no release call, so a mapped image can never be freed. */
+    if (f->mapped) {
+        return false;
+    }
+
+    size_t logical_size = size;
+    const bool compressed = lz4_frame_detect(data, size);
+    if (compressed && !lz4_frame_content_size(data, size, &logical_size)) {
+        return false;
+    }
+
+    kmem_free(f->inflated);
+    f->inflated = NULL;
+    f->raw = data;
+    f->raw_size = size;
+    f->compressed = compressed;
+    f->size = logical_size;
+    f->data = compressed ? NULL : data;
+    return true;
+}
+
+static bool module_data(module_file* f) {
+    if (f->data != NULL || f->size == 0) {
+        return true;
+    }
+
+    uint8_t* out = (uint8_t*)kmem_alloc(f->size);
+    if (out == NULL) {
+        return false;
+    }
+    size_t produced = 0;
+    if (!lz4_frame_decode(f->raw, f->raw_size, out, f->size, &produced) || produced != f->size) {
+        kmem_free(out);
+        return false;
+    }
+    f->inflated = out;
+    f->data = out;
+    return true;
 }
 
 static void reset_modules(void) {
-    for (size_t i = 0; i < kModuleMaxFiles; ++i) {
-        s_module_files[i].used = false;
-        s_module_files[i].name[0] = '\0';
-        s_module_files[i].data = NULL;
-        s_module_files[i].size = 0;
+    for (size_t i = 0; i < s_module_count; ++i) {
+        kmem_free(s_module_files[i].inflated);
     }
+    s_module_count = 0;
 }
 
-void fs_reset_ramdisk(void) {
+static void reset_table(ram_file* table) {
     for (size_t i = 0; i < kRamMaxFiles; ++i) {
-        s_ram_files[i].used = false;
-        s_ram_files[i].name[0] = '\0';
-        s_ram_files[i].size = 0;
+        clear_file(&table[i]);
     }
 }
 
-void fs_init(void) {
-    fs_reset_ramdisk();
-    reset_modules();
+static void reset_snapshots(void) {
+    for (size_t i = 0; i < kSnapshotMax; ++i) {
+        reset_table(s_snapshots[i].files);
+        s_snapshots[i].used = false;
+        s_snapshots[i].id = 0;
+        s_snapshots[i].label[0] = '\0';
+    }
+}
+
+static void reset_blocks(void) {
+    for (size_t i = 0; i < kRamBlockCount; ++i) {
+        s_block_refs[i] = 0;
+    }
+}
 
+void fs_reset_ramdisk(void) {
+    reset_table(s_ram_files);
+    notify(NULL, FS_EVENT_RESET);
+}
+
+static void seed_default_files(void) {
     (void)fs_write("readme.txt", "Welcome to PyCoreOS virtual filesystem.");
     (void)fs_write("notes.txt", "Try: help, apps, open calc, find, head, tail, grep, wc, todo add, journal add");
     (void)fs_write("settings.cfg", "mouse_speed=2\ntheme=0\nresolution_mode=0\n");
 }
 
+void fs_init(void) {
+    for (size_t i = 0; i < kRamMaxFiles; ++i) {
+        s_ram_files[i].block = kRamNoBlock;
+    }
+    for (size_t i = 0; i < kSnapshotMax; ++i) {
+        for (size_t j = 0; j < kRamMaxFiles; ++j) {
+            s_snapshots[i].files[j].block = kRamNoBlock;
+        }
+    }
+    reset_blocks();
+    fs_reset_ramdisk();
+    reset_snapshots();
+    reset_modules();
+    seed_default_files();
+}
+
+static bool strip_suffix(char* name, const char* suffix) {
+    const size_t name_len = cstr_len(name);
+    const size_t suffix_len = cstr_len(suffix);
+    if (name_len <= suffix_len || !str_eq(name + name_len - suffix_len, suffix)) {
+        return false;
+    }
+    name[name_len - suffix_len] = '\0';
+    return true;
+}
+
 bool fs_import_module(const char* name, const void* data, size_t size) {
     if (name == NULL || name[0] == '\0' || data == NULL || size == 0) {
         return false;
     }
-    if (find_ram_file(name) >= 0) {
+
+    /* "foo.wad.lz4" is published as "foo.wad"; the frame magic decides. */
+    char fs_name[kModuleNameMax];
+    if (!copy_cstr(fs_name, sizeof(fs_name), name)) {
+        return false;
+    }
+    if (lz4_frame_detect((const uint8_t*)data, size)) {
+        (void)strip_suffix(fs_name, ".lz4");
+    }
+    if (find_ram_file(fs_name) >= 0) {
         return false;
     }
 
-    int existing = find_module_file(name);
+    int existing = find_module_file(fs_name);
     if (existing >= 0) {
-        s_module_files[existing].data = (const uint8_t*)data;
-        s_module_files[existing].size = size;
+        if (!set_module_image(&s_module_files[existing], (const uint8_t*)data, size)) {
+            return false;
+        }
+        notify(fs_name, FS_EVENT_WRITE);
         return true;
     }
 
@@ -153,16 +374,14 @@ bool fs_import_module(const char* name, const void* data, size_t size) {
     }
 
     module_file* f = &s_module_files[slot];
-    f->used = true;
-    if (!copy_cstr(f->name, sizeof(f->name), name)) {
-        f->used = false;
-        f->name[0] = '\0';
-        f->data = NULL;
-        f->size = 0;
+    f->inflated = NULL;
+    f->mapped = false;
+    (void)copy_cstr(f->name, sizeof(f->name), fs_name);
+    if (!set_module_image(f, (const uint8_t*)data, size)) {
+        --s_module_count;
         return false;
     }
-    f->data = (const uint8_t*)data;
-    f->size = size;
+    notify(fs_name, FS_EVENT_CREATE);
     return true;
 }
 
@@ -173,12 +392,7 @@ size_t fs_count(void) {
             ++total;
         }
     }
-    for (size_t i = 0; i < kModuleMaxFiles; ++i) {
-        if (s_module_files[i].used) {
-            ++total;
-        }
-    }
-    return total;
+    return total + s_module_count;
 }
 
 static bool file_at(size_t index, fs_backend* out_backend, size_t* out_slot) {
@@ -200,20 +414,14 @@ static bool file_at(size_t index, fs_backend* out_backend, size_t* out_slot) {
         ++n;
     }
 
-    for (size_t i = 0; i < kModuleMaxFiles; ++i) {
-        if (!s_module_files[i].used) {
-            continue;
+    if (index - n < s_module_count) {
+        if (out_backend != NULL) {
+            *out_backend = FS_BACKEND_BOOT_MODULE;
         }
-        if (n == index) {
-            if (out_backend != NULL) {
-                *out_backend = FS_BACKEND_BOOT_MODULE;
-            }
-            if (out_slot != NULL) {
-                *out_slot = i;
-            }
-            return true;
+        if (out_slot != NULL) {
+            *out_slot = index - n;
         }
-        ++n;
+        return true;
     }
 
     return false;
@@ -299,9 +507,10 @@ bool fs_read_bytes(const char* name, size_t offset, void* out, size_t out_cap, s
             return true;
         }
         const size_t bytes = min_size(out_cap, f->size - offset);
+        const uint8_t* src = file_data(f);
         uint8_t* dst = (uint8_t*)out;
         for (size_t i = 0; i < bytes; ++i) {
-            dst[i] = f->data[offset + i];
+            dst[i] = src[offset + i];
         }
         if (out_read != NULL) {
             *out_read = bytes;
@@ -311,10 +520,13 @@ bool fs_read_bytes(const char* name, size_t offset, void* out, size_t out_cap, s
 
     const int mod_idx = find_module_file(name);
     if (mod_idx >= 0) {
-        const module_file* f = &s_module_files[mod_idx];
+        module_file* f = &s_module_files[mod_idx];
         if (offset >= f->size) {
             return true;
         }
+        if (!module_data(f)) {
+            return false;
+        }
         const size_t bytes = min_size(out_cap, f->size - offset);
         uint8_t* dst = (uint8_t*)out;
         for (size_t i = 0; i < bytes; ++i) {
@@ -336,15 +548,20 @@ bool fs_map_readonly(const char* name, const uint8_t** out_data, size_t* out_siz
 
     const int ram_idx = find_ram_file(name);
     if (ram_idx >= 0) {
-        *out_data = s_ram_files[ram_idx].data;
+        *out_data = file_data(&s_ram_files[ram_idx]);
         *out_size = s_ram_files[ram_idx].size;
         return true;
     }
 
     const int mod_idx = find_module_file(name);
     if (mod_idx >= 0) {
-        *out_data = s_module_files[mod_idx].data;
-        *out_size = s_module_files[mod_idx].size;
+        module_file* f = &s_module_files[mod_idx];
+        if (!module_data(f)) {
+            return false;
+        }
+        f->mapped = true;
+        *out_data = (f->data != NULL) ? f->data : kEmptyData;
+        *out_size = f->size;
         return true;
     }
 
@@ -384,26 +601,33 @@ bool fs_write_bytes(const char* name, const void* data, size_t size) {
     }
 
     int idx = find_ram_file(name);
-    if (idx < 0) {
+    const bool created = idx < 0;
+    if (created) {
         idx = alloc_ram_slot();
         if (idx < 0) {
             return false;
         }
         s_ram_files[idx].used = true;
         if (!copy_cstr(s_ram_files[idx].name, sizeof(s_ram_files[idx].name), name)) {
-            s_ram_files[idx].used = false;
-            s_ram_files[idx].name[0] = '\0';
-            s_ram_files[idx].size = 0;
+            clear_file(&s_ram_files[idx]);
             return false;
         }
     }
 
     ram_file* f = &s_ram_files[idx];
+    uint8_t* dst = file_data_for_write(f, size);
+    if (dst == NULL && size > 0) {
+        if (created) {
+            clear_file(f);
+        }
+        return false;
+    }
     f->size = size;
     const uint8_t* src = (const uint8_t*)data;
     for (size_t i = 0; i < size; ++i) {
-        f->data[i] = src[i];
+        dst[i] = src[i];
     }
+    notify(f->name, created ? FS_EVENT_CREATE : FS_EVENT_WRITE);
     return true;
 }
 
@@ -435,11 +659,11 @@ bool fs_touch(const char* name) {
 
     s_ram_files[idx].used = true;
     if (!copy_cstr(s_ram_files[idx].name, sizeof(s_ram_files[idx].name), name)) {
-        s_ram_files[idx].used = false;
-        s_ram_files[idx].name[0] = '\0';
+        clear_file(&s_ram_files[idx]);
         return false;
     }
     s_ram_files[idx].size = 0;
+    notify(s_ram_files[idx].name, FS_EVENT_CREATE);
     return true;
 }
 
@@ -449,24 +673,32 @@ bool fs_remove(const char* name) {
         return false;
     }
 
-    s_ram_files[idx].used = false;
-    s_ram_files[idx].name[0] = '\0';
-    s_ram_files[idx].size = 0;
+    clear_file(&s_ram_files[idx]);
+    notify(name, FS_EVENT_REMOVE);
     return true;
 }
 
-size_t fs_ramdisk_used(void) {
-    size_t total = 0;
-    for (size_t i = 0; i < kRamMaxFiles; ++i) {
-        if (s_ram_files[i].used) {
-            total += s_ram_files[i].size;
+static size_t count_used_blocks(void) {
+    size_t used = 0;
+    for (size_t i = 0; i < kRamBlockCount; ++i) {
+        if (s_block_refs[i] > 0) {
+            ++used;
         }
     }
-    return total;
+    return used;
+}
+
+/* Counts whole pool blocks, including those only snapshots still pin. */
+size_t fs_ramdisk_used(void) {
+    return count_used_blocks() * (size_t)kRamDataMax;
 }
 
 size_t fs_ramdisk_capacity(void) {
-    return (size_t)kRamMaxFiles * (size_t)kRamDataMax;
+    return (size_t)kRamBlockCount * (size_t)kRamDataMax;
+}
+
+bool fs_ramdisk_full(void) {
+    return count_used_blocks() == kRamBlockCount;
 }
 
 static bool append_bytes(uint8_t* out, size_t out_cap, size_t* cursor, const void* src, size_t len) {
@@ -495,23 +727,47 @@ static bool append_u32(uint8_t* out, size_t out_cap, size_t* cursor, uint32_t va
     return append_bytes(out, out_cap, cursor, raw, sizeof(raw));
 }
 
-static bool read_u32(const uint8_t* data, size_t size, size_t* cursor, uint32_t* out) {
-    if (data == NULL || cursor == NULL || out == NULL) {
+static bool append_file_entry(uint8_t* out, size_t out_cap, size_t* cursor, const ram_file* f, const uint16_t* block_ids) {
+    const size_t name_len = cstr_len(f->name);
+    if (name_len == 0 || name_len > 255U) {
         return false;
     }
-    if (*cursor + 4 > size) {
-        return false;
+
+    const uint8_t name_len_u8 = (uint8_t)name_len;
+    const uint32_t block_id = (f->block == kRamNoBlock) ? 0xFFFFFFFFU : (uint32_t)block_ids[f->block];
+    return append_bytes(out, out_cap, cursor, &name_len_u8, sizeof(name_len_u8)) &&
+           append_u32(out, out_cap, cursor, (uint32_t)f->size) &&
+           append_u32(out, out_cap, cursor, block_id) &&
+           append_bytes(out, out_cap, cursor, f->name, name_len);
+}
+
+static uint32_t count_table_files(const ram_file* table) {
+    uint32_t count = 0;
+    for (size_t i = 0; i < kRamMaxFiles; ++i) {
+        if (table[i].used) {
+            ++count;
+        }
     }
+    return count;
+}
 
-    const uint8_t* p = data + *cursor;
-    *out = (uint32_t)p[0] |
-           ((uint32_t)p[1] << 8U) |
-           ((uint32_t)p[2] << 16U) |
-           ((uint32_t)p[3] << 24U);
-    *cursor += 4;
-    return true;
+static void note_table_block_sizes(const ram_file* table, uint16_t* block_len) {
+    for (size_t i = 0; i < kRamMaxFiles; ++i) {
+        if (table[i].used && table[i].block != kRamNoBlock && table[i].size > block_len[table[i].block]) {
+            block_len[table[i].block] = (uint16_t)table[i].size;
+        }
+    }
 }
 
+/*
+ * Image layout (version 2, little endian):
+ *   "PYFS" u32 version
+ *   u32 block_count, then per block: u32 len, len bytes
+ *   u32 file_count, then per file: u8 name_len, u32 size, u32 block_id, name
+ *   u32 snapshot_count, then per snapshot: u32 id, u8 label_len, u32 file_count,
+ *       label, file entries as above
+ * Blocks shared between the live table and snapshots are written once.
+ */
 size_t fs_serialize_ramdisk(uint8_t* out, size_t out_cap) {
     size_t cursor = 0;
     const char magic[4] = {'P', 'Y', 'F', 'S'};
@@ -519,109 +775,737 @@ size_t fs_serialize_ramdisk(uint8_t* out, size_t out_cap) {
     if (!append_bytes(out, out_cap, &cursor, magic, sizeof(magic))) {
         return 0;
     }
+    if (!append_u32(out, out_cap, &cursor, 2U)) {
+        return 0;
+    }
 
-    uint32_t count = 0;
-    for (size_t i = 0; i < kRamMaxFiles; ++i) {
-        if (s_ram_files[i].used) {
-            ++count;
+    static uint16_t block_len[kRamBlockCount];
+    static uint16_t block_ids[kRamBlockCount];
+    for (size_t i = 0; i < kRamBlockCount; ++i) {
+        block_len[i] = 0;
+    }
+    note_table_block_sizes(s_ram_files, block_len);
+    uint32_t snapshot_count = 0;
+    for (size_t i = 0; i < kSnapshotMax; ++i) {
+        if (s_snapshots[i].used) {
+            note_table_block_sizes(s_snapshots[i].files, block_len);
+            ++snapshot_count;
         }
     }
 
-    if (!append_u32(out, out_cap, &cursor, 1U)) {
-        return 0;
+    uint32_t block_count = 0;
+    for (size_t i = 0; i < kRamBlockCount; ++i) {
+        if (s_block_refs[i] != 0) {
+            block_ids[i] = (uint16_t)block_count++;
+        }
     }
-    if (!append_u32(out, out_cap, &cursor, count)) {
+    if (!append_u32(out, out_cap, &cursor, block_count)) {
         return 0;
     }
-
-    for (size_t i = 0; i < kRamMaxFiles; ++i) {
-        if (!s_ram_files[i].used) {
+    for (size_t i = 0; i < kRamBlockCount; ++i) {
+        if (s_block_refs[i] == 0) {
             continue;
         }
-
-        const ram_file* f = &s_ram_files[i];
-        const size_t name_len = cstr_len(f->name);
-        if (name_len == 0 || name_len > 255U) {
+        if (!append_u32(out, out_cap, &cursor, block_len[i]) ||
+            !append_bytes(out, out_cap, &cursor, s_block_data[i], block_len[i])) {
             return 0;
         }
+    }
 
-        const uint8_t name_len_u8 = (uint8_t)name_len;
-        if (!append_bytes(out, out_cap, &cursor, &name_len_u8, sizeof(name_len_u8))) {
+    if (!append_u32(out, out_cap, &cursor, count_table_files(s_ram_files))) {
+        return 0;
+    }
+    for (size_t i = 0; i < kRamMaxFiles; ++i) {
+        if (s_ram_files[i].used && !append_file_entry(out, out_cap, &cursor, &s_ram_files[i], block_ids)) {
             return 0;
         }
-        if (!append_u32(out, out_cap, &cursor, (uint32_t)f->size)) {
-            return 0;
+    }
+
+    if (!append_u32(out, out_cap, &cursor, snapshot_count)) {
+        return 0;
+    }
+    for (size_t i = 0; i < kSnapshotMax; ++i) {
+        const ram_snapshot* snap = &s_snapshots[i];
+        if (!snap->used) {
+            continue;
         }
-        if (!append_bytes(out, out_cap, &cursor, f->name, name_len)) {
+        const uint8_t label_len = (uint8_t)cstr_len(snap->label);
+        if (!append_u32(out, out_cap, &cursor, snap->id) ||
+            !append_bytes(out, out_cap, &cursor, &label_len, sizeof(label_len)) ||
+            !append_u32(out, out_cap, &cursor, count_table_files(snap->files)) ||
+            !append_bytes(out, out_cap, &cursor, snap->label, label_len)) {
             return 0;
         }
-        if (!append_bytes(out, out_cap, &cursor, f->data, f->size)) {
-            return 0;
+        for (size_t j = 0; j < kRamMaxFiles; ++j) {
+            if (snap->files[j].used && !append_file_entry(out, out_cap, &cursor, &snap->files[j], block_ids)) {
+                return 0;
+            }
         }
     }
 
     return cursor;
 }
 
+typedef enum load_stage {
+    LOAD_STAGE_IDLE = 0,
+    LOAD_STAGE_HEADER,
+    LOAD_STAGE_V1_COUNT,
+    LOAD_STAGE_V1_ENTRY,
+    LOAD_STAGE_NAME,
+    LOAD_STAGE_V1_DATA,
+    LOAD_STAGE_BLOCK_COUNT,
+    LOAD_STAGE_BLOCK_HEADER,
+    LOAD_STAGE_BLOCK_DATA,
+    LOAD_STAGE_FILE_COUNT,
+    LOAD_STAGE_FILE_ENTRY,
+    LOAD_STAGE_SNAPSHOT_COUNT,
+    LOAD_STAGE_SNAPSHOT_HEADER,
+    LOAD_STAGE_SNAPSHOT_LABEL,
+    LOAD_STAGE_DONE,
+} load_stage;
+
+/*
+ * Incremental parser for PYFS images (version 1 and 2). Input may be split
+ * at any byte boundary; payloads are written straight into pool blocks.
+ */
+typedef struct load_stream {
+    load_stage stage;
+    uint32_t version;
+    uint8_t scratch[12];
+    size_t scratch_len;
+    uint32_t files_left;
+    uint8_t name_len;
+    uint32_t file_size;
+    uint32_t file_block;
+    char name[kRamNameMax];
+    size_t name_got;
+    uint8_t* data_dst;
+    uint32_t data_len;
+    uint32_t data_got;
+    uint32_t blocks_left;
+    uint32_t blocks_loaded;
+    int16_t block_map[kRamBlockCount];
+    uint32_t snapshots_left;
+    ram_snapshot* snapshot;
+    ram_file* table;
+} load_stream;
+
+static load_stream s_load;
+
+/*
+ * Live ramdisk state set aside while a load replaces it in place. A load
+ * that fails to parse or fails its checksum puts it back, so a bad image
+ * never costs live data and the disk is only read once.
+ */
+typedef struct load_backup {
+    ram_file files[kRamMaxFiles];
+    uint16_t block_refs[kRamBlockCount];
+    uint8_t block_data[kRamBlockCount][kRamDataMax];
+    ram_snapshot snapshots[kSnapshotMax];
+    uint32_t next_snapshot_id;
+} load_backup;
+
+static load_backup* s_load_backup = NULL;
+
+static bool load_take(const uint8_t** data, size_t* size, size_t need) {
+    while (s_load.scratch_len < need && *size > 0) {
+        s_load.scratch[s_load.scratch_len++] = **data;
+        ++(*data);
+        --(*size);
+    }
+    if (s_load.scratch_len < need) {
+        return false;
+    }
+    s_load.scratch_len = 0;
+    return true;
+}
+
+static uint32_t load_scratch_u32(size_t at) {
+    const uint8_t* p = s_load.scratch + at;
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8U) | ((uint32_t)p[2] << 16U) | ((uint32_t)p[3] << 24U);
+}
+
+static void load_next_snapshot(void) {
+    s_load.stage = (s_load.snapshots_left == 0) ? LOAD_STAGE_DONE : LOAD_STAGE_SNAPSHOT_HEADER;
+}
+
+static void load_next_file(void) {
+    if (s_load.files_left > 0) {
+        s_load.stage = (s_load.version == 1U) ? LOAD_STAGE_V1_ENTRY : LOAD_STAGE_FILE_ENTRY;
+    } else if (s_load.version == 1U) {
+        s_load.stage = LOAD_STAGE_DONE;
+    } else if (s_load.table == s_ram_files) {
+        s_load.stage = LOAD_STAGE_SNAPSHOT_COUNT;
+    } else {
+        load_next_snapshot();
+    }
+}
+
+static void load_next_block(void) {
+    s_load.stage = (s_load.blocks_left == 0) ? LOAD_STAGE_FILE_COUNT : LOAD_STAGE_BLOCK_HEADER;
+}
+
+static bool load_place_file(void) {
+    s_load.name[s_load.name_len] = '\0';
+    ram_file* table = s_load.table;
+    if (table == s_ram_files && find_module_file(s_load.name) >= 0) {
+        return false;
+    }
+    int idx = find_table_file(table, s_load.name);
+    if (idx < 0) {
+        idx = alloc_table_slot(table);
+        if (idx < 0) {
+            return false;
+        }
+        table[idx].used = true;
+        (void)copy_cstr(table[idx].name, sizeof(table[idx].name), s_load.name);
+    }
+    ram_file* f = &table[idx];
+
+    if (s_load.version == 1U) {
+        s_load.data_dst = file_data_for_write(f, s_load.file_size);
+        if (s_load.data_dst == NULL && s_load.file_size > 0) {
+            return false;
+        }
+    } else {
+        block_unref(f->block);
+        f->block = kRamNoBlock;
+        if (s_load.file_block != 0xFFFFFFFFU) {
+            if (s_load.file_block >= s_load.blocks_loaded) {
+                return false;
+            }
+            f->block = s_load.block_map[s_load.file_block];
+            block_ref(f->block);
+        }
+    }
+    f->size = s_load.file_size;
+    return true;
+}
+
+static bool load_open_snapshot(uint32_t id) {
+    for (size_t i = 0; i < kSnapshotMax; ++i) {
+        if (!s_snapshots[i].used) {
+            s_snapshots[i].used = true;
+            s_snapshots[i].id = id;
+            s_load.snapshot = &s_snapshots[i];
+            s_load.table = s_snapshots[i].files;
+            if (id >= s_next_snapshot_id) {
+                s_next_snapshot_id = id + 1U;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+static void load_reset_all(void) {
+    fs_reset_ramdisk();
+    reset_snapshots();
+    reset_blocks();
+}
+
+static void copy_block_bytes(uint8_t* dst, const uint8_t* src) {
+    for (size_t i = 0; i < kRamDataMax; ++i) {
+        dst[i] = src[i];
+    }
+}
+
+static bool load_save_live(void) {
+    load_backup* b = (load_backup*)kmem_alloc(sizeof(load_backup));
+    if (b == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < kRamMaxFiles; ++i) {
+        b->files[i] = s_ram_files[i];
+    }
+    for (size_t i = 0; i < kRamBlockCount; ++i) {
+        b->block_refs[i] = s_block_refs[i];
+        if (s_block_refs[i] > 0) {
+            copy_block_bytes(b->block_data[i], s_block_data[i]);
+        }
+    }
+    for (size_t i = 0; i < kSnapshotMax; ++i) {
+        b->snapshots[i].used = s_snapshots[i].used;
+        b->snapshots[i].id = s_snapshots[i].id;
+        (void)copy_cstr(b->snapshots[i].label, sizeof(b->snapshots[i].label), s_snapshots[i].label);
+        for (size_t j = 0; j < kRamMaxFiles; ++j) {
+            b->snapshots[i].files[j] = s_snapshots[i].files[j];
+        }
+    }
+    b->next_snapshot_id = s_next_snapshot_id;
+    s_load_backup = b;
+    return true;
+}
+
+/* restore puts the saved state back; otherwise the load is kept and the copy dropped. */
+static void load_release_live(bool restore) {
+    load_backup* b = s_load_backup;
+    s_load_backup = NULL;
+    if (b == NULL) {
+        return;
+    }
+    if (restore) {
+        for (size_t i = 0; i < kRamMaxFiles; ++i) {
+            s_ram_files[i] = b->files[i];
+        }
+        for (size_t i = 0; i < kRamBlockCount; ++i) {
+            s_block_refs[i] = b->block_refs[i];
+            if (b->block_refs[i] > 0) {
+                copy_block_bytes(s_block_data[i], b->block_data[i]);
+            }
+        }
+        for (size_t i = 0; i < kSnapshotMax; ++i) {
+            s_snapshots[i].used = b->snapshots[i].used;
+            s_snapshots[i].id = b->snapshots[i].id;
+            (void)copy_cstr(s_snapshots[i].label, sizeof(s_snapshots[i].label), b->snapshots[i].label);
+            for (size_t j = 0; j < kRamMaxFiles; ++j) {
+                s_snapshots[i].files[j] = b->snapshots[i].files[j];
+            }
+        }
+        s_next_snapshot_id = b->next_snapshot_id;
+        notify(NULL, FS_EVENT_RESET);
+    }
+    kmem_free(b);
+}
+
+bool fs_load_stream_begin(void) {
+    load_release_live(false);
+    if (!load_save_live()) {
+        s_load.stage = LOAD_STAGE_IDLE;
+        return false;
+    }
+    load_reset_all();
+    s_load.stage = LOAD_STAGE_HEADER;
+    s_load.scratch_len = 0;
+    s_load.files_left = 0;
+    s_load.blocks_left = 0;
+    s_load.blocks_loaded = 0;
+    s_load.snapshots_left = 0;
+    s_load.snapshot = NULL;
+    s_load.table = s_ram_files;
+    return true;
+}
+
+bool fs_load_stream_feed(const uint8_t* data, size_t size) {
+    if (s_load.stage == LOAD_STAGE_IDLE || (data == NULL && size > 0)) {
+        return false;
+    }
+
+    /* Stages return when they need more input, so empty sections finish here. */
+    while (s_load.stage != LOAD_STAGE_DONE) {
+        switch (s_load.stage) {
+        case LOAD_STAGE_HEADER:
+            if (!load_take(&data, &size, 8)) {
+                return true;
+            }
+            if (s_load.scratch[0] != 'P' || s_load.scratch[1] != 'Y' ||
+                s_load.scratch[2] != 'F' || s_load.scratch[3] != 'S') {
+                return false;
+            }
+            s_load.version = load_scratch_u32(4);
+            if (s_load.version == 1U) {
+                s_load.stage = LOAD_STAGE_V1_COUNT;
+            } else if (s_load.version == 2U) {
+                s_load.stage = LOAD_STAGE_BLOCK_COUNT;
+            } else {
+                return false;
+            }
+            break;
+
+        case LOAD_STAGE_V1_COUNT:
+        case LOAD_STAGE_FILE_COUNT:
+            if (!load_take(&data, &size, 4)) {
+                return true;
+            }
+            s_load.files_left = load_scratch_u32(0);
+            if (s_load.files_left > kRamMaxFiles) {
+                return false;
+            }
+            load_next_file();
+            break;
+
+        case LOAD_STAGE_V1_ENTRY:
+        case LOAD_STAGE_FILE_ENTRY: {
+            const size_t need = (s_load.stage == LOAD_STAGE_V1_ENTRY) ? 5U : 9U;
+            if (!load_take(&data, &size, need)) {
+                return true;
+            }
+            s_load.name_len = s_load.scratch[0];
+            s_load.file_size = load_scratch_u32(1);
+            s_load.file_block = (need == 9U) ? load_scratch_u32(5) : 0xFFFFFFFFU;
+            if (s_load.name_len == 0 || (size_t)s_load.name_len >= sizeof(s_load.name) ||
+                s_load.file_size > kRamDataMax) {
+                return false;
+            }
+            s_load.name_got = 0;
+            s_load.stage = LOAD_STAGE_NAME;
+            break;
+        }
+
+        case LOAD_STAGE_NAME:
+            while (size > 0 && s_load.name_got < s_load.name_len) {
+                s_load.name[s_load.name_got++] = (char)*data++;
+                --size;
+            }
+            if (s_load.name_got < s_load.name_len) {
+                return true;
+            }
+            if (!load_place_file()) {
+                return false;
+            }
+            if (s_load.version == 1U) {
+                s_load.data_len = s_load.file_size;
+                s_load.data_got = 0;
+                s_load.stage = LOAD_STAGE_V1_DATA;
+            } else {
+                --s_load.files_left;
+                load_next_file();
+            }
+            break;
+
+        case LOAD_STAGE_V1_DATA:
+        case LOAD_STAGE_BLOCK_DATA: {
+            const size_t want = min_size(size, (size_t)(s_load.data_len - s_load.data_got));
+            uint8_t* dst = s_load.data_dst + s_load.data_got;
+            for (size_t i = 0; i < want; ++i) {
+                dst[i] = data[i];
+            }
+            data += want;
+            size -= want;
+            s_load.data_got += (uint32_t)want;
+            if (s_load.data_got < s_load.data_len) {
+                return true;
+            }
+            if (s_load.stage == LOAD_STAGE_V1_DATA) {
+                --s_load.files_left;
+                load_next_file();
+            } else {
+                --s_load.blocks_left;
+                load_next_block();
+            }
+            break;
+        }
+
+        case LOAD_STAGE_BLOCK_COUNT:
+            if (!load_take(&data, &size, 4)) {
+                return true;
+            }
+            s_load.blocks_left = load_scratch_u32(0);
+            if (s_load.blocks_left > kRamBlockCount) {
+                return false;
+            }
+            load_next_block();
+            break;
+
+        case LOAD_STAGE_BLOCK_HEADER: {
+            if (!load_take(&data, &size, 4)) {
+                return true;
+            }
+            s_load.data_len = load_scratch_u32(0);
+            if (s_load.data_len > kRamDataMax) {
+                return false;
+            }
+            /* The loader holds one reference until fs_load_stream_end(). */
+            const int block = alloc_block();
+            if (block == kRamNoBlock) {
+                return false;
+            }
+            s_load.block_map[s_load.blocks_loaded++] = (int16_t)block;
+            s_load.data_dst = s_block_data[block];
+            s_load.data_got = 0;
+            s_load.stage = LOAD_STAGE_BLOCK_DATA;
+            break;
+        }
+
+        case LOAD_STAGE_SNAPSHOT_COUNT:
+            if (!load_take(&data, &size, 4)) {
+                return true;
+            }
+            s_load.snapshots_left = load_scratch_u32(0);
+            if (s_load.snapshots_left > kSnapshotMax) {
+                return false;
+            }
+            load_next_snapshot();
+            break;
+
+        case LOAD_STAGE_SNAPSHOT_HEADER:
+            if (!load_take(&data, &size, 9)) {
+                return true;
+            }
+            s_load.name_len = s_load.scratch[4];
+            s_load.files_left = load_scratch_u32(5);
+            if ((size_t)s_load.name_len >= kSnapshotLabelMax || s_load.files_left > kRamMaxFiles ||
+                !load_open_snapshot(load_scratch_u32(0))) {
+                return false;
+            }
+            s_load.name_got = 0;
+            s_load.stage = LOAD_STAGE_SNAPSHOT_LABEL;
+            break;
+
+        case LOAD_STAGE_SNAPSHOT_LABEL:
+            while (size > 0 && s_load.name_got < s_load.name_len) {
+                s_load.snapshot->label[s_load.name_got++] = (char)*data++;
+                --size;
+            }
+            if (s_load.name_got < s_load.name_len) {
+                return true;
+            }
+            s_load.snapshot->label[s_load.name_len] = '\0';
+            --s_load.snapshots_left;
+            load_next_file();
+            break;
+
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+bool fs_load_stream_end(void) {
+    const bool complete = s_load.stage == LOAD_STAGE_DONE;
+    s_load.stage = LOAD_STAGE_IDLE;
+    if (!complete) {
+        load_release_live(true);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < s_load.blocks_loaded; ++i) {
+        block_unref(s_load.block_map[i]);
+    }
+    load_release_live(false);
+    notify(NULL, FS_EVENT_RESET);
+    return true;
+}
+
+void fs_load_stream_abort(void) {
+    s_load.stage = LOAD_STAGE_IDLE;
+    load_release_live(true);
+}
+
 bool fs_deserialize_ramdisk(const uint8_t* data, size_t size) {
     if (data == NULL || size < 12) {
         return false;
     }
-
     if (data[0] != 'P' || data[1] != 'Y' || data[2] != 'F' || data[3] != 'S') {
         return false;
     }
 
-    size_t cursor = 4;
-    uint32_t version = 0;
-    uint32_t count = 0;
-    if (!read_u32(data, size, &cursor, &version) || version != 1U) {
+    if (!fs_load_stream_begin()) {
         return false;
     }
-    if (!read_u32(data, size, &cursor, &count)) {
+    if (!fs_load_stream_feed(data, size)) {
+        fs_load_stream_abort();
         return false;
     }
+    return fs_load_stream_end();
+}
 
-    fs_reset_ramdisk();
+static ram_snapshot* find_snapshot(uint32_t id) {
+    for (size_t i = 0; i < kSnapshotMax; ++i) {
+        if (s_snapshots[i].used && s_snapshots[i].id == id) {
+            return &s_snapshots[i];
+        }
+    }
+    return NULL;
+}
 
-    for (uint32_t i = 0; i < count; ++i) {
-        if (cursor + 1 > size) {
-            fs_init();
-            return false;
+static void copy_table(ram_file* dst, const ram_file* src) {
+    for (size_t i = 0; i < kRamMaxFiles; ++i) {
+        block_ref(src[i].used ? src[i].block : kRamNoBlock);
+        clear_file(&dst[i]);
+        dst[i] = src[i];
+        if (!src[i].used) {
+            dst[i].block = kRamNoBlock;
         }
+    }
+}
 
-        const uint8_t name_len = data[cursor++];
-        uint32_t file_size = 0;
-        if (name_len == 0 || !read_u32(data, size, &cursor, &file_size)) {
-            fs_init();
-            return false;
+bool fs_snapshot_create(const char* label, uint32_t* out_id) {
+    ram_snapshot* snap = NULL;
+    for (size_t i = 0; i < kSnapshotMax; ++i) {
+        if (!s_snapshots[i].used) {
+            snap = &s_snapshots[i];
+            break;
         }
-        if (file_size > kRamDataMax) {
-            fs_init();
-            return false;
+    }
+    if (snap == NULL) {
+        return false;
+    }
+
+    snap->used = true;
+    snap->id = s_next_snapshot_id++;
+    if (label == NULL || label[0] == '\0' || !copy_cstr(snap->label, sizeof(snap->label), label)) {
+        (void)copy_cstr(snap->label, sizeof(snap->label), "snapshot");
+    }
+    copy_table(snap->files, s_ram_files);
+    if (out_id != NULL) {
+        *out_id = snap->id;
+    }
+    return true;
+}
+
+size_t fs_snapshot_count(void) {
+    size_t total = 0;
+    for (size_t i = 0; i < kSnapshotMax; ++i) {
+        if (s_snapshots[i].used) {
+            ++total;
         }
-        if (cursor + (size_t)name_len + (size_t)file_size > size) {
-            fs_init();
-            return false;
+    }
+    return total;
+}
+
+bool fs_snapshot_info_at(size_t index, fs_snapshot_info* out_info) {
+    if (out_info == NULL) {
+        return false;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < kSnapshotMax; ++i) {
+        const ram_snapshot* snap = &s_snapshots[i];
+        if (!snap->used) {
+            continue;
+        }
+        if (n++ != index) {
+            continue;
         }
 
-        char name[kRamNameMax];
-        if ((size_t)name_len >= sizeof(name)) {
-            fs_init();
-            return false;
+        out_info->id = snap->id;
+        (void)copy_cstr(out_info->label, sizeof(out_info->label), snap->label);
+        out_info->files = 0;
+        out_info->bytes = 0;
+        out_info->private_bytes = 0;
+        for (size_t j = 0; j < kRamMaxFiles; ++j) {
+            const ram_file* f = &snap->files[j];
+            if (!f->used) {
+                continue;
+            }
+            ++out_info->files;
+            out_info->bytes += (uint32_t)f->size;
+            if (f->block != kRamNoBlock && s_block_refs[f->block] == 1) {
+                out_info->private_bytes += (uint32_t)f->size;
+            }
         }
-        for (uint8_t j = 0; j < name_len; ++j) {
-            name[j] = (char)data[cursor + j];
+        return true;
+    }
+    return false;
+}
+
+bool fs_snapshot_restore(uint32_t id) {
+    const ram_snapshot* snap = find_snapshot(id);
+    if (snap == NULL) {
+        return false;
+    }
+
+    copy_table(s_ram_files, snap->files);
+    for (size_t i = 0; i < kRamMaxFiles; ++i) {
+        if (s_ram_files[i].used && find_module_file(s_ram_files[i].name) >= 0) {
+            clear_file(&s_ram_files[i]);
         }
-        name[name_len] = '\0';
-        cursor += (size_t)name_len;
+    }
+    notify(NULL, FS_EVENT_RESET);
+    return true;
+}
 
-        if (!fs_write_bytes(name, data + cursor, (size_t)file_size)) {
-            fs_init();
+bool fs_snapshot_delete(uint32_t id) {
+    ram_snapshot* snap = find_snapshot(id);
+    if (snap == NULL) {
+        return false;
+    }
+
+    reset_table(snap->files);
+    snap->used = false;
+    snap->id = 0;
+    snap->label[0] = '\0';
+    return true;
+}
+
+static bool same_contents(const ram_file* a, const ram_file* b) {
+    if (a->size != b->size) {
+        return false;
+    }
+    if (a->block == b->block) {
+        return true;
+    }
+    const uint8_t* da = file_data(a);
+    const uint8_t* db = file_data(b);
+    for (size_t i = 0; i < a->size; ++i) {
+        if (da[i] != db[i]) {
             return false;
         }
-        cursor += (size_t)file_size;
     }
-
     return true;
 }
+
+size_t fs_snapshot_diff(uint32_t id, fs_snapshot_diff_fn callback, void* ctx) {
+    const ram_snapshot* snap = find_snapshot(id);
+    if (snap == NULL) {
+        return 0;
+    }
+
+    size_t changes = 0;
+    for (size_t i = 0; i < kRamMaxFiles; ++i) {
+        const ram_file* old_file = &snap->files[i];
+        if (!old_file->used) {
+            continue;
+        }
+        const int live_idx = find_ram_file(old_file->name);
+        fs_snapshot_change change = FS_SNAPSHOT_REMOVED;
+        if (live_idx >= 0) {
+            if (same_contents(old_file, &s_ram_files[live_idx])) {
+                continue;
+            }
+            change = FS_SNAPSHOT_MODIFIED;
+        }
+        ++changes;
+        if (callback != NULL) {
+            callback(old_file->name, change, ctx);
+        }
+    }
+
+    for (size_t i = 0; i < kRamMaxFiles; ++i) {
+        const ram_file* f = &s_ram_files[i];
+        if (!f->used || find_table_file(snap->files, f->name) >= 0) {
+            continue;
+        }
+        ++changes;
+        if (callback != NULL) {
+            callback(f->name, FS_SNAPSHOT_ADDED, ctx);
+        }
+    }
+    return changes;
+}
+
+uint32_t fs_generation(void) {
+    return s_generation;
+}
+
+int fs_watch(const char* name, uint32_t event_mask, fs_watch_fn callback, void* ctx) {
+    if (callback == NULL || event_mask == 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < kWatchMax; ++i) {
+        fs_watcher* w = &s_watchers[i];
+        if (w->used) {
+            continue;
+        }
+        w->name[0] = '\0';
+        if (name != NULL && !copy_cstr(w->name, sizeof(w->name), name)) {
+            return -1;
+        }
+        w->mask = event_mask;
+        w->callback = callback;
+        w->ctx = ctx;
+        w->used = true;
+        return (int)i;
+    }
+    return -1;
+}
+
+void fs_unwatch(int handle) {
+    if (handle < 0 || handle >= kWatchMax) {
+        return;
+    }
+    s_watchers[handle].used = false;
+    s_watchers[handle].callback = NULL;
+}
@@ -1,6 +1,7 @@
 #include "kernel/fs_persist.h"
 
-#include "drivers/ata.h"
+#include "drivers/blockdev.h"
+#include "kernel/block_cache.h"
 #include "kernel/filesystem.h"
 
 #include <stddef.h>
@@ -8,14 +9,18 @@
 
 enum {
     kFsPersistStartLba = 2048U,
-    kFsPersistMaxBytes = 300000U,
+    /* Whole block pool plus metadata for the live table and every snapshot. */
+    kFsPersistMaxBytes = 851968U,
     kFsPersistHeaderSectors = 1U,
+    kFsPersistRunSectors = 64U,
 };
 
+static const uint32_t kChecksumSeed = 0xC0DEC0DEU;
+
+static const blockdev* s_dev = NULL;
 static bool s_available = false;
 
-static uint32_t checksum32(const uint8_t* data, size_t size) {
-    uint32_t acc = 0xC0DEC0DEU;
+static uint32_t checksum32_update(uint32_t acc, const uint8_t* data, size_t size) {
     for (size_t i = 0; i < size; ++i) {
         acc ^= (uint32_t)data[i];
         acc = (acc << 5U) | (acc >> 27U);
@@ -24,26 +29,35 @@ static uint32_t checksum32(const uint8_t* data, size_t size) {
     return acc;
 }
 
+static uint32_t checksum32(const uint8_t* data, size_t size) {
+    return checksum32_update(kChecksumSeed, data, size);
+}
+
 void fs_persist_init(void) {
-    s_available = ata_ready();
+    s_dev = blockdev_primary();
+    s_available = s_dev != NULL;
 }
 
 bool fs_persist_available(void) {
     return s_available;
 }
 
+uint64_t fs_persist_reserved_end(void) {
+    return (uint64_t)kFsPersistStartLba + kFsPersistHeaderSectors + (kFsPersistMaxBytes + 511U) / 512U;
+}
+
 bool fs_persist_save_now(void) {
     if (!s_available) {
         return false;
     }
 
-    static uint8_t image[kFsPersistMaxBytes];
+    static uint8_t image[kFsPersistMaxBytes] __attribute__((aligned(4)));
     const size_t image_size = fs_serialize_ramdisk(image, sizeof(image));
     if (image_size == 0) {
         return false;
     }
 
-    uint8_t header[512];
+    uint8_t header[512] __attribute__((aligned(4)));
     for (size_t i = 0; i < sizeof(header); ++i) {
         header[i] = 0;
     }
@@ -66,32 +80,61 @@ bool fs_persist_save_now(void) {
     header[14] = (uint8_t)((sum >> 16U) & 0xFFU);
     header[15] = (uint8_t)((sum >> 24U) & 0xFFU);
 
-    if (!ata_write_sector28(kFsPersistStartLba, header)) {
+    if (!block_cache_write(s_dev, kFsPersistStartLba, kFsPersistHeaderSectors, header)) {
         return false;
     }
 
+    /* Zero the tail of the last sector so the whole image goes out in one call. */
     const size_t data_sectors = (image_size + 511U) / 512U;
-    for (size_t s = 0; s < data_sectors; ++s) {
-        uint8_t sector[512];
-        for (size_t i = 0; i < sizeof(sector); ++i) {
-            sector[i] = 0;
-        }
+    for (size_t i = image_size; i < data_sectors * 512U; ++i) {
+        image[i] = 0;
+    }
+    if (!block_cache_write(s_dev, kFsPersistStartLba + kFsPersistHeaderSectors, (uint32_t)data_sectors, image)) {
+        return false;
+    }
+    /* The only barrier of the save: the image is durable once this returns. */
+    return block_cache_sync(s_dev);
+}
 
-        const size_t offset = s * 512U;
-        size_t chunk = image_size - offset;
-        if (chunk > sizeof(sector)) {
-            chunk = sizeof(sector);
+/* Stream multi-sector runs straight into the file table: no staging image. */
+static bool stream_image(size_t image_size, uint32_t expected_sum) {
+    static uint8_t run[kFsPersistRunSectors * 512U] __attribute__((aligned(4)));
+    uint32_t lba = kFsPersistStartLba + kFsPersistHeaderSectors;
+    size_t remaining = image_size;
+    uint32_t sum = kChecksumSeed;
+
+    if (!fs_load_stream_begin()) {
+        return false;
+    }
+    while (remaining > 0) {
+        uint32_t sectors = (uint32_t)((remaining + 511U) / 512U);
+        if (sectors > kFsPersistRunSectors) {
+            sectors = kFsPersistRunSectors;
         }
-        for (size_t i = 0; i < chunk; ++i) {
-            sector[i] = image[offset + i];
+        if (!block_cache_read(s_dev, lba, sectors, run)) {
+            fs_load_stream_abort();
+            return false;
         }
 
-        if (!ata_write_sector28(kFsPersistStartLba + kFsPersistHeaderSectors + (uint32_t)s, sector)) {
+        size_t chunk = (size_t)sectors * 512U;
+        if (chunk > remaining) {
+            chunk = remaining;
+        }
+        sum = checksum32_update(sum, run, chunk);
+        if (!fs_load_stream_feed(run, chunk)) {
+            fs_load_stream_abort();
             return false;
         }
+
+        lba += sectors;
+        remaining -= chunk;
     }
 
-    return true;
+    if (sum != expected_sum) {
+        fs_load_stream_abort();
+        return false;
+    }
+    return fs_load_stream_end();
 }
 
 bool fs_persist_load_now(void) {
@@ -99,8 +142,8 @@ bool fs_persist_load_now(void) {
         return false;
     }
 
-    uint8_t header[512];
-    if (!ata_read_sector28(kFsPersistStartLba, header)) {
+    uint8_t header[512] __attribute__((aligned(4)));
+    if (!block_cache_read(s_dev, kFsPersistStartLba, kFsPersistHeaderSectors, header)) {
         return false;
     }
     if (header[0] != 'P' || header[1] != 'Y' || header[2] != 'F' || header[3] != 'S' ||
@@ -120,28 +163,8 @@ bool fs_persist_load_now(void) {
         return false;
     }
 
-    static uint8_t image[kFsPersistMaxBytes];
-    const size_t data_sectors = (image_size + 511U) / 512U;
-    for (size_t s = 0; s < data_sectors; ++s) {
-        uint8_t sector[512];
-        if (!ata_read_sector28(kFsPersistStartLba + kFsPersistHeaderSectors + (uint32_t)s, sector)) {
-            return false;
-        }
-
-        const size_t offset = s * 512U;
-        size_t chunk = image_size - offset;
-        if (chunk > sizeof(sector)) {
-            chunk = sizeof(sector);
-        }
-        for (size_t i = 0; i < chunk; ++i) {
-            image[offset + i] = sector[i];
-        }
-    }
-
-    if (checksum32(image, image_size) != expected_sum) {
-        return false;
-    }
-    return fs_deserialize_ramdisk(image, image_size);
+    /* One pass: a structure or checksum failure rolls the ramdisk back to what it was. */
+    return stream_image(image_size, expected_sum);
 }
 
 bool fs_save_to_disk(void) {
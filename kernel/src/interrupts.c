@@ -1,5 +1,6 @@
 #include "kernel/interrupts.h"
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -61,23 +62,45 @@ enum {
     kUserCs = 0x1B,
     kUserDs = 0x23,
     kTssSel = 0x28,
-    kInt80Vector = 0x80
+    kInt80Vector = 0x80,
+    kInt80KernelCall = 2,
+
+    kPicMasterCmd = 0x20,
+    kPicMasterData = 0x21,
+    kPicSlaveCmd = 0xA0,
+    kPicSlaveData = 0xA1,
+    kPicEoi = 0x20,
+    kPicReadIsr = 0x0B,
+    kIrqVectorBase = 0x20,
+    kIrqLines = 16,
+    kIrqCascade = 2,
+
+    kEflagsIf = 0x200
 };
 
+typedef struct irq_slot {
+    irq_handler_fn handler;
+    void* ctx;
+} irq_slot;
+
 extern void desktop_tick(void);
 extern void isr_hang_stub(void);
 extern void isr_int80_stub(void);
 extern void ring3_desktop_entry(void);
 extern void ring3_enter_desktop(void);
+extern const uint32_t irq_stub_table[kIrqLines];
 
 static gdt_entry s_gdt[6];
 static table_ptr s_gdt_ptr;
 static idt_entry s_idt[256];
 static table_ptr s_idt_ptr;
 static tss_entry s_tss;
-static uint8_t s_ring0_stack[8192] __attribute__((aligned(16)));
+static uint8_t s_ring0_stack[32768] __attribute__((aligned(16)));
 static uint8_t s_ring3_stack[16384] __attribute__((aligned(16)));
 
+static irq_slot s_irq_slots[kIrqLines];
+static kernel_call_fn s_kernel_calls[KERNEL_CALL_COUNT];
+
 volatile uint32_t g_ring3_stack_top = 0;
 volatile uint32_t g_ring3_resume_esp = 0;
 volatile uint32_t g_ring3_resume_eip = 0;
@@ -99,6 +122,55 @@ static void set_idt_entry(uint8_t vector, uintptr_t handler, uint16_t selector,
     s_idt[vector].offset_high = (uint16_t)((handler >> 16U) & 0xFFFFU);
 }
 
+static inline void outb(uint16_t port, uint8_t value) {
+    __asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t value;
+    __asm__ volatile("inb %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline void io_wait(void) {
+    __asm__ volatile("outb %%al, $0x80" : : "a"(0));
+}
+
+/* Move IRQ0-15 off the CPU exception vectors and mask every line except the cascade. */
+static void pic_remap(void) {
+    outb(kPicMasterCmd, 0x11);
+    io_wait();
+    outb(kPicSlaveCmd, 0x11);
+    io_wait();
+    outb(kPicMasterData, kIrqVectorBase);
+    io_wait();
+    outb(kPicSlaveData, kIrqVectorBase + 8);
+    io_wait();
+    outb(kPicMasterData, 1U << kIrqCascade);
+    io_wait();
+    outb(kPicSlaveData, kIrqCascade);
+    io_wait();
+    outb(kPicMasterData, 0x01);
+    io_wait();
+    outb(kPicSlaveData, 0x01);
+    io_wait();
+
+    outb(kPicMasterData, (uint8_t)~(1U << kIrqCascade));
+    outb(kPicSlaveData, 0xFF);
+}
+
+static void pic_unmask(uint8_t irq) {
+    const uint16_t port = (irq < 8U) ? kPicMasterData : kPicSlaveData;
+    const uint8_t bit = (uint8_t)(1U << (irq & 7U));
+    outb(port, (uint8_t)(inb(port) & ~bit));
+}
+
+static uint16_t pic_in_service(void) {
+    outb(kPicMasterCmd, kPicReadIsr);
+    outb(kPicSlaveCmd, kPicReadIsr);
+    return (uint16_t)((uint16_t)inb(kPicSlaveCmd) << 8U) | inb(kPicMasterCmd);
+}
+
 static void zero_tss(void) {
     uint8_t* bytes = (uint8_t*)&s_tss;
     for (size_t i = 0; i < sizeof(s_tss); ++i) {
@@ -148,6 +220,10 @@ void idt_init(void) {
         set_idt_entry((uint8_t)i, (uintptr_t)isr_hang_stub, kKernelCs, 0x8EU);
     }
     set_idt_entry(kInt80Vector, (uintptr_t)isr_int80_stub, kKernelCs, 0xEEU);
+    for (size_t i = 0; i < kIrqLines; ++i) {
+        set_idt_entry((uint8_t)(kIrqVectorBase + i), irq_stub_table[i], kKernelCs, 0x8EU);
+    }
+    pic_remap();
 
     s_idt_ptr.limit = (uint16_t)(sizeof(s_idt) - 1U);
     s_idt_ptr.base = (uint32_t)(uintptr_t)&s_idt[0];
@@ -160,6 +236,131 @@ void desktop_tick_user(void) {
     ring3_enter_desktop();
 }
 
+static bool at_cpl0(void) {
+    uint16_t cs;
+    __asm__ volatile("movw %%cs, %0" : "=r"(cs));
+    return (cs & 3U) == 0U;
+}
+
+bool kernel_call_register(kernel_call_id id, kernel_call_fn fn) {
+    if (!at_cpl0() || (uint32_t)id >= KERNEL_CALL_COUNT || fn == NULL || s_kernel_calls[id] != NULL) {
+        return false;
+    }
+    s_kernel_calls[id] = fn;
+    return true;
+}
+
+void kernel_call_dispatch(uint32_t id, void* ctx);
+
+/* Reached from int 0x80 with a ring-3 supplied id: only table entries can run. */
+void kernel_call_dispatch(uint32_t id, void* ctx) {
+    if (id < KERNEL_CALL_COUNT && s_kernel_calls[id] != NULL) {
+        s_kernel_calls[id](ctx);
+    }
+}
+
+void kernel_call(kernel_call_id id, void* ctx) {
+    if (at_cpl0()) {
+        kernel_call_dispatch((uint32_t)id, ctx);
+        return;
+    }
+    __asm__ volatile("int $0x80" : : "a"(kInt80KernelCall), "b"((uint32_t)id), "c"(ctx) : "memory");
+}
+
+bool irq_register(uint8_t irq, irq_handler_fn handler, void* ctx) {
+    if (irq >= kIrqLines || irq == kIrqCascade || handler == NULL || s_irq_slots[irq].handler != NULL) {
+        return false;
+    }
+
+    const uint32_t flags = irq_save();
+    s_irq_slots[irq].handler = handler;
+    s_irq_slots[irq].ctx = ctx;
+    pic_unmask(irq);
+    irq_restore(flags);
+    return true;
+}
+
+void irq_enable(void) {
+    __asm__ volatile("sti" : : : "memory");
+}
+
+uint32_t irq_save(void) {
+    uint32_t flags;
+    __asm__ volatile("pushfl\n"
+                     "popl %0\n"
+                     "cli"
+                     : "=r"(flags)
+                     :
+                     : "memory");
+    return flags;
+}
+
+void irq_restore(uint32_t flags) {
+    if ((flags & kEflagsIf) != 0) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+}
+
+void irq_dispatch(uint32_t irq);
+
+void irq_dispatch(uint32_t irq) {
+    /* IRQ7/IRQ15 fire spuriously when a request vanishes before the ack. */
+    if ((irq == 7U || irq == 15U) && (pic_in_service() & (1U << irq)) == 0) {
+        if (irq == 15U) {
+            outb(kPicMasterCmd, kPicEoi);
+        }
+        return;
+    }
+
+    const irq_slot* slot = &s_irq_slots[irq];
+    if (slot->handler != NULL) {
+        slot->handler(slot->ctx);
+    }
+
+    if (irq >= 8U) {
+        outb(kPicSlaveCmd, kPicEoi);
+    }
+    outb(kPicMasterCmd, kPicEoi);
+}
+
+#define IRQ_STUB(n)                \
+    ".global irq_stub_" #n "\n"   \
+    "irq_stub_" #n ":\n"          \
+    "    pushl $" #n "\n"         \
+    "    jmp irq_common_stub\n"
+
+__asm__(
+    IRQ_STUB(0) IRQ_STUB(1) IRQ_STUB(2) IRQ_STUB(3)
+    IRQ_STUB(4) IRQ_STUB(5) IRQ_STUB(6) IRQ_STUB(7)
+    IRQ_STUB(8) IRQ_STUB(9) IRQ_STUB(10) IRQ_STUB(11)
+    IRQ_STUB(12) IRQ_STUB(13) IRQ_STUB(14) IRQ_STUB(15)
+    "irq_common_stub:\n"
+    "    pusha\n"
+    "    pushl %ds\n"
+    "    pushl %es\n"
+    "    movw $0x10, %ax\n"
+    "    movw %ax, %ds\n"
+    "    movw %ax, %es\n"
+    "    cld\n"
+    "    pushl 40(%esp)\n"
+    "    call irq_dispatch\n"
+    "    addl $4, %esp\n"
+    "    popl %es\n"
+    "    popl %ds\n"
+    "    popa\n"
+    "    addl $4, %esp\n"
+    "    iret\n"
+    ".section .rodata\n"
+    ".align 4\n"
+    ".global irq_stub_table\n"
+    "irq_stub_table:\n"
+    "    .long irq_stub_0, irq_stub_1, irq_stub_2, irq_stub_3\n"
+    "    .long irq_stub_4, irq_stub_5, irq_stub_6, irq_stub_7\n"
+    "    .long irq_stub_8, irq_stub_9, irq_stub_10, irq_stub_11\n"
+    "    .long irq_stub_12, irq_stub_13, irq_stub_14, irq_stub_15\n"
+    ".text\n"
+);
+
 __asm__(
     ".global isr_hang_stub\n"
     "isr_hang_stub:\n"
@@ -169,6 +370,11 @@ __asm__(
     "    jmp 1b\n"
 );
 
+/*
+ * int 0x80: eax=1 leaves the desktop tick, eax=2 runs kernel call table
+ * entry ebx with ctx ecx at CPL0 on the TSS stack. Interrupts are re-enabled
+ * for the call if the caller had them on; every register is preserved.
+ */
 __asm__(
     ".global isr_int80_stub\n"
     "isr_int80_stub:\n"
@@ -177,6 +383,28 @@ __asm__(
     "    movl g_ring3_resume_esp, %esp\n"
     "    jmp *g_ring3_resume_eip\n"
     "1:\n"
+    "    cmpl $2, %eax\n"
+    "    jne 3f\n"
+    "    pusha\n"
+    "    pushl %ds\n"
+    "    pushl %es\n"
+    "    movw $0x10, %ax\n"
+    "    movw %ax, %ds\n"
+    "    movw %ax, %es\n"
+    "    cld\n"
+    "    testl $0x200, 48(%esp)\n"
+    "    jz 2f\n"
+    "    sti\n"
+    "2:\n"
+    "    pushl %ecx\n"
+    "    pushl %ebx\n"
+    "    call kernel_call_dispatch\n"
+    "    addl $8, %esp\n"
+    "    cli\n"
+    "    popl %es\n"
+    "    popl %ds\n"
+    "    popa\n"
+    "3:\n"
     "    iret\n"
 );
 
@@ -195,6 +423,11 @@ __asm__(
     "    jmp 1b\n"
 );
 
+/*
+ * The desktop tick runs at CPL3 with IOPL=0: port I/O and cli/sti fault there,
+ * so shell commands reach the drivers through kernel_call. The caller's
+ * EFLAGS, including IF, are restored once int 0x80 brings control back.
+ */
 __asm__(
     ".global ring3_enter_desktop\n"
     "ring3_enter_desktop:\n"
@@ -203,16 +436,19 @@ __asm__(
     "    push %ebx\n"
     "    push %esi\n"
     "    push %edi\n"
+    "    pushfl\n"
     "    movl $1f, g_ring3_resume_eip\n"
     "    movl %esp, g_ring3_resume_esp\n"
     "    movl g_ring3_stack_top, %eax\n"
     "    pushl $0x23\n"
     "    pushl %eax\n"
     "    pushfl\n"
+    "    andl $0xFFFFCFFF, (%esp)\n"
     "    pushl $0x1B\n"
     "    pushl $ring3_desktop_entry\n"
     "    iret\n"
     "1:\n"
+    "    popfl\n"
     "    pop %edi\n"
     "    pop %esi\n"
     "    pop %ebx\n"
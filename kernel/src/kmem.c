@@ -0,0 +1,98 @@
+#include "kernel/kmem.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    kKmemArenaBytes = 16 * 1024 * 1024,
+    kKmemAlign = 16,
+};
+
+/*
+ * First-fit allocator over a static arena. Blocks are laid out back to back,
+ * each prefixed by a header; adjacent free blocks are merged while scanning.
+ */
+typedef struct kmem_header {
+    uint32_t size;
+    uint32_t used;
+    uint32_t reserved[2];
+} kmem_header;
+
+static uint8_t s_arena[kKmemArenaBytes] __attribute__((aligned(kKmemAlign)));
+static bool s_ready = false;
+static size_t s_used = 0;
+
+static kmem_header* header_at(size_t offset) {
+    return (kmem_header*)(void*)&s_arena[offset];
+}
+
+static void kmem_setup(void) {
+    kmem_header* first = header_at(0);
+    first->size = (uint32_t)(kKmemArenaBytes - sizeof(kmem_header));
+    first->used = 0;
+    s_used = 0;
+    s_ready = true;
+}
+
+void* kmem_alloc(size_t size) {
+    if (!s_ready) {
+        kmem_setup();
+    }
+    if (size == 0 || size > (size_t)kKmemArenaBytes) {
+        return NULL;
+    }
+
+    const size_t need = (size + (kKmemAlign - 1U)) & ~(size_t)(kKmemAlign - 1U);
+    size_t offset = 0;
+    while (offset < (size_t)kKmemArenaBytes) {
+        kmem_header* h = header_at(offset);
+        if (!h->used) {
+            size_t next = offset + sizeof(kmem_header) + h->size;
+            while (next < (size_t)kKmemArenaBytes && !header_at(next)->used) {
+                h->size += (uint32_t)(sizeof(kmem_header) + header_at(next)->size);
+                next = offset + sizeof(kmem_header) + h->size;
+            }
+
+            if (h->size >= need) {
+                const size_t spare = h->size - need;
+                if (spare > sizeof(kmem_header) + kKmemAlign) {
+                    kmem_header* rest = header_at(offset + sizeof(kmem_header) + need);
+                    rest->size = (uint32_t)(spare - sizeof(kmem_header));
+                    rest->used = 0;
+                    h->size = (uint32_t)need;
+                }
+                h->used = 1;
+                s_used += h->size;
+                return (void*)(h + 1);
+            }
+        }
+        offset += sizeof(kmem_header) + h->size;
+    }
+    return NULL;
+}
+
+void kmem_free(void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    const uint8_t* p = (const uint8_t*)ptr;
+    if (p < s_arena + sizeof(kmem_header) || p >= s_arena + kKmemArenaBytes) {
+        return;
+    }
+
+    kmem_header* h = (kmem_header*)ptr - 1;
+    if (!h->used) {
+        return;
+    }
+    h->used = 0;
+    s_used -= h->size;
+}
+
+size_t kmem_used(void) {
+    return s_used;
+}
+
+size_t kmem_capacity(void) {
+    return (size_t)kKmemArenaBytes;
+}
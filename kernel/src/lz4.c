@@ -0,0 +1,208 @@
+#include "kernel/lz4.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    kLz4FrameMagic = 0x184D2204,
+    kLz4FlagContentSize = 0x08,
+    kLz4FlagBlockChecksum = 0x10,
+    kLz4FlagDictId = 0x01,
+    kLz4MinMatch = 4,
+};
+
+static const uint32_t kLz4BlockUncompressed = 0x80000000U;
+
+static uint32_t read_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8U) | ((uint32_t)p[2] << 16U) | ((uint32_t)p[3] << 24U);
+}
+
+/* Parses the frame descriptor; returns its length or 0 when the frame is not usable. */
+static size_t frame_header(const uint8_t* data, size_t size, uint8_t* out_flags, uint64_t* out_content_size) {
+    if (data == NULL || size < 7 || read_le32(data) != (uint32_t)kLz4FrameMagic) {
+        return 0;
+    }
+
+    const uint8_t flags = data[4];
+    if ((flags >> 6U) != 1U || (flags & kLz4FlagDictId) != 0) {
+        return 0;
+    }
+
+    size_t len = 6;
+    uint64_t content_size = 0;
+    if ((flags & kLz4FlagContentSize) != 0) {
+        if (size < len + 8) {
+            return 0;
+        }
+        content_size = (uint64_t)read_le32(data + len) | ((uint64_t)read_le32(data + len + 4) << 32U);
+        len += 8;
+    }
+    len += 1; /* header checksum */
+    if (len > size) {
+        return 0;
+    }
+
+    *out_flags = flags;
+    *out_content_size = content_size;
+    return len;
+}
+
+static bool read_length(const uint8_t** ip, const uint8_t* iend, size_t* inout_len) {
+    if (*inout_len != 15U) {
+        return true;
+    }
+    for (;;) {
+        if (*ip >= iend) {
+            return false;
+        }
+        const uint8_t b = *(*ip)++;
+        *inout_len += b;
+        if (b != 255U) {
+            return true;
+        }
+    }
+}
+
+/*
+ * Decodes one LZ4 block at out + *inout_pos. With out == NULL only the
+ * decoded length is accumulated, which sizes frames lacking a content size.
+ */
+static bool decode_block(const uint8_t* ip, size_t in_len, uint8_t* out, size_t out_cap, size_t* inout_pos) {
+    const uint8_t* iend = ip + in_len;
+    size_t op = *inout_pos;
+
+    while (ip < iend) {
+        const uint8_t token = *ip++;
+
+        size_t lit = (size_t)(token >> 4U);
+        if (!read_length(&ip, iend, &lit) || lit > (size_t)(iend - ip) || (out != NULL && lit > out_cap - op)) {
+            return false;
+        }
+        if (out != NULL) {
+            for (size_t i = 0; i < lit; ++i) {
+                out[op + i] = ip[i];
+            }
+        }
+        ip += lit;
+        op += lit;
+
+        if (ip == iend) {
+            break;
+        }
+        if (iend - ip < 2) {
+            return false;
+        }
+        const size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8U);
+        ip += 2;
+        if (offset == 0 || offset > op) {
+            return false;
+        }
+
+        size_t match = (size_t)(token & 0x0FU);
+        if (!read_length(&ip, iend, &match)) {
+            return false;
+        }
+        match += kLz4MinMatch;
+        if (out != NULL) {
+            if (match > out_cap - op) {
+                return false;
+            }
+            /* Byte copy on purpose: matches may overlap their own output. */
+            const uint8_t* src = out + op - offset;
+            for (size_t i = 0; i < match; ++i) {
+                out[op + i] = src[i];
+            }
+        }
+        op += match;
+    }
+
+    *inout_pos = op;
+    return true;
+}
+
+static bool walk_frame(const uint8_t* data, size_t size, uint8_t* out, size_t out_cap, size_t* out_len) {
+    uint8_t flags = 0;
+    uint64_t content_size = 0;
+    size_t cursor = frame_header(data, size, &flags, &content_size);
+    if (cursor == 0) {
+        return false;
+    }
+
+    size_t pos = 0;
+    for (;;) {
+        if (size - cursor < 4) {
+            return false;
+        }
+        const uint32_t word = read_le32(data + cursor);
+        cursor += 4;
+        if (word == 0) {
+            break;
+        }
+
+        const size_t block_len = (size_t)(word & ~kLz4BlockUncompressed);
+        if (block_len > size - cursor) {
+            return false;
+        }
+        if ((word & kLz4BlockUncompressed) != 0) {
+            if (out != NULL) {
+                if (block_len > out_cap - pos) {
+                    return false;
+                }
+                for (size_t i = 0; i < block_len; ++i) {
+                    out[pos + i] = data[cursor + i];
+                }
+            }
+            pos += block_len;
+        } else if (!decode_block(data + cursor, block_len, out, out_cap, &pos)) {
+            return false;
+        }
+
+        cursor += block_len;
+        if ((flags & kLz4FlagBlockChecksum) != 0) {
+            cursor += 4;
+            if (cursor > size) {
+                return false;
+            }
+        }
+    }
+
+    if ((flags & kLz4FlagContentSize) != 0 && content_size != (uint64_t)pos) {
+        return false;
+    }
+    *out_len = pos;
+    return true;
+}
+
+bool lz4_frame_detect(const uint8_t* data, size_t size) {
+    return data != NULL && size >= 4 && read_le32(data) == (uint32_t)kLz4FrameMagic;
+}
+
+bool lz4_frame_content_size(const uint8_t* data, size_t size, size_t* out_size) {
+    if (out_size == NULL) {
+        return false;
+    }
+
+    uint8_t flags = 0;
+    uint64_t content_size = 0;
+    if (frame_header(data, size, &flags, &content_size) == 0) {
+        return false;
+    }
+    if ((flags & kLz4FlagContentSize) != 0) {
+        if (content_size > (uint64_t)SIZE_MAX) {
+            return false;
+        }
+        *out_size = (size_t)content_size;
+        return true;
+    }
+
+    /* No size in the descriptor: count the output without writing it. */
+    return walk_frame(data, size, NULL, 0, out_size);
+}
+
+bool lz4_frame_decode(const uint8_t* data, size_t size, uint8_t* out, size_t out_cap, size_t* out_len) {
+    if (out == NULL || out_len == NULL) {
+        return false;
+    }
+    return walk_frame(data, size, out, out_cap, out_len);
+}
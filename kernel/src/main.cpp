@@ -2,9 +2,17 @@
 #include "drivers/framebuffer.h"
 #include "drivers/keyboard.h"
 #include "drivers/mouse.h"
+#include "drivers/ahci.h"
 #include "drivers/ata.h"
+#include "drivers/net_e1000.h"
 #include "drivers/net_rtl8139.h"
+#include "drivers/net_virtio.h"
+#include "drivers/nvme.h"
+#include "drivers/pci.h"
+#include "drivers/virtio_blk.h"
 #include "gui/desktop.h"
+#include "kernel/block_cache.h"
+#include "kernel/block_queue.h"
 #include "kernel/cli.h"
 #include "kernel/console.h"
 #include "kernel/display.h"
@@ -13,6 +21,7 @@
 #include "kernel/interrupts.h"
 #include "kernel/multiboot.h"
 #include "kernel/net_stack.h"
+#include "kernel/net_tcpperf.h"
 #include "kernel/release.h"
 #include "kernel/serial.h"
 #include "kernel/timing.h"
@@ -176,12 +185,31 @@ extern "C" void kernel_main(unsigned int multiboot_magic, unsigned int multiboot
     keyboard_init();
     display_init();
     mouse_init(display_width(), display_height());
+    /* Fastest storage first: fs_persist uses the first registered blockdev. */
+    pci_init();
+    nvme_init();
+    virtio_blk_init();
+    ahci_init();
     ata_init();
+    virtio_net_init();
+    e1000_init();
     rtl8139_init();
     net_stack_init();
+    net_tcpperf_init();
     fs_init();
+    block_cache_init();
+    block_queue_init();
+    irq_enable();
     fs_persist_init();
-    (void)fs_load_from_disk();
+    timing_calibrate_tsc();
+    {
+        const unsigned long long load_start = timing_tsc_now();
+        const bool loaded = fs_load_from_disk();
+        const unsigned int load_us = timing_tsc_to_us(timing_tsc_now() - load_start);
+        serial_write(loaded ? "[BOOT] fs load ok in " : "[BOOT] fs load skipped in ");
+        serial_write_u32(load_us);
+        serial_write(" us\n");
+    }
     import_embedded_doom_wad();
     import_multiboot_modules(multiboot_info_addr);
     doom_bridge_init();
@@ -224,7 +252,9 @@ extern "C" void kernel_main(unsigned int multiboot_magic, unsigned int multiboot
                 desktop_set_mouse(ms.x, ms.y, ms.left, ms.right, ms.middle, ms.wheel_delta);
             }
 
+            block_queue_poll();
             net_stack_poll();
+            net_tcpperf_poll();
             __asm__ volatile("pause");
             ++idle_spins;
         }
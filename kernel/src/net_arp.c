@@ -0,0 +1,410 @@
+#include "kernel/net_arp.h"
+
+#include "drivers/netdev.h"
+#include "drivers/pktbuf.h"
+#include "kernel/net_stack.h"
+#include "kernel/timing.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    kArpFrameBytes = 42,
+    /* Power of two; twice the entry count keeps chains to about one entry. */
+    kHashBuckets = 64,
+    kHashShift = 26,
+    kNoEntry = -1,
+    /* A confirmed mapping is used without question for this long... */
+    kReachableMs = 60000,
+    /* ...then refreshed on use, and forgotten if nothing confirms it by now. */
+    kExpireMs = 180000,
+    kRetryMs = 1000,
+    kMaxProbes = 3,
+    kTickMs = 100,
+};
+
+typedef struct arp_entry {
+    net_arp_state state;
+    uint32_t ip;
+    uint8_t mac[6];
+    uint32_t confirmed_at;
+    uint32_t last_used;
+    /* Next request: a retry while incomplete, a refresh while stale. */
+    uint32_t probe_at;
+    uint32_t probes;
+    int hash_next;
+    /* Frames waiting for the reply, oldest first, linked through pktbuf.next. */
+    pktbuf* pending_head;
+    pktbuf* pending_tail;
+    uint32_t pending;
+} arp_entry;
+
+static arp_entry s_entries[NET_ARP_MAX_ENTRIES];
+static int s_buckets[kHashBuckets];
+static bool s_buckets_ready = false;
+static uint32_t s_next_tick = 0;
+static net_arp_stats s_stats;
+
+static uint16_t read_be16(const uint8_t* p) {
+    return (uint16_t)(((uint16_t)p[0] << 8U) | (uint16_t)p[1]);
+}
+
+static uint32_t read_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24U) | ((uint32_t)p[1] << 16U) | ((uint32_t)p[2] << 8U) | (uint32_t)p[3];
+}
+
+static void write_be16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8U);
+    p[1] = (uint8_t)(v & 0xFFU);
+}
+
+static void write_be32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)((v >> 24U) & 0xFFU);
+    p[1] = (uint8_t)((v >> 16U) & 0xFFU);
+    p[2] = (uint8_t)((v >> 8U) & 0xFFU);
+    p[3] = (uint8_t)(v & 0xFFU);
+}
+
+static bool time_reached(uint32_t now, uint32_t deadline) {
+    return (int32_t)(now - deadline) >= 0;
+}
+
+static uint32_t bucket_of(uint32_t ip) {
+    return (ip * 2654435761U) >> kHashShift;
+}
+
+static void buckets_setup(void) {
+    if (s_buckets_ready) {
+        return;
+    }
+    for (uint32_t i = 0; i < kHashBuckets; ++i) {
+        s_buckets[i] = kNoEntry;
+    }
+    s_buckets_ready = true;
+}
+
+static int lookup(uint32_t ip) {
+    buckets_setup();
+    for (int i = s_buckets[bucket_of(ip)]; i != kNoEntry; i = s_entries[i].hash_next) {
+        if (s_entries[i].ip == ip) {
+            return i;
+        }
+    }
+    return kNoEntry;
+}
+
+static void drop_pending(arp_entry* e) {
+    while (e->pending_head != NULL) {
+        pktbuf* pb = e->pending_head;
+        e->pending_head = pb->next;
+        pb->next = NULL;
+        pktbuf_put(pb);
+        ++s_stats.pending_drops;
+    }
+    e->pending_tail = NULL;
+    e->pending = 0;
+}
+
+static void free_entry(int index) {
+    arp_entry* e = &s_entries[index];
+    int* link = &s_buckets[bucket_of(e->ip)];
+    while (*link != kNoEntry) {
+        if (*link == index) {
+            *link = e->hash_next;
+            break;
+        }
+        link = &s_entries[*link].hash_next;
+    }
+    drop_pending(e);
+    e->state = NET_ARP_FREE;
+    e->hash_next = kNoEntry;
+}
+
+/* Takes a free slot, or the least recently used resolved entry. */
+static int alloc_entry(uint32_t ip, uint32_t now) {
+    buckets_setup();
+    int victim = kNoEntry;
+    for (int i = 0; i < NET_ARP_MAX_ENTRIES; ++i) {
+        const arp_entry* e = &s_entries[i];
+        if (e->state == NET_ARP_FREE) {
+            victim = i;
+            break;
+        }
+        if (e->state != NET_ARP_INCOMPLETE &&
+            (victim == kNoEntry || (int32_t)(e->last_used - s_entries[victim].last_used) < 0)) {
+            victim = i;
+        }
+    }
+    if (victim == kNoEntry) {
+        return kNoEntry;
+    }
+    if (s_entries[victim].state != NET_ARP_FREE) {
+        free_entry(victim);
+        ++s_stats.evictions;
+    }
+
+    arp_entry* e = &s_entries[victim];
+    const uint32_t bucket = bucket_of(ip);
+    e->ip = ip;
+    e->confirmed_at = now;
+    e->last_used = now;
+    e->probe_at = now;
+    e->probes = 0;
+    e->pending_head = NULL;
+    e->pending_tail = NULL;
+    e->pending = 0;
+    e->hash_next = s_buckets[bucket];
+    s_buckets[bucket] = victim;
+    return victim;
+}
+
+static bool send_arp(uint16_t op, const uint8_t* target_mac, uint32_t target_ip) {
+    const netdev* dev = net_stack_device();
+    pktbuf* pb = (dev != NULL) ? pktbuf_alloc() : NULL;
+    uint8_t* frame = (pb != NULL) ? pktbuf_append(pb, kArpFrameBytes) : NULL;
+    if (frame == NULL) {
+        pktbuf_put(pb);
+        return false;
+    }
+    for (int i = 0; i < 6; ++i) {
+        frame[i] = (target_mac != NULL) ? target_mac[i] : 0xFFU;
+        frame[6 + i] = dev->mac[i];
+    }
+    write_be16(frame + 12, 0x0806U);
+
+    uint8_t* arp = frame + 14;
+    write_be16(arp + 0, 1U);
+    write_be16(arp + 2, 0x0800U);
+    arp[4] = 6U;
+    arp[5] = 4U;
+    write_be16(arp + 6, op);
+    for (int i = 0; i < 6; ++i) {
+        arp[8 + i] = dev->mac[i];
+        arp[18 + i] = (target_mac != NULL) ? target_mac[i] : 0U;
+    }
+    write_be32(arp + 14, net_stack_local_ipv4());
+    write_be32(arp + 24, target_ip);
+    return netdev_send_pktbuf(dev, pb);
+}
+
+static void send_request(arp_entry* e, uint32_t now) {
+    ++e->probes;
+    e->probe_at = now + kRetryMs;
+    ++s_stats.requests_sent;
+    (void)send_arp(1U, NULL, e->ip);
+}
+
+static void send_with_mac(pktbuf* pb, const uint8_t* mac) {
+    for (int i = 0; i < 6; ++i) {
+        pb->data[i] = mac[i];
+    }
+    (void)netdev_send_pktbuf(net_stack_device(), pb);
+}
+
+static void confirm(arp_entry* e, const uint8_t* mac, uint32_t now) {
+    for (int i = 0; i < 6; ++i) {
+        e->mac[i] = mac[i];
+    }
+    e->state = NET_ARP_REACHABLE;
+    e->confirmed_at = now;
+    e->probes = 0;
+    while (e->pending_head != NULL) {
+        pktbuf* pb = e->pending_head;
+        e->pending_head = pb->next;
+        pb->next = NULL;
+        send_with_mac(pb, e->mac);
+    }
+    e->pending_tail = NULL;
+    e->pending = 0;
+}
+
+bool net_arp_output(pktbuf* pb, uint32_t next_hop_be) {
+    if (pb == NULL) {
+        return false;
+    }
+    if (net_stack_device() == NULL || pb->len < 14U) {
+        pktbuf_put(pb);
+        return false;
+    }
+    const uint32_t now = timing_ms_now();
+    int index = lookup(next_hop_be);
+    if (index != kNoEntry && s_entries[index].state != NET_ARP_INCOMPLETE) {
+        arp_entry* e = &s_entries[index];
+        e->last_used = now;
+        if (e->state == NET_ARP_STALE && time_reached(now, e->probe_at)) {
+            send_request(e, now);
+        }
+        ++s_stats.hits;
+        send_with_mac(pb, e->mac);
+        return true;
+    }
+
+    ++s_stats.misses;
+    if (index == kNoEntry) {
+        index = alloc_entry(next_hop_be, now);
+        if (index == kNoEntry) {
+            pktbuf_put(pb);
+            ++s_stats.pending_drops;
+            return false;
+        }
+        s_entries[index].state = NET_ARP_INCOMPLETE;
+        send_request(&s_entries[index], now);
+    }
+
+    /*
+     * A shared buffer is only lent for this call (TCP restores its segment
+     * once we return), so the queue must hold a private copy.
+     */
+    if (pb->refs > 1U) {
+        pktbuf* copy = pktbuf_alloc();
+        uint8_t* bytes = (copy != NULL) ? pktbuf_append(copy, pb->len) : NULL;
+        if (bytes == NULL) {
+            if (copy != NULL) {
+                pktbuf_put(copy);
+            }
+            pktbuf_put(pb);
+            ++s_stats.pending_drops;
+            return false;
+        }
+        for (uint16_t i = 0; i < pb->len; ++i) {
+            bytes[i] = pb->data[i];
+        }
+        pktbuf_put(pb);
+        pb = copy;
+    }
+
+    arp_entry* e = &s_entries[index];
+    if (e->pending >= NET_ARP_MAX_PENDING) {
+        pktbuf* oldest = e->pending_head;
+        e->pending_head = oldest->next;
+        oldest->next = NULL;
+        pktbuf_put(oldest);
+        --e->pending;
+        ++s_stats.pending_drops;
+    }
+    pb->next = NULL;
+    if (e->pending_head != NULL) {
+        e->pending_tail->next = pb;
+    } else {
+        e->pending_head = pb;
+    }
+    e->pending_tail = pb;
+    ++e->pending;
+    return true;
+}
+
+/*
+ * RFC 826 merge: any packet from a known neighbour refreshes its entry; a
+ * new entry is only created when the packet is aimed at us.
+ */
+void net_arp_input(const uint8_t* frame, size_t len) {
+    if (len < kArpFrameBytes) {
+        return;
+    }
+    const uint8_t* arp = frame + 14;
+    const uint16_t op = read_be16(arp + 6);
+    if (read_be16(arp + 0) != 1U || read_be16(arp + 2) != 0x0800U || arp[4] != 6U || arp[5] != 4U ||
+        (op != 1U && op != 2U)) {
+        return;
+    }
+    const uint8_t* sender_mac = arp + 8;
+    const uint32_t sender_ip = read_be32(arp + 14);
+    const uint32_t target_ip = read_be32(arp + 24);
+    const uint32_t local = net_stack_local_ipv4();
+    const uint32_t now = timing_ms_now();
+
+    if (sender_ip != 0U && sender_ip != local) {
+        int index = lookup(sender_ip);
+        if (index != kNoEntry) {
+            confirm(&s_entries[index], sender_mac, now);
+            ++s_stats.updates;
+        } else if (target_ip == local) {
+            index = alloc_entry(sender_ip, now);
+            if (index != kNoEntry) {
+                confirm(&s_entries[index], sender_mac, now);
+            }
+        }
+    }
+
+    if (op == 1U && target_ip == local) {
+        ++s_stats.replies_sent;
+        (void)send_arp(2U, sender_mac, sender_ip);
+    }
+}
+
+void net_arp_timer(void) {
+    const uint32_t now = timing_ms_now();
+    if (!time_reached(now, s_next_tick)) {
+        return;
+    }
+    s_next_tick = now + kTickMs;
+
+    for (int i = 0; i < NET_ARP_MAX_ENTRIES; ++i) {
+        arp_entry* e = &s_entries[i];
+        switch (e->state) {
+        case NET_ARP_INCOMPLETE:
+            if (time_reached(now, e->probe_at)) {
+                if (e->probes >= kMaxProbes) {
+                    free_entry(i);
+                } else {
+                    send_request(e, now);
+                }
+            }
+            break;
+        case NET_ARP_REACHABLE:
+            if (now - e->confirmed_at >= kReachableMs) {
+                e->state = NET_ARP_STALE;
+                e->probe_at = now;
+            }
+            break;
+        case NET_ARP_STALE:
+            if (now - e->confirmed_at >= kExpireMs) {
+                free_entry(i);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void net_arp_flush(void) {
+    buckets_setup();
+    for (int i = 0; i < NET_ARP_MAX_ENTRIES; ++i) {
+        if (s_entries[i].state != NET_ARP_FREE) {
+            free_entry(i);
+        }
+    }
+}
+
+bool net_arp_entry_at(size_t index, net_arp_entry* out) {
+    if (out == NULL) {
+        return false;
+    }
+    const uint32_t now = timing_ms_now();
+    for (int i = 0; i < NET_ARP_MAX_ENTRIES; ++i) {
+        const arp_entry* e = &s_entries[i];
+        if (e->state == NET_ARP_FREE) {
+            continue;
+        }
+        if (index-- > 0U) {
+            continue;
+        }
+        out->state = e->state;
+        out->ipv4_be = e->ip;
+        for (int k = 0; k < 6; ++k) {
+            out->mac[k] = (e->state == NET_ARP_INCOMPLETE) ? 0U : e->mac[k];
+        }
+        out->age_ms = (e->state == NET_ARP_INCOMPLETE) ? 0U : now - e->confirmed_at;
+        out->pending = e->pending;
+        return true;
+    }
+    return false;
+}
+
+void net_arp_get_stats(net_arp_stats* out) {
+    if (out != NULL) {
+        *out = s_stats;
+    }
+}
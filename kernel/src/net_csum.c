@@ -0,0 +1,79 @@
+#include "kernel/net_csum.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Packet data sits at any offset in a pktbuf; x86 loads it unaligned at full speed. */
+typedef uint32_t unaligned_u32 __attribute__((aligned(1), may_alias));
+typedef uint16_t unaligned_u16 __attribute__((aligned(1), may_alias));
+
+static uint32_t fold32(uint64_t acc) {
+    acc = (acc & 0xFFFFFFFFU) + (acc >> 32U);
+    acc = (acc & 0xFFFFFFFFU) + (acc >> 32U);
+    return (uint32_t)acc;
+}
+
+static uint16_t fold16(uint32_t sum) {
+    sum = (sum & 0xFFFFU) + (sum >> 16U);
+    sum = (sum & 0xFFFFU) + (sum >> 16U);
+    return (uint16_t)sum;
+}
+
+/*
+ * The ones' complement sum is byte-order independent (RFC 1071 2(B)):
+ * adding native little-endian words yields the byte-swapped sum, so whole
+ * 32-bit words go into a 64-bit accumulator whose carries are folded back
+ * once at the end, eight words per iteration. The result is swapped to
+ * big-endian only when it is merged into the caller's sum.
+ */
+uint32_t net_csum_add(uint32_t sum, const uint8_t* data, size_t len) {
+    uint64_t acc = 0;
+    while (len >= 32U) {
+        const unaligned_u32* w = (const unaligned_u32*)data;
+        acc += (uint64_t)w[0] + w[1] + w[2] + w[3];
+        acc += (uint64_t)w[4] + w[5] + w[6] + w[7];
+        data += 32;
+        len -= 32U;
+    }
+    while (len >= 4U) {
+        acc += *(const unaligned_u32*)data;
+        data += 4;
+        len -= 4U;
+    }
+    if (len >= 2U) {
+        acc += *(const unaligned_u16*)data;
+        data += 2;
+        len -= 2U;
+    }
+    if (len != 0U) {
+        /* The pad byte follows, so the lone byte is the low half of a little-endian word. */
+        acc += *data;
+    }
+
+    const uint16_t swapped = fold16(fold32(acc));
+    const uint32_t be = (uint32_t)(uint16_t)((swapped >> 8U) | (swapped << 8U));
+    const uint32_t total = sum + be;
+    /* End-around carry: 2^32 is 1 modulo 0xFFFF. */
+    return total + (total < be ? 1U : 0U);
+}
+
+uint16_t net_csum_fold(uint32_t sum) {
+    return (uint16_t)~fold16(sum);
+}
+
+uint32_t net_csum_pseudo(uint32_t src_ipv4_be, uint32_t dst_ipv4_be, uint8_t protocol, uint16_t length) {
+    return (src_ipv4_be >> 16U) + (src_ipv4_be & 0xFFFFU) + (dst_ipv4_be >> 16U) + (dst_ipv4_be & 0xFFFFU) +
+           (uint32_t)protocol + (uint32_t)length;
+}
+
+/* HC' = ~(~HC + ~m + m'), RFC 1624 eqn. 3; avoids the -0 result of eqn. 2. */
+uint16_t net_csum_update16(uint16_t csum, uint16_t old_word, uint16_t new_word) {
+    const uint32_t sum = (uint32_t)(uint16_t)~csum + (uint32_t)(uint16_t)~old_word + (uint32_t)new_word;
+    return net_csum_fold(sum);
+}
+
+uint16_t net_csum_update32(uint16_t csum, uint32_t old_value, uint32_t new_value) {
+    const uint32_t sum = (uint32_t)(uint16_t)~csum + (uint32_t)(uint16_t)~(old_value >> 16U) +
+                         (uint32_t)(uint16_t)~(old_value & 0xFFFFU) + (new_value >> 16U) + (new_value & 0xFFFFU);
+    return net_csum_fold(sum);
+}
@@ -0,0 +1,99 @@
+#include "kernel/net_route.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kept sorted by descending prefix length, so the first match is the longest. */
+static net_route s_routes[NET_ROUTE_MAX];
+static size_t s_count = 0;
+
+static bool mask_is_contiguous(uint32_t mask) {
+    const uint32_t inverted = ~mask;
+    return (inverted & (inverted + 1U)) == 0U;
+}
+
+static uint32_t prefix_len(uint32_t mask) {
+    uint32_t bits = 0;
+    while ((mask & 0x80000000U) != 0U) {
+        ++bits;
+        mask <<= 1U;
+    }
+    return bits;
+}
+
+static int find(uint32_t dest_be, uint32_t netmask_be) {
+    for (size_t i = 0; i < s_count; ++i) {
+        if (s_routes[i].dest_be == dest_be && s_routes[i].netmask_be == netmask_be) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/* Replaces an existing route to the same prefix. */
+bool net_route_add(uint32_t dest_be, uint32_t netmask_be, uint32_t gateway_be) {
+    if (!mask_is_contiguous(netmask_be) || (dest_be & ~netmask_be) != 0U) {
+        return false;
+    }
+    const int existing = find(dest_be, netmask_be);
+    if (existing >= 0) {
+        s_routes[existing].gateway_be = gateway_be;
+        return true;
+    }
+    if (s_count >= NET_ROUTE_MAX) {
+        return false;
+    }
+
+    size_t pos = s_count;
+    while (pos > 0U && prefix_len(s_routes[pos - 1U].netmask_be) < prefix_len(netmask_be)) {
+        s_routes[pos] = s_routes[pos - 1U];
+        --pos;
+    }
+    s_routes[pos].dest_be = dest_be;
+    s_routes[pos].netmask_be = netmask_be;
+    s_routes[pos].gateway_be = gateway_be;
+    ++s_count;
+    return true;
+}
+
+bool net_route_remove(uint32_t dest_be, uint32_t netmask_be) {
+    const int index = find(dest_be, netmask_be);
+    if (index < 0) {
+        return false;
+    }
+    for (size_t i = (size_t)index; i + 1U < s_count; ++i) {
+        s_routes[i] = s_routes[i + 1U];
+    }
+    --s_count;
+    return true;
+}
+
+void net_route_clear(void) {
+    s_count = 0;
+}
+
+size_t net_route_count(void) {
+    return s_count;
+}
+
+bool net_route_at(size_t index, net_route* out) {
+    if (index >= s_count || out == NULL) {
+        return false;
+    }
+    *out = s_routes[index];
+    return true;
+}
+
+bool net_route_lookup(uint32_t dst_be, uint32_t* next_hop_be) {
+    for (size_t i = 0; i < s_count; ++i) {
+        const net_route* r = &s_routes[i];
+        if ((dst_be & r->netmask_be) == r->dest_be) {
+            if (next_hop_be != NULL) {
+                *next_hop_be = (r->gateway_be != 0U) ? r->gateway_be : dst_be;
+            }
+            return true;
+        }
+    }
+    return false;
+}
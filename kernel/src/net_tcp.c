@@ -0,0 +1,1495 @@
+#include "kernel/net_tcp.h"
+
+#include "drivers/pktbuf.h"
+#include "kernel/net_csum.h"
+#include "kernel/net_stack.h"
+#include "kernel/timing.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    kProtoTcp = 6,
+    kTcpHeaderBytes = 20,
+    kFlagFin = 0x01,
+    kFlagSyn = 0x02,
+    kFlagRst = 0x04,
+    kFlagPsh = 0x08,
+    kFlagAck = 0x10,
+    /* MSS, NOP, window scale. */
+    kSynOptionBytes = 8,
+    /* Segments queued for sending, sent or not: about 93 KiB at full MSS. */
+    kSendSegs = 64,
+    /* Receive buffer; window scaling lets the advertised window exceed 64 KiB. */
+    kRecvBytes = 96 * 1024,
+    /* Pktbufs a connection may hold on receive, in order and out of order together. */
+    kRecvSegs = 72,
+    kOooSegs = 16,
+    kWindowShift = 2,
+    /* Segments up to this size are copied onto the previous buffer instead of pinning a pktbuf each. */
+    kCopyBreak = 256,
+    /* Send never takes the last pool buffers; the NIC receive rings refill from them. */
+    kPoolReserve = 128,
+    kDefaultMss = 536,
+    kInitialWindowSegs = 10,
+    kDupAckThreshold = 3,
+    kRtoInitialMs = 1000,
+    kRtoMinMs = 200,
+    kRtoMaxMs = 60000,
+    kMaxRetries = 8,
+    kDelayedAckMs = 40,
+    kTimeWaitMs = 2000,
+    kFinWait2Ms = 30000,
+    kEphemeralFirst = 49152,
+    kNoSocket = -1,
+};
+
+typedef struct tcp_seg {
+    /* Payload only; headers are pushed in front for each transmission. */
+    pktbuf* pb;
+    uint32_t seq;
+    /* Folded sum of the payload, kept across retransmissions. */
+    uint32_t sum;
+    bool sum_valid;
+} tcp_seg;
+
+typedef struct tcp_ooo {
+    pktbuf* pb;
+    uint32_t seq;
+} tcp_ooo;
+
+typedef struct tcp_socket {
+    bool used;
+    /* The handle belongs to the caller; cleared by close and for connections not yet accepted. */
+    bool user_open;
+    bool nodelay;
+    bool reset;
+    net_tcp_state state;
+    /* Listener that owns this connection until accept. */
+    int parent;
+    uint16_t local_port;
+    uint16_t remote_port;
+    uint32_t remote_ip;
+
+    /* Send side: snd_max is the highest sequence ever sent; snd_nxt rewinds on timeout. */
+    uint32_t iss;
+    uint32_t snd_una;
+    uint32_t snd_nxt;
+    uint32_t snd_max;
+    uint32_t snd_wnd;
+    uint32_t snd_wl1;
+    uint32_t snd_wl2;
+    uint16_t mss;
+    uint8_t snd_wscale;
+    uint8_t rcv_wscale;
+    tcp_seg sq[kSendSegs];
+    uint32_t sq_head;
+    uint32_t sq_count;
+    /* Queue entries from the head that have been transmitted since the last rewind. */
+    uint32_t sq_sent;
+    bool fin_queued;
+    bool fin_sent;
+    bool fin_acked;
+    uint32_t fin_seq;
+
+    /* Congestion control (RFC 5681) with NewReno recovery (RFC 6582). */
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t dupacks;
+    bool in_recovery;
+    uint32_t recover;
+
+    /* RTT estimation (RFC 6298): srtt and rttvar in 1/8 and 1/4 ms. */
+    bool rtt_valid;
+    bool rtt_timing;
+    uint32_t rtt_seq;
+    uint32_t rtt_start;
+    uint32_t srtt8;
+    uint32_t rttvar4;
+    uint32_t rto_ms;
+    bool rto_armed;
+    uint32_t rto_at;
+    uint32_t retries;
+
+    /* Receive side: rcv_adv is the right window edge last offered, never moved back. */
+    uint32_t irs;
+    uint32_t rcv_nxt;
+    uint32_t rcv_adv;
+    pktbuf* rq_head;
+    pktbuf* rq_tail;
+    uint32_t rq_bytes;
+    uint32_t rq_segs;
+    tcp_ooo ooo[kOooSegs];
+    uint32_t ooo_count;
+    uint32_t ooo_bytes;
+    bool fin_received;
+    uint32_t unacked_segs;
+    bool ack_now;
+    bool delack_armed;
+    uint32_t delack_at;
+    /* TIME_WAIT and FIN_WAIT_2 expiry. */
+    uint32_t state_at;
+
+    uint64_t bytes_acked;
+    uint64_t bytes_received;
+    uint32_t retransmits;
+    uint32_t fast_retransmits;
+    uint32_t ooo_segments;
+} tcp_socket;
+
+static tcp_socket s_sockets[NET_TCP_MAX_SOCKETS];
+static uint16_t s_next_ephemeral = kEphemeralFirst;
+static uint32_t s_iss_seed = 0;
+static net_tcp_stats s_stats;
+
+static const char* const kStateNames[] = {
+    "closed",     "listen",     "syn-sent",   "syn-received", "established", "fin-wait-1",
+    "fin-wait-2", "close-wait", "closing",    "last-ack",     "time-wait",
+};
+
+static uint16_t read_be16(const uint8_t* p) {
+    return (uint16_t)(((uint16_t)p[0] << 8U) | (uint16_t)p[1]);
+}
+
+static uint32_t read_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24U) | ((uint32_t)p[1] << 16U) | ((uint32_t)p[2] << 8U) | (uint32_t)p[3];
+}
+
+static void write_be16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8U);
+    p[1] = (uint8_t)(v & 0xFFU);
+}
+
+static void write_be32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)((v >> 24U) & 0xFFU);
+    p[1] = (uint8_t)((v >> 16U) & 0xFFU);
+    p[2] = (uint8_t)((v >> 8U) & 0xFFU);
+    p[3] = (uint8_t)(v & 0xFFU);
+}
+
+static bool seq_lt(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static bool seq_le(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) <= 0;
+}
+
+static bool seq_gt(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) > 0;
+}
+
+static bool seq_ge(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) >= 0;
+}
+
+static bool time_reached(uint32_t now, uint32_t deadline) {
+    return (int32_t)(now - deadline) >= 0;
+}
+
+static uint32_t min_u32(uint32_t a, uint32_t b) {
+    return (a < b) ? a : b;
+}
+
+static uint32_t max_u32(uint32_t a, uint32_t b) {
+    return (a > b) ? a : b;
+}
+
+static uint32_t fold16(uint32_t sum) {
+    sum = (sum & 0xFFFFU) + (sum >> 16U);
+    return (sum & 0xFFFFU) + (sum >> 16U);
+}
+
+static tcp_socket* socket_at(int sock) {
+    if (sock < 0 || sock >= NET_TCP_MAX_SOCKETS || !s_sockets[sock].used) {
+        return NULL;
+    }
+    return &s_sockets[sock];
+}
+
+static bool port_in_use(uint16_t port) {
+    for (int i = 0; i < NET_TCP_MAX_SOCKETS; ++i) {
+        if (s_sockets[i].used && s_sockets[i].local_port == port) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Connections first, then a listener on the port; linear is fine for NET_TCP_MAX_SOCKETS. */
+static int find_socket(uint16_t local_port, uint32_t remote_ip, uint16_t remote_port) {
+    int listener = kNoSocket;
+    for (int i = 0; i < NET_TCP_MAX_SOCKETS; ++i) {
+        const tcp_socket* s = &s_sockets[i];
+        if (!s->used || s->local_port != local_port || s->state == NET_TCP_CLOSED) {
+            continue;
+        }
+        if (s->state == NET_TCP_LISTEN) {
+            listener = i;
+        } else if (s->remote_ip == remote_ip && s->remote_port == remote_port) {
+            return i;
+        }
+    }
+    return listener;
+}
+
+static void free_queues(tcp_socket* s) {
+    for (uint32_t i = 0; i < s->sq_count; ++i) {
+        pktbuf_put(s->sq[(s->sq_head + i) % kSendSegs].pb);
+    }
+    s->sq_head = 0;
+    s->sq_count = 0;
+    s->sq_sent = 0;
+    while (s->rq_head != NULL) {
+        pktbuf* pb = s->rq_head;
+        s->rq_head = pb->next;
+        pktbuf_put(pb);
+    }
+    s->rq_tail = NULL;
+    s->rq_bytes = 0;
+    s->rq_segs = 0;
+    for (uint32_t i = 0; i < s->ooo_count; ++i) {
+        pktbuf_put(s->ooo[i].pb);
+    }
+    s->ooo_count = 0;
+    s->ooo_bytes = 0;
+}
+
+/* Ends the connection; the slot is freed unless the caller still holds the handle. */
+static void set_closed(tcp_socket* s) {
+    free_queues(s);
+    s->state = NET_TCP_CLOSED;
+    s->rto_armed = false;
+    s->delack_armed = false;
+    if (!s->user_open) {
+        s->used = false;
+    }
+}
+
+static void init_connection(tcp_socket* s) {
+    s_iss_seed += 64000U + (uint32_t)timing_tsc_now();
+    s->reset = false;
+    s->iss = s_iss_seed;
+    s->snd_una = s->iss;
+    s->snd_nxt = s->iss;
+    s->snd_max = s->iss;
+    s->snd_wnd = 0;
+    s->snd_wl1 = 0;
+    s->snd_wl2 = 0;
+    s->mss = kDefaultMss;
+    s->snd_wscale = 0;
+    s->rcv_wscale = 0;
+    s->fin_queued = false;
+    s->fin_sent = false;
+    s->fin_acked = false;
+    s->fin_seq = 0;
+    s->cwnd = kInitialWindowSegs * kDefaultMss;
+    s->ssthresh = 0x7FFFFFFFU;
+    s->dupacks = 0;
+    s->in_recovery = false;
+    s->recover = s->iss;
+    s->rtt_valid = false;
+    s->rtt_timing = false;
+    s->srtt8 = 0;
+    s->rttvar4 = 0;
+    s->rto_ms = kRtoInitialMs;
+    s->rto_armed = false;
+    s->retries = 0;
+    s->irs = 0;
+    s->rcv_nxt = 0;
+    s->rcv_adv = 0;
+    s->fin_received = false;
+    s->unacked_segs = 0;
+    s->ack_now = false;
+    s->delack_armed = false;
+    s->bytes_acked = 0;
+    s->bytes_received = 0;
+    s->retransmits = 0;
+    s->fast_retransmits = 0;
+    s->ooo_segments = 0;
+}
+
+static int alloc_socket(void) {
+    for (int i = 0; i < NET_TCP_MAX_SOCKETS; ++i) {
+        tcp_socket* s = &s_sockets[i];
+        if (!s->used) {
+            s->used = true;
+            s->user_open = false;
+            s->nodelay = false;
+            s->state = NET_TCP_CLOSED;
+            s->parent = kNoSocket;
+            s->local_port = 0;
+            s->remote_port = 0;
+            s->remote_ip = 0;
+            s->sq_head = 0;
+            s->sq_count = 0;
+            s->sq_sent = 0;
+            s->rq_head = NULL;
+            s->rq_tail = NULL;
+            s->rq_bytes = 0;
+            s->rq_segs = 0;
+            s->ooo_count = 0;
+            s->ooo_bytes = 0;
+            init_connection(s);
+            return i;
+        }
+    }
+    return kNoSocket;
+}
+
+static void arm_rto(tcp_socket* s, uint32_t now) {
+    s->rto_armed = true;
+    s->rto_at = now + s->rto_ms;
+}
+
+static void rtt_sample(tcp_socket* s, uint32_t rtt_ms) {
+    if (!s->rtt_valid) {
+        s->srtt8 = rtt_ms * 8U;
+        s->rttvar4 = rtt_ms * 2U;
+        s->rtt_valid = true;
+    } else {
+        int32_t delta = (int32_t)rtt_ms - (int32_t)(s->srtt8 >> 3U);
+        s->srtt8 = (uint32_t)((int32_t)s->srtt8 + delta);
+        if (delta < 0) {
+            delta = -delta;
+        }
+        s->rttvar4 = s->rttvar4 - (s->rttvar4 >> 2U) + (uint32_t)delta;
+    }
+    const uint32_t rto = (s->srtt8 >> 3U) + max_u32(1U, s->rttvar4);
+    s->rto_ms = max_u32(kRtoMinMs, min_u32(rto, kRtoMaxMs));
+}
+
+static uint32_t recv_space(const tcp_socket* s) {
+    const uint32_t held = s->rq_bytes + s->ooo_bytes;
+    if (held >= kRecvBytes || s->rq_segs + s->ooo_count >= kRecvSegs) {
+        return 0;
+    }
+    return kRecvBytes - held;
+}
+
+/*
+ * Receiver silly-window avoidance (RFC 1122 4.2.3.3): the right edge only
+ * moves once it can grow by min(buffer / 2, MSS), and never moves back.
+ */
+static void update_rcv_adv(tcp_socket* s) {
+    const uint32_t space = min_u32(recv_space(s), 0xFFFFU << s->rcv_wscale);
+    const uint32_t edge = s->rcv_nxt + space;
+    if (seq_lt(s->rcv_adv, s->rcv_nxt)) {
+        s->rcv_adv = s->rcv_nxt;
+    }
+    if (seq_ge(edge, s->rcv_adv + min_u32(kRecvBytes / 2U, s->mss))) {
+        s->rcv_adv = edge;
+    }
+}
+
+/* Prepends a TCP header to pb (options, if any, already at pb->data) and sends it; consumes pb. */
+static bool emit(pktbuf* pb, uint32_t dst_ip, uint16_t src_port, uint16_t dst_port, uint32_t seq, uint32_t ack,
+                 uint8_t flags, uint16_t window, size_t opt_len, uint32_t payload_sum) {
+    uint8_t* th = pktbuf_push(pb, kTcpHeaderBytes);
+    if (th == NULL) {
+        pktbuf_put(pb);
+        return false;
+    }
+    write_be16(th + 0, src_port);
+    write_be16(th + 2, dst_port);
+    write_be32(th + 4, seq);
+    write_be32(th + 8, ack);
+    th[12] = (uint8_t)(((kTcpHeaderBytes + opt_len) / 4U) << 4U);
+    th[13] = flags;
+    write_be16(th + 14, window);
+    write_be16(th + 16, 0);
+    write_be16(th + 18, 0);
+    const uint32_t sum = net_csum_pseudo(net_stack_source_ipv4(dst_ip), dst_ip, kProtoTcp, pb->len) + payload_sum;
+    write_be16(th + 16, net_csum_fold(net_csum_add(sum, th, kTcpHeaderBytes)));
+    ++s_stats.tx_segments;
+    return net_stack_send_ipv4(pb, dst_ip, kProtoTcp);
+}
+
+/* Every segment carries the current ACK and window, so sending one settles any pending ACK. */
+static bool send_segment(tcp_socket* s, pktbuf* pb, uint32_t seq, uint8_t flags, size_t opt_len, uint32_t payload_sum) {
+    update_rcv_adv(s);
+    uint32_t window = s->rcv_adv - s->rcv_nxt;
+    if ((flags & kFlagSyn) == 0U) {
+        window >>= s->rcv_wscale;
+    }
+    if ((flags & kFlagAck) != 0U) {
+        s->unacked_segs = 0;
+        s->ack_now = false;
+        s->delack_armed = false;
+    }
+    return emit(pb, s->remote_ip, s->local_port, s->remote_port, seq, (flags & kFlagAck) ? s->rcv_nxt : 0U, flags,
+                (uint16_t)min_u32(window, 0xFFFFU), opt_len, payload_sum);
+}
+
+static bool send_control(tcp_socket* s, uint32_t seq, uint8_t flags) {
+    pktbuf* pb = pktbuf_alloc();
+    return (pb != NULL) && send_segment(s, pb, seq, flags, 0, 0);
+}
+
+static bool send_ack(tcp_socket* s) {
+    return send_control(s, s->snd_nxt, kFlagAck);
+}
+
+/* SYN or SYN-ACK. Window scaling is offered on active opens and echoed on passive ones. */
+static bool send_syn(tcp_socket* s, bool ack, uint32_t now) {
+    pktbuf* pb = pktbuf_alloc();
+    const bool offer_wscale = !ack || s->rcv_wscale != 0U;
+    uint8_t* opt = (pb != NULL) ? pktbuf_append(pb, offer_wscale ? kSynOptionBytes : 4U) : NULL;
+    if (opt == NULL) {
+        pktbuf_put(pb);
+        return false;
+    }
+    opt[0] = 2U;
+    opt[1] = 4U;
+    write_be16(opt + 2, NET_TCP_MSS);
+    if (offer_wscale) {
+        opt[4] = 1U;
+        opt[5] = 3U;
+        opt[6] = 3U;
+        opt[7] = kWindowShift;
+    }
+    const size_t opt_len = pb->len;
+    const uint32_t sum = fold16(net_csum_add(0, opt, opt_len));
+    if (s->snd_max == s->iss) {
+        s->snd_nxt = s->iss + 1U;
+        s->snd_max = s->snd_nxt;
+        s->rtt_timing = true;
+        s->rtt_seq = s->snd_max;
+        s->rtt_start = now;
+    }
+    return send_segment(s, pb, s->iss, (uint8_t)(kFlagSyn | (ack ? kFlagAck : 0U)), opt_len, sum);
+}
+
+static void send_reset_reply(uint32_t remote_ip, uint16_t remote_port, uint16_t local_port, uint32_t seq, uint32_t ack,
+                             uint8_t flags, uint32_t seg_len) {
+    if ((flags & kFlagRst) != 0U) {
+        return;
+    }
+    pktbuf* pb = pktbuf_alloc();
+    if (pb == NULL) {
+        return;
+    }
+    ++s_stats.resets_sent;
+    if ((flags & kFlagAck) != 0U) {
+        (void)emit(pb, remote_ip, local_port, remote_port, ack, 0, kFlagRst, 0, 0, 0);
+    } else {
+        (void)emit(pb, remote_ip, local_port, remote_port, 0, seq + seg_len, kFlagRst | kFlagAck, 0, 0, 0);
+    }
+}
+
+static void abort_connection(tcp_socket* s) {
+    if (s->state != NET_TCP_CLOSED && s->state != NET_TCP_LISTEN && s->state != NET_TCP_SYN_SENT) {
+        ++s_stats.resets_sent;
+        (void)send_control(s, s->snd_nxt, kFlagRst | kFlagAck);
+    }
+    s->reset = true;
+    set_closed(s);
+}
+
+/*
+ * Sends one queued segment. The NIC gets its own reference; the headers
+ * pushed for this transmission are stripped again so the queue keeps bare
+ * payload. A buffer the NIC still holds from an earlier transmission is not
+ * touched: its header bytes may still be in DMA.
+ */
+static bool transmit_seg(tcp_socket* s, tcp_seg* seg, bool last) {
+    pktbuf* pb = seg->pb;
+    if (pb->refs > 1U) {
+        return false;
+    }
+    if (!seg->sum_valid) {
+        seg->sum = fold16(net_csum_add(0, pb->data, pb->len));
+        seg->sum_valid = true;
+    }
+    if (seq_lt(seg->seq, s->snd_max)) {
+        ++s->retransmits;
+        ++s_stats.retransmits;
+    }
+    uint8_t* data = pb->data;
+    const uint16_t len = pb->len;
+    pktbuf_get(pb);
+    const bool ok = send_segment(s, pb, seg->seq, (uint8_t)(kFlagAck | (last ? kFlagPsh : 0U)), 0, seg->sum);
+    pb->data = data;
+    pb->len = len;
+    return ok;
+}
+
+static bool can_send_data(const tcp_socket* s) {
+    return s->state == NET_TCP_ESTABLISHED || s->state == NET_TCP_CLOSE_WAIT || s->state == NET_TCP_FIN_WAIT_1 ||
+           s->state == NET_TCP_CLOSING || s->state == NET_TCP_LAST_ACK;
+}
+
+/* Sends what the congestion and peer windows allow, then the FIN once the queue is out. */
+static void output(tcp_socket* s, uint32_t now) {
+    if (!can_send_data(s)) {
+        return;
+    }
+    const uint32_t wnd = min_u32(s->cwnd, s->snd_wnd);
+    while (s->sq_sent < s->sq_count) {
+        tcp_seg* seg = &s->sq[(s->sq_head + s->sq_sent) % kSendSegs];
+        const uint32_t flight = s->snd_nxt - s->snd_una;
+        const bool last = s->sq_sent + 1U == s->sq_count;
+        if (flight + seg->pb->len > wnd) {
+            break;
+        }
+        /* Nagle: hold a short tail while anything is unacknowledged. */
+        if (!s->nodelay && last && seg->pb->len < s->mss && flight > 0U && !s->fin_queued) {
+            break;
+        }
+        if (!transmit_seg(s, seg, last)) {
+            break;
+        }
+        ++s->sq_sent;
+        s->snd_nxt = seg->seq + seg->pb->len;
+        if (seq_gt(s->snd_nxt, s->snd_max)) {
+            s->snd_max = s->snd_nxt;
+            if (!s->rtt_timing) {
+                s->rtt_timing = true;
+                s->rtt_seq = s->snd_max;
+                s->rtt_start = now;
+            }
+        }
+        if (!s->rto_armed) {
+            arm_rto(s, now);
+        }
+    }
+
+    if (s->fin_queued && !s->fin_sent && s->sq_sent == s->sq_count) {
+        s->fin_seq = s->snd_nxt;
+        if (send_control(s, s->fin_seq, kFlagFin | kFlagAck)) {
+            s->fin_sent = true;
+            s->snd_nxt = s->fin_seq + 1U;
+            if (seq_gt(s->snd_nxt, s->snd_max)) {
+                s->snd_max = s->snd_nxt;
+            }
+            if (!s->rto_armed) {
+                arm_rto(s, now);
+            }
+        }
+    }
+
+    /* Data blocked by a closed peer window with nothing in flight: the timer doubles as the persist timer. */
+    if (s->sq_sent < s->sq_count && s->snd_una == s->snd_max && !s->rto_armed) {
+        arm_rto(s, now);
+    }
+}
+
+static void retransmit_head(tcp_socket* s) {
+    if (s->sq_count > 0U && s->sq_sent > 0U) {
+        (void)transmit_seg(s, &s->sq[s->sq_head], s->sq_count == 1U);
+    } else if (s->fin_sent && !s->fin_acked) {
+        ++s->retransmits;
+        ++s_stats.retransmits;
+        (void)send_control(s, s->fin_seq, kFlagFin | kFlagAck);
+    }
+}
+
+static void rto_expired(tcp_socket* s, uint32_t now) {
+    s->rto_armed = false;
+    if (s->snd_una == s->snd_max) {
+        /* Nothing outstanding: probe the zero window with an old sequence number so the peer answers. */
+        if (s->sq_sent < s->sq_count) {
+            (void)send_control(s, s->snd_una - 1U, kFlagAck);
+            s->rto_ms = min_u32(s->rto_ms * 2U, kRtoMaxMs);
+            arm_rto(s, now);
+        }
+        return;
+    }
+    if (++s->retries > kMaxRetries) {
+        abort_connection(s);
+        return;
+    }
+    s->rto_ms = min_u32(s->rto_ms * 2U, kRtoMaxMs);
+    /* Karn: nothing timed across a retransmission is a valid sample. */
+    s->rtt_timing = false;
+
+    if (s->state == NET_TCP_SYN_SENT || s->state == NET_TCP_SYN_RECEIVED) {
+        ++s->retransmits;
+        ++s_stats.retransmits;
+        (void)send_syn(s, s->state == NET_TCP_SYN_RECEIVED, now);
+        arm_rto(s, now);
+        return;
+    }
+
+    /* Go back N: everything past snd_una is resent as the collapsed window reopens. */
+    if (s->retries == 1U) {
+        s->ssthresh = max_u32((s->snd_max - s->snd_una) / 2U, 2U * s->mss);
+    }
+    s->cwnd = s->mss;
+    s->dupacks = 0;
+    s->in_recovery = false;
+    s->recover = s->snd_max;
+    s->snd_nxt = s->snd_una;
+    s->sq_sent = 0;
+    if (s->fin_sent && !s->fin_acked) {
+        s->fin_sent = false;
+    }
+    output(s, now);
+    if (!s->rto_armed) {
+        arm_rto(s, now);
+    }
+}
+
+static void parse_options(const uint8_t* opt, uint32_t len, uint16_t* out_mss, int* out_wscale) {
+    uint32_t i = 0;
+    while (i < len) {
+        const uint8_t kind = opt[i];
+        if (kind == 0U) {
+            break;
+        }
+        if (kind == 1U) {
+            ++i;
+            continue;
+        }
+        if (i + 1U >= len || opt[i + 1U] < 2U || i + opt[i + 1U] > len) {
+            break;
+        }
+        if (kind == 2U && opt[i + 1U] == 4U) {
+            *out_mss = read_be16(opt + i + 2U);
+        } else if (kind == 3U && opt[i + 1U] == 3U) {
+            *out_wscale = (opt[i + 2U] > 14U) ? 14 : (int)opt[i + 2U];
+        }
+        i += opt[i + 1U];
+    }
+}
+
+/* Applies the peer's SYN options; window scaling only when both sides offered it. */
+static void apply_syn_options(tcp_socket* s, uint16_t peer_mss, int peer_wscale, bool we_offered) {
+    s->mss = (uint16_t)min_u32(NET_TCP_MSS, (peer_mss >= 64U) ? peer_mss : kDefaultMss);
+    if (peer_wscale >= 0 && we_offered) {
+        s->snd_wscale = (uint8_t)peer_wscale;
+        s->rcv_wscale = kWindowShift;
+    } else {
+        s->snd_wscale = 0;
+        s->rcv_wscale = 0;
+    }
+}
+
+static void enter_established(tcp_socket* s, uint32_t seq, uint32_t ack, uint32_t snd_wnd, uint32_t now) {
+    if (s->rtt_timing && seq_ge(ack, s->rtt_seq)) {
+        rtt_sample(s, now - s->rtt_start);
+    }
+    s->rtt_timing = false;
+    if (!s->rtt_valid) {
+        s->rto_ms = kRtoInitialMs;
+    }
+    s->snd_una = ack;
+    s->snd_wnd = snd_wnd;
+    s->snd_wl1 = seq;
+    s->snd_wl2 = ack;
+    s->cwnd = kInitialWindowSegs * (uint32_t)s->mss;
+    s->recover = ack - 1U;
+    s->retries = 0;
+    s->rto_armed = false;
+    s->state = NET_TCP_ESTABLISHED;
+}
+
+static void listen_input(int listener, uint32_t remote_ip, uint16_t remote_port, uint32_t seq, uint32_t ack,
+                         uint8_t flags, uint16_t wnd, const uint8_t* opt, uint32_t opt_len, uint32_t seg_len) {
+    const tcp_socket* l = &s_sockets[listener];
+    if ((flags & kFlagRst) != 0U) {
+        return;
+    }
+    if ((flags & kFlagAck) != 0U || (flags & kFlagSyn) == 0U) {
+        send_reset_reply(remote_ip, remote_port, l->local_port, seq, ack, flags, seg_len);
+        return;
+    }
+
+    uint32_t pending = 0;
+    for (int i = 0; i < NET_TCP_MAX_SOCKETS; ++i) {
+        if (s_sockets[i].used && s_sockets[i].parent == listener) {
+            ++pending;
+        }
+    }
+    const int child = (pending < NET_TCP_BACKLOG) ? alloc_socket() : kNoSocket;
+    if (child == kNoSocket) {
+        ++s_stats.listen_drops;
+        return;
+    }
+
+    tcp_socket* s = &s_sockets[child];
+    s->parent = listener;
+    s->local_port = l->local_port;
+    s->remote_ip = remote_ip;
+    s->remote_port = remote_port;
+    s->irs = seq;
+    s->rcv_nxt = seq + 1U;
+    s->rcv_adv = s->rcv_nxt;
+    uint16_t peer_mss = kDefaultMss;
+    int peer_wscale = -1;
+    parse_options(opt, opt_len, &peer_mss, &peer_wscale);
+    apply_syn_options(s, peer_mss, peer_wscale, true);
+    s->snd_wnd = wnd;
+    s->state = NET_TCP_SYN_RECEIVED;
+    ++s_stats.passive_opens;
+    const uint32_t now = timing_ms_now();
+    (void)send_syn(s, true, now);
+    arm_rto(s, now);
+}
+
+static void syn_sent_input(tcp_socket* s, uint32_t seq, uint32_t ack, uint8_t flags, uint16_t wnd, const uint8_t* opt,
+                           uint32_t opt_len, uint32_t seg_len, uint32_t now) {
+    const bool has_ack = (flags & kFlagAck) != 0U;
+    if (has_ack && ack != s->snd_max) {
+        send_reset_reply(s->remote_ip, s->remote_port, s->local_port, seq, ack, flags, seg_len);
+        return;
+    }
+    if ((flags & kFlagRst) != 0U) {
+        if (has_ack) {
+            ++s_stats.resets_received;
+            s->reset = true;
+            set_closed(s);
+        }
+        return;
+    }
+    if ((flags & kFlagSyn) == 0U) {
+        return;
+    }
+
+    s->irs = seq;
+    s->rcv_nxt = seq + 1U;
+    s->rcv_adv = s->rcv_nxt;
+    uint16_t peer_mss = kDefaultMss;
+    int peer_wscale = -1;
+    parse_options(opt, opt_len, &peer_mss, &peer_wscale);
+    apply_syn_options(s, peer_mss, peer_wscale, true);
+    if (has_ack) {
+        /* The window in a SYN is never scaled. */
+        enter_established(s, seq, ack, wnd, now);
+        (void)send_ack(s);
+    } else {
+        /* Simultaneous open. */
+        s->state = NET_TCP_SYN_RECEIVED;
+        (void)send_syn(s, true, now);
+        arm_rto(s, now);
+    }
+}
+
+/* Processes the acknowledgement and window of a segment on a synchronized connection. */
+static void ack_input(tcp_socket* s, uint32_t seq, uint32_t ack, uint32_t wnd, uint32_t plen, uint32_t now) {
+    if (seq_gt(ack, s->snd_max)) {
+        s->ack_now = true;
+        return;
+    }
+    const uint32_t old_wnd = s->snd_wnd;
+    if (seq_lt(s->snd_wl1, seq) || (s->snd_wl1 == seq && seq_le(s->snd_wl2, ack))) {
+        s->snd_wnd = wnd << s->snd_wscale;
+        s->snd_wl1 = seq;
+        s->snd_wl2 = ack;
+    }
+    if (seq_lt(ack, s->snd_una)) {
+        return;
+    }
+
+    const uint32_t flight = s->snd_max - s->snd_una;
+    if (ack == s->snd_una) {
+        if (plen != 0U || s->snd_wnd != old_wnd || flight == 0U) {
+            return;
+        }
+        ++s->dupacks;
+        if (s->dupacks == kDupAckThreshold && !s->in_recovery && seq_gt(ack, s->recover)) {
+            s->ssthresh = max_u32(flight / 2U, 2U * s->mss);
+            s->recover = s->snd_max;
+            s->in_recovery = true;
+            ++s->fast_retransmits;
+            ++s_stats.fast_retransmits;
+            retransmit_head(s);
+            s->cwnd = s->ssthresh + kDupAckThreshold * (uint32_t)s->mss;
+        } else if (s->in_recovery) {
+            /* Each further duplicate means a segment left the network. */
+            s->cwnd += s->mss;
+        }
+        return;
+    }
+
+    const uint32_t acked = ack - s->snd_una;
+    if (s->rtt_timing && seq_ge(ack, s->rtt_seq)) {
+        rtt_sample(s, now - s->rtt_start);
+        s->rtt_timing = false;
+    }
+    s->retries = 0;
+
+    while (s->sq_count > 0U) {
+        tcp_seg* seg = &s->sq[s->sq_head];
+        if (seq_le(seg->seq + seg->pb->len, ack)) {
+            s->bytes_acked += seg->pb->len;
+            pktbuf_put(seg->pb);
+            s->sq_head = (s->sq_head + 1U) % kSendSegs;
+            --s->sq_count;
+            if (s->sq_sent > 0U) {
+                --s->sq_sent;
+            }
+            continue;
+        }
+        if (seq_lt(seg->seq, ack)) {
+            const uint32_t n = ack - seg->seq;
+            (void)pktbuf_pull(seg->pb, n);
+            seg->seq = ack;
+            seg->sum_valid = false;
+            s->bytes_acked += n;
+        }
+        break;
+    }
+    if (s->fin_sent && seq_gt(ack, s->fin_seq)) {
+        s->fin_acked = true;
+    }
+    s->snd_una = ack;
+    if (seq_lt(s->snd_nxt, ack)) {
+        /* An ACK overtook the go-back-N resend; skip what it covers. */
+        s->snd_nxt = ack;
+        s->sq_sent = 0;
+        while (s->sq_sent < s->sq_count && seq_lt(s->sq[(s->sq_head + s->sq_sent) % kSendSegs].seq, ack)) {
+            ++s->sq_sent;
+        }
+    }
+
+    if (s->in_recovery) {
+        if (seq_ge(ack, s->recover)) {
+            s->in_recovery = false;
+            s->dupacks = 0;
+            s->cwnd = min_u32(s->ssthresh, max_u32(s->snd_max - s->snd_una, s->mss) + s->mss);
+        } else {
+            /* Partial ACK: the next hole is lost too. */
+            retransmit_head(s);
+            s->cwnd = ((s->cwnd > acked) ? s->cwnd - acked : 0U) + s->mss;
+        }
+    } else {
+        s->dupacks = 0;
+        if (s->cwnd < s->ssthresh) {
+            /* Slow start, counting bytes acked (RFC 3465, L = 2). */
+            s->cwnd += min_u32(acked, 2U * s->mss);
+        } else {
+            s->cwnd += max_u32(1U, ((uint32_t)s->mss * s->mss) / s->cwnd);
+        }
+    }
+    s->cwnd = min_u32(s->cwnd, 2U * kSendSegs * NET_TCP_MSS);
+
+    if (s->snd_una == s->snd_max) {
+        s->rto_armed = false;
+    } else {
+        arm_rto(s, now);
+    }
+}
+
+static pktbuf* claim_payload(const uint8_t* frame, size_t frame_len, size_t offset, uint32_t plen) {
+    pktbuf* pb = net_stack_claim(frame, frame_len);
+    if (pb != NULL) {
+        (void)pktbuf_pull(pb, offset);
+        pktbuf_trim(pb, plen);
+        pb->next = NULL;
+    }
+    return pb;
+}
+
+static void rq_link(tcp_socket* s, pktbuf* pb) {
+    pb->next = NULL;
+    if (s->rq_tail != NULL) {
+        s->rq_tail->next = pb;
+    } else {
+        s->rq_head = pb;
+    }
+    s->rq_tail = pb;
+    ++s->rq_segs;
+    s->rq_bytes += pb->len;
+}
+
+/* Moves out-of-order segments that now continue the stream onto the receive queue. */
+static void ooo_drain(tcp_socket* s) {
+    while (s->ooo_count > 0U && seq_le(s->ooo[0].seq, s->rcv_nxt)) {
+        const tcp_ooo e = s->ooo[0];
+        for (uint32_t i = 1; i < s->ooo_count; ++i) {
+            s->ooo[i - 1U] = s->ooo[i];
+        }
+        --s->ooo_count;
+        s->ooo_bytes -= e.pb->len;
+        const uint32_t end = e.seq + e.pb->len;
+        if (seq_le(end, s->rcv_nxt)) {
+            pktbuf_put(e.pb);
+            continue;
+        }
+        (void)pktbuf_pull(e.pb, s->rcv_nxt - e.seq);
+        s->bytes_received += e.pb->len;
+        s->rcv_nxt = end;
+        rq_link(s, e.pb);
+    }
+}
+
+/* Keeps a segment beyond a hole, sorted by sequence; returns true once the frame is claimed. */
+static bool ooo_insert(tcp_socket* s, const uint8_t* frame, size_t frame_len, size_t offset, uint32_t seq,
+                       uint32_t plen) {
+    uint32_t pos = 0;
+    while (pos < s->ooo_count && seq_lt(s->ooo[pos].seq, seq)) {
+        ++pos;
+    }
+    if (s->ooo_count >= kOooSegs || (pos < s->ooo_count && s->ooo[pos].seq == seq && s->ooo[pos].pb->len >= plen)) {
+        return false;
+    }
+    pktbuf* pb = claim_payload(frame, frame_len, offset, plen);
+    if (pb == NULL) {
+        return true;
+    }
+    if (pos < s->ooo_count && s->ooo[pos].seq == seq) {
+        s->ooo_bytes -= s->ooo[pos].pb->len;
+        pktbuf_put(s->ooo[pos].pb);
+    } else {
+        for (uint32_t i = s->ooo_count; i > pos; --i) {
+            s->ooo[i] = s->ooo[i - 1U];
+        }
+        ++s->ooo_count;
+    }
+    s->ooo[pos].pb = pb;
+    s->ooo[pos].seq = seq;
+    s->ooo_bytes += plen;
+    ++s->ooo_segments;
+    return true;
+}
+
+/* Queues segment payload inside the offered window; returns true once the frame is claimed. */
+static bool data_input(tcp_socket* s, const uint8_t* frame, size_t frame_len, size_t offset, uint32_t seq,
+                       uint32_t plen) {
+    if (seq_lt(seq, s->rcv_nxt)) {
+        const uint32_t dup = s->rcv_nxt - seq;
+        if (dup >= plen) {
+            s->ack_now = true;
+            return false;
+        }
+        offset += dup;
+        seq = s->rcv_nxt;
+        plen -= dup;
+    }
+    if (!seq_lt(seq, s->rcv_adv)) {
+        s->ack_now = true;
+        return false;
+    }
+    if (seq_gt(seq + plen, s->rcv_adv)) {
+        plen = s->rcv_adv - seq;
+    }
+    if (plen > recv_space(s)) {
+        s->ack_now = true;
+        return false;
+    }
+
+    /* Nobody will read a connection the caller closed: acknowledge and discard. */
+    if (!s->user_open && s->parent == kNoSocket) {
+        if (seq == s->rcv_nxt) {
+            s->rcv_nxt += plen;
+            s->ack_now = true;
+        }
+        return false;
+    }
+
+    if (seq != s->rcv_nxt) {
+        s->ack_now = true;
+        return ooo_insert(s, frame, frame_len, offset, seq, plen);
+    }
+
+    bool claimed = false;
+    pktbuf* tail = s->rq_tail;
+    if (tail != NULL && plen <= kCopyBreak && tail->refs == 1U && pktbuf_tailroom(tail) >= plen) {
+        uint8_t* dst = pktbuf_append(tail, plen);
+        for (uint32_t i = 0; i < plen; ++i) {
+            dst[i] = frame[offset + i];
+        }
+        s->rq_bytes += plen;
+    } else {
+        pktbuf* pb = claim_payload(frame, frame_len, offset, plen);
+        claimed = true;
+        if (pb == NULL) {
+            return true;
+        }
+        rq_link(s, pb);
+    }
+    s->rcv_nxt += plen;
+    s->bytes_received += plen;
+    if (s->ooo_count > 0U) {
+        ooo_drain(s);
+        s->ack_now = true;
+    }
+    ++s->unacked_segs;
+    return claimed;
+}
+
+/* Handles a FIN that continues the stream; the caller has already taken any data in front of it. */
+static void fin_input(tcp_socket* s, uint32_t now) {
+    s->rcv_nxt += 1U;
+    s->fin_received = true;
+    s->ack_now = true;
+    switch (s->state) {
+    case NET_TCP_SYN_RECEIVED:
+    case NET_TCP_ESTABLISHED:
+        s->state = NET_TCP_CLOSE_WAIT;
+        break;
+    case NET_TCP_FIN_WAIT_1:
+        s->state = s->fin_acked ? NET_TCP_TIME_WAIT : NET_TCP_CLOSING;
+        break;
+    case NET_TCP_FIN_WAIT_2:
+        s->state = NET_TCP_TIME_WAIT;
+        break;
+    default:
+        break;
+    }
+    if (s->state == NET_TCP_TIME_WAIT) {
+        s->rto_armed = false;
+        s->state_at = now + kTimeWaitMs;
+    }
+}
+
+/* Segment on a connection past LISTEN and SYN_SENT; returns true once the frame is claimed. */
+static bool connection_input(tcp_socket* s, const uint8_t* frame, size_t frame_len, size_t offset, uint32_t seq,
+                             uint32_t ack, uint8_t flags, uint16_t wnd, uint32_t plen, uint32_t now) {
+    const uint32_t seg_len = plen + (((flags & kFlagFin) != 0U) ? 1U : 0U);
+    const uint32_t rcv_wnd = seq_gt(s->rcv_adv, s->rcv_nxt) ? s->rcv_adv - s->rcv_nxt : 0U;
+    bool acceptable;
+    if (seg_len == 0U) {
+        acceptable = (rcv_wnd == 0U) ? seq == s->rcv_nxt
+                                     : (seq_ge(seq, s->rcv_nxt) && seq_lt(seq, s->rcv_nxt + rcv_wnd));
+    } else {
+        acceptable = rcv_wnd > 0U && ((seq_ge(seq, s->rcv_nxt) && seq_lt(seq, s->rcv_nxt + rcv_wnd)) ||
+                                      (seq_ge(seq + seg_len - 1U, s->rcv_nxt) &&
+                                       seq_lt(seq + seg_len - 1U, s->rcv_nxt + rcv_wnd)));
+    }
+    if (!acceptable) {
+        if ((flags & kFlagRst) == 0U) {
+            (void)send_ack(s);
+        }
+        return false;
+    }
+
+    if ((flags & kFlagRst) != 0U) {
+        ++s_stats.resets_received;
+        s->reset = true;
+        set_closed(s);
+        return false;
+    }
+    if ((flags & kFlagSyn) != 0U) {
+        /* A SYN inside the window of a live connection; answer with an ACK and let the peer sort it out. */
+        (void)send_ack(s);
+        return false;
+    }
+    if ((flags & kFlagAck) == 0U) {
+        return false;
+    }
+
+    if (s->state == NET_TCP_SYN_RECEIVED) {
+        if (!seq_gt(ack, s->snd_una) || seq_gt(ack, s->snd_max)) {
+            send_reset_reply(s->remote_ip, s->remote_port, s->local_port, seq, ack, flags, seg_len);
+            return false;
+        }
+        enter_established(s, seq, ack, (uint32_t)wnd << s->snd_wscale, now);
+    } else {
+        ack_input(s, seq, ack, wnd, plen, now);
+    }
+
+    if (s->fin_acked) {
+        if (s->state == NET_TCP_FIN_WAIT_1) {
+            s->state = NET_TCP_FIN_WAIT_2;
+            s->state_at = now + kFinWait2Ms;
+        } else if (s->state == NET_TCP_CLOSING) {
+            s->state = NET_TCP_TIME_WAIT;
+            s->state_at = now + kTimeWaitMs;
+        } else if (s->state == NET_TCP_LAST_ACK) {
+            set_closed(s);
+            return false;
+        }
+    }
+
+    bool claimed = false;
+    const bool receiving = s->state == NET_TCP_ESTABLISHED || s->state == NET_TCP_FIN_WAIT_1 ||
+                           s->state == NET_TCP_FIN_WAIT_2;
+    if (plen > 0U && receiving) {
+        claimed = data_input(s, frame, frame_len, offset, seq, plen);
+    }
+    if ((flags & kFlagFin) != 0U) {
+        if (!s->fin_received && receiving && seq + plen == s->rcv_nxt) {
+            fin_input(s, now);
+        } else if (s->state == NET_TCP_TIME_WAIT) {
+            /* Our ACK of the FIN was lost. */
+            s->ack_now = true;
+            s->state_at = now + kTimeWaitMs;
+        }
+    }
+
+    output(s, now);
+    if (s->ack_now || s->unacked_segs >= 2U) {
+        (void)send_ack(s);
+    } else if (s->unacked_segs > 0U && !s->delack_armed) {
+        s->delack_armed = true;
+        s->delack_at = now + kDelayedAckMs;
+    }
+    return claimed;
+}
+
+int net_tcp_socket(void) {
+    const int sock = alloc_socket();
+    if (sock != kNoSocket) {
+        s_sockets[sock].user_open = true;
+    }
+    return sock;
+}
+
+bool net_tcp_bind(int sock, uint16_t port) {
+    tcp_socket* s = socket_at(sock);
+    if (s == NULL || !s->user_open || s->local_port != 0U) {
+        return false;
+    }
+    if (port == 0U) {
+        for (uint32_t tries = 0; tries < 65536U - kEphemeralFirst; ++tries) {
+            const uint16_t candidate = s_next_ephemeral;
+            s_next_ephemeral = (s_next_ephemeral == 0xFFFFU) ? kEphemeralFirst : (uint16_t)(s_next_ephemeral + 1U);
+            if (!port_in_use(candidate)) {
+                port = candidate;
+                break;
+            }
+        }
+        if (port == 0U) {
+            return false;
+        }
+    } else if (port_in_use(port)) {
+        return false;
+    }
+    s->local_port = port;
+    return true;
+}
+
+bool net_tcp_listen(int sock) {
+    tcp_socket* s = socket_at(sock);
+    if (s == NULL || !s->user_open || s->state != NET_TCP_CLOSED || s->local_port == 0U) {
+        return false;
+    }
+    s->state = NET_TCP_LISTEN;
+    return true;
+}
+
+int net_tcp_accept(int sock, uint32_t* out_ipv4_be, uint16_t* out_port) {
+    const tcp_socket* l = socket_at(sock);
+    if (l == NULL || l->state != NET_TCP_LISTEN) {
+        return -1;
+    }
+    for (int i = 0; i < NET_TCP_MAX_SOCKETS; ++i) {
+        tcp_socket* s = &s_sockets[i];
+        if (s->used && s->parent == sock && s->state != NET_TCP_SYN_RECEIVED) {
+            s->parent = kNoSocket;
+            s->user_open = true;
+            if (out_ipv4_be != NULL) {
+                *out_ipv4_be = s->remote_ip;
+            }
+            if (out_port != NULL) {
+                *out_port = s->remote_port;
+            }
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool net_tcp_connect(int sock, uint32_t dst_ipv4_be, uint16_t dst_port) {
+    tcp_socket* s = socket_at(sock);
+    if (s == NULL || !s->user_open || s->state != NET_TCP_CLOSED || dst_port == 0U || !net_stack_ready()) {
+        return false;
+    }
+    if (s->local_port == 0U && !net_tcp_bind(sock, 0)) {
+        return false;
+    }
+    free_queues(s);
+    init_connection(s);
+    s->remote_ip = dst_ipv4_be;
+    s->remote_port = dst_port;
+    s->state = NET_TCP_SYN_SENT;
+    ++s_stats.active_opens;
+    const uint32_t now = timing_ms_now();
+    (void)send_syn(s, false, now);
+    arm_rto(s, now);
+    return true;
+}
+
+int net_tcp_send(int sock, const void* buf, size_t len) {
+    tcp_socket* s = socket_at(sock);
+    if (s == NULL || !s->user_open || (buf == NULL && len > 0U)) {
+        return -1;
+    }
+    if (s->state == NET_TCP_SYN_SENT || s->state == NET_TCP_SYN_RECEIVED) {
+        return 0;
+    }
+    if (s->fin_queued || (s->state != NET_TCP_ESTABLISHED && s->state != NET_TCP_CLOSE_WAIT)) {
+        return -1;
+    }
+    if (len > 0x7FFFFFFFU) {
+        len = 0x7FFFFFFFU;
+    }
+
+    const uint8_t* src = (const uint8_t*)buf;
+    size_t taken = 0;
+    while (taken < len) {
+        /* Top up an unsent tail segment before starting another. */
+        tcp_seg* tail = (s->sq_count > s->sq_sent) ? &s->sq[(s->sq_head + s->sq_count - 1U) % kSendSegs] : NULL;
+        if (tail != NULL && tail->pb->len < s->mss && tail->pb->refs == 1U) {
+            const size_t n = min_u32((uint32_t)(s->mss - tail->pb->len), (uint32_t)(len - taken));
+            uint8_t* dst = pktbuf_append(tail->pb, n);
+            if (dst == NULL) {
+                break;
+            }
+            for (size_t i = 0; i < n; ++i) {
+                dst[i] = src[taken + i];
+            }
+            tail->sum_valid = false;
+            taken += n;
+            continue;
+        }
+
+        pktbuf_stats pool;
+        pktbuf_get_stats(&pool);
+        if (s->sq_count >= kSendSegs || pool.free <= kPoolReserve) {
+            break;
+        }
+        pktbuf* pb = pktbuf_alloc();
+        if (pb == NULL) {
+            break;
+        }
+        const tcp_seg* last = (s->sq_count > 0U) ? &s->sq[(s->sq_head + s->sq_count - 1U) % kSendSegs] : NULL;
+        tcp_seg* seg = &s->sq[(s->sq_head + s->sq_count) % kSendSegs];
+        seg->seq = (last != NULL) ? last->seq + last->pb->len : s->snd_max;
+        seg->pb = pb;
+        seg->sum_valid = false;
+        ++s->sq_count;
+    }
+    output(s, timing_ms_now());
+    return (int)taken;
+}
+
+int net_tcp_recv(int sock, void* buf, size_t cap) {
+    tcp_socket* s = socket_at(sock);
+    if (s == NULL || !s->user_open || (buf == NULL && cap > 0U)) {
+        return -1;
+    }
+    if (s->rq_head == NULL) {
+        return (s->fin_received || s->reset || s->state == NET_TCP_CLOSED) ? 0 : -1;
+    }
+    if (cap > 0x7FFFFFFFU) {
+        cap = 0x7FFFFFFFU;
+    }
+
+    uint8_t* dst = (uint8_t*)buf;
+    size_t n = 0;
+    while (n < cap && s->rq_head != NULL) {
+        pktbuf* pb = s->rq_head;
+        const size_t chunk = (pb->len < cap - n) ? pb->len : cap - n;
+        for (size_t i = 0; i < chunk; ++i) {
+            dst[n + i] = pb->data[i];
+        }
+        n += chunk;
+        s->rq_bytes -= (uint32_t)chunk;
+        if (chunk == pb->len) {
+            s->rq_head = pb->next;
+            if (s->rq_head == NULL) {
+                s->rq_tail = NULL;
+            }
+            --s->rq_segs;
+            pktbuf_put(pb);
+        } else {
+            (void)pktbuf_pull(pb, chunk);
+        }
+    }
+
+    /* Tell the peer about a reopened window once it is worth a segment of its own. */
+    if (s->state == NET_TCP_ESTABLISHED || s->state == NET_TCP_FIN_WAIT_1 || s->state == NET_TCP_FIN_WAIT_2) {
+        const uint32_t before = s->rcv_adv - s->rcv_nxt;
+        update_rcv_adv(s);
+        const uint32_t after = s->rcv_adv - s->rcv_nxt;
+        if (after >= before + 2U * s->mss || (before < s->mss && after >= s->mss)) {
+            (void)send_ack(s);
+        }
+    }
+    return (int)n;
+}
+
+void net_tcp_close(int sock) {
+    tcp_socket* s = socket_at(sock);
+    if (s == NULL || !s->user_open) {
+        return;
+    }
+    s->user_open = false;
+
+    /* Nobody will read them now. */
+    while (s->rq_head != NULL) {
+        pktbuf* pb = s->rq_head;
+        s->rq_head = pb->next;
+        pktbuf_put(pb);
+    }
+    s->rq_tail = NULL;
+    s->rq_bytes = 0;
+    s->rq_segs = 0;
+
+    switch (s->state) {
+    case NET_TCP_LISTEN:
+        for (int i = 0; i < NET_TCP_MAX_SOCKETS; ++i) {
+            if (s_sockets[i].used && s_sockets[i].parent == sock) {
+                s_sockets[i].parent = kNoSocket;
+                abort_connection(&s_sockets[i]);
+            }
+        }
+        set_closed(s);
+        break;
+    case NET_TCP_ESTABLISHED:
+        s->state = NET_TCP_FIN_WAIT_1;
+        s->fin_queued = true;
+        output(s, timing_ms_now());
+        break;
+    case NET_TCP_CLOSE_WAIT:
+        s->state = NET_TCP_LAST_ACK;
+        s->fin_queued = true;
+        output(s, timing_ms_now());
+        break;
+    case NET_TCP_CLOSED:
+    case NET_TCP_SYN_SENT:
+    case NET_TCP_SYN_RECEIVED:
+        set_closed(s);
+        break;
+    default:
+        /* Already closing; the timers finish the job. */
+        break;
+    }
+}
+
+void net_tcp_set_nodelay(int sock, bool nodelay) {
+    tcp_socket* s = socket_at(sock);
+    if (s != NULL) {
+        s->nodelay = nodelay;
+        output(s, timing_ms_now());
+    }
+}
+
+uint32_t net_tcp_poll(int sock) {
+    const tcp_socket* s = socket_at(sock);
+    if (s == NULL) {
+        return 0;
+    }
+    if (s->state == NET_TCP_LISTEN) {
+        for (int i = 0; i < NET_TCP_MAX_SOCKETS; ++i) {
+            if (s_sockets[i].used && s_sockets[i].parent == sock && s_sockets[i].state != NET_TCP_SYN_RECEIVED) {
+                return NET_TCP_POLL_IN;
+            }
+        }
+        return 0;
+    }
+    uint32_t mask = 0;
+    if (s->rq_head != NULL || s->fin_received || s->reset) {
+        mask |= NET_TCP_POLL_IN;
+    }
+    if ((s->state == NET_TCP_ESTABLISHED || s->state == NET_TCP_CLOSE_WAIT) && !s->fin_queued &&
+        s->sq_count < kSendSegs) {
+        mask |= NET_TCP_POLL_OUT;
+    }
+    /* Nothing more will move in either direction. */
+    if (s->reset || s->state == NET_TCP_CLOSED || s->state == NET_TCP_TIME_WAIT) {
+        mask |= NET_TCP_POLL_HUP;
+    }
+    return mask;
+}
+
+bool net_tcp_get_info(int sock, net_tcp_info* out) {
+    const tcp_socket* s = socket_at(sock);
+    if (s == NULL || out == NULL) {
+        return false;
+    }
+    out->state = s->state;
+    out->reset = s->reset;
+    out->srtt_ms = s->srtt8 >> 3U;
+    out->rto_ms = s->rto_ms;
+    out->cwnd = s->cwnd;
+    out->ssthresh = s->ssthresh;
+    out->snd_wnd = s->snd_wnd;
+    out->rcv_wnd = seq_gt(s->rcv_adv, s->rcv_nxt) ? s->rcv_adv - s->rcv_nxt : 0U;
+    out->snd_wscale = s->snd_wscale;
+    out->rcv_wscale = s->rcv_wscale;
+    out->bytes_acked = s->bytes_acked;
+    out->bytes_received = s->bytes_received;
+    out->retransmits = s->retransmits;
+    out->fast_retransmits = s->fast_retransmits;
+    out->ooo_segments = s->ooo_segments;
+    return true;
+}
+
+void net_tcp_get_stats(net_tcp_stats* out) {
+    if (out != NULL) {
+        *out = s_stats;
+    }
+}
+
+const char* net_tcp_state_name(net_tcp_state state) {
+    if ((uint32_t)state >= sizeof(kStateNames) / sizeof(kStateNames[0])) {
+        return "?";
+    }
+    return kStateNames[state];
+}
+
+void net_tcp_timer(void) {
+    const uint32_t now = timing_ms_now();
+    for (int i = 0; i < NET_TCP_MAX_SOCKETS; ++i) {
+        tcp_socket* s = &s_sockets[i];
+        if (!s->used || s->state == NET_TCP_CLOSED || s->state == NET_TCP_LISTEN) {
+            continue;
+        }
+        if ((s->state == NET_TCP_TIME_WAIT || s->state == NET_TCP_FIN_WAIT_2) && time_reached(now, s->state_at)) {
+            set_closed(s);
+            continue;
+        }
+        if (s->delack_armed && time_reached(now, s->delack_at)) {
+            (void)send_ack(s);
+        }
+        if (s->rto_armed && time_reached(now, s->rto_at)) {
+            rto_expired(s, now);
+        } else if (s->sq_sent < s->sq_count) {
+            /* Picks up segments a full NIC queue turned away. */
+            output(s, now);
+        }
+    }
+}
+
+bool net_tcp_input(const uint8_t* frame, size_t len) {
+    const uint8_t* ip = frame + 14;
+    const uint32_t ihl = (uint32_t)(ip[0] & 0x0FU) * 4U;
+    const size_t ip_len = len - 14U;
+    if (ip_len < ihl + kTcpHeaderBytes) {
+        ++s_stats.rx_errors;
+        return false;
+    }
+    const uint8_t* th = ip + ihl;
+    const uint32_t tcp_len = (uint32_t)(ip_len - ihl);
+    const uint32_t doff = (uint32_t)(th[12] >> 4U) * 4U;
+    const uint32_t src_ip = read_be32(ip + 12);
+    if (doff < kTcpHeaderBytes || doff > tcp_len ||
+        net_csum_fold(net_csum_add(net_csum_pseudo(src_ip, read_be32(ip + 16), kProtoTcp, (uint16_t)tcp_len), th,
+                                   tcp_len)) != 0U) {
+        ++s_stats.rx_errors;
+        return false;
+    }
+    ++s_stats.rx_segments;
+
+    const uint16_t src_port = read_be16(th + 0);
+    const uint16_t dst_port = read_be16(th + 2);
+    const uint32_t seq = read_be32(th + 4);
+    const uint32_t ack = read_be32(th + 8);
+    const uint8_t flags = th[13];
+    const uint16_t wnd = read_be16(th + 14);
+    const uint32_t plen = tcp_len - doff;
+    const uint32_t seg_len = plen + (((flags & kFlagSyn) != 0U) ? 1U : 0U) + (((flags & kFlagFin) != 0U) ? 1U : 0U);
+
+    const int sock = find_socket(dst_port, src_ip, src_port);
+    if (sock == kNoSocket) {
+        send_reset_reply(src_ip, src_port, dst_port, seq, ack, flags, seg_len);
+        return false;
+    }
+    tcp_socket* s = &s_sockets[sock];
+    if (s->state == NET_TCP_LISTEN) {
+        listen_input(sock, src_ip, src_port, seq, ack, flags, wnd, th + kTcpHeaderBytes, doff - kTcpHeaderBytes,
+                     seg_len);
+        return false;
+    }
+    const uint32_t now = timing_ms_now();
+    if (s->state == NET_TCP_SYN_SENT) {
+        syn_sent_input(s, seq, ack, flags, wnd, th + kTcpHeaderBytes, doff - kTcpHeaderBytes, seg_len, now);
+        return false;
+    }
+    return connection_input(s, frame, len, 14U + ihl + doff, seq, ack, flags, wnd, plen, now);
+}
@@ -0,0 +1,226 @@
+#include "kernel/net_tcpperf.h"
+
+#include "kernel/kmem.h"
+#include "kernel/net_stack.h"
+#include "kernel/net_tcp.h"
+#include "kernel/serial.h"
+#include "kernel/timing.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    kSinkBytes = 8192,
+    /* recv calls per poll, so a fast sender cannot starve the rest of the main loop. */
+    kRecvBudget = 16,
+    kZeroBytes = 4096,
+};
+
+static int s_listener = -1;
+static int s_rx_sock = -1;
+static uint64_t s_rx_bytes = 0;
+static uint32_t s_rx_start = 0;
+
+static int s_tx_sock = -1;
+static const uint8_t* s_tx_data = NULL;
+/* Private copy of the caller's data, so the source may change or go away mid-send. */
+static uint8_t* s_tx_copy = NULL;
+static size_t s_tx_len = 0;
+static uint32_t s_tx_total = 0;
+static uint32_t s_tx_queued = 0;
+static uint32_t s_tx_start = 0;
+static bool s_tx_started = false;
+
+static net_tcpperf_result s_last;
+static bool s_have_last = false;
+static uint8_t s_sink[kSinkBytes];
+static const uint8_t kZeros[kZeroBytes] = {0};
+
+/* num * mul / den in 32 bits, trading low bits of num and den for range. */
+static uint32_t scaled_ratio(uint32_t num, uint32_t mul, uint32_t den) {
+    while (num > 0xFFFFFFFFU / mul) {
+        num >>= 1U;
+        den >>= 1U;
+    }
+    return (den > 0U) ? (num * mul) / den : 0U;
+}
+
+static void finish(bool sent, bool ok, uint64_t bytes, uint32_t start, uint32_t retransmits) {
+    uint32_t ms = timing_ms_now() - start;
+    if (ms == 0U) {
+        ms = 1U;
+    }
+    s_last.sent = sent;
+    s_last.ok = ok;
+    s_last.bytes = bytes;
+    s_last.ms = ms;
+    /* No 64-bit division here: KiB fit 32 bits up to 4 TiB. */
+    s_last.kib_per_s = scaled_ratio((uint32_t)(bytes >> 10U), 1000U, ms);
+    s_last.retransmits = retransmits;
+    s_have_last = true;
+
+    serial_write("PYCOREOS_TCPPERF dir=");
+    serial_write(sent ? "tx" : "rx");
+    serial_write(ok ? " ok" : " reset");
+    serial_write(" bytes=");
+    serial_write_u64(bytes);
+    serial_write(" ms=");
+    serial_write_u32(ms);
+    serial_write(" kib_s=");
+    serial_write_u32(s_last.kib_per_s);
+    serial_write(" retx=");
+    serial_write_u32(retransmits);
+    serial_write("\n");
+}
+
+void net_tcpperf_init(void) {
+    if (!net_stack_ready() || s_listener >= 0) {
+        return;
+    }
+    s_listener = net_tcp_socket();
+    if (s_listener >= 0 && (!net_tcp_bind(s_listener, NET_TCPPERF_PORT) || !net_tcp_listen(s_listener))) {
+        net_tcp_close(s_listener);
+        s_listener = -1;
+    }
+}
+
+static void poll_receiver(void) {
+    if (s_rx_sock < 0) {
+        if (s_listener < 0) {
+            return;
+        }
+        s_rx_sock = net_tcp_accept(s_listener, NULL, NULL);
+        if (s_rx_sock < 0) {
+            return;
+        }
+        s_rx_bytes = 0;
+        s_rx_start = timing_ms_now();
+    }
+
+    for (int budget = kRecvBudget; budget > 0; --budget) {
+        const int n = net_tcp_recv(s_rx_sock, s_sink, sizeof(s_sink));
+        if (n < 0) {
+            return;
+        }
+        if (n == 0) {
+            net_tcp_info info;
+            const bool have_info = net_tcp_get_info(s_rx_sock, &info);
+            finish(false, have_info && !info.reset, s_rx_bytes, s_rx_start, have_info ? info.retransmits : 0U);
+            net_tcp_close(s_rx_sock);
+            s_rx_sock = -1;
+            return;
+        }
+        s_rx_bytes += (uint64_t)n;
+    }
+}
+
+static void end_send(bool close) {
+    if (close) {
+        net_tcp_close(s_tx_sock);
+    }
+    s_tx_sock = -1;
+    s_tx_data = NULL;
+    kmem_free(s_tx_copy);
+    s_tx_copy = NULL;
+}
+
+static void poll_sender(void) {
+    if (s_tx_sock < 0) {
+        return;
+    }
+    net_tcp_info info;
+    if (!net_tcp_get_info(s_tx_sock, &info)) {
+        end_send(false);
+        return;
+    }
+    if (info.reset || info.state == NET_TCP_CLOSED) {
+        finish(true, false, info.bytes_acked, s_tx_start, info.retransmits);
+        end_send(true);
+        return;
+    }
+    if (info.state == NET_TCP_SYN_SENT) {
+        return;
+    }
+    if (!s_tx_started) {
+        s_tx_started = true;
+        s_tx_start = timing_ms_now();
+    }
+
+    /* The data is copied once, straight into the frames the NIC sends. */
+    while (s_tx_queued < s_tx_total) {
+        const size_t offset = s_tx_queued % s_tx_len;
+        size_t chunk = s_tx_len - offset;
+        if (chunk > s_tx_total - s_tx_queued) {
+            chunk = s_tx_total - s_tx_queued;
+        }
+        const int n = net_tcp_send(s_tx_sock, s_tx_data + offset, chunk);
+        if (n <= 0) {
+            break;
+        }
+        s_tx_queued += (uint32_t)n;
+    }
+
+    if (info.bytes_acked >= s_tx_total) {
+        finish(true, true, s_tx_total, s_tx_start, info.retransmits);
+        end_send(true);
+    }
+}
+
+void net_tcpperf_poll(void) {
+    if (!net_stack_ready()) {
+        return;
+    }
+    poll_receiver();
+    poll_sender();
+}
+
+bool net_tcpperf_start_send(uint32_t ipv4_be, uint16_t port, const uint8_t* data, size_t len, uint32_t total) {
+    if (s_tx_sock >= 0 || total == 0U || !net_stack_ready()) {
+        return false;
+    }
+    uint8_t* copy = NULL;
+    if (data == NULL || len == 0U) {
+        data = kZeros;
+        len = sizeof(kZeros);
+    } else {
+        copy = (uint8_t*)kmem_alloc(len);
+        if (copy == NULL) {
+            return false;
+        }
+        for (size_t i = 0; i < len; ++i) {
+            copy[i] = data[i];
+        }
+        data = copy;
+    }
+    const int sock = net_tcp_socket();
+    if (sock < 0) {
+        kmem_free(copy);
+        return false;
+    }
+    if (!net_tcp_connect(sock, ipv4_be, port)) {
+        net_tcp_close(sock);
+        kmem_free(copy);
+        return false;
+    }
+    s_tx_sock = sock;
+    s_tx_copy = copy;
+    s_tx_data = data;
+    s_tx_len = len;
+    s_tx_total = total;
+    s_tx_queued = 0;
+    s_tx_started = false;
+    return true;
+}
+
+bool net_tcpperf_busy(void) {
+    return s_tx_sock >= 0;
+}
+
+bool net_tcpperf_last_result(net_tcpperf_result* out) {
+    if (!s_have_last || out == NULL) {
+        return false;
+    }
+    *out = s_last;
+    return true;
+}
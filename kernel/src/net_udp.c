@@ -0,0 +1,358 @@
+#include "kernel/net_udp.h"
+
+#include "drivers/pktbuf.h"
+#include "kernel/net_csum.h"
+#include "kernel/net_stack.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    kProtoUdp = 17,
+    kUdpHeaderBytes = 8,
+    /* Power of two; twice the socket count keeps chains to about one entry. */
+    kHashBuckets = 32,
+    kNoSocket = -1,
+};
+
+typedef struct udp_socket {
+    bool used;
+    uint16_t port;
+    /* Next socket in the same hash bucket. */
+    int hash_next;
+    /* Received datagrams, oldest first, linked through pktbuf.next; data starts at the IPv4 header. */
+    pktbuf* rx_head;
+    pktbuf* rx_tail;
+    net_udp_socket_stats stats;
+} udp_socket;
+
+static udp_socket s_sockets[NET_UDP_MAX_SOCKETS];
+static int s_buckets[kHashBuckets];
+static bool s_buckets_ready = false;
+static uint16_t s_next_ephemeral = NET_UDP_EPHEMERAL_FIRST;
+static net_udp_stats s_stats;
+
+static uint16_t read_be16(const uint8_t* p) {
+    return (uint16_t)(((uint16_t)p[0] << 8U) | (uint16_t)p[1]);
+}
+
+static uint32_t read_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24U) | ((uint32_t)p[1] << 16U) | ((uint32_t)p[2] << 8U) | (uint32_t)p[3];
+}
+
+static void write_be16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8U);
+    p[1] = (uint8_t)(v & 0xFFU);
+}
+
+static uint32_t bucket_of(uint16_t port) {
+    return ((uint32_t)port ^ ((uint32_t)port >> 5U) ^ ((uint32_t)port >> 10U)) & (kHashBuckets - 1U);
+}
+
+static void buckets_setup(void) {
+    if (s_buckets_ready) {
+        return;
+    }
+    for (uint32_t i = 0; i < kHashBuckets; ++i) {
+        s_buckets[i] = kNoSocket;
+    }
+    s_buckets_ready = true;
+}
+
+static udp_socket* socket_at(int sock) {
+    if (sock < 0 || sock >= NET_UDP_MAX_SOCKETS || !s_sockets[sock].used) {
+        return NULL;
+    }
+    return &s_sockets[sock];
+}
+
+static int lookup(uint16_t port) {
+    buckets_setup();
+    for (int i = s_buckets[bucket_of(port)]; i != kNoSocket; i = s_sockets[i].hash_next) {
+        if (s_sockets[i].port == port) {
+            return i;
+        }
+    }
+    return kNoSocket;
+}
+
+static void unhash(int sock) {
+    int* link = &s_buckets[bucket_of(s_sockets[sock].port)];
+    while (*link != kNoSocket) {
+        if (*link == sock) {
+            *link = s_sockets[sock].hash_next;
+            break;
+        }
+        link = &s_sockets[*link].hash_next;
+    }
+    s_sockets[sock].hash_next = kNoSocket;
+    s_sockets[sock].port = 0;
+}
+
+int net_udp_socket(void) {
+    buckets_setup();
+    for (int i = 0; i < NET_UDP_MAX_SOCKETS; ++i) {
+        udp_socket* s = &s_sockets[i];
+        if (!s->used) {
+            s->used = true;
+            s->port = 0;
+            s->hash_next = kNoSocket;
+            s->rx_head = NULL;
+            s->rx_tail = NULL;
+            s->stats = (net_udp_socket_stats){0, 0, 0, 0, 0};
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool net_udp_bind(int sock, uint16_t port) {
+    udp_socket* s = socket_at(sock);
+    if (s == NULL || s->port != 0U) {
+        return false;
+    }
+
+    if (port == 0U) {
+        /* Walk the ephemeral range once; 16 sockets cannot exhaust it. */
+        for (uint32_t tries = 0; tries < 65536U - NET_UDP_EPHEMERAL_FIRST; ++tries) {
+            const uint16_t candidate = s_next_ephemeral;
+            s_next_ephemeral = (s_next_ephemeral == 0xFFFFU) ? NET_UDP_EPHEMERAL_FIRST : (uint16_t)(s_next_ephemeral + 1U);
+            if (lookup(candidate) == kNoSocket) {
+                port = candidate;
+                break;
+            }
+        }
+        if (port == 0U) {
+            return false;
+        }
+    } else if (lookup(port) != kNoSocket) {
+        return false;
+    }
+
+    const uint32_t bucket = bucket_of(port);
+    s->port = port;
+    s->hash_next = s_buckets[bucket];
+    s_buckets[bucket] = sock;
+    return true;
+}
+
+void net_udp_close(int sock) {
+    udp_socket* s = socket_at(sock);
+    if (s == NULL) {
+        return;
+    }
+    if (s->port != 0U) {
+        unhash(sock);
+    }
+    while (s->rx_head != NULL) {
+        pktbuf* pb = s->rx_head;
+        s->rx_head = pb->next;
+        pktbuf_put(pb);
+    }
+    s->rx_tail = NULL;
+    s->stats.queued = 0;
+    s->used = false;
+}
+
+uint16_t net_udp_local_port(int sock) {
+    const udp_socket* s = socket_at(sock);
+    return (s != NULL) ? s->port : 0U;
+}
+
+bool net_udp_send_pktbuf(int sock, pktbuf* pb, uint32_t dst_ipv4_be, uint16_t dst_port) {
+    udp_socket* s = socket_at(sock);
+    if (pb == NULL) {
+        return false;
+    }
+    if (s == NULL || dst_port == 0U || pb->len > NET_UDP_MAX_PAYLOAD || (s->port == 0U && !net_udp_bind(sock, 0))) {
+        pktbuf_put(pb);
+        ++s_stats.tx_errors;
+        if (s != NULL) {
+            ++s->stats.tx_errors;
+        }
+        return false;
+    }
+
+    uint8_t* udp = pktbuf_push(pb, kUdpHeaderBytes);
+    if (udp == NULL) {
+        pktbuf_put(pb);
+        ++s_stats.tx_errors;
+        ++s->stats.tx_errors;
+        return false;
+    }
+    const uint16_t udp_len = pb->len;
+    write_be16(udp + 0, s->port);
+    write_be16(udp + 2, dst_port);
+    write_be16(udp + 4, udp_len);
+    write_be16(udp + 6, 0);
+    const uint32_t pseudo = net_csum_pseudo(net_stack_source_ipv4(dst_ipv4_be), dst_ipv4_be, kProtoUdp, udp_len);
+    uint16_t csum = net_csum_fold(net_csum_add(pseudo, udp, udp_len));
+    if (csum == 0U) {
+        csum = 0xFFFFU;
+    }
+    write_be16(udp + 6, csum);
+
+    if (!net_stack_send_ipv4(pb, dst_ipv4_be, kProtoUdp)) {
+        ++s_stats.tx_errors;
+        ++s->stats.tx_errors;
+        return false;
+    }
+    ++s_stats.tx_datagrams;
+    ++s->stats.tx_datagrams;
+    return true;
+}
+
+int net_udp_sendto(int sock, const void* buf, size_t len, uint32_t dst_ipv4_be, uint16_t dst_port) {
+    if ((buf == NULL && len > 0U) || len > NET_UDP_MAX_PAYLOAD || socket_at(sock) == NULL) {
+        return -1;
+    }
+    pktbuf* pb = pktbuf_alloc();
+    uint8_t* payload = (pb != NULL) ? pktbuf_append(pb, len) : NULL;
+    if (payload == NULL) {
+        pktbuf_put(pb);
+        ++s_stats.tx_errors;
+        ++s_sockets[sock].stats.tx_errors;
+        return -1;
+    }
+    const uint8_t* src = (const uint8_t*)buf;
+    for (size_t i = 0; i < len; ++i) {
+        payload[i] = src[i];
+    }
+    return net_udp_send_pktbuf(sock, pb, dst_ipv4_be, dst_port) ? (int)len : -1;
+}
+
+pktbuf* net_udp_recv_pktbuf(int sock, uint32_t* out_ipv4_be, uint16_t* out_port) {
+    udp_socket* s = socket_at(sock);
+    if (s == NULL || s->rx_head == NULL) {
+        return NULL;
+    }
+    pktbuf* pb = s->rx_head;
+    s->rx_head = pb->next;
+    if (s->rx_head == NULL) {
+        s->rx_tail = NULL;
+    }
+    pb->next = NULL;
+    --s->stats.queued;
+
+    /* Queued datagrams were validated on input. */
+    const uint8_t* ip = pb->data;
+    const uint32_t ihl = (uint32_t)(ip[0] & 0x0FU) * 4U;
+    const uint8_t* udp = ip + ihl;
+    if (out_ipv4_be != NULL) {
+        *out_ipv4_be = read_be32(ip + 12);
+    }
+    if (out_port != NULL) {
+        *out_port = read_be16(udp + 0);
+    }
+    const uint16_t udp_len = read_be16(udp + 4);
+    (void)pktbuf_pull(pb, ihl + kUdpHeaderBytes);
+    pktbuf_trim(pb, (size_t)udp_len - kUdpHeaderBytes);
+    return pb;
+}
+
+int net_udp_recvfrom(int sock, void* buf, size_t cap, uint32_t* out_ipv4_be, uint16_t* out_port) {
+    if (buf == NULL && cap > 0U) {
+        return -1;
+    }
+    pktbuf* pb = net_udp_recv_pktbuf(sock, out_ipv4_be, out_port);
+    if (pb == NULL) {
+        return -1;
+    }
+    const size_t n = (pb->len < cap) ? pb->len : cap;
+    uint8_t* dst = (uint8_t*)buf;
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = pb->data[i];
+    }
+    pktbuf_put(pb);
+    return (int)n;
+}
+
+uint32_t net_udp_poll(int sock) {
+    const udp_socket* s = socket_at(sock);
+    if (s == NULL) {
+        return 0;
+    }
+    uint32_t mask = 0;
+    if (s->rx_head != NULL) {
+        mask |= NET_UDP_POLL_IN;
+    }
+    pktbuf_stats pool;
+    pktbuf_get_stats(&pool);
+    if (net_stack_ready() && pool.free > 0U) {
+        mask |= NET_UDP_POLL_OUT;
+    }
+    return mask;
+}
+
+bool net_udp_get_socket_stats(int sock, net_udp_socket_stats* out) {
+    const udp_socket* s = socket_at(sock);
+    if (s == NULL || out == NULL) {
+        return false;
+    }
+    *out = s->stats;
+    return true;
+}
+
+void net_udp_get_stats(net_udp_stats* out) {
+    if (out != NULL) {
+        *out = s_stats;
+    }
+}
+
+/* The port is looked up before the frame is claimed, so unwanted traffic never costs a buffer. */
+bool net_udp_input(const uint8_t* frame, size_t len) {
+    const uint8_t* ip = frame + 14;
+    const uint32_t ihl = (uint32_t)(ip[0] & 0x0FU) * 4U;
+    const size_t ip_len = len - 14U;
+    if (ip_len < ihl + kUdpHeaderBytes) {
+        ++s_stats.rx_errors;
+        return false;
+    }
+    const uint8_t* udp = ip + ihl;
+    const uint16_t udp_len = read_be16(udp + 4);
+    if (udp_len < kUdpHeaderBytes || udp_len > ip_len - ihl) {
+        ++s_stats.rx_errors;
+        return false;
+    }
+    if (read_be16(udp + 6) != 0U) {
+        const uint32_t pseudo = net_csum_pseudo(read_be32(ip + 12), read_be32(ip + 16), kProtoUdp, udp_len);
+        const uint32_t sum = net_csum_add(pseudo, udp, udp_len);
+        if (net_csum_fold(sum) != 0U) {
+            ++s_stats.rx_errors;
+            return false;
+        }
+    }
+
+    const int sock = lookup(read_be16(udp + 2));
+    if (sock == kNoSocket) {
+        ++s_stats.rx_no_port;
+        return false;
+    }
+    udp_socket* s = &s_sockets[sock];
+    if (s->stats.queued >= NET_UDP_RX_QUEUE_MAX) {
+        ++s->stats.rx_drops;
+        ++s_stats.rx_queue_drops;
+        return false;
+    }
+
+    pktbuf* pb = net_stack_claim(frame, len);
+    if (pb == NULL) {
+        ++s->stats.rx_drops;
+        ++s_stats.rx_queue_drops;
+        return true;
+    }
+    (void)pktbuf_pull(pb, 14U);
+    pktbuf_trim(pb, ihl + udp_len);
+    pb->next = NULL;
+    if (s->rx_tail != NULL) {
+        s->rx_tail->next = pb;
+    } else {
+        s->rx_head = pb;
+    }
+    s->rx_tail = pb;
+    ++s->stats.queued;
+    ++s->stats.rx_datagrams;
+    ++s_stats.rx_datagrams;
+    return true;
+}
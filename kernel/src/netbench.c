@@ -0,0 +1,184 @@
+#include "kernel/netbench.h"
+
+#include "drivers/net_loopback.h"
+#include "drivers/netdev.h"
+#include "kernel/net_stack.h"
+#include "kernel/net_tcp.h"
+#include "kernel/net_udp.h"
+#include "kernel/timing.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    /* Datagrams or echoes queued before the stack runs; within the UDP receive queue. */
+    kBurst = 16,
+    kEchoBytes = 8,
+    /* A TCP run with no progress for this long has failed. */
+    kStallMs = 2000,
+    kSinkBytes = 8192,
+};
+
+static const char* const kTestNames[NETBENCH_TEST_COUNT] = {
+    "udp",
+    "icmp",
+    "tcp",
+};
+
+static uint8_t s_payload[NETBENCH_MAX_SIZE];
+static uint8_t s_sink[kSinkBytes];
+
+/* num * mul / den in 32 bits, trading low bits of num and den for range. */
+static uint32_t scaled_ratio(uint32_t num, uint32_t mul, uint32_t den) {
+    while (num > 0xFFFFFFFFU / mul) {
+        num >>= 1U;
+        den >>= 1U;
+    }
+    return (den > 0U) ? (num * mul) / den : 0U;
+}
+
+static uint32_t loopback_rx_frames(const netdev* lo) {
+    netdev_stats st;
+    lo->get_stats(lo->ctx, &st);
+    return st.rx_frames;
+}
+
+/* Runs the stack until every looped-back frame, and whatever it provoked, has been handled. */
+static void settle(const netdev* lo) {
+    do {
+        net_stack_poll();
+    } while (lo->rx_pending(lo->ctx));
+}
+
+static bool run_udp(const netdev* lo, const netbench_config* config, netbench_result* out) {
+    const int rx = net_udp_socket();
+    const int tx = net_udp_socket();
+    bool ok = rx >= 0 && tx >= 0 && net_udp_bind(rx, NETBENCH_PORT);
+    uint32_t sent = 0;
+    uint32_t received = 0;
+    while (ok && sent < config->count) {
+        /* A failed send counts as lost. */
+        for (uint32_t i = 0; i < kBurst && sent < config->count; ++i) {
+            (void)net_udp_sendto(tx, s_payload, config->size, 0x7F000001U, NETBENCH_PORT);
+            ++sent;
+        }
+        settle(lo);
+        while (net_udp_recvfrom(rx, s_sink, sizeof(s_sink), NULL, NULL) >= 0) {
+            ++received;
+        }
+    }
+    net_udp_close(tx);
+    net_udp_close(rx);
+    out->bytes = received * config->size;
+    out->lost = config->count - received;
+    return ok && received > 0U;
+}
+
+static bool run_icmp(const netdev* lo, const netbench_config* config, netbench_result* out) {
+    const uint32_t replies_before = net_stack_echo_replies();
+    uint32_t sent = 0;
+    while (sent < config->count) {
+        for (uint32_t i = 0; i < kBurst && sent < config->count; ++i) {
+            (void)net_stack_send_ping(0x7F000001U);
+            ++sent;
+        }
+        settle(lo);
+    }
+    const uint32_t replies = net_stack_echo_replies() - replies_before;
+    out->bytes = replies * kEchoBytes;
+    out->lost = (replies < config->count) ? config->count - replies : 0U;
+    return replies > 0U;
+}
+
+static bool run_tcp(const netdev* lo, const netbench_config* config, netbench_result* out) {
+    const uint32_t total = config->count * config->size;
+    const int listener = net_tcp_socket();
+    const int client = net_tcp_socket();
+    bool ok = listener >= 0 && client >= 0 && net_tcp_bind(listener, NETBENCH_PORT) && net_tcp_listen(listener) &&
+              net_tcp_connect(client, 0x7F000001U, NETBENCH_PORT);
+    int server = -1;
+    uint32_t queued = 0;
+    uint32_t received = 0;
+    uint32_t last_progress = timing_ms_now();
+    while (ok && received < total) {
+        net_stack_poll();
+        if (server < 0) {
+            server = net_tcp_accept(listener, NULL, NULL);
+        }
+        while (queued < total) {
+            const uint32_t chunk = (total - queued < config->size) ? total - queued : config->size;
+            const int n = net_tcp_send(client, s_payload, chunk);
+            if (n <= 0) {
+                ok = n == 0;
+                break;
+            }
+            queued += (uint32_t)n;
+        }
+        int n = -1;
+        while (server >= 0 && (n = net_tcp_recv(server, s_sink, sizeof(s_sink))) > 0) {
+            received += (uint32_t)n;
+            last_progress = timing_ms_now();
+        }
+        if (n == 0 || timing_ms_now() - last_progress > kStallMs) {
+            ok = false;
+        }
+    }
+
+    /* Let the FIN exchanges finish so the port is free for the next run. */
+    net_tcp_close(client);
+    settle(lo);
+    net_tcp_close(server);
+    settle(lo);
+    net_tcp_close(listener);
+    out->bytes = received;
+    out->lost = 0U;
+    return ok;
+}
+
+const char* netbench_test_name(netbench_test test) {
+    return ((uint32_t)test < NETBENCH_TEST_COUNT) ? kTestNames[test] : "?";
+}
+
+bool netbench_run(const netbench_config* config, netbench_result* out) {
+    const netdev* lo = net_loopback_device();
+    if (config == NULL || out == NULL || lo == NULL || !net_stack_ready() ||
+        (uint32_t)config->test >= NETBENCH_TEST_COUNT || config->count == 0U || config->count > NETBENCH_MAX_COUNT ||
+        config->size == 0U || config->size > NETBENCH_MAX_SIZE || timing_tsc_khz() == 0U) {
+        return false;
+    }
+    if (config->test == NETBENCH_TCP && config->count > 0xFFFFFFFFU / config->size) {
+        return false;
+    }
+    for (uint32_t i = 0; i < NETBENCH_MAX_SIZE; ++i) {
+        s_payload[i] = (uint8_t)(i * 31U + 7U);
+    }
+    /* Start from an empty queue so earlier traffic is not counted. */
+    settle(lo);
+
+    const uint32_t frames_before = loopback_rx_frames(lo);
+    const uint64_t start = timing_tsc_now();
+    bool ok = false;
+    if (config->test == NETBENCH_UDP) {
+        ok = run_udp(lo, config, out);
+    } else if (config->test == NETBENCH_ICMP) {
+        ok = run_icmp(lo, config, out);
+    } else {
+        ok = run_tcp(lo, config, out);
+    }
+    uint64_t cycles = timing_tsc_now() - start;
+    const uint32_t us = timing_tsc_to_us(cycles);
+
+    uint32_t packets = loopback_rx_frames(lo) - frames_before;
+    out->packets = packets;
+    out->elapsed_us = us;
+    out->packets_per_s = scaled_ratio(packets, 1000000U, (us > 0U) ? us : 1U);
+    out->bytes_per_s = scaled_ratio(out->bytes, 1000000U, (us > 0U) ? us : 1U);
+    /* Without 64-bit division: drop low bits of both until the cycle count fits. */
+    while (cycles > 0xFFFFFFFFULL && packets > 1U) {
+        cycles >>= 1U;
+        packets >>= 1U;
+    }
+    out->cycles_per_packet = (packets > 0U && cycles <= 0xFFFFFFFFULL) ? (uint32_t)cycles / packets : 0U;
+    return ok;
+}
@@ -47,3 +47,33 @@ void serial_write(const char* text) {
         outb(kCom1, (uint8_t)text[i]);
     }
 }
+
+void serial_write_u32(uint32_t value) {
+    char tmp[11];
+    size_t n = sizeof(tmp) - 1U;
+    tmp[n] = '\0';
+    do {
+        tmp[--n] = (char)('0' + (value % 10U));
+        value /= 10U;
+    } while (value != 0U && n > 0U);
+    serial_write(&tmp[n]);
+}
+
+void serial_write_u64(uint64_t value) {
+    /* Long division by 10 in 16-bit steps: there is no libgcc for 64-bit '/'. */
+    char tmp[21];
+    size_t n = sizeof(tmp) - 1U;
+    tmp[n] = '\0';
+    do {
+        const uint32_t hi = (uint32_t)(value >> 32U);
+        const uint32_t lo = (uint32_t)value;
+        const uint32_t q_hi = hi / 10U;
+        uint32_t t = ((hi % 10U) << 16U) | (lo >> 16U);
+        const uint32_t q_mid = t / 10U;
+        t = ((t % 10U) << 16U) | (lo & 0xFFFFU);
+        const uint32_t q_lo = t / 10U;
+        tmp[--n] = (char)('0' + (t % 10U));
+        value = ((uint64_t)q_hi << 32U) | (q_mid << 16U) | q_lo;
+    } while (value != 0U && n > 0U);
+    serial_write(&tmp[n]);
+}
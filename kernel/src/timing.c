@@ -65,3 +65,50 @@ void timing_sleep_ms(uint32_t ms) {
         __asm__ volatile("pause");
     }
 }
+
+static uint32_t s_tsc_khz = 0U;
+
+static uint64_t udiv64_32(uint64_t n, uint32_t d) {
+    /* Two-step divl: the kernel links without libgcc, so no __udivdi3. */
+    const uint32_t hi = (uint32_t)(n >> 32U);
+    const uint32_t lo = (uint32_t)n;
+    const uint32_t q_hi = hi / d;
+    uint32_t rem = hi % d;
+    uint32_t q_lo = 0U;
+    __asm__("divl %4" : "=a"(q_lo), "=d"(rem) : "a"(lo), "d"(rem), "rm"(d));
+    return ((uint64_t)q_hi << 32U) | (uint64_t)q_lo;
+}
+
+uint64_t timing_tsc_now(void) {
+    uint32_t lo = 0U;
+    uint32_t hi = 0U;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32U) | (uint64_t)lo;
+}
+
+void timing_calibrate_tsc(void) {
+    const uint64_t start = timing_tsc_now();
+    timing_sleep_ms(10U);
+    const uint64_t elapsed = timing_tsc_now() - start;
+    const uint32_t khz = (uint32_t)udiv64_32(elapsed, 10U);
+    s_tsc_khz = (khz != 0U) ? khz : 1U;
+}
+
+uint32_t timing_tsc_khz(void) {
+    return s_tsc_khz;
+}
+
+uint32_t timing_ms_now(void) {
+    if (s_tsc_khz == 0U) {
+        return 0U;
+    }
+    return (uint32_t)udiv64_32(timing_tsc_now(), s_tsc_khz);
+}
+
+uint32_t timing_tsc_to_us(uint64_t cycles) {
+    if (s_tsc_khz == 0U) {
+        return 0U;
+    }
+    const uint64_t us = udiv64_32(cycles * 1000U, s_tsc_khz);
+    return (us > 0xFFFFFFFFULL) ? 0xFFFFFFFFU : (uint32_t)us;
+}